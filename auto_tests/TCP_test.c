@@ -590,6 +590,204 @@ START_TEST(test_client)
 }
 END_TEST
 
+static void do_TCP_clients_delay(const Logger *logger, Mono_Time *mono_time, TCP_Client_Connection *conn,
+                                 TCP_Client_Connection *conn2)
+{
+    c_sleep(10);
+    mono_time_update(mono_time);
+    do_TCP_connection(logger, mono_time, conn, nullptr);
+    do_TCP_connection(logger, mono_time, conn2, nullptr);
+}
+
+// Test routing between clients when the server runs its connections on several workers.
+START_TEST(test_client_workers)
+{
+    Mono_Time *mono_time = mono_time_new();
+    Logger *logger = logger_new();
+
+    uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(self_public_key, self_secret_key);
+    TCP_Server *tcp_s = new_TCP_server_workers(logger, USE_IPV6, NUM_PORTS, ports, self_secret_key, nullptr, 4);
+
+    if (tcp_s == nullptr) {
+        // Workers need epoll.
+        logger_kill(logger);
+        mono_time_free(mono_time);
+        return;
+    }
+
+    ck_assert_msg(tcp_server_listen_count(tcp_s) == NUM_PORTS, "Failed to bind the relay server to all ports.");
+
+    uint8_t f_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t f_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(f_public_key, f_secret_key);
+    uint8_t f2_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t f2_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(f2_public_key, f2_secret_key);
+
+    IP_Port ip_port_tcp_s;
+    ip_port_tcp_s.ip = get_loopback();
+    ip_port_tcp_s.port = net_htons(ports[random_u32() % NUM_PORTS]);
+    TCP_Client_Connection *conn = new_TCP_connection(mono_time, ip_port_tcp_s, self_public_key, f_public_key, f_secret_key,
+                                  nullptr);
+    ip_port_tcp_s.port = net_htons(ports[random_u32() % NUM_PORTS]);
+    TCP_Client_Connection *conn2 = new_TCP_connection(mono_time, ip_port_tcp_s, self_public_key, f2_public_key,
+                                   f2_secret_key, nullptr);
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        if (tcp_con_status(conn) == TCP_CLIENT_CONFIRMED && tcp_con_status(conn2) == TCP_CLIENT_CONFIRMED) {
+            break;
+        }
+
+        do_TCP_clients_delay(logger, mono_time, conn, conn2);
+    }
+
+    ck_assert_msg(tcp_con_status(conn) == TCP_CLIENT_CONFIRMED && tcp_con_status(conn2) == TCP_CLIENT_CONFIRMED,
+                  "Clients did not connect to the workers.");
+
+    routing_response_handler(conn, response_callback, (char *)conn + 2);
+    routing_status_handler(conn, status_callback, (void *)2);
+    routing_data_handler(conn, data_callback, (void *)3);
+    oob_data_handler(conn, oob_data_callback, (void *)4);
+
+    oob_data_callback_good = response_callback_good = status_callback_good = data_callback_good = 0;
+
+    uint8_t data[5] = {1, 2, 3, 4, 5};
+    memcpy(oob_pubkey, f2_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    send_oob_packet(conn2, f_public_key, data, 5);
+    send_routing_request(conn, f2_public_key);
+    send_routing_request(conn2, f_public_key);
+
+    for (uint32_t i = 0; i < 500 && (oob_data_callback_good == 0 || status_callback_good == 0); ++i) {
+        do_TCP_clients_delay(logger, mono_time, conn, conn2);
+    }
+
+    ck_assert_msg(oob_data_callback_good == 1, "OOB callback not called");
+    ck_assert_msg(response_callback_good == 1, "Response callback not called.");
+    ck_assert_msg(status_callback_good == 1, "Status callback not called.");
+    ck_assert_msg(status_callback_status == 2, "Wrong status callback status.");
+
+    // The routing response of conn2 may arrive just after the notification of conn.
+    for (uint32_t i = 0; i < 500 && send_data(conn2, 0, data, 5) != 1; ++i) {
+        do_TCP_clients_delay(logger, mono_time, conn, conn2);
+    }
+
+    for (uint32_t i = 0; i < 500 && data_callback_good == 0; ++i) {
+        do_TCP_clients_delay(logger, mono_time, conn, conn2);
+    }
+
+    ck_assert_msg(data_callback_good == 1, "Data callback was not called.");
+
+    status_callback_good = 0;
+    send_disconnect_request(conn2, 0);
+
+    for (uint32_t i = 0; i < 500 && status_callback_good == 0; ++i) {
+        do_TCP_clients_delay(logger, mono_time, conn, conn2);
+    }
+
+    ck_assert_msg(status_callback_good == 1, "Status callback not called");
+    ck_assert_msg(status_callback_status == 1, "Wrong status callback status.");
+
+    kill_TCP_server(tcp_s);
+    kill_TCP_connection(conn);
+    kill_TCP_connection(conn2);
+
+    logger_kill(logger);
+    mono_time_free(mono_time);
+}
+END_TEST
+
+// Test that a client queues packets the server does not take yet, refuses more
+// once its queue is over the limit and sends the queued ones intact later.
+START_TEST(test_client_send_queue)
+{
+    Mono_Time *mono_time = mono_time_new();
+    Logger *logger = logger_new();
+
+    uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(self_public_key, self_secret_key);
+    TCP_Server *tcp_s = new_TCP_server(logger, USE_IPV6, NUM_PORTS, ports, self_secret_key, nullptr);
+    ck_assert_msg(tcp_s != nullptr, "Failed to create a TCP relay server.");
+
+    uint8_t f_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t f_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(f_public_key, f_secret_key);
+    uint8_t f2_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t f2_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(f2_public_key, f2_secret_key);
+
+    IP_Port ip_port_tcp_s;
+    ip_port_tcp_s.ip = get_loopback();
+    ip_port_tcp_s.port = net_htons(ports[random_u32() % NUM_PORTS]);
+    TCP_Client_Connection *conn = new_TCP_connection(mono_time, ip_port_tcp_s, self_public_key, f_public_key, f_secret_key,
+                                  nullptr);
+    TCP_Client_Connection *conn2 = new_TCP_connection(mono_time, ip_port_tcp_s, self_public_key, f2_public_key,
+                                   f2_secret_key, nullptr);
+
+    for (uint32_t i = 0; i < 100; ++i) {
+        if (tcp_con_status(conn) == TCP_CLIENT_CONFIRMED && tcp_con_status(conn2) == TCP_CLIENT_CONFIRMED) {
+            break;
+        }
+
+        do_TCP_server_delay(tcp_s, mono_time, 5);
+        do_TCP_clients_delay(logger, mono_time, conn, conn2);
+    }
+
+    ck_assert_msg(tcp_con_status(conn) == TCP_CLIENT_CONFIRMED && tcp_con_status(conn2) == TCP_CLIENT_CONFIRMED,
+                  "Clients did not connect to the server.");
+
+    oob_data_handler(conn, oob_data_callback, (void *)4);
+    tcp_con_set_send_queue_limit(conn2, 4 * MAX_PACKET_SIZE);
+
+    // The server does not run, so the socket buffers fill up and the client has to queue.
+    uint8_t filler[TCP_MAX_OOB_DATA_LENGTH] = {0};
+    uint32_t sent = 0;
+
+    while (send_oob_packet(conn2, f_public_key, filler, sizeof(filler)) == 1) {
+        ++sent;
+        ck_assert_msg(sent < 1000000, "Client never stopped taking packets.");
+    }
+
+    TCP_Send_Queue_Stats stats;
+    tcp_con_get_send_queue_stats(conn2, &stats);
+    ck_assert_msg(tcp_con_send_pending(conn2), "Client did not queue anything.");
+    ck_assert_msg(stats.refused == 1, "Client refused %u packets instead of 1.", (unsigned)stats.refused);
+    ck_assert_msg(stats.queued <= 4 * MAX_PACKET_SIZE && stats.max_queued == stats.queued,
+                  "Client queued %u bytes, at most %u at once.", (unsigned)stats.queued, stats.max_queued);
+
+    for (uint32_t i = 0; i < 500 && (tcp_con_send_pending(conn2) || tcp_server_send_pending(tcp_s)); ++i) {
+        do_TCP_server_delay(tcp_s, mono_time, 5);
+        do_TCP_clients_delay(logger, mono_time, conn, conn2);
+    }
+
+    ck_assert_msg(!tcp_con_send_pending(conn2), "Client did not send its queue.");
+    tcp_con_get_send_queue_stats(conn2, &stats);
+    ck_assert_msg(stats.queued == 0 && stats.connections == 0, "Client still reports queued data.");
+
+    // The server only passes this on if everything before it was intact.
+    uint8_t data[5] = {1, 2, 3, 4, 5};
+    memcpy(oob_pubkey, f2_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    oob_data_callback_good = 0;
+    ck_assert_msg(send_oob_packet(conn2, f_public_key, data, sizeof(data)) == 1, "Failed to send OOB packet.");
+
+    for (uint32_t i = 0; i < 100 && oob_data_callback_good == 0; ++i) {
+        do_TCP_server_delay(tcp_s, mono_time, 5);
+        do_TCP_clients_delay(logger, mono_time, conn, conn2);
+    }
+
+    ck_assert_msg(oob_data_callback_good == 1, "OOB packet sent after the queue did not arrive.");
+
+    kill_TCP_server(tcp_s);
+    kill_TCP_connection(conn);
+    kill_TCP_connection(conn2);
+
+    logger_kill(logger);
+    mono_time_free(mono_time);
+}
+END_TEST
+
 // Test how the client handles servers that don't respond.
 START_TEST(test_client_invalid)
 {
@@ -859,6 +1057,8 @@ static Suite *TCP_suite(void)
     DEFTESTCASE_SLOW(basic, 5);
     DEFTESTCASE_SLOW(some, 10);
     DEFTESTCASE_SLOW(client, 10);
+    DEFTESTCASE_SLOW(client_workers, 20);
+    DEFTESTCASE_SLOW(client_send_queue, 20);
     DEFTESTCASE_SLOW(client_invalid, 15);
     DEFTESTCASE_SLOW(tcp_connection, 20);
     DEFTESTCASE_SLOW(tcp_connection2, 20);
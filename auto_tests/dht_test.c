@@ -807,6 +807,102 @@ static void test_dht_node_packing(void)
     free(data);
 }
 
+static void test_close_list(void)
+{
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+    IP ip;
+    ip_init(&ip, 0);
+    Networking_Core *net = new_networking(log, ip, DHT_DEFAULT_PORT);
+    ck_assert_msg(net != nullptr, "Failed to create Networking_Core");
+    DHT *dht = new_dht(log, mono_time, net, true);
+    ck_assert_msg(dht != nullptr, "Failed to create DHT");
+
+    // Fill every other bucket, so that the closest nodes of some keys are in earlier buckets.
+    for (uint32_t i = 0; i < LCLIENT_LIST; i += 2 * LCLIENT_NODES) {
+        for (uint32_t j = 0; j < LCLIENT_NODES; ++j) {
+            uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+            make_bucket_key(public_key, dht->self_public_key, i / LCLIENT_NODES);
+
+            IP_Port ip_port;
+            ip_init(&ip_port.ip, 0);
+            ip_port.ip.ip.v4.uint32 = net_htonl(0x01000000 + i + j);
+            ip_port.port = net_htons(TOX_PORT_DEFAULT);
+            addto_lists(dht, ip_port, public_key);
+
+            const Client_data *client = dht_find_close_client(dht, public_key);
+            ck_assert_msg(client == &dht->close_clientlist[i + j], "Added node is not where it belongs");
+        }
+    }
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        make_bucket_key(public_key, dht->self_public_key, random_u32() % LCLIENT_LENGTH);
+
+        Node_format nodes[MAX_SENT_NODES];
+        const int num_nodes = get_close_nodes(dht, public_key, nodes, net_family_unspec, true, 0);
+        ck_assert_msg(num_nodes == MAX_SENT_NODES, "Found %d nodes", num_nodes);
+
+        for (uint32_t j = 1; j < MAX_SENT_NODES; ++j) {
+            ck_assert_msg(id_closest(public_key, nodes[j - 1].public_key, nodes[j].public_key) == 1,
+                          "Nodes are not sorted from the closest");
+        }
+
+        for (uint32_t j = 0; j < LCLIENT_LIST; ++j) {
+            const Client_data *client = &dht->close_clientlist[j];
+
+            if (client->assoc4.timestamp == 0 || index_of_node_pk(nodes, MAX_SENT_NODES, client->public_key) != UINT32_MAX) {
+                continue;
+            }
+
+            for (uint32_t k = 0; k < MAX_SENT_NODES; ++k) {
+                ck_assert_msg(id_closest(public_key, nodes[k].public_key, client->public_key) == 1,
+                              "A closer node was left out");
+            }
+        }
+    }
+
+    // A node that moves keeps its place.
+    Client_data *client = &dht->close_clientlist[LCLIENT_NODES * 2];
+    IP_Port ip_port = client->assoc4.ip_port;
+    ip_port.port = net_htons(TOX_PORT_DEFAULT + 1);
+    addto_lists(dht, ip_port, client->public_key);
+    ck_assert_msg(dht_find_close_client(dht, client->public_key) == client, "Moved node was not found");
+    ck_assert_msg(ipport_equal(&client->assoc4.ip_port, &ip_port), "Moved node has the wrong address");
+
+    // A new key from the same address takes its place.
+    uint8_t old_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t new_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    memcpy(old_public_key, client->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    random_bytes(new_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    addto_lists(dht, ip_port, new_public_key);
+    ck_assert_msg(dht_find_close_client(dht, new_public_key) == client, "New key did not replace the old one");
+    ck_assert_msg(dht_find_close_client(dht, old_public_key) == nullptr, "Old key is still found");
+
+    // Of two nodes at one address, the second is found by it once the first moves away.
+    Client_data *first = &dht->close_clientlist[LCLIENT_NODES * 4];
+    Client_data *second = &dht->close_clientlist[LCLIENT_NODES * 4 + 1];
+    const IP_Port shared_ip_port = first->assoc4.ip_port;
+    addto_lists(dht, shared_ip_port, second->public_key);
+    ck_assert_msg(ipport_equal(&second->assoc4.ip_port, &shared_ip_port), "Second node did not move");
+
+    ip_port = shared_ip_port;
+    ip_port.port = net_htons(TOX_PORT_DEFAULT + 1);
+    addto_lists(dht, ip_port, first->public_key);
+    ck_assert_msg(ipport_equal(&first->assoc4.ip_port, &ip_port), "First node did not move");
+
+    memcpy(old_public_key, second->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    random_bytes(new_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    addto_lists(dht, shared_ip_port, new_public_key);
+    ck_assert_msg(dht_find_close_client(dht, new_public_key) == second, "New key did not replace the second node");
+    ck_assert_msg(dht_find_close_client(dht, old_public_key) == nullptr, "Second node's old key is still found");
+
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+}
+
 int main(void)
 {
     setvbuf(stdout, nullptr, _IONBF, 0);
@@ -816,6 +912,7 @@ int main(void)
 
     test_list();
     test_DHT_test();
+    test_close_list();
 
     if (enable_broken_tests) {
         test_addto_lists_ipv4();
@@ -0,0 +1,211 @@
+/* Tests that a net_crypto connection sending lossless packets at a steady rate
+ * takes its packet buffers from the pool instead of allocating new ones.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/net_crypto.h"
+#include "../testing/misc_tools.h"
+#include "check_compat.h"
+
+#define PORT_A 33730
+#define PORT_B 33731
+
+#define PACKETS_PER_ROUND 100
+#define WARMUP_ROUNDS 5
+#define STEADY_ROUNDS 20
+
+typedef struct Peer {
+    Logger *log;
+    Mono_Time *mono_time;
+    Networking_Core *net;
+    DHT *dht;
+    Net_Crypto *c;
+
+    int conn_id;
+    bool online;
+    uint32_t received;
+} Peer;
+
+static void peer_init(Peer *peer, uint16_t port)
+{
+    memset(peer, 0, sizeof(Peer));
+    peer->conn_id = -1;
+
+    IP ip;
+    ip_init(&ip, false);
+
+    peer->log = logger_new();
+    peer->mono_time = mono_time_new();
+    peer->net = new_networking(peer->log, ip, port);
+    ck_assert_msg(peer->net != nullptr, "failed to open port %u", port);
+    peer->dht = new_dht(peer->log, peer->mono_time, peer->net, true);
+    ck_assert(peer->dht != nullptr);
+
+    TCP_Proxy_Info proxy_info = {{{{0}}}};
+    peer->c = new_net_crypto(peer->log, peer->mono_time, peer->dht, &proxy_info);
+    ck_assert(peer->c != nullptr);
+}
+
+static void peer_kill(Peer *peer)
+{
+    kill_net_crypto(peer->c);
+    kill_dht(peer->dht);
+    kill_networking(peer->net);
+    mono_time_free(peer->mono_time);
+    logger_kill(peer->log);
+}
+
+static int handle_status(void *object, int id, uint8_t status, void *userdata)
+{
+    Peer *peer = (Peer *)object;
+    peer->online = status != 0;
+    return 0;
+}
+
+static int handle_data(void *object, int id, const uint8_t *data, uint16_t length, void *userdata)
+{
+    Peer *peer = (Peer *)object;
+    ++peer->received;
+    return 0;
+}
+
+static void peer_set_handlers(Peer *peer)
+{
+    connection_status_handler(peer->c, peer->conn_id, &handle_status, peer, 0);
+    connection_data_handler(peer->c, peer->conn_id, &handle_data, peer, 0);
+}
+
+static int handle_new_connection(void *object, New_Connection *n_c)
+{
+    Peer *peer = (Peer *)object;
+    peer->conn_id = accept_crypto_connection(peer->c, n_c);
+
+    if (peer->conn_id == -1) {
+        return -1;
+    }
+
+    peer_set_handlers(peer);
+    return 0;
+}
+
+static void run_peers(Peer *a, Peer *b)
+{
+    Peer *peers[] = {a, b};
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        mono_time_update(peers[i]->mono_time);
+        networking_poll(peers[i]->net, nullptr);
+        do_net_crypto(peers[i]->c, nullptr);
+    }
+
+    c_sleep(5);
+}
+
+/* return true once every packet buffer allocated by peer is back in its pool. */
+static bool all_buffers_pooled(Peer *peer)
+{
+    Packet_Pool_Stats stats;
+    nc_packet_pool_stats(peer->c, &stats);
+    return stats.pooled == stats.allocated - stats.released;
+}
+
+/* Send a round of lossless packets from a to b and run both until b got them
+ * all and a got all their buffers back from the send array.
+ */
+static void send_round(Peer *a, Peer *b)
+{
+    const uint32_t expected = b->received + PACKETS_PER_ROUND;
+    uint8_t packet[512];
+    memset(packet, 0, sizeof(packet));
+    packet[0] = PACKET_ID_RANGE_LOSSLESS_CUSTOM_START;
+
+    for (uint32_t i = 0; i < PACKETS_PER_ROUND; ++i) {
+        ck_assert_msg(write_cryptpacket(a->c, a->conn_id, packet, sizeof(packet), false) != -1,
+                      "failed to send packet %u", i);
+    }
+
+    for (uint32_t i = 0; i < 2000 && (b->received < expected || !all_buffers_pooled(a) || !all_buffers_pooled(b)); ++i) {
+        run_peers(a, b);
+    }
+
+    ck_assert_msg(b->received == expected, "received %u packets instead of %u", b->received, expected);
+    ck_assert_msg(all_buffers_pooled(a) && all_buffers_pooled(b), "packet buffers were not given back to the pool");
+}
+
+static void test_packet_pool_reuse(void)
+{
+    Peer a;
+    Peer b;
+    peer_init(&a, PORT_A);
+    peer_init(&b, PORT_B);
+
+    new_connection_handler(b.c, &handle_new_connection, &b);
+
+    a.conn_id = new_crypto_connection(a.c, nc_get_self_public_key(b.c), dht_get_self_public_key(b.dht));
+    ck_assert(a.conn_id != -1);
+    peer_set_handlers(&a);
+
+    IP_Port ip_port;
+    ip_init(&ip_port.ip, false);
+    ip_port.ip.ip.v4 = get_ip4_loopback();
+    ip_port.port = net_htons(PORT_B);
+    ck_assert(set_direct_ip_port(a.c, a.conn_id, ip_port, false) == 0);
+
+    for (uint32_t i = 0; i < 2000 && !(a.online && b.online); ++i) {
+        run_peers(&a, &b);
+    }
+
+    ck_assert_msg(a.online && b.online, "crypto connection did not come online");
+
+    for (uint32_t i = 0; i < WARMUP_ROUNDS; ++i) {
+        send_round(&a, &b);
+    }
+
+    Packet_Pool_Stats sender_before;
+    Packet_Pool_Stats receiver_before;
+    nc_packet_pool_stats(a.c, &sender_before);
+    nc_packet_pool_stats(b.c, &receiver_before);
+    ck_assert_msg(sender_before.allocated > 0, "the sender never allocated a packet buffer");
+
+    for (uint32_t i = 0; i < STEADY_ROUNDS; ++i) {
+        send_round(&a, &b);
+    }
+
+    Packet_Pool_Stats sender_after;
+    Packet_Pool_Stats receiver_after;
+    nc_packet_pool_stats(a.c, &sender_after);
+    nc_packet_pool_stats(b.c, &receiver_after);
+
+    printf("sender: %lu allocated, %lu reused; receiver: %lu allocated, %lu reused\n",
+           (unsigned long)sender_after.allocated, (unsigned long)sender_after.reused,
+           (unsigned long)receiver_after.allocated, (unsigned long)receiver_after.reused);
+
+    ck_assert_msg(sender_after.allocated == sender_before.allocated,
+                  "the sender allocated %lu packet buffers after warming up",
+                  (unsigned long)(sender_after.allocated - sender_before.allocated));
+    ck_assert_msg(receiver_after.allocated == receiver_before.allocated,
+                  "the receiver allocated %lu packet buffers after warming up",
+                  (unsigned long)(receiver_after.allocated - receiver_before.allocated));
+    ck_assert_msg(sender_after.reused - sender_before.reused >= STEADY_ROUNDS * PACKETS_PER_ROUND,
+                  "the sender reused only %lu packet buffers",
+                  (unsigned long)(sender_after.reused - sender_before.reused));
+
+    peer_kill(&b);
+    peer_kill(&a);
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    test_packet_pool_reuse();
+    return 0;
+}
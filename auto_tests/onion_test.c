@@ -262,6 +262,24 @@ static void test_basic(void)
 
     printf("test 2 complete\n");
 
+    ck_assert_msg(onion_set_workers(onion1, 2) && onion_set_workers(onion2, 2), "Failed to start onion workers.");
+    ret = send_onion_packet(onion1->net, &path, nodes[3].ip_port, req_packet, sizeof(req_packet));
+    ck_assert_msg(ret == 0, "Failed to create/send onion packet.");
+
+    handled_test_1 = 0;
+    handled_test_2 = 0;
+
+    do {
+        do_onion(onion1);
+        do_onion(onion2);
+        c_sleep(1);
+    } while (handled_test_2 == 0);
+
+    ck_assert_msg(handled_test_1 == 1, "Onion request did not arrive through the workers.");
+    ck_assert_msg(onion_set_workers(onion1, 0) && onion_set_workers(onion2, 0), "Failed to stop onion workers.");
+
+    printf("test 2 with workers complete\n");
+
     GC_Announces_List unused_var;
     Onion_Announce *onion1_a = new_onion_announce(mono_time1, onion1->dht, &unused_var);
     Onion_Announce *onion2_a = new_onion_announce(mono_time2, onion2->dht, &unused_var);
@@ -292,8 +310,8 @@ static void test_basic(void)
 
     random_bytes(sb_data, sizeof(sb_data));
     memcpy(&s, sb_data, sizeof(uint64_t));
-    memcpy(onion_announce_entry_public_key(onion2_a, 1), dht_get_self_public_key(onion2->dht), CRYPTO_PUBLIC_KEY_SIZE);
-    onion_announce_entry_set_time(onion2_a, 1, mono_time_get(mono_time2));
+    ck_assert_msg(onion_announce_add_entry(onion2_a, dht_get_self_public_key(onion2->dht)) != -1,
+                  "Failed to add an entry to Onion_Announce.");
     networking_registerhandler(onion1->net, NET_PACKET_ONION_DATA_RESPONSE, &handle_test_4, onion1);
     send_announce_request(onion1->net, &path, nodes[3],
                           dht_get_self_public_key(onion1->dht),
@@ -306,9 +324,10 @@ static void test_basic(void)
         do_onion(onion1);
         do_onion(onion2);
         c_sleep(50);
-    } while (memcmp(onion_announce_entry_public_key(onion2_a, ONION_ANNOUNCE_MAX_ENTRIES - 2),
-                    dht_get_self_public_key(onion1->dht),
-                    CRYPTO_PUBLIC_KEY_SIZE) != 0);
+    } while (onion_announce_entry_public_key(onion2_a, 1) == nullptr
+             || memcmp(onion_announce_entry_public_key(onion2_a, 1),
+                       dht_get_self_public_key(onion1->dht),
+                       CRYPTO_PUBLIC_KEY_SIZE) != 0);
 
     c_sleep(1000);
     Logger *log3 = logger_new();
@@ -634,6 +653,12 @@ static void test_announce(void)
     onion_getfriendip(onions[NUM_LAST]->onion_c, frnum, &ip_port);
     ck_assert_msg(ip_port.port == net_port(onions[NUM_FIRST]->onion->net), "Port in returned ip not correct.");
 
+    Onion_Path_Stats path_stats;
+    onion_get_path_stats(onions[NUM_LAST]->onion_c, &path_stats);
+    ck_assert_msg(path_stats.taken > 0, "No onion path built ahead of time was used.");
+    ck_assert_msg(path_stats.taken + path_stats.expired <= path_stats.built_ahead,
+                  "More onion paths left the pool than were built ahead of time.");
+
     for (i = 0; i < NUM_ONIONS; ++i) {
         kill_onions(onions[i]);
     }
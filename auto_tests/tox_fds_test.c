@@ -0,0 +1,145 @@
+/* Tests that a client can wait on the file descriptors from tox_get_fds() for
+ * up to tox_iteration_deadline() milliseconds instead of sleeping.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(__WIN32__) && !defined(WIN32)
+#include <poll.h>
+#endif
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "../testing/misc_tools.h"
+#include "check_compat.h"
+
+#define MAX_FDS 16
+
+#define MESSAGE "wake up"
+
+#if !defined(_WIN32) && !defined(__WIN32__) && !defined(WIN32)
+
+static void accept_friend_request(Tox *tox, const uint8_t *public_key, const uint8_t *data, size_t length,
+                                  void *userdata)
+{
+    tox_friend_add_norequest(tox, public_key, nullptr);
+}
+
+static void handle_message(Tox *tox, uint32_t friend_number, Tox_Message_Type type, const uint8_t *message,
+                           size_t length, void *userdata)
+{
+    bool *message_received = (bool *)userdata;
+    *message_received = true;
+}
+
+/* Wait until one of the descriptors of tox is readable or its deadline has
+ * passed, the way a client would instead of sleeping.
+ *
+ * return the number of readable descriptors.
+ */
+static int wait_for_tox(const Tox *tox)
+{
+    int fds[MAX_FDS];
+    const uint32_t num_fds = tox_get_fds(tox, fds, MAX_FDS);
+    ck_assert_msg(num_fds >= 1, "tox_get_fds returned no descriptors, not even the UDP socket");
+    ck_assert_msg(num_fds <= MAX_FDS, "tox_get_fds returned %u descriptors", num_fds);
+    ck_assert_msg(tox_get_fds(tox, nullptr, 0) == num_fds, "tox_get_fds without room returned another count");
+
+    struct pollfd pfds[MAX_FDS];
+
+    for (uint32_t i = 0; i < num_fds; ++i) {
+        ck_assert_msg(fds[i] >= 0, "tox_get_fds returned an invalid descriptor %d", fds[i]);
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+
+    const uint32_t interval = tox_iteration_interval(tox);
+    const uint32_t deadline = tox_iteration_deadline(tox);
+    ck_assert_msg(deadline >= interval, "deadline %u ms is shorter than the iteration interval %u ms", deadline,
+                  interval);
+
+    const int ready = poll(pfds, num_fds, (int)deadline);
+    ck_assert_msg(ready >= 0, "poll failed");
+    return ready;
+}
+
+static void test_wait_on_fds(void)
+{
+    printf("Initialising 2 toxes.\n");
+    uint32_t index[] = { 1, 2 };
+
+    Tox *const tox1 = tox_new_log(nullptr, nullptr, &index[0]);
+    Tox *const tox2 = tox_new_log(nullptr, nullptr, &index[1]);
+    ck_assert_msg(tox1 && tox2, "failed to create 2 tox instances");
+
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(tox1, dht_key);
+    const uint16_t dht_port = tox_self_get_udp_port(tox1, nullptr);
+    tox_bootstrap(tox2, "localhost", dht_port, dht_key, nullptr);
+
+    tox_callback_friend_request(tox2, accept_friend_request);
+    tox_callback_friend_message(tox2, handle_message);
+
+    uint8_t address[TOX_ADDRESS_SIZE];
+    tox_self_get_address(tox2, address);
+    const uint32_t friend_number = tox_friend_add(tox1, address, (const uint8_t *)MESSAGE, sizeof(MESSAGE), nullptr);
+    ck_assert_msg(friend_number == 0, "failed to add friend error code: %u", friend_number);
+
+    bool message_received = false;
+
+    do {
+        tox_iterate(tox1, nullptr);
+        tox_iterate(tox2, &message_received);
+
+        wait_for_tox(tox1);
+        wait_for_tox(tox2);
+    } while (tox_friend_get_connection_status(tox1, 0, nullptr) != TOX_CONNECTION_UDP ||
+             tox_friend_get_connection_status(tox2, 0, nullptr) != TOX_CONNECTION_UDP);
+
+    printf("Tox clients connected, sending a message.\n");
+
+    Tox_Err_Friend_Send_Message err;
+    tox_friend_send_message(tox1, 0, TOX_MESSAGE_TYPE_NORMAL, (const uint8_t *)MESSAGE, sizeof(MESSAGE), &err);
+    ck_assert_msg(err == TOX_ERR_FRIEND_SEND_MESSAGE_OK, "failed to send message: %d", err);
+
+    // The message reaches one of the descriptors of tox2, which wakes it up
+    // before its deadline.
+    bool woken = false;
+
+    while (!message_received) {
+        tox_iterate(tox1, nullptr);
+
+        if (wait_for_tox(tox2) > 0) {
+            woken = true;
+        }
+
+        tox_iterate(tox2, &message_received);
+    }
+
+    ck_assert_msg(woken, "the descriptors of tox2 never became readable");
+
+    tox_kill(tox1);
+    tox_kill(tox2);
+}
+
+#endif
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+#if !defined(_WIN32) && !defined(__WIN32__) && !defined(WIN32)
+    test_wait_on_fds();
+#else
+    printf("poll is not available, skipping the test.\n");
+#endif
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+/* Tests that toxes with experimental_udp_batching connect and talk, and that a
+ * packet the kernel refuses doesn't take the rest of the send queue with it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/network.h"
+#include "../toxcore/tox.h"
+#include "../testing/misc_tools.h"
+#include "check_compat.h"
+
+#define SENDER_PORT 33620
+#define RECEIVER_PORT 33621
+#define NUM_PACKETS 20
+
+#define MESSAGE "batched"
+
+static int handle_packet(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    uint32_t *received = (uint32_t *)object;
+    ++*received;
+    return 0;
+}
+
+static void test_flush_skips_failed_packet(void)
+{
+    Logger *log = logger_new();
+    IP ip;
+    ip_init(&ip, false);
+    Networking_Core *sender = new_networking(log, ip, SENDER_PORT);
+    Networking_Core *receiver = new_networking(log, ip, RECEIVER_PORT);
+    ck_assert_msg(sender != nullptr && receiver != nullptr, "failed to open ports %u and %u", SENDER_PORT,
+                  RECEIVER_PORT);
+
+    if (!networking_set_batch_send(sender, true)) {
+        printf("UDP send batching is not supported here, skipping the send queue test.\n");
+    } else {
+        uint32_t received = 0;
+        networking_registerhandler(receiver, NET_PACKET_PING_REQUEST, &handle_packet, &received);
+
+        IP_Port ip_port;
+        ip_port.ip = ip;
+        ip_port.ip.ip.v4 = get_ip4_loopback();
+        ip_port.port = net_htons(RECEIVER_PORT);
+
+        // Sending to port 0 fails with EINVAL.
+        IP_Port bad_ip_port = ip_port;
+        bad_ip_port.port = 0;
+
+        const uint8_t packet[] = {NET_PACKET_PING_REQUEST, 1, 2, 3};
+
+        for (uint32_t i = 0; i < NUM_PACKETS; ++i) {
+            if (i == NUM_PACKETS / 4 || i == NUM_PACKETS / 2) {
+                sendpacket(sender, bad_ip_port, packet, sizeof(packet));
+            }
+
+            sendpacket(sender, ip_port, packet, sizeof(packet));
+        }
+
+        networking_flush(sender);
+
+        Net_Send_Stats stats;
+        networking_get_send_stats(sender, &stats);
+        ck_assert_msg(stats.packets == NUM_PACKETS, "sent %u packets instead of %u", (unsigned)stats.packets,
+                      NUM_PACKETS);
+
+        for (uint32_t i = 0; i < 100 && received < NUM_PACKETS; ++i) {
+            networking_poll(receiver, nullptr);
+            c_sleep(10);
+        }
+
+        ck_assert_msg(received == NUM_PACKETS, "received %u packets instead of %u", received, NUM_PACKETS);
+    }
+
+    kill_networking(receiver);
+    kill_networking(sender);
+    logger_kill(log);
+}
+
+static void accept_friend_request(Tox *tox, const uint8_t *public_key, const uint8_t *data, size_t length,
+                                  void *userdata)
+{
+    tox_friend_add_norequest(tox, public_key, nullptr);
+}
+
+static void handle_message(Tox *tox, uint32_t friend_number, Tox_Message_Type type, const uint8_t *message,
+                           size_t length, void *userdata)
+{
+    bool *message_received = (bool *)userdata;
+
+    if (length == sizeof(MESSAGE) && memcmp(message, MESSAGE, sizeof(MESSAGE)) == 0) {
+        *message_received = true;
+    }
+}
+
+static void test_toxes_with_batching(void)
+{
+    printf("Initialising 2 toxes with UDP batching.\n");
+    uint32_t index[] = { 1, 2 };
+    const time_t cur_time = time(nullptr);
+
+    struct Tox_Options *options = tox_options_new(nullptr);
+    ck_assert(options != nullptr);
+    tox_options_set_experimental_udp_batching(options, true);
+
+    Tox *const tox1 = tox_new_log(options, nullptr, &index[0]);
+    Tox *const tox2 = tox_new_log(options, nullptr, &index[1]);
+    tox_options_free(options);
+
+    ck_assert_msg(tox1 && tox2, "failed to create 2 tox instances");
+
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(tox1, dht_key);
+    const uint16_t dht_port = tox_self_get_udp_port(tox1, nullptr);
+    tox_bootstrap(tox2, "localhost", dht_port, dht_key, nullptr);
+
+    tox_callback_friend_request(tox2, accept_friend_request);
+    tox_callback_friend_message(tox2, handle_message);
+
+    uint8_t address[TOX_ADDRESS_SIZE];
+    tox_self_get_address(tox2, address);
+    const uint32_t friend_number = tox_friend_add(tox1, address, (const uint8_t *)MESSAGE, sizeof(MESSAGE), nullptr);
+    ck_assert_msg(friend_number == 0, "failed to add friend error code: %u", friend_number);
+
+    bool message_received = false;
+
+    do {
+        tox_iterate(tox1, nullptr);
+        tox_iterate(tox2, &message_received);
+
+        c_sleep(ITERATION_INTERVAL);
+    } while (tox_friend_get_connection_status(tox1, 0, nullptr) != TOX_CONNECTION_UDP ||
+             tox_friend_get_connection_status(tox2, 0, nullptr) != TOX_CONNECTION_UDP);
+
+    printf("Tox clients connected over UDP, took %lu seconds.\n", (unsigned long)(time(nullptr) - cur_time));
+
+    Tox_Err_Friend_Send_Message err;
+    tox_friend_send_message(tox1, 0, TOX_MESSAGE_TYPE_NORMAL, (const uint8_t *)MESSAGE, sizeof(MESSAGE), &err);
+    ck_assert_msg(err == TOX_ERR_FRIEND_SEND_MESSAGE_OK, "failed to send message: %d", err);
+
+    while (!message_received) {
+        tox_iterate(tox1, nullptr);
+        tox_iterate(tox2, &message_received);
+
+        c_sleep(ITERATION_INTERVAL);
+    }
+
+    tox_kill(tox1);
+    tox_kill(tox2);
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    test_flush_skips_failed_packet();
+    test_toxes_with_batching();
+    return 0;
+}
@@ -128,7 +128,9 @@ static void parse_tcp_relay_ports_config(config_t *cfg, uint16_t **tcp_relay_por
 
 int get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                        int *enable_ipv6, int *enable_ipv4_fallback, int *enable_lan_discovery, int *enable_tcp_relay,
-                       uint16_t **tcp_relay_ports, int *tcp_relay_port_count, int *enable_motd, char **motd)
+                       uint16_t **tcp_relay_ports, int *tcp_relay_port_count, int *enable_motd, char **motd,
+                       char **metrics_file_path, int *metrics_interval, int *onion_announce_capacity,
+                       int *onion_workers)
 {
     config_t cfg;
 
@@ -141,6 +143,10 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
     const char *NAME_ENABLE_TCP_RELAY     = "enable_tcp_relay";
     const char *NAME_ENABLE_MOTD          = "enable_motd";
     const char *NAME_MOTD                 = "motd";
+    const char *NAME_METRICS_FILE_PATH    = "metrics_file_path";
+    const char *NAME_METRICS_INTERVAL     = "metrics_interval";
+    const char *NAME_ONION_ANNOUNCE_CAPACITY = "onion_announce_capacity";
+    const char *NAME_ONION_WORKERS        = "onion_workers";
 
     config_init(&cfg);
 
@@ -244,6 +250,32 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
         (*motd)[motd_length - 1] = '\0';
     }
 
+    // Get metrics file location
+    const char *tmp_metrics_file;
+
+    if (config_lookup_string(&cfg, NAME_METRICS_FILE_PATH, &tmp_metrics_file) == CONFIG_FALSE) {
+        tmp_metrics_file = DEFAULT_METRICS_FILE_PATH;
+    }
+
+    *metrics_file_path = (char *)malloc(strlen(tmp_metrics_file) + 1);
+    strcpy(*metrics_file_path, tmp_metrics_file);
+
+    // Get metrics interval
+    if (config_lookup_int(&cfg, NAME_METRICS_INTERVAL, metrics_interval) == CONFIG_FALSE || *metrics_interval <= 0) {
+        *metrics_interval = DEFAULT_METRICS_INTERVAL;
+    }
+
+    // Get onion announce capacity
+    if (config_lookup_int(&cfg, NAME_ONION_ANNOUNCE_CAPACITY, onion_announce_capacity) == CONFIG_FALSE
+            || *onion_announce_capacity <= 0) {
+        *onion_announce_capacity = DEFAULT_ONION_ANNOUNCE_CAPACITY;
+    }
+
+    // Get onion workers
+    if (config_lookup_int(&cfg, NAME_ONION_WORKERS, onion_workers) == CONFIG_FALSE || *onion_workers < 0) {
+        *onion_workers = DEFAULT_ONION_WORKERS;
+    }
+
     config_destroy(&cfg);
 
     log_write(LOG_LEVEL_INFO, "Successfully read:\n");
@@ -276,6 +308,15 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
         log_write(LOG_LEVEL_INFO, "'%s': %s\n", NAME_MOTD, *motd);
     }
 
+    // show the interval only if metrics are written
+    if (**metrics_file_path != '\0') {
+        log_write(LOG_LEVEL_INFO, "'%s': %s\n", NAME_METRICS_FILE_PATH, *metrics_file_path);
+        log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_METRICS_INTERVAL, *metrics_interval);
+    }
+
+    log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_ONION_ANNOUNCE_CAPACITY, *onion_announce_capacity);
+    log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_ONION_WORKERS, *onion_workers);
+
     return 1;
 }
 
@@ -23,5 +23,9 @@
 #define DEFAULT_TCP_RELAY_PORTS_COUNT 3
 #define DEFAULT_ENABLE_MOTD           1 // 1 - true, 0 - false
 #define DEFAULT_MOTD                  DAEMON_NAME
+#define DEFAULT_METRICS_FILE_PATH     "" // empty - don't write metrics
+#define DEFAULT_METRICS_INTERVAL      10 // seconds
+#define DEFAULT_ONION_ANNOUNCE_CAPACITY 160 // announced keys stored
+#define DEFAULT_ONION_WORKERS         0 // peel onion packets in the main loop
 
 #endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_CONFIG_DEFAULTS_H
@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * Tox DHT bootstrap daemon.
+ * Writing the load counters of toxcore to a file for monitoring.
+ */
+#include "metrics_file.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define METRICS_PREFIX "tox_bootstrapd_"
+
+static void write_metric_header(FILE *file, const char *name, const char *type, const char *help)
+{
+    fprintf(file, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+    fprintf(file, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+static void write_metric(FILE *file, const char *name, const char *type, const char *help, uint64_t value)
+{
+    write_metric_header(file, name, type, help);
+    fprintf(file, METRICS_PREFIX "%s %" PRIu64 "\n", name, value);
+}
+
+static void write_cache_metric(FILE *file, const char *name, const char *help, uint64_t dht_value,
+                               uint64_t onion_value)
+{
+    write_metric_header(file, name, "counter", help);
+    fprintf(file, METRICS_PREFIX "%s{cache=\"dht\"} %" PRIu64 "\n", name, dht_value);
+    fprintf(file, METRICS_PREFIX "%s{cache=\"onion\"} %" PRIu64 "\n", name, onion_value);
+}
+
+static void write_packet_metrics(FILE *file, const Networking_Core *net)
+{
+    write_metric_header(file, "udp_packets_received_total", "counter", "UDP packets received, by packet id.");
+
+    for (uint32_t id = 0; id < 256; ++id) {
+        Net_Recv_Stats stats;
+        networking_get_recv_stats(net, id, &stats);
+
+        if (stats.packets != 0) {
+            fprintf(file, METRICS_PREFIX "udp_packets_received_total{packet_id=\"%u\"} %" PRIu64 "\n", id,
+                    stats.packets);
+        }
+    }
+
+    write_metric_header(file, "udp_bytes_received_total", "counter", "UDP bytes received, by packet id.");
+
+    for (uint32_t id = 0; id < 256; ++id) {
+        Net_Recv_Stats stats;
+        networking_get_recv_stats(net, id, &stats);
+
+        if (stats.packets != 0) {
+            fprintf(file, METRICS_PREFIX "udp_bytes_received_total{packet_id=\"%u\"} %" PRIu64 "\n", id,
+                    stats.bytes);
+        }
+    }
+
+    Metrics_Histogram times;
+
+    if (!networking_get_handler_times(net, 0, &times)) {
+        return;
+    }
+
+    write_metric_header(file, "udp_handler_seconds", "histogram", "Time spent handling UDP packets, by packet id.");
+
+    for (uint32_t id = 0; id < 256; ++id) {
+        networking_get_handler_times(net, id, &times);
+
+        if (times.count == 0) {
+            continue;
+        }
+
+        uint64_t cumulative = 0;
+
+        for (uint32_t i = 0; i < METRICS_HISTOGRAM_BUCKETS - 1; ++i) {
+            cumulative += times.buckets[i];
+            fprintf(file, METRICS_PREFIX "udp_handler_seconds_bucket{packet_id=\"%u\",le=\"%.9g\"} %" PRIu64 "\n", id,
+                    (metrics_histogram_bound(i) + 1) / 1e9, cumulative);
+        }
+
+        fprintf(file, METRICS_PREFIX "udp_handler_seconds_bucket{packet_id=\"%u\",le=\"+Inf\"} %" PRIu64 "\n", id,
+                times.count);
+        fprintf(file, METRICS_PREFIX "udp_handler_seconds_sum{packet_id=\"%u\"} %.9f\n", id, times.sum / 1e9);
+        fprintf(file, METRICS_PREFIX "udp_handler_seconds_count{packet_id=\"%u\"} %" PRIu64 "\n", id, times.count);
+    }
+}
+
+static void write_tcp_server_metrics(FILE *file, const TCP_Server *tcp_server)
+{
+    TCP_Server_Stats stats;
+    tcp_server_get_stats(tcp_server, &stats);
+
+    write_metric_header(file, "tcp_connections", "gauge", "TCP relay connections, by state.");
+    fprintf(file, METRICS_PREFIX "tcp_connections{state=\"incoming\"} %u\n", stats.incoming);
+    fprintf(file, METRICS_PREFIX "tcp_connections{state=\"unconfirmed\"} %u\n", stats.unconfirmed);
+    fprintf(file, METRICS_PREFIX "tcp_connections{state=\"accepted\"} %u\n", stats.accepted);
+    write_metric(file, "tcp_packets_received_total", "counter", "Packets received from TCP relay clients.",
+                 stats.packets_received);
+    write_metric(file, "tcp_bytes_received_total", "counter", "Bytes of packets received from TCP relay clients.",
+                 stats.bytes_received);
+    write_metric(file, "tcp_packets_relayed_total", "counter", "Data packets passed on between TCP relay clients.",
+                 stats.packets_relayed);
+    write_metric(file, "tcp_bytes_relayed_total", "counter",
+                 "Bytes of data packets passed on between TCP relay clients.", stats.bytes_relayed);
+    write_metric(file, "tcp_oob_relayed_total", "counter", "Out of band packets passed on between TCP relay clients.",
+                 stats.oob_relayed);
+    write_metric(file, "tcp_onion_requests_total", "counter", "Onion requests of TCP relay clients sent on.",
+                 stats.onion_requests);
+    write_metric(file, "tcp_onion_responses_total", "counter", "Onion responses passed back to TCP relay clients.",
+                 stats.onion_responses);
+
+    TCP_Send_Queue_Stats queue_stats;
+    tcp_server_get_send_queue_stats(tcp_server, &queue_stats);
+
+    write_metric(file, "tcp_queued_bytes", "gauge", "Bytes waiting in the send queues of TCP relay clients.",
+                 queue_stats.queued);
+    write_metric(file, "tcp_queued_connections", "gauge", "TCP relay clients with bytes waiting to be sent.",
+                 queue_stats.connections);
+    write_metric(file, "tcp_packets_refused_total", "counter", "Packets refused because a send queue was full.",
+                 queue_stats.refused);
+    write_metric(file, "tcp_packets_dropped_total", "counter",
+                 "Priority packets dropped because a send queue was full.", queue_stats.dropped);
+}
+
+int write_metrics_file(const char *path, const DHT *dht, const Onion *onion, const TCP_Server *tcp_server)
+{
+    const size_t tmp_path_size = strlen(path) + sizeof(".tmp");
+    char *tmp_path = (char *)malloc(tmp_path_size);
+
+    if (tmp_path == nullptr) {
+        return 0;
+    }
+
+    snprintf(tmp_path, tmp_path_size, "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "w");
+
+    if (file == nullptr) {
+        free(tmp_path);
+        return 0;
+    }
+
+    DHT_Stats dht_stats;
+    dht_get_stats(dht, &dht_stats);
+
+    write_metric(file, "dht_close_nodes", "gauge", "Nodes in the DHT close list that answered recently.",
+                 dht_stats.close_nodes);
+
+    Onion_Stats onion_stats;
+    onion_get_stats(onion, &onion_stats);
+
+    write_metric(file, "onion_requests_total", "counter", "Onion requests passed on to the next node.",
+                 onion_stats.requests);
+    write_metric(file, "onion_responses_total", "counter", "Onion responses passed back towards their sender.",
+                 onion_stats.responses);
+    write_metric(file, "onion_dropped_total", "counter", "Onion packets dropped because a worker queue was full.",
+                 onion_stats.dropped);
+
+    write_cache_metric(file, "shared_key_hits_total", "Shared keys found in a cache, by cache.",
+                       dht_stats.shared_keys.hits, onion_stats.shared_keys.hits);
+    write_cache_metric(file, "shared_key_misses_total", "Shared keys that had to be computed, by cache.",
+                       dht_stats.shared_keys.misses, onion_stats.shared_keys.misses);
+    write_cache_metric(file, "shared_key_evictions_total", "Shared keys evicted from a full cache, by cache.",
+                       dht_stats.shared_keys.evictions, onion_stats.shared_keys.evictions);
+
+    write_packet_metrics(file, dht_get_net(dht));
+
+    if (tcp_server != nullptr) {
+        write_tcp_server_metrics(file, tcp_server);
+    }
+
+    const bool written = !ferror(file);
+
+    if (fclose(file) != 0 || !written || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        free(tmp_path);
+        return 0;
+    }
+
+    free(tmp_path);
+    return 1;
+}
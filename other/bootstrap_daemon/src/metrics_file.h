@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * Tox DHT bootstrap daemon.
+ * Writing the load counters of toxcore to a file for monitoring.
+ */
+#ifndef C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_METRICS_FILE_H
+#define C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_METRICS_FILE_H
+
+#include "../../../toxcore/TCP_server.h"
+#include "../../../toxcore/onion.h"
+
+/**
+ * Writes the counters of the networking, DHT, onion and, if it is not null, the
+ * TCP relay of the daemon to a file in the Prometheus text format.
+ * The file is written under a temporary name and then renamed, so that
+ * collectors reading it never see half of it.
+ *
+ * @return 1 on success,
+ *         0 on failure, the previous file is left as it was.
+ */
+int write_metrics_file(const char *path, const DHT *dht, const Onion *onion, const TCP_Server *tcp_server);
+
+#endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_METRICS_FILE_H
@@ -40,6 +40,7 @@
 #include "config.h"
 #include "global.h"
 #include "log.h"
+#include "metrics_file.h"
 
 
 #define SLEEP_MILLISECONDS(MS) usleep(1000*MS)
@@ -239,9 +240,14 @@ int main(int argc, char *argv[])
     int tcp_relay_port_count;
     int enable_motd;
     char *motd = nullptr;
+    char *metrics_file_path = nullptr;
+    int metrics_interval;
+    int announce_capacity;
+    int onion_workers;
 
     if (get_general_config(cfg_file_path, &pid_file_path, &keys_file_path, &port, &enable_ipv6, &enable_ipv4_fallback,
-                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd)) {
+                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd,
+                           &metrics_file_path, &metrics_interval, &announce_capacity, &onion_workers)) {
         log_write(LOG_LEVEL_INFO, "General config read successfully\n");
     } else {
         log_write(LOG_LEVEL_ERROR, "Couldn't read config file: %s. Exiting.\n", cfg_file_path);
@@ -255,6 +261,7 @@ int main(int argc, char *argv[])
         free(tcp_relay_ports);
         free(keys_file_path);
         free(pid_file_path);
+        free(metrics_file_path);
         return 1;
     }
 
@@ -288,6 +295,7 @@ int main(int argc, char *argv[])
                 free(motd);
                 free(tcp_relay_ports);
                 free(keys_file_path);
+                free(metrics_file_path);
                 return 1;
             }
         } else {
@@ -296,6 +304,7 @@ int main(int argc, char *argv[])
             free(motd);
             free(tcp_relay_ports);
             free(keys_file_path);
+            free(metrics_file_path);
             return 1;
         }
     }
@@ -309,6 +318,7 @@ int main(int argc, char *argv[])
         free(motd);
         free(tcp_relay_ports);
         free(keys_file_path);
+        free(metrics_file_path);
         return 1;
     }
 
@@ -324,6 +334,7 @@ int main(int argc, char *argv[])
         free(motd);
         free(tcp_relay_ports);
         free(keys_file_path);
+        free(metrics_file_path);
         return 1;
     }
 
@@ -338,6 +349,7 @@ int main(int argc, char *argv[])
         free(motd);
         free(tcp_relay_ports);
         free(keys_file_path);
+        free(metrics_file_path);
         return 1;
     }
 
@@ -354,9 +366,20 @@ int main(int argc, char *argv[])
         free(motd);
         free(tcp_relay_ports);
         free(keys_file_path);
+        free(metrics_file_path);
         return 1;
     }
 
+    if (!onion_announce_set_capacity(onion_a, announce_capacity)) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't store %d announced keys. Continuing with %u.\n", announce_capacity,
+                  onion_announce_capacity(onion_a));
+    }
+
+    if (onion_workers > 0 && !onion_set_workers(onion, onion_workers)) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't start %d onion workers. Peeling onion packets in the main loop.\n",
+                  onion_workers);
+    }
+
     if (enable_motd) {
         if (bootstrap_set_callbacks(dht_get_net(dht), DAEMON_VERSION_NUMBER, (uint8_t *)motd, strlen(motd) + 1) == 0) {
             log_write(LOG_LEVEL_INFO, "Set MOTD successfully.\n");
@@ -372,6 +395,7 @@ int main(int argc, char *argv[])
             free(motd);
             free(tcp_relay_ports);
             free(keys_file_path);
+            free(metrics_file_path);
             return 1;
         }
     }
@@ -389,6 +413,7 @@ int main(int argc, char *argv[])
         logger_kill(logger);
         free(tcp_relay_ports);
         free(keys_file_path);
+        free(metrics_file_path);
         return 1;
     }
 
@@ -404,6 +429,7 @@ int main(int argc, char *argv[])
             kill_networking(net);
             logger_kill(logger);
             free(tcp_relay_ports);
+            free(metrics_file_path);
             return 1;
         }
 
@@ -446,6 +472,7 @@ int main(int argc, char *argv[])
             mono_time_free(mono_time);
             kill_networking(net);
             logger_kill(logger);
+            free(metrics_file_path);
             return 1;
         }
     }
@@ -461,6 +488,7 @@ int main(int argc, char *argv[])
         mono_time_free(mono_time);
         kill_networking(net);
         logger_kill(logger);
+        free(metrics_file_path);
         return 1;
     }
 
@@ -476,6 +504,14 @@ int main(int argc, char *argv[])
         log_write(LOG_LEVEL_INFO, "Initialized LAN discovery successfully.\n");
     }
 
+    const bool enable_metrics = metrics_file_path[0] != '\0';
+    uint64_t last_metrics = 0;
+    bool metrics_failed = false;
+
+    if (enable_metrics && !networking_set_handler_timing(net, true)) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't enable timing of packet handlers. Continuing without it.\n");
+    }
+
     struct sigaction sa;
 
     sa.sa_handler = handle_signal;
@@ -515,6 +551,18 @@ int main(int argc, char *argv[])
             waiting_for_dht_connection = 0;
         }
 
+        if (enable_metrics && mono_time_is_timeout(mono_time, last_metrics, metrics_interval)) {
+            const bool written = write_metrics_file(metrics_file_path, dht, onion, tcp_server);
+
+            // Only report a change, not every failed attempt
+            if (!written && !metrics_failed) {
+                log_write(LOG_LEVEL_WARNING, "Couldn't write metrics to %s.\n", metrics_file_path);
+            }
+
+            metrics_failed = !written;
+            last_metrics = mono_time_get(mono_time);
+        }
+
         SLEEP_MILLISECONDS(30);
     }
 
@@ -542,6 +590,7 @@ int main(int argc, char *argv[])
     mono_time_free(mono_time);
     kill_networking(net);
     logger_kill(logger);
+    free(metrics_file_path);
 
     return 0;
 }
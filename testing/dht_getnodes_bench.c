@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* DHT close list benchmark
+ *
+ * Fills every bucket of the close list of a DHT node, as a well connected
+ * bootstrap node would have it, and prints how many lookups per second it
+ * does: finding the nodes closest to random keys, adding nodes that are in the
+ * list already, as every packet from a DHT node does, and answering get nodes
+ * requests that arrive on loopback. For the requests only the node side is
+ * timed, not building them or reading the answers. Then adds friends and
+ * prints how fast new nodes go into their lists and how fast the closest nodes
+ * are found when their lists are searched as well.
+ *
+ * Usage: ./dht_getnodes_bench [num_lookups]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/mono_time.h"
+#include "misc_tools.h"
+
+#define BENCH_NODE_PORT 33601
+#define BENCH_CLIENT_PORT 33602
+
+/* Requests sent before letting the node catch up, small enough for the UDP
+ * socket buffers to take them all. */
+#define BENCH_BATCH 64
+
+#define BENCH_FRIENDS 100
+
+static int handle_sendnodes(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    uint32_t *answers = (uint32_t *)object;
+    ++*answers;
+    return 0;
+}
+
+static double per_second(uint32_t count, clock_t ticks)
+{
+    const double seconds = (double)ticks / CLOCKS_PER_SEC;
+    return seconds > 0 ? count / seconds : 0.0;
+}
+
+static void bench_get_close_nodes(const DHT *dht, uint32_t num_lookups)
+{
+    uint8_t target[CRYPTO_PUBLIC_KEY_SIZE];
+    Node_format close_nodes[MAX_SENT_NODES];
+    uint32_t found = 0;
+    const clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_lookups; ++i) {
+        random_bytes(target, sizeof(target));
+        found += get_close_nodes(dht, target, close_nodes, net_family_unspec, true, 0);
+    }
+
+    const clock_t ticks = clock() - start;
+    printf("get_close_nodes: %8u in %7.3f s CPU, %10.0f per second, %.2f nodes each\n", num_lookups,
+           (double)ticks / CLOCKS_PER_SEC, per_second(num_lookups, ticks), (double)found / num_lookups);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_lookups = 200000;
+
+    if (argc > 1) {
+        num_lookups = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Networking_Core *node_net = new_networking(log, ip, BENCH_NODE_PORT);
+    DHT *dht = node_net != nullptr ? new_dht(log, mono_time, node_net, true) : nullptr;
+    Networking_Core *client_net = new_networking(log, ip, BENCH_CLIENT_PORT);
+    DHT *client_dht = client_net != nullptr ? new_dht(log, mono_time, client_net, true) : nullptr;
+
+    if (dht == nullptr || client_dht == nullptr) {
+        fprintf(stderr, "failed to start the DHTs on ports %u and %u\n", BENCH_NODE_PORT, BENCH_CLIENT_PORT);
+        return 1;
+    }
+
+    const uint32_t num_nodes = LCLIENT_LIST;
+    Node_format *nodes = (Node_format *)calloc(num_nodes, sizeof(Node_format));
+
+    if (nodes == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        make_bucket_key(nodes[i].public_key, dht_get_self_public_key(dht), i / LCLIENT_NODES);
+        ip_init(&nodes[i].ip_port.ip, false);
+        nodes[i].ip_port.ip.ip.v4.uint32 = net_htonl(0x01000000 + i);
+        nodes[i].ip_port.port = net_htons(33445);
+
+        addto_lists(dht, nodes[i].ip_port, nodes[i].public_key);
+    }
+
+    uint32_t in_list = 0;
+
+    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
+        in_list += dht_get_close_client(dht, i)->assoc4.timestamp != 0;
+    }
+
+    printf("%u nodes in the close list\n", in_list);
+
+    bench_get_close_nodes(dht, num_lookups);
+
+    clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_lookups; ++i) {
+        const Node_format *node = &nodes[i % num_nodes];
+        addto_lists(dht, node->ip_port, node->public_key);
+    }
+
+    clock_t ticks = clock() - start;
+    printf("addto_lists:     %8u in %7.3f s CPU, %10.0f per second\n", num_lookups, (double)ticks / CLOCKS_PER_SEC,
+           per_second(num_lookups, ticks));
+
+    IP_Port node_ip_port;
+    node_ip_port.ip = ip;
+    node_ip_port.port = net_htons(BENCH_NODE_PORT);
+
+    uint8_t target[CRYPTO_PUBLIC_KEY_SIZE];
+    uint32_t answers = 0;
+    networking_registerhandler(client_net, NET_PACKET_SEND_NODES_IPV6, &handle_sendnodes, &answers);
+
+    uint32_t sent = 0;
+    ticks = 0;
+
+    while (answers < num_lookups) {
+        for (uint32_t i = 0; i < BENCH_BATCH && sent < num_lookups; ++i) {
+            random_bytes(target, sizeof(target));
+            dht_getnodes(client_dht, &node_ip_port, dht_get_self_public_key(dht), target);
+            ++sent;
+        }
+
+        const uint32_t before = answers;
+        mono_time_update(mono_time);
+
+        start = clock();
+        networking_poll(node_net, nullptr);
+        ticks += clock() - start;
+
+        networking_poll(client_net, nullptr);
+
+        /* UDP packets may get lost, so top up when nothing moves. */
+        if (sent == num_lookups && answers == before) {
+            sent = answers;
+        }
+    }
+
+    printf("get nodes:       %8u in %7.3f s CPU, %10.0f per second\n", answers, (double)ticks / CLOCKS_PER_SEC,
+           per_second(answers, ticks));
+
+    for (uint32_t i = 0; i < BENCH_FRIENDS; ++i) {
+        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        random_bytes(public_key, sizeof(public_key));
+        dht_addfriend(dht, public_key, nullptr, nullptr, 0, nullptr);
+    }
+
+    printf("%u friends\n", BENCH_FRIENDS);
+
+    IP_Port new_ip_port;
+    ip_init(&new_ip_port.ip, false);
+    new_ip_port.port = net_htons(33445);
+    start = clock();
+
+    for (uint32_t i = 0; i < num_lookups; ++i) {
+        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        random_bytes(public_key, sizeof(public_key));
+        new_ip_port.ip.ip.v4.uint32 = net_htonl(0x02000000 + i);
+        addto_lists(dht, new_ip_port, public_key);
+    }
+
+    ticks = clock() - start;
+    printf("addto_lists new: %8u in %7.3f s CPU, %10.0f per second\n", num_lookups, (double)ticks / CLOCKS_PER_SEC,
+           per_second(num_lookups, ticks));
+
+    bench_get_close_nodes(dht, num_lookups);
+
+    free(nodes);
+    kill_dht(client_dht);
+    kill_networking(client_net);
+    kill_dht(dht);
+    kill_networking(node_net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Group broadcast benchmark
+ *
+ * Sends group messages into groups of 50 and 500 directly connected peers and
+ * prints the CPU time each message costs the sender: wrapping and encrypting
+ * it for every peer, storing it in their send arrays and handing the packets
+ * to the socket. Packets go to a loopback socket that is never read, and are
+ * queued with send batching so that system calls do not dominate.
+ *
+ * Usage: ./group_broadcast_bench [num_messages]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/group_chats.h"
+#include "../toxcore/group_connection.h"
+#include "../toxcore/mono_time.h"
+
+#define BENCH_MESSAGE_SIZE 256
+
+static void bench_broadcast(const Logger *log, Mono_Time *mono_time, Networking_Core *net, IP_Port sink,
+                            uint32_t num_peers, uint32_t num_messages)
+{
+    GC_Chat *chat = (GC_Chat *)calloc(1, sizeof(GC_Chat));
+    GC_Connection *gcc = (GC_Connection *)calloc(num_peers, sizeof(GC_Connection));
+    GC_GroupPeer *group = (GC_GroupPeer *)calloc(num_peers, sizeof(GC_GroupPeer));
+
+    if (chat == nullptr || gcc == nullptr || group == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    chat->logger = log;
+    chat->mono_time = mono_time;
+    chat->net = net;
+    chat->gcc = gcc;
+    chat->group = group;
+    chat->numpeers = num_peers;
+    chat->group[0].role = GR_FOUNDER;
+
+    uint8_t self_secret_key[ENC_SECRET_KEY];
+    crypto_new_keypair(chat->self_public_key, self_secret_key);
+
+    for (uint32_t i = 1; i < num_peers; ++i) {
+        GC_Connection *gconn = &chat->gcc[i];
+        gconn->handshaked = true;
+        gconn->confirmed = true;
+        gconn->addr.ip_port = sink;
+        gconn->last_received_direct_time = mono_time_get(mono_time);
+        new_symmetric_key(gconn->shared_key);
+        gcc_set_send_message_id(gconn, 1);
+    }
+
+    uint8_t message[BENCH_MESSAGE_SIZE];
+    memset(message, 'a', sizeof(message));
+
+    clock_t elapsed = 0;
+
+    for (uint32_t m = 0; m < num_messages; ++m) {
+        const clock_t start = clock();
+        gc_send_message(chat, message, sizeof(message), GC_MESSAGE_TYPE_NORMAL);
+        networking_flush(net);
+        elapsed += clock() - start;
+
+        /* Peers ack every message, so send arrays stay small. */
+        for (uint32_t i = 1; i < num_peers; ++i) {
+            gcc_handle_ack(&chat->gcc[i], chat->gcc[i].send_message_id - 1);
+        }
+    }
+
+    const double seconds = (double)elapsed / CLOCKS_PER_SEC;
+
+    printf("%4u peers: %6u messages in %7.3f s CPU, %9.1f us per message, %6.2f us per peer\n", num_peers,
+           num_messages, seconds, seconds * 1e6 / num_messages, seconds * 1e6 / num_messages / (num_peers - 1));
+
+    gcc_cleanup(chat);
+    free(chat->group);
+    free(chat);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_messages = 2000;
+
+    if (argc > 1) {
+        num_messages = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Networking_Core *net = new_networking_ex(log, ip, 0, 0, nullptr);
+    Networking_Core *sink_net = new_networking_ex(log, ip, 0, 0, nullptr);
+
+    if (net == nullptr || sink_net == nullptr) {
+        fprintf(stderr, "failed to create sockets\n");
+        return 1;
+    }
+
+    networking_set_batch_send(net, true);
+
+    IP_Port sink;
+    sink.ip = ip;
+    sink.port = net_port(sink_net);
+
+    const uint32_t group_sizes[] = {50, 500};
+
+    for (size_t i = 0; i < sizeof(group_sizes) / sizeof(group_sizes[0]); ++i) {
+        bench_broadcast(log, mono_time, net, sink, group_sizes[i], num_messages * 50 / group_sizes[i]);
+    }
+
+    kill_networking(sink_net);
+    kill_networking(net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Group connection memory benchmark
+ *
+ * Adds 10, 100 and 1000 peers to a group the way the group chat code does and
+ * passes a few lossless messages through each connection: most are acked,
+ * one stays in flight and one arrives out of order. Prints how much resident
+ * memory each peer costs. Only Linux exposes the resident set size through
+ * /proc, elsewhere the numbers are reported as 0.
+ *
+ * Usage: ./group_mem_bench [max_peers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../toxcore/group_chats.h"
+#include "../toxcore/group_connection.h"
+#include "../toxcore/mono_time.h"
+
+#define BENCH_MESSAGES_ACKED 8
+#define BENCH_MESSAGE_SIZE 128
+
+/* Return resident set size of the process in bytes, 0 if unknown. */
+static uint64_t resident_memory(void)
+{
+#ifdef __linux__
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f == nullptr) {
+        return 0;
+    }
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(f);
+    return (uint64_t)resident * 4096;
+#else
+    return 0;
+#endif
+}
+
+static void bench_peers(const Logger *log, const Mono_Time *mono_time, uint32_t num_peers)
+{
+    GC_Chat *chat = (GC_Chat *)calloc(1, sizeof(GC_Chat));
+
+    if (chat == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    chat->logger = log;
+    chat->mono_time = mono_time;
+
+    uint8_t message[BENCH_MESSAGE_SIZE] = {0};
+    GC_Message_Buffer *buffer = gcc_message_buffer_new(message, sizeof(message));
+
+    if (buffer == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    const uint64_t before = resident_memory();
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        GC_Connection *tmp_gcc = (GC_Connection *)realloc(chat->gcc, sizeof(GC_Connection) * (chat->numpeers + 1));
+
+        if (tmp_gcc == nullptr) {
+            fprintf(stderr, "failed to add peer %u\n", i);
+            break;
+        }
+
+        memset(&tmp_gcc[chat->numpeers], 0, sizeof(GC_Connection));
+        chat->gcc = tmp_gcc;
+        GC_Connection *gconn = &chat->gcc[chat->numpeers];
+        ++chat->numpeers;
+
+        gcc_set_send_message_id(gconn, 1);
+
+        for (uint64_t id = 1; id <= BENCH_MESSAGES_ACKED; ++id) {
+            gcc_add_to_send_array(log, mono_time, gconn, buffer, 0);
+            gcc_handle_ack(gconn, id);
+        }
+
+        gcc_add_to_send_array(log, mono_time, gconn, buffer, 0);
+        gcc_handle_received_message(chat, chat->numpeers - 1, message, sizeof(message), 0, 3, false);
+    }
+
+    const uint64_t after = resident_memory();
+    const uint64_t total = after > before ? after - before : 0;
+
+    printf("%5u peers: %12llu bytes total, %9llu bytes per peer\n", chat->numpeers, (unsigned long long)total,
+           chat->numpeers ? (unsigned long long)(total / chat->numpeers) : 0ULL);
+
+    gcc_cleanup(chat);
+    gcc_message_buffer_release(buffer);
+    free(chat);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max_peers = 1000;
+
+    if (argc > 1) {
+        max_peers = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    printf("sizeof(GC_Connection) = %zu\n", sizeof(GC_Connection));
+
+    const uint32_t counts[] = {10, 100, 1000};
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        if (counts[i] <= max_peers) {
+            bench_peers(log, mono_time, counts[i]);
+        }
+    }
+
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
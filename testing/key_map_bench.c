@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Key lookup structure churn benchmark
+ *
+ * Fills a BS_List and a Key_Map with 10000 and with 100000 random public keys,
+ * the way a busy TCP relay fills its list of accepted connections, then looks
+ * keys up, replaces keys of connections that go away with new ones and finally
+ * removes all keys. Prints the average time of each operation.
+ *
+ * Usage: ./key_map_bench [num_ops]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/key_map.h"
+#include "../toxcore/list.h"
+
+typedef struct Bench_Map {
+    const char *name;
+    void *map;
+    int (*init)(void *map, uint32_t key_size, uint32_t initial_capacity);
+    void (*clear)(void *map);
+    int (*find)(const void *map, const uint8_t *key);
+    int (*add)(void *map, const uint8_t *key, int id);
+    int (*remove)(void *map, const uint8_t *key, int id);
+} Bench_Map;
+
+static int list_init(void *map, uint32_t key_size, uint32_t initial_capacity)
+{
+    return bs_list_init((BS_List *)map, key_size, initial_capacity);
+}
+static void list_free(void *map)
+{
+    bs_list_free((BS_List *)map);
+}
+static int list_find(const void *map, const uint8_t *key)
+{
+    return bs_list_find((const BS_List *)map, key);
+}
+static int list_add(void *map, const uint8_t *key, int id)
+{
+    return bs_list_add((BS_List *)map, key, id);
+}
+static int list_remove(void *map, const uint8_t *key, int id)
+{
+    return bs_list_remove((BS_List *)map, key, id);
+}
+
+static int map_init(void *map, uint32_t key_size, uint32_t initial_capacity)
+{
+    return key_map_init((Key_Map *)map, key_size, initial_capacity);
+}
+static void map_free(void *map)
+{
+    key_map_free((Key_Map *)map);
+}
+static int map_find(const void *map, const uint8_t *key)
+{
+    return key_map_find((const Key_Map *)map, key);
+}
+static int map_add(void *map, const uint8_t *key, int id)
+{
+    return key_map_add((Key_Map *)map, key, id);
+}
+static int map_remove(void *map, const uint8_t *key, int id)
+{
+    return key_map_remove((Key_Map *)map, key, id);
+}
+
+static double ns_per_op(clock_t start, uint32_t ops)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / ops;
+}
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "%s failed\n", what);
+        exit(1);
+    }
+}
+
+/* keys holds num_keys keys for the initial fill followed by num_ops keys that
+ * replace them; picks holds num_ops random connection ids. */
+static void bench(const Bench_Map *bm, uint32_t num_keys, uint32_t num_ops, const uint8_t *keys,
+                  const uint32_t *picks)
+{
+    uint32_t *live = (uint32_t *)malloc(num_keys * sizeof(uint32_t));
+    check(live != nullptr, "malloc");
+    check(bm->init(bm->map, CRYPTO_PUBLIC_KEY_SIZE, 8), "init");
+
+    clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        live[i] = i;
+        check(bm->add(bm->map, keys + (size_t)i * CRYPTO_PUBLIC_KEY_SIZE, i) == 1, "add");
+    }
+
+    const double fill = ns_per_op(start, num_keys);
+    start = clock();
+
+    for (uint32_t i = 0; i < num_ops; ++i) {
+        const uint32_t id = picks[i];
+        check(bm->find(bm->map, keys + (size_t)live[id] * CRYPTO_PUBLIC_KEY_SIZE) == (int)id, "find");
+    }
+
+    const double find = ns_per_op(start, num_ops);
+    start = clock();
+
+    for (uint32_t i = 0; i < num_ops; ++i) {
+        const uint32_t id = picks[i];
+        check(bm->remove(bm->map, keys + (size_t)live[id] * CRYPTO_PUBLIC_KEY_SIZE, id), "remove");
+        live[id] = num_keys + i;
+        check(bm->add(bm->map, keys + (size_t)live[id] * CRYPTO_PUBLIC_KEY_SIZE, id) == 1, "add");
+    }
+
+    const double churn = ns_per_op(start, num_ops);
+    start = clock();
+
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        check(bm->remove(bm->map, keys + (size_t)live[i] * CRYPTO_PUBLIC_KEY_SIZE, i), "remove");
+    }
+
+    const double drain = ns_per_op(start, num_keys);
+
+    printf("%-8s %6u keys: add %8.0f ns, find %6.0f ns, replace %8.0f ns, remove %8.0f ns\n", bm->name, num_keys,
+           fill, find, churn, drain);
+
+    bm->clear(bm->map);
+    free(live);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_ops = 100000;
+
+    if (argc > 1) {
+        num_ops = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    if (num_ops == 0) {
+        fprintf(stderr, "usage: %s [num_ops]\n", argv[0]);
+        return 1;
+    }
+
+    const uint32_t sizes[] = {10000, 100000};
+    const uint32_t max_keys = sizes[1] + num_ops;
+    uint8_t *keys = (uint8_t *)malloc((size_t)max_keys * CRYPTO_PUBLIC_KEY_SIZE);
+    uint32_t *picks = (uint32_t *)malloc(num_ops * sizeof(uint32_t));
+
+    if (keys == nullptr || picks == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    random_bytes(keys, (size_t)max_keys * CRYPTO_PUBLIC_KEY_SIZE);
+
+    BS_List list;
+    Key_Map map;
+    const Bench_Map maps[] = {
+        {"BS_List", &list, &list_init, &list_free, &list_find, &list_add, &list_remove},
+        {"Key_Map", &map, &map_init, &map_free, &map_find, &map_add, &map_remove},
+    };
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (uint32_t i = 0; i < num_ops; ++i) {
+            picks[i] = random_u32() % sizes[s];
+        }
+
+        for (uint32_t m = 0; m < sizeof(maps) / sizeof(maps[0]); ++m) {
+            bench(&maps[m], sizes[s], num_ops, keys, picks);
+        }
+    }
+
+    free(picks);
+    free(keys);
+    return 0;
+}
@@ -35,6 +35,7 @@
 #endif
 
 #include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
 #include "../toxcore/tox.h"
 #include "../toxcore/util.h"
 
@@ -280,3 +281,15 @@ int use_test_rng(uint32_t seed)
     assert(!"libsodium required for use_test_rng");
 }
 #endif
+
+void make_bucket_key(uint8_t *public_key, const uint8_t *self_public_key, uint32_t bucket)
+{
+    random_bytes(public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    const uint32_t byte = bucket / 8;
+    const uint8_t bit = 0x80 >> (bucket % 8);
+    const uint8_t prefix = (uint8_t)~(bit * 2 - 1);
+
+    memcpy(public_key, self_public_key, byte);
+    public_key[byte] = (self_public_key[byte] & prefix) | (~self_public_key[byte] & bit) | (public_key[byte] & (bit - 1));
+}
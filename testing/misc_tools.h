@@ -26,6 +26,12 @@ Tox *tox_new_log_lan(struct Tox_Options *options, Tox_Err_New *err, void *log_us
 
 int use_test_rng(uint32_t seed);
 
+/* Make a random public key that goes into the given bucket of the DHT close
+ * list of self_public_key: it shares the first bucket bits with it and differs
+ * in the next one.
+ */
+void make_bucket_key(uint8_t *public_key, const uint8_t *self_public_key, uint32_t bucket);
+
 #ifdef __cplusplus
 }
 #endif
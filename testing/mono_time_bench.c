@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* mono_time reader benchmark
+ *
+ * Calls mono_time_get num_reads times on each of 1, 2, 4... reader threads,
+ * up to the number of cores, while one writer thread keeps calling
+ * mono_time_update, and prints the average cost of a read.
+ *
+ * Usage: ./mono_time_bench [num_reads]
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/mono_time.h"
+
+#define BENCH_MAX_READERS 64
+
+/* Updates between two checks of whether the writer should stop. */
+#define BENCH_WRITER_BATCH 1000
+
+typedef struct Bench_Writer {
+    pthread_t thread;
+    Mono_Time *mono_time;
+    pthread_mutex_t mutex;
+    bool stopping;
+} Bench_Writer;
+
+typedef struct Bench_Reader {
+    pthread_t thread;
+    const Mono_Time *mono_time;
+    uint32_t num_reads;
+    uint64_t sum;
+    uint64_t ns;
+} Bench_Reader;
+
+static uint64_t wall_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void *writer_thread(void *arg)
+{
+    Bench_Writer *writer = (Bench_Writer *)arg;
+
+    while (true) {
+        for (uint32_t i = 0; i < BENCH_WRITER_BATCH; ++i) {
+            mono_time_update(writer->mono_time);
+        }
+
+        pthread_mutex_lock(&writer->mutex);
+        const bool stopping = writer->stopping;
+        pthread_mutex_unlock(&writer->mutex);
+
+        if (stopping) {
+            return nullptr;
+        }
+    }
+}
+
+static void *reader_thread(void *arg)
+{
+    Bench_Reader *reader = (Bench_Reader *)arg;
+    uint64_t sum = 0;
+    const uint64_t start = wall_time_ns();
+
+    for (uint32_t i = 0; i < reader->num_reads; ++i) {
+        sum += mono_time_get(reader->mono_time);
+    }
+
+    reader->ns = wall_time_ns() - start;
+    reader->sum = sum;
+    return nullptr;
+}
+
+/* return the average cost of a read in nanoseconds with num_readers readers,
+ * or a negative number if the threads could not be started.
+ */
+static double reader_cost_ns(Mono_Time *mono_time, uint32_t num_readers, uint32_t num_reads)
+{
+    Bench_Writer writer = {0};
+    writer.mono_time = mono_time;
+    pthread_mutex_init(&writer.mutex, nullptr);
+
+    if (pthread_create(&writer.thread, nullptr, &writer_thread, &writer) != 0) {
+        pthread_mutex_destroy(&writer.mutex);
+        return -1;
+    }
+
+    Bench_Reader readers[BENCH_MAX_READERS] = {{0}};
+    uint32_t started = 0;
+
+    for (; started < num_readers; ++started) {
+        readers[started].mono_time = mono_time;
+        readers[started].num_reads = num_reads;
+
+        if (pthread_create(&readers[started].thread, nullptr, &reader_thread, &readers[started]) != 0) {
+            break;
+        }
+    }
+
+    uint64_t total_ns = 0;
+
+    for (uint32_t i = 0; i < started; ++i) {
+        pthread_join(readers[i].thread, nullptr);
+        total_ns += readers[i].ns;
+    }
+
+    pthread_mutex_lock(&writer.mutex);
+    writer.stopping = true;
+    pthread_mutex_unlock(&writer.mutex);
+    pthread_join(writer.thread, nullptr);
+    pthread_mutex_destroy(&writer.mutex);
+
+    if (started < num_readers) {
+        return -1;
+    }
+
+    return (double)total_ns / ((double)num_readers * num_reads);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_reads = 1000000;
+
+    if (argc > 1) {
+        num_reads = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    if (num_reads == 0) {
+        fprintf(stderr, "usage: %s [num_reads]\n", argv[0]);
+        return 1;
+    }
+
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (num_cores < 2) {
+        num_cores = 2;
+    }
+
+    const uint32_t max_readers = num_cores < BENCH_MAX_READERS ? (uint32_t)num_cores : BENCH_MAX_READERS;
+
+    Mono_Time *mono_time = mono_time_new();
+
+    if (mono_time == nullptr) {
+        fprintf(stderr, "mono_time_new failed\n");
+        return 1;
+    }
+
+    for (uint32_t num_readers = 1; num_readers <= max_readers; num_readers *= 2) {
+        const double cost = reader_cost_ns(mono_time, num_readers, num_reads);
+
+        if (cost < 0) {
+            fprintf(stderr, "failed to start %u reader threads\n", num_readers);
+            mono_time_free(mono_time);
+            return 1;
+        }
+
+        printf("mono_time_get with %2u reader(s) and 1 writer: %6.2f ns/call\n", num_readers, cost);
+    }
+
+    mono_time_free(mono_time);
+    return 0;
+}
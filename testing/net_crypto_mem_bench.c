@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* net_crypto memory benchmark
+ *
+ * Creates 1, 1000 and 10000 idle crypto connections and prints how much
+ * resident memory each of them costs. Only Linux exposes the resident set size
+ * through /proc, elsewhere the numbers are reported as 0.
+ *
+ * Usage: ./net_crypto_mem_bench [max_connections]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/net_crypto.h"
+
+/* Return resident set size of the process in bytes, 0 if unknown. */
+static uint64_t resident_memory(void)
+{
+#ifdef __linux__
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f == nullptr) {
+        return 0;
+    }
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(f);
+    return (uint64_t)resident * 4096;
+#else
+    return 0;
+#endif
+}
+
+static void bench_connections(Logger *log, Mono_Time *mono_time, uint32_t num_connections)
+{
+    Networking_Core *net = new_networking_no_udp(log);
+    DHT *dht = new_dht(log, mono_time, net, true);
+    TCP_Proxy_Info proxy_info = {{{{0}}}};
+    Net_Crypto *c = new_net_crypto(log, mono_time, dht, &proxy_info);
+
+    if (c == nullptr) {
+        fprintf(stderr, "failed to create net_crypto instance\n");
+        exit(1);
+    }
+
+    const uint64_t before = resident_memory();
+    uint32_t created = 0;
+
+    for (uint32_t i = 0; i < num_connections; ++i) {
+        uint8_t real_pk[CRYPTO_PUBLIC_KEY_SIZE];
+        uint8_t dht_pk[CRYPTO_PUBLIC_KEY_SIZE];
+        uint8_t sk[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(real_pk, sk);
+        crypto_new_keypair(dht_pk, sk);
+
+        if (new_crypto_connection(c, real_pk, dht_pk) == -1) {
+            fprintf(stderr, "failed to create connection %u\n", i);
+            break;
+        }
+
+        ++created;
+    }
+
+    const uint64_t after = resident_memory();
+    const uint64_t total = after > before ? after - before : 0;
+
+    printf("%6u connections: %10llu bytes total, %8llu bytes per connection\n", created,
+           (unsigned long long)total, created ? (unsigned long long)(total / created) : 0ULL);
+
+    kill_net_crypto(c);
+    kill_dht(dht);
+    kill_networking(net);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max_connections = 10000;
+
+    if (argc > 1) {
+        max_connections = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    const uint32_t counts[] = {1, 1000, 10000};
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        if (counts[i] <= max_connections) {
+            bench_connections(log, mono_time, counts[i]);
+        }
+    }
+
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* UDP receive benchmark
+ *
+ * Sends bursts of packets between two sockets on loopback and measures the CPU
+ * time networking_poll spends delivering them to the packet handler, once with
+ * batched receiving (recvmmsg where available) and once with one system call
+ * per packet. Only the receiving side is timed.
+ *
+ * Usage: ./network_recv_bench [num_packets]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/network.h"
+
+#define BENCH_PACKET_ID 254
+#define BENCH_PACKET_SIZE 128
+#define BENCH_BURST_SIZE 256
+
+static int handle_bench_packet(void *object, IP_Port source, const uint8_t *packet, uint16_t length,
+                               void *userdata)
+{
+    uint32_t *received = (uint32_t *)object;
+    ++*received;
+    return 0;
+}
+
+static void bench_receive(Logger *log, uint32_t num_packets, bool batch)
+{
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Networking_Core *sender = new_networking_ex(log, ip, 0, 0, nullptr);
+    Networking_Core *receiver = new_networking_ex(log, ip, 0, 0, nullptr);
+
+    if (sender == nullptr || receiver == nullptr) {
+        fprintf(stderr, "failed to create sockets\n");
+        exit(1);
+    }
+
+    uint32_t received = 0;
+    networking_registerhandler(receiver, BENCH_PACKET_ID, &handle_bench_packet, &received);
+    networking_set_batch_receive(receiver, batch);
+
+    IP_Port dest;
+    dest.ip = ip;
+    dest.port = net_port(receiver);
+
+    uint8_t packet[BENCH_PACKET_SIZE];
+    memset(packet, 0, sizeof(packet));
+    packet[0] = BENCH_PACKET_ID;
+
+    clock_t elapsed = 0;
+    uint32_t sent = 0;
+
+    while (sent < num_packets) {
+        for (uint32_t i = 0; i < BENCH_BURST_SIZE && sent < num_packets; ++i) {
+            sendpacket(sender, dest, packet, sizeof(packet));
+            ++sent;
+        }
+
+        const clock_t start = clock();
+        networking_poll(receiver, nullptr);
+        elapsed += clock() - start;
+    }
+
+    const double seconds = (double)elapsed / CLOCKS_PER_SEC;
+
+    printf("%-10s %8u/%u packets received in %7.3f s CPU, %10.0f packets/s\n", batch ? "batched" : "unbatched",
+           received, num_packets, seconds, seconds > 0 ? received / seconds : 0.0);
+
+    kill_networking(receiver);
+    kill_networking(sender);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_packets = 1000000;
+
+    if (argc > 1) {
+        num_packets = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+
+    bench_receive(log, num_packets, false);
+    bench_receive(log, num_packets, true);
+
+    logger_kill(log);
+    return 0;
+}
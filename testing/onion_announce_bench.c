@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Onion announce store benchmark
+ *
+ * Sends announce requests on loopback to a node that stores announced keys,
+ * as the last node of their onion paths would. Twice as many keys as the node
+ * stores announce themselves over and over, so the store stays full and keeps
+ * swapping keys in and out. Prints how many announce requests per second the
+ * node answers, with the default capacity of the store and with a large one.
+ * The requests are built before the clock starts, so the CPU time is spent on
+ * the node side and on the sockets.
+ *
+ * Usage: ./onion_announce_bench [num_requests]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/mono_time.h"
+#include "../toxcore/onion_announce.h"
+
+#define BENCH_NODE_PORT 33550
+#define BENCH_CLIENT_PORT 33551
+
+/* Requests sent before letting the node catch up, small enough for the UDP
+ * socket buffers to take them all. */
+#define BENCH_BATCH 64
+
+#define BENCH_REQUEST_SIZE (ONION_ANNOUNCE_REQUEST_MIN_SIZE + ONION_RETURN_3)
+
+/* create_announce_request makes requests of the old kind, which get responses
+ * that carry one byte less before the ping id. */
+#define BENCH_RESPONSE_MIN_SIZE (ONION_ANNOUNCE_RESPONSE_MIN_SIZE - 1)
+
+typedef struct Bench_Key {
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+    uint8_t ping_id[ONION_PING_ID_SIZE];
+    bool have_ping_id;
+    uint8_t request[BENCH_REQUEST_SIZE];
+} Bench_Key;
+
+typedef struct Bench_Client {
+    const uint8_t *node_public_key;
+    Bench_Key *keys;
+    uint32_t num_keys;
+    uint32_t responses;
+    uint32_t ping_ids;
+} Bench_Client;
+
+/* Takes the ping id out of the responses to the first requests. */
+static int handle_recv_3(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    ++client->responses;
+
+    const uint8_t *data = packet + 1 + ONION_RETURN_3;
+    const uint16_t data_length = length - (1 + ONION_RETURN_3);
+
+    if (length < 1 + ONION_RETURN_3 + BENCH_RESPONSE_MIN_SIZE || data[0] != NET_PACKET_ANNOUNCE_RSPONSE_OLD) {
+        return 1;
+    }
+
+    if (client->ping_ids == client->num_keys) {
+        return 0;
+    }
+
+    uint64_t sendback;
+    memcpy(&sendback, data + 1, sizeof(sendback));
+
+    if (sendback >= client->num_keys) {
+        return 1;
+    }
+
+    Bench_Key *key = &client->keys[sendback];
+
+    if (key->have_ping_id) {
+        return 0;
+    }
+
+    const uint16_t encrypted_offset = 1 + ONION_ANNOUNCE_SENDBACK_DATA_LENGTH + CRYPTO_NONCE_SIZE;
+    uint8_t plain[ONION_ANNOUNCE_RESPONSE_MAX_SIZE];
+
+    if (decrypt_data(client->node_public_key, key->secret_key, data + 1 + ONION_ANNOUNCE_SENDBACK_DATA_LENGTH,
+                     data + encrypted_offset, data_length - encrypted_offset, plain) <= 0) {
+        return 1;
+    }
+
+    memcpy(key->ping_id, plain + 1, ONION_PING_ID_SIZE);
+    key->have_ping_id = true;
+    ++client->ping_ids;
+    return 0;
+}
+
+static void make_requests(Bench_Client *client)
+{
+    for (uint32_t i = 0; i < client->num_keys; ++i) {
+        Bench_Key *key = &client->keys[i];
+
+        if (create_announce_request(key->request, sizeof(key->request), client->node_public_key, key->public_key,
+                                    key->secret_key, key->ping_id, key->public_key, key->public_key,
+                                    i) != ONION_ANNOUNCE_REQUEST_MIN_SIZE) {
+            fprintf(stderr, "failed to create announce request\n");
+            exit(1);
+        }
+
+        random_bytes(key->request + ONION_ANNOUNCE_REQUEST_MIN_SIZE, ONION_RETURN_3);
+    }
+}
+
+/* Sends num_requests requests, going round the keys, and waits for the
+ * answers, sending again what got lost.
+ */
+static void send_requests(Mono_Time *mono_time, Networking_Core *node_net, Networking_Core *client_net,
+                          Bench_Client *client, uint32_t num_requests)
+{
+    IP_Port node_ip_port;
+    ip_init(&node_ip_port.ip, false);
+    node_ip_port.ip.ip.v4 = get_ip4_loopback();
+    node_ip_port.port = net_htons(BENCH_NODE_PORT);
+
+    client->responses = 0;
+    uint32_t sent = 0;
+
+    while (client->responses < num_requests) {
+        for (uint32_t i = 0; i < BENCH_BATCH && sent < num_requests; ++i) {
+            sendpacket(client_net, node_ip_port, client->keys[sent % client->num_keys].request, BENCH_REQUEST_SIZE);
+            ++sent;
+        }
+
+        const uint32_t responses = client->responses;
+        mono_time_update(mono_time);
+        networking_poll(node_net, nullptr);
+        networking_poll(client_net, nullptr);
+
+        /* UDP packets may get lost, so top up when nothing moves. */
+        if (sent == num_requests && client->responses == responses) {
+            sent = client->responses;
+        }
+    }
+}
+
+static void bench_store(Mono_Time *mono_time, Networking_Core *node_net, Networking_Core *client_net, const DHT *dht,
+                        Onion_Announce *onion_a, uint32_t capacity, uint32_t num_requests)
+{
+    if (!onion_announce_set_capacity(onion_a, capacity)) {
+        fprintf(stderr, "failed to set the capacity to %u\n", capacity);
+        exit(1);
+    }
+
+    Bench_Client client = {nullptr};
+    client.node_public_key = dht_get_self_public_key(dht);
+    client.num_keys = capacity * 2;
+    client.keys = (Bench_Key *)calloc(client.num_keys, sizeof(Bench_Key));
+
+    if (client.keys == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < client.num_keys; ++i) {
+        crypto_new_keypair(client.keys[i].public_key, client.keys[i].secret_key);
+    }
+
+    networking_registerhandler(client_net, NET_PACKET_ONION_RECV_3, &handle_recv_3, &client);
+
+    // The first requests only get the ping ids.
+    make_requests(&client);
+
+    while (client.ping_ids < client.num_keys) {
+        send_requests(mono_time, node_net, client_net, &client, client.num_keys);
+    }
+
+    make_requests(&client);
+
+    const clock_t start = clock();
+    send_requests(mono_time, node_net, client_net, &client, num_requests);
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%6u entries: %8u requests in %7.3f s CPU, %8.0f requests/s, %u stored\n", capacity, client.responses,
+           seconds, seconds > 0 ? client.responses / seconds : 0.0, onion_announce_num_entries(onion_a));
+
+    networking_registerhandler(client_net, NET_PACKET_ONION_RECV_3, nullptr, nullptr);
+    free(client.keys);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_requests = 100000;
+
+    if (argc > 1) {
+        num_requests = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Networking_Core *node_net = new_networking(log, ip, BENCH_NODE_PORT);
+    DHT *dht = node_net != nullptr ? new_dht(log, mono_time, node_net, true) : nullptr;
+    GC_Announces_List *gc_announces_list = new_gca_list();
+    Onion_Announce *onion_a = dht != nullptr ? new_onion_announce(mono_time, dht, gc_announces_list) : nullptr;
+    Networking_Core *client_net = new_networking(log, ip, BENCH_CLIENT_PORT);
+
+    if (onion_a == nullptr || client_net == nullptr) {
+        fprintf(stderr, "failed to start the node on ports %u and %u\n", BENCH_NODE_PORT, BENCH_CLIENT_PORT);
+        return 1;
+    }
+
+    bench_store(mono_time, node_net, client_net, dht, onion_a, ONION_ANNOUNCE_MAX_ENTRIES, num_requests);
+    bench_store(mono_time, node_net, client_net, dht, onion_a, 10000, num_requests);
+
+    kill_networking(client_net);
+    kill_onion_announce(onion_a);
+    kill_gca(gc_announces_list);
+    kill_dht(dht);
+    kill_networking(node_net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
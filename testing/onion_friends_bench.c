@@ -0,0 +1,240 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Onion client friend search benchmark
+ *
+ * Starts a small network of onion nodes on loopback and an onion client with
+ * 100, 1000 and 10000 friends that never come online, as a bot account would
+ * have. Time is simulated, one second per round, so that the client searches
+ * for its friends for minutes within seconds. Once the lists of nodes of the
+ * friends filled up, prints how much CPU time do_onion_client takes per run.
+ * Only that call is timed, not the nodes or the sockets.
+ *
+ * Usage: ./onion_friends_bench [warmup_seconds] [seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/mono_time.h"
+#include "../toxcore/onion_announce.h"
+#include "../toxcore/onion_client.h"
+
+#define BENCH_NODE_PORT 33562
+#define BENCH_CLIENT_PORT 33600
+#define BENCH_NODES 16
+
+/* Rounds of polling per simulated second, so that answers arrive within it. */
+#define BENCH_POLLS 3
+
+typedef struct Bench_Node {
+    Mono_Time *mono_time;
+    Networking_Core *net;
+    DHT *dht;
+    Onion *onion;
+    GC_Announces_List *gc_announces_list;
+    Onion_Announce *onion_a;
+} Bench_Node;
+
+typedef struct Bench_Client {
+    Mono_Time *mono_time;
+    Networking_Core *net;
+    DHT *dht;
+    Net_Crypto *c;
+    GC_Session gc_session;
+    Onion_Client *onion_c;
+} Bench_Client;
+
+static uint64_t current_time_ms;
+
+static uint64_t get_current_time(Mono_Time *mono_time, void *user_data)
+{
+    return current_time_ms;
+}
+
+static Mono_Time *new_bench_mono_time(void)
+{
+    Mono_Time *mono_time = mono_time_new();
+
+    if (mono_time == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    mono_time_set_current_time_callback(mono_time, &get_current_time, nullptr);
+    mono_time_update(mono_time);
+    return mono_time;
+}
+
+static void start_node(const Logger *log, Bench_Node *node, IP ip, uint16_t port)
+{
+    node->mono_time = new_bench_mono_time();
+    node->net = new_networking(log, ip, port);
+    node->dht = node->net != nullptr ? new_dht(log, node->mono_time, node->net, true) : nullptr;
+    node->onion = node->dht != nullptr ? new_onion(node->mono_time, node->dht) : nullptr;
+    node->gc_announces_list = new_gca_list();
+    node->onion_a = node->onion != nullptr ? new_onion_announce(node->mono_time, node->dht, node->gc_announces_list)
+                    : nullptr;
+
+    if (node->onion_a == nullptr) {
+        fprintf(stderr, "failed to start a node on port %u\n", port);
+        exit(1);
+    }
+}
+
+static void kill_node(Bench_Node *node)
+{
+    kill_onion_announce(node->onion_a);
+    kill_gca(node->gc_announces_list);
+    kill_onion(node->onion);
+    kill_dht(node->dht);
+    kill_networking(node->net);
+    mono_time_free(node->mono_time);
+}
+
+static void start_client(const Logger *log, Bench_Client *client, IP ip, const Bench_Node *nodes)
+{
+    memset(client, 0, sizeof(Bench_Client));
+    client->mono_time = new_bench_mono_time();
+    client->net = new_networking(log, ip, BENCH_CLIENT_PORT);
+    client->dht = client->net != nullptr ? new_dht(log, client->mono_time, client->net, true) : nullptr;
+
+    TCP_Proxy_Info proxy_info = {{{{0}}}};
+    client->c = client->dht != nullptr ? new_net_crypto(log, client->mono_time, client->dht, &proxy_info) : nullptr;
+    client->onion_c = client->c != nullptr ? new_onion_client(log, client->mono_time, client->c, &client->gc_session)
+                      : nullptr;
+
+    if (client->onion_c == nullptr) {
+        fprintf(stderr, "failed to start the client on port %u\n", BENCH_CLIENT_PORT);
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < BENCH_NODES; ++i) {
+        IP_Port ip_port = {ip, net_htons(BENCH_NODE_PORT + i)};
+        dht_bootstrap(client->dht, ip_port, dht_get_self_public_key(nodes[i].dht));
+    }
+}
+
+static void kill_client(Bench_Client *client)
+{
+    kill_onion_client(client->onion_c);
+    kill_net_crypto(client->c);
+    kill_dht(client->dht);
+    kill_networking(client->net);
+    mono_time_free(client->mono_time);
+}
+
+/* Simulate one second of the network, returning the CPU time do_onion_client
+ * of the client took. */
+static clock_t run_second(Bench_Node *nodes, Bench_Client *client)
+{
+    current_time_ms += 1000;
+    clock_t onion_client_time = 0;
+
+    for (uint32_t poll = 0; poll < BENCH_POLLS; ++poll) {
+        for (uint32_t i = 0; i < BENCH_NODES; ++i) {
+            mono_time_update(nodes[i].mono_time);
+            networking_poll(nodes[i].net, nullptr);
+            do_dht(nodes[i].dht);
+        }
+
+        mono_time_update(client->mono_time);
+        networking_poll(client->net, nullptr);
+        do_dht(client->dht);
+
+        const clock_t start = clock();
+        do_onion_client(client->onion_c);
+        onion_client_time += clock() - start;
+    }
+
+    return onion_client_time;
+}
+
+static void bench_friends(Bench_Node *nodes, const Logger *log, IP ip, uint32_t num_friends, uint32_t warmup_seconds,
+                          uint32_t seconds)
+{
+    Bench_Client client;
+    start_client(log, &client, ip, nodes);
+
+    for (uint32_t i = 0; i < num_friends; ++i) {
+        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(public_key, secret_key);
+
+        if (onion_addfriend(client.onion_c, public_key) == -1) {
+            fprintf(stderr, "failed to add friend %u\n", i);
+            exit(1);
+        }
+    }
+
+    for (uint32_t i = 0; i < warmup_seconds; ++i) {
+        run_second(nodes, &client);
+    }
+
+    clock_t total = 0;
+    uint32_t connected = 0;
+
+    for (uint32_t i = 0; i < seconds; ++i) {
+        total += run_second(nodes, &client);
+        connected += onion_connection_status(client.onion_c) != 0;
+    }
+
+    const double cpu_seconds = (double)total / CLOCKS_PER_SEC;
+
+    printf("%5u friends: %7.3f s CPU in do_onion_client over %u s, %9.1f us per second, connected for %u s\n",
+           num_friends, cpu_seconds, seconds, cpu_seconds * 1e6 / seconds, connected);
+
+    kill_client(&client);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t warmup_seconds = 60;
+    uint32_t seconds = 60;
+
+    if (argc > 1) {
+        warmup_seconds = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    if (argc > 2) {
+        seconds = (uint32_t)strtoul(argv[2], nullptr, 10);
+    }
+
+    if (seconds == 0) {
+        fprintf(stderr, "usage: %s [warmup_seconds] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    Logger *log = logger_new();
+    current_time_ms = 1000;
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Bench_Node nodes[BENCH_NODES];
+
+    for (uint32_t i = 0; i < BENCH_NODES; ++i) {
+        start_node(log, &nodes[i], ip, BENCH_NODE_PORT + i);
+    }
+
+    for (uint32_t i = 1; i < BENCH_NODES; ++i) {
+        IP_Port ip_port = {ip, net_htons(BENCH_NODE_PORT + i - 1)};
+        dht_bootstrap(nodes[i].dht, ip_port, dht_get_self_public_key(nodes[i - 1].dht));
+    }
+
+    const uint32_t friends[] = {100, 1000, 10000};
+
+    for (size_t i = 0; i < sizeof(friends) / sizeof(friends[0]); ++i) {
+        bench_friends(nodes, log, ip, friends[i], warmup_seconds, seconds);
+    }
+
+    for (uint32_t i = 0; i < BENCH_NODES; ++i) {
+        kill_node(&nodes[i]);
+    }
+
+    logger_kill(log);
+    return 0;
+}
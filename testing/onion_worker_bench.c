@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Onion worker benchmark
+ *
+ * Sends onion requests on loopback from several sources through a node that
+ * relays them, as the first node of their onion paths, to a node played by this
+ * benchmark. The relay first peels them in networking_poll and then on 1, 2 and
+ * 4 onion workers. Prints how many requests per second arrive in wall clock
+ * time, so the numbers only grow with the workers when there are enough cores
+ * for them. The requests are built before the clock starts.
+ *
+ * Usage: ./onion_worker_bench [num_packets]
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/mono_time.h"
+#include "../toxcore/onion.h"
+
+#define BENCH_RELAY_PORT 33552
+#define BENCH_NODE_PORT 33553
+#define BENCH_SOURCE_PORT 33554
+#define BENCH_SOURCES 8
+#define BENCH_DATA_SIZE 200
+#define BENCH_STALL_MS 1000
+
+/* Requests on their way at any time, small enough for the UDP socket buffers
+ * and the worker queues to take them all. */
+#define BENCH_IN_FLIGHT 128
+
+typedef struct Bench_Source {
+    Networking_Core *net;
+    uint8_t request[ONION_MAX_PACKET_SIZE];
+    uint16_t request_length;
+} Bench_Source;
+
+static uint64_t wall_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int handle_send_1(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    uint32_t *forwarded = (uint32_t *)object;
+    ++*forwarded;
+    return 0;
+}
+
+static void make_request(const DHT *dht, Bench_Source *source, IP_Port relay_ip_port, IP_Port node_ip_port)
+{
+    Node_format nodes[ONION_PATH_LENGTH];
+    memcpy(nodes[0].public_key, dht_get_self_public_key(dht), CRYPTO_PUBLIC_KEY_SIZE);
+    nodes[0].ip_port = relay_ip_port;
+
+    for (uint32_t i = 1; i < ONION_PATH_LENGTH; ++i) {
+        uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(nodes[i].public_key, secret_key);
+        nodes[i].ip_port = node_ip_port;
+    }
+
+    Onion_Path path;
+    create_onion_path(dht, &path, nodes);
+
+    uint8_t data[BENCH_DATA_SIZE] = {0};
+    const int length = create_onion_packet(source->request, sizeof(source->request), &path, node_ip_port, data,
+                                           sizeof(data));
+
+    if (length == -1) {
+        fprintf(stderr, "failed to create onion request\n");
+        exit(1);
+    }
+
+    source->request_length = length;
+}
+
+static void bench_workers(Mono_Time *mono_time, Networking_Core *relay_net, Onion *onion, Networking_Core *node_net,
+                          Bench_Source *sources, IP_Port relay_ip_port, uint32_t num_workers, uint32_t num_packets)
+{
+    if (!onion_set_workers(onion, num_workers)) {
+        fprintf(stderr, "failed to start %u onion workers\n", num_workers);
+        exit(1);
+    }
+
+    Onion_Stats before;
+    onion_get_stats(onion, &before);
+
+    uint32_t forwarded = 0;
+    networking_registerhandler(node_net, NET_PACKET_ONION_SEND_1, &handle_send_1, &forwarded);
+
+    uint32_t sent = 0;
+    uint32_t last_forwarded = 0;
+    uint64_t last_progress = wall_time_ms();
+
+    const uint64_t start = wall_time_ms();
+    const clock_t cpu_start = clock();
+
+    while (forwarded < num_packets) {
+        while (sent < num_packets && sent - forwarded < BENCH_IN_FLIGHT) {
+            const Bench_Source *source = &sources[sent % BENCH_SOURCES];
+            sendpacket(source->net, relay_ip_port, source->request, source->request_length);
+            ++sent;
+        }
+
+        mono_time_update(mono_time);
+        networking_poll(relay_net, nullptr);
+        networking_poll(node_net, nullptr);
+
+        const uint64_t now = wall_time_ms();
+
+        if (forwarded != last_forwarded) {
+            last_forwarded = forwarded;
+            last_progress = now;
+        } else if (now - last_progress > BENCH_STALL_MS) {
+            /* UDP packets may get lost, so top up when nothing moves. */
+            sent = forwarded;
+            last_progress = now;
+        }
+    }
+
+    const double seconds = (double)(wall_time_ms() - start) / 1000;
+    const double cpu_seconds = (double)(clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    Onion_Stats after;
+    onion_get_stats(onion, &after);
+
+    if (num_workers == 0) {
+        printf("no workers: ");
+    } else {
+        printf("%u workers:  ", num_workers);
+    }
+
+    printf("%8u forwarded in %7.3f s (%7.3f s CPU), %8.0f packets/s, %llu dropped\n", forwarded, seconds,
+           cpu_seconds, seconds > 0 ? forwarded / seconds : 0.0,
+           (unsigned long long)(after.dropped - before.dropped));
+
+    networking_registerhandler(node_net, NET_PACKET_ONION_SEND_1, nullptr, nullptr);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_packets = 100000;
+
+    if (argc > 1) {
+        num_packets = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Networking_Core *relay_net = new_networking(log, ip, BENCH_RELAY_PORT);
+    DHT *dht = relay_net != nullptr ? new_dht(log, mono_time, relay_net, true) : nullptr;
+    Onion *onion = dht != nullptr ? new_onion(mono_time, dht) : nullptr;
+    Networking_Core *node_net = new_networking(log, ip, BENCH_NODE_PORT);
+
+    if (onion == nullptr || node_net == nullptr) {
+        fprintf(stderr, "failed to start the relay on ports %u and %u\n", BENCH_RELAY_PORT, BENCH_NODE_PORT);
+        return 1;
+    }
+
+    IP_Port relay_ip_port;
+    relay_ip_port.ip = ip;
+    relay_ip_port.port = net_htons(BENCH_RELAY_PORT);
+
+    IP_Port node_ip_port;
+    node_ip_port.ip = ip;
+    node_ip_port.port = net_htons(BENCH_NODE_PORT);
+
+    Bench_Source sources[BENCH_SOURCES];
+
+    for (uint32_t i = 0; i < BENCH_SOURCES; ++i) {
+        sources[i].net = new_networking(log, ip, BENCH_SOURCE_PORT + i);
+
+        if (sources[i].net == nullptr) {
+            fprintf(stderr, "failed to open source port %u\n", BENCH_SOURCE_PORT + i);
+            return 1;
+        }
+
+        make_request(dht, &sources[i], relay_ip_port, node_ip_port);
+    }
+
+    printf("%u sources, %u requests of %u bytes\n", BENCH_SOURCES, num_packets, sources[0].request_length);
+
+    const uint32_t workers[] = {0, 1, 2, 4};
+
+    for (size_t i = 0; i < sizeof(workers) / sizeof(workers[0]); ++i) {
+        bench_workers(mono_time, relay_net, onion, node_net, sources, relay_ip_port, workers[i], num_packets);
+    }
+
+    for (uint32_t i = 0; i < BENCH_SOURCES; ++i) {
+        kill_networking(sources[i].net);
+    }
+
+    kill_networking(node_net);
+    kill_onion(onion);
+    kill_dht(dht);
+    kill_networking(relay_net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
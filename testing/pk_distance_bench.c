@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Public key distance benchmark
+ *
+ * Compares the distances of random keys to a target a byte (and a bit) at a
+ * time, the way the DHT used to, and with the word at a time functions of
+ * pk_distance.h, for keys that share 0, 2, 8 and 20 bytes with the target:
+ * the nodes of the DHT close to a key share longer prefixes with it the bigger
+ * the network is. Also finds which of 8 keys 80 bytes apart, like the nodes of
+ * a client list, are closer to the target than a bound, one key at a time and
+ * with pk_closer_than. Prints the average time of each comparison.
+ *
+ * Usage: ./pk_distance_bench [num_ops]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/pk_distance.h"
+
+#define BENCH_KEYS 1024
+#define BENCH_LIST 8
+#define BENCH_STRIDE 80
+
+static int bytewise_closest(const uint8_t *pk, const uint8_t *pk1, const uint8_t *pk2)
+{
+    for (size_t i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; ++i) {
+        const uint8_t distance1 = pk[i] ^ pk1[i];
+        const uint8_t distance2 = pk[i] ^ pk2[i];
+
+        if (distance1 < distance2) {
+            return 1;
+        }
+
+        if (distance1 > distance2) {
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+static unsigned int bitwise_common_prefix(const uint8_t *pk1, const uint8_t *pk2)
+{
+    unsigned int i;
+    unsigned int j = 0;
+
+    for (i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; ++i) {
+        if (pk1[i] == pk2[i]) {
+            continue;
+        }
+
+        for (j = 0; j < 8; ++j) {
+            const uint8_t mask = 1 << (7 - j);
+
+            if ((pk1[i] & mask) != (pk2[i] & mask)) {
+                break;
+            }
+        }
+
+        break;
+    }
+
+    return i * 8 + j;
+}
+
+static double ns_per_op(clock_t ticks, uint32_t num_ops)
+{
+    return (double)ticks / CLOCKS_PER_SEC * 1e9 / num_ops;
+}
+
+/* Keep the compiler from dropping the results, and from inlining the byte at
+ * a time functions of this file into the loops, which it can't do with the
+ * ones of pk_distance.c either.
+ */
+static volatile uint32_t sink;
+
+typedef int closest_cb(const uint8_t *pk, const uint8_t *pk1, const uint8_t *pk2);
+typedef unsigned int common_prefix_cb(const uint8_t *pk1, const uint8_t *pk2);
+
+static closest_cb *volatile bytewise_closest_fn = bytewise_closest;
+static common_prefix_cb *volatile bitwise_common_prefix_fn = bitwise_common_prefix;
+
+static void bench_prefix(const uint8_t *target, uint8_t *keys, uint32_t prefix_bytes, uint32_t num_ops)
+{
+    for (uint32_t i = 0; i < BENCH_KEYS; ++i) {
+        random_bytes(&keys[i * CRYPTO_PUBLIC_KEY_SIZE], CRYPTO_PUBLIC_KEY_SIZE);
+        memcpy(&keys[i * CRYPTO_PUBLIC_KEY_SIZE], target, prefix_bytes);
+    }
+
+    closest_cb *const closest = bytewise_closest_fn;
+    common_prefix_cb *const common_prefix = bitwise_common_prefix_fn;
+    uint32_t result = 0;
+    clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_ops; ++i) {
+        result += closest(target, &keys[(i % BENCH_KEYS) * CRYPTO_PUBLIC_KEY_SIZE],
+                          &keys[((i + 1) % BENCH_KEYS) * CRYPTO_PUBLIC_KEY_SIZE]);
+    }
+
+    const clock_t bytewise = clock() - start;
+    start = clock();
+
+    for (uint32_t i = 0; i < num_ops; ++i) {
+        result += pk_closest(target, &keys[(i % BENCH_KEYS) * CRYPTO_PUBLIC_KEY_SIZE],
+                             &keys[((i + 1) % BENCH_KEYS) * CRYPTO_PUBLIC_KEY_SIZE]);
+    }
+
+    const clock_t wordwise = clock() - start;
+    start = clock();
+
+    for (uint32_t i = 0; i < num_ops; ++i) {
+        result += common_prefix(target, &keys[(i % BENCH_KEYS) * CRYPTO_PUBLIC_KEY_SIZE]);
+    }
+
+    const clock_t bitwise_prefix = clock() - start;
+    start = clock();
+
+    for (uint32_t i = 0; i < num_ops; ++i) {
+        result += pk_common_prefix(target, &keys[(i % BENCH_KEYS) * CRYPTO_PUBLIC_KEY_SIZE]);
+    }
+
+    const clock_t clz_prefix = clock() - start;
+    sink = result;
+
+    printf("%2u byte prefix: closest %6.2f ns bytewise, %6.2f ns pk_closest; "
+           "common prefix %6.2f ns bitwise, %6.2f ns pk_common_prefix\n",
+           prefix_bytes, ns_per_op(bytewise, num_ops), ns_per_op(wordwise, num_ops),
+           ns_per_op(bitwise_prefix, num_ops), ns_per_op(clz_prefix, num_ops));
+}
+
+static void bench_batch(const uint8_t *target, uint32_t num_ops)
+{
+    uint8_t *lists = (uint8_t *)calloc(BENCH_KEYS, BENCH_LIST * BENCH_STRIDE);
+    Pk_Distance *bounds = (Pk_Distance *)calloc(BENCH_KEYS, sizeof(Pk_Distance));
+
+    if (lists == nullptr || bounds == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < BENCH_KEYS; ++i) {
+        for (uint32_t j = 0; j < BENCH_LIST; ++j) {
+            uint8_t *key = &lists[(i * BENCH_LIST + j) * BENCH_STRIDE];
+            random_bytes(key, CRYPTO_PUBLIC_KEY_SIZE);
+            memcpy(key, target, 2);
+        }
+
+        uint8_t bound_key[CRYPTO_PUBLIC_KEY_SIZE];
+        random_bytes(bound_key, sizeof(bound_key));
+        memcpy(bound_key, target, 2);
+        pk_distance(&bounds[i], target, bound_key);
+    }
+
+    const uint32_t num_lists = num_ops / BENCH_LIST;
+    uint32_t result = 0;
+    clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_lists; ++i) {
+        const uint8_t *list = &lists[(i % BENCH_KEYS) * BENCH_LIST * BENCH_STRIDE];
+        uint32_t closer = 0;
+
+        for (uint32_t j = 0; j < BENCH_LIST; ++j) {
+            Pk_Distance distance;
+            pk_distance(&distance, target, &list[j * BENCH_STRIDE]);
+
+            if (pk_distance_cmp(&distance, &bounds[i % BENCH_KEYS]) < 0) {
+                closer |= UINT32_C(1) << j;
+            }
+        }
+
+        result += closer;
+    }
+
+    const clock_t one_by_one = clock() - start;
+    start = clock();
+
+    for (uint32_t i = 0; i < num_lists; ++i) {
+        result += pk_closer_than(target, &bounds[i % BENCH_KEYS], &lists[(i % BENCH_KEYS) * BENCH_LIST * BENCH_STRIDE],
+                                 BENCH_STRIDE, BENCH_LIST);
+    }
+
+    const clock_t batch = clock() - start;
+    sink = result;
+
+    printf("closer than a bound, %u keys at a time: %6.2f ns a key one by one, %6.2f ns pk_closer_than\n",
+           BENCH_LIST, ns_per_op(one_by_one, num_lists * BENCH_LIST), ns_per_op(batch, num_lists * BENCH_LIST));
+
+    free(bounds);
+    free(lists);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_ops = 10000000;
+
+    if (argc > 1) {
+        num_ops = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    if (num_ops < BENCH_LIST) {
+        fprintf(stderr, "usage: %s [num_ops]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t target[CRYPTO_PUBLIC_KEY_SIZE];
+    random_bytes(target, sizeof(target));
+
+    uint8_t *keys = (uint8_t *)malloc(BENCH_KEYS * CRYPTO_PUBLIC_KEY_SIZE);
+
+    if (keys == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    const uint32_t prefixes[] = {0, 2, 8, 20};
+
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+        bench_prefix(target, keys, prefixes[i], num_ops);
+    }
+
+    bench_batch(target, num_ops);
+
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* DHT shared key cache benchmark
+ *
+ * Replays the request pattern of a busy bootstrap node against shared key
+ * caches of several sizes and prints their hit rates. Request sources follow a
+ * Zipf distribution: a few hundred well connected DHT nodes send most of the
+ * packets while a long tail of clients is only seen a handful of times.
+ *
+ * Usage: ./shared_keys_bench [num_requests] [num_peers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/mono_time.h"
+
+/* Pick a peer index in [0, num_peers) with probability proportional to 1 / (index + 1). */
+static uint32_t zipf_peer(const double *cdf, uint32_t num_peers)
+{
+    const double r = (double)random_u32() / UINT32_MAX;
+    uint32_t lo = 0;
+    uint32_t hi = num_peers - 1;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+
+        if (cdf[mid] < r) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_requests = 200000;
+    uint32_t num_peers = 50000;
+
+    if (argc > 1) {
+        num_requests = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    if (argc > 2) {
+        num_peers = (uint32_t)strtoul(argv[2], nullptr, 10);
+    }
+
+    if (num_requests == 0 || num_peers == 0) {
+        fprintf(stderr, "usage: %s [num_requests] [num_peers]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t *public_keys = (uint8_t *)malloc((size_t)num_peers * CRYPTO_PUBLIC_KEY_SIZE);
+    double *cdf = (double *)malloc(num_peers * sizeof(double));
+    uint32_t *requests = (uint32_t *)malloc(num_requests * sizeof(uint32_t));
+
+    if (public_keys == nullptr || cdf == nullptr || requests == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(self_public_key, self_secret_key);
+
+    double total = 0;
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        crypto_new_keypair(public_keys + (size_t)i * CRYPTO_PUBLIC_KEY_SIZE, secret_key);
+        total += 1.0 / (i + 1);
+        cdf[i] = total;
+    }
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        cdf[i] /= total;
+    }
+
+    uint32_t distinct = 0;
+    uint8_t *seen = (uint8_t *)calloc(num_peers, 1);
+
+    for (uint32_t i = 0; i < num_requests; ++i) {
+        requests[i] = zipf_peer(cdf, num_peers);
+
+        if (seen != nullptr && !seen[requests[i]]) {
+            seen[requests[i]] = 1;
+            ++distinct;
+        }
+    }
+
+    free(seen);
+
+    printf("%u requests from %u distinct peers\n", num_requests, distinct);
+
+    Mono_Time *mono_time = mono_time_new();
+    const uint32_t capacities[] = {256, 1024, 4096, 16384};
+
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); ++c) {
+        Shared_Keys *shared_keys = shared_keys_new(capacities[c]);
+
+        if (shared_keys == nullptr) {
+            fprintf(stderr, "failed to create cache of %u keys\n", capacities[c]);
+            return 1;
+        }
+
+        uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+        const clock_t start = clock();
+
+        for (uint32_t i = 0; i < num_requests; ++i) {
+            get_shared_key(mono_time, shared_keys, shared_key, self_secret_key,
+                           public_keys + (size_t)requests[i] * CRYPTO_PUBLIC_KEY_SIZE);
+        }
+
+        const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        Shared_Keys_Stats stats;
+        shared_keys_get_stats(shared_keys, &stats);
+
+        printf("capacity %6u: hit rate %5.1f%%, %8llu misses, %8llu evictions, %7.3f s CPU\n", capacities[c],
+               100.0 * stats.hits / num_requests, (unsigned long long)stats.misses,
+               (unsigned long long)stats.evictions, seconds);
+
+        shared_keys_free(shared_keys);
+    }
+
+    mono_time_free(mono_time);
+    free(requests);
+    free(cdf);
+    free(public_keys);
+    return 0;
+}
@@ -0,0 +1,178 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* TCP relay handshake benchmark
+ *
+ * Simulates the reconnect storm that follows a relay restart: many clients
+ * connect to a TCP relay server on loopback at once, each sends its handshake
+ * and hangs up as soon as the server answered it. Prints how many handshakes
+ * per second the server answers, once on a freshly started server and once
+ * more right after, when the session keypairs it made ahead of time are used
+ * up. The clients build their handshakes before the clock starts, so the CPU
+ * time is spent on the server side and on the sockets.
+ *
+ * Usage: ./tcp_handshake_bench [num_clients]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/TCP_server.h"
+#include "../toxcore/mono_time.h"
+
+#define BENCH_PORT 33546
+
+/* Clients connecting at the same time, below the incoming queue of the server
+ * so that it does not drop any of them. */
+#define BENCH_IN_FLIGHT (MAX_INCOMING_CONNECTIONS / 2)
+
+typedef struct Bench_Client {
+    Socket sock;
+    bool sent;
+    uint16_t received;
+    uint8_t handshake[TCP_CLIENT_HANDSHAKE_SIZE];
+} Bench_Client;
+
+static void make_handshake(uint8_t *handshake, const uint8_t *server_public_key)
+{
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(public_key, secret_key);
+
+    uint8_t plain[TCP_HANDSHAKE_PLAIN_SIZE];
+    uint8_t temp_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(plain, temp_secret_key);
+    random_nonce(plain + CRYPTO_PUBLIC_KEY_SIZE);
+
+    memcpy(handshake, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    random_nonce(handshake + CRYPTO_PUBLIC_KEY_SIZE);
+    encrypt_data(server_public_key, secret_key, handshake + CRYPTO_PUBLIC_KEY_SIZE, plain, sizeof(plain),
+                 handshake + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE);
+}
+
+static bool connect_client(Bench_Client *client, IP_Port ip_port)
+{
+    client->sock = net_socket(net_family_ipv4, TOX_SOCK_STREAM, TOX_PROTO_TCP);
+
+    if (!sock_valid(client->sock) || !set_socket_nonblock(client->sock)) {
+        return false;
+    }
+
+    net_connect(client->sock, ip_port);
+    client->sent = false;
+    client->received = 0;
+    return true;
+}
+
+/* return true once the server answered the handshake of the client.
+ */
+static bool do_client(Bench_Client *client)
+{
+    if (!client->sent) {
+        client->sent = net_send(client->sock, client->handshake, TCP_CLIENT_HANDSHAKE_SIZE) == TCP_CLIENT_HANDSHAKE_SIZE;
+        return false;
+    }
+
+    uint8_t response[TCP_SERVER_HANDSHAKE_SIZE];
+    const int len = net_recv(client->sock, response, TCP_SERVER_HANDSHAKE_SIZE - client->received);
+
+    if (len > 0) {
+        client->received += len;
+    }
+
+    return client->received == TCP_SERVER_HANDSHAKE_SIZE;
+}
+
+static void bench_storm(const char *name, TCP_Server *server, Mono_Time *mono_time, Bench_Client *clients,
+                        uint32_t num_clients)
+{
+    IP_Port ip_port;
+    ip_init(&ip_port.ip, false);
+    ip_port.ip.ip.v4 = get_ip4_loopback();
+    ip_port.port = net_htons(BENCH_PORT);
+
+    Bench_Client *in_flight[BENCH_IN_FLIGHT];
+    uint32_t num_in_flight = 0;
+    uint32_t next = 0;
+    uint32_t answered = 0;
+
+    const clock_t start = clock();
+
+    while (answered < num_clients) {
+        while (num_in_flight < BENCH_IN_FLIGHT && next < num_clients) {
+            if (!connect_client(&clients[next], ip_port)) {
+                fprintf(stderr, "failed to connect client %u\n", next);
+                exit(1);
+            }
+
+            in_flight[num_in_flight] = &clients[next];
+            ++num_in_flight;
+            ++next;
+        }
+
+        mono_time_update(mono_time);
+        do_TCP_server(server, mono_time);
+
+        for (uint32_t i = 0; i < num_in_flight;) {
+            if (do_client(in_flight[i])) {
+                kill_sock(in_flight[i]->sock);
+                ++answered;
+                --num_in_flight;
+                in_flight[i] = in_flight[num_in_flight];
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%-14s %6u handshakes in %7.3f s CPU, %8.0f handshakes/s\n", name, answered, seconds,
+           seconds > 0 ? answered / seconds : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_clients = 10000;
+
+    if (argc > 1) {
+        num_clients = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    uint8_t server_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t server_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(server_public_key, server_secret_key);
+
+    Bench_Client *clients = (Bench_Client *)calloc(num_clients, sizeof(Bench_Client));
+
+    if (clients == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < num_clients; ++i) {
+        make_handshake(clients[i].handshake, server_public_key);
+    }
+
+    const uint16_t port = BENCH_PORT;
+    TCP_Server *server = new_TCP_server(log, false, 1, &port, server_secret_key, nullptr);
+
+    if (server == nullptr) {
+        fprintf(stderr, "failed to start TCP server on port %u\n", port);
+        return 1;
+    }
+
+    bench_storm("after restart:", server, mono_time, clients, num_clients);
+    bench_storm("back to back:", server, mono_time, clients, num_clients);
+
+    kill_TCP_server(server);
+    free(clients);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
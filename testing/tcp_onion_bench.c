@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* TCP relay onion forwarding benchmark
+ *
+ * Connects a TCP client to a TCP relay server that runs an onion on loopback.
+ * The client sends onion requests through the relay, which passes them on over
+ * UDP to a node played by this benchmark. That node then sends onion responses
+ * back through the relay to the client. Prints how many onion packets per
+ * second the relay passes on in each direction, for small and for large
+ * packets. Everything runs in this process, so the CPU time covers the client,
+ * the relay and the UDP node.
+ *
+ * Usage: ./tcp_onion_bench [num_packets]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/TCP_client.h"
+#include "../toxcore/TCP_server.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/onion.h"
+
+#define BENCH_TCP_PORT 33547
+#define BENCH_RELAY_PORT 33548
+#define BENCH_NODE_PORT 33549
+#define BENCH_SETUP_ROUNDS 100000
+
+/* Packets sent before letting the relay catch up, small enough for the UDP
+ * socket buffers to take them all. */
+#define BENCH_BATCH 64
+
+typedef struct Bench_Node {
+    uint32_t forwarded;
+    uint8_t ret[ONION_RETURN_1];
+    bool have_ret;
+} Bench_Node;
+
+static int handle_send_1(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    Bench_Node *node = (Bench_Node *)object;
+
+    if (length <= ONION_RETURN_1) {
+        return 1;
+    }
+
+    memcpy(node->ret, packet + length - ONION_RETURN_1, ONION_RETURN_1);
+    node->have_ret = true;
+    ++node->forwarded;
+    return 0;
+}
+
+static int handle_onion_response(void *object, const uint8_t *data, uint16_t length, void *userdata)
+{
+    uint32_t *received = (uint32_t *)object;
+    ++*received;
+    return 0;
+}
+
+typedef struct Bench_Relay {
+    Networking_Core *net;
+    DHT *dht;
+    Onion *onion;
+    TCP_Server *server;
+} Bench_Relay;
+
+static void run_all(const Logger *log, Mono_Time *mono_time, Bench_Relay *relay, TCP_Client_Connection *client,
+                    Networking_Core *node_net)
+{
+    mono_time_update(mono_time);
+    do_TCP_connection(log, mono_time, client, nullptr);
+    networking_poll(relay->net, nullptr);
+    do_TCP_server(relay->server, mono_time);
+    networking_poll(node_net, nullptr);
+    do_TCP_connection(log, mono_time, client, nullptr);
+}
+
+static void bench_onion(const Logger *log, Mono_Time *mono_time, Bench_Relay *relay, TCP_Client_Connection *client,
+                        Networking_Core *node_net, Bench_Node *node, uint32_t num_packets, uint16_t data_size)
+{
+    Node_format nodes[ONION_PATH_LENGTH];
+    memcpy(nodes[0].public_key, dht_get_self_public_key(relay->dht), CRYPTO_PUBLIC_KEY_SIZE);
+    ip_init(&nodes[0].ip_port.ip, false);
+    nodes[0].ip_port.ip.ip.v4 = get_ip4_loopback();
+    nodes[0].ip_port.port = net_htons(BENCH_RELAY_PORT);
+
+    for (uint32_t i = 1; i < ONION_PATH_LENGTH; ++i) {
+        uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(nodes[i].public_key, secret_key);
+        nodes[i].ip_port = nodes[0].ip_port;
+        nodes[i].ip_port.port = net_htons(BENCH_NODE_PORT);
+    }
+
+    Onion_Path path;
+    create_onion_path(relay->dht, &path, nodes);
+
+    uint8_t *data = (uint8_t *)calloc(1, data_size);
+    uint8_t request[ONION_MAX_PACKET_SIZE];
+
+    if (data == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    const int request_length = create_onion_packet_tcp(request, sizeof(request), &path, nodes[2].ip_port, data,
+                               data_size);
+
+    if (request_length == -1) {
+        fprintf(stderr, "failed to create onion request of %u bytes\n", data_size);
+        exit(1);
+    }
+
+    node->forwarded = 0;
+    uint32_t sent = 0;
+    clock_t start = clock();
+
+    while (node->forwarded < num_packets) {
+        for (uint32_t i = 0; i < BENCH_BATCH && sent < num_packets; ++i) {
+            if (send_onion_request(client, request, request_length) != 1) {
+                break;
+            }
+
+            ++sent;
+        }
+
+        const uint32_t forwarded = node->forwarded;
+        run_all(log, mono_time, relay, client, node_net);
+
+        /* UDP packets may get lost, so top up when nothing moves. */
+        if (sent == num_packets && node->forwarded == forwarded) {
+            sent = node->forwarded;
+        }
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%4u byte requests:  %8u forwarded in %7.3f s CPU, %10.0f packets/s\n", data_size, node->forwarded,
+           seconds, seconds > 0 ? node->forwarded / seconds : 0.0);
+
+    if (!node->have_ret) {
+        fprintf(stderr, "no onion request arrived\n");
+        exit(1);
+    }
+
+    const uint16_t response_length = 1 + ONION_RETURN_1 + data_size;
+    uint8_t *response = (uint8_t *)calloc(1, response_length);
+
+    if (response == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    response[0] = NET_PACKET_ONION_RECV_1;
+    memcpy(response + 1, node->ret, ONION_RETURN_1);
+    response[1 + ONION_RETURN_1] = NET_PACKET_ANNOUNCE_RESPONSE;
+
+    uint32_t received = 0;
+    onion_response_handler(client, &handle_onion_response, &received);
+
+    sent = 0;
+    start = clock();
+
+    while (received < num_packets) {
+        for (uint32_t i = 0; i < BENCH_BATCH && sent < num_packets; ++i) {
+            sendpacket(node_net, nodes[0].ip_port, response, response_length);
+            ++sent;
+        }
+
+        const uint32_t before = received;
+        run_all(log, mono_time, relay, client, node_net);
+
+        if (sent == num_packets && received == before) {
+            sent = received;
+        }
+    }
+
+    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%4u byte responses: %8u passed back in %7.3f s CPU, %10.0f packets/s\n", data_size, received, seconds,
+           seconds > 0 ? received / seconds : 0.0);
+
+    free(response);
+    free(data);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_packets = 200000;
+
+    if (argc > 1) {
+        num_packets = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Bench_Relay relay;
+    relay.net = new_networking(log, ip, BENCH_RELAY_PORT);
+    relay.dht = relay.net != nullptr ? new_dht(log, mono_time, relay.net, true) : nullptr;
+    relay.onion = relay.dht != nullptr ? new_onion(mono_time, relay.dht) : nullptr;
+
+    const uint16_t tcp_port = BENCH_TCP_PORT;
+    relay.server = relay.onion != nullptr
+                   ? new_TCP_server(log, false, 1, &tcp_port, dht_get_self_secret_key(relay.dht), relay.onion)
+                   : nullptr;
+
+    Networking_Core *node_net = new_networking(log, ip, BENCH_NODE_PORT);
+
+    if (relay.server == nullptr || node_net == nullptr) {
+        fprintf(stderr, "failed to start the relay on ports %u and %u\n", BENCH_TCP_PORT, BENCH_RELAY_PORT);
+        return 1;
+    }
+
+    Bench_Node node = {0};
+    networking_registerhandler(node_net, NET_PACKET_ONION_SEND_1, &handle_send_1, &node);
+
+    IP_Port server_ip_port;
+    server_ip_port.ip = ip;
+    server_ip_port.port = net_htons(BENCH_TCP_PORT);
+
+    uint8_t client_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t client_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(client_public_key, client_secret_key);
+    TCP_Client_Connection *client = new_TCP_connection(mono_time, server_ip_port, tcp_server_public_key(relay.server),
+                                    client_public_key, client_secret_key, nullptr);
+
+    if (client == nullptr) {
+        fprintf(stderr, "failed to connect the client\n");
+        return 1;
+    }
+
+    for (uint32_t round = 0; round < BENCH_SETUP_ROUNDS && tcp_con_status(client) != TCP_CLIENT_CONFIRMED; ++round) {
+        run_all(log, mono_time, &relay, client, node_net);
+    }
+
+    if (tcp_con_status(client) != TCP_CLIENT_CONFIRMED) {
+        fprintf(stderr, "client did not get confirmed\n");
+        return 1;
+    }
+
+    bench_onion(log, mono_time, &relay, client, node_net, &node, num_packets, 100);
+    bench_onion(log, mono_time, &relay, client, node_net, &node, num_packets, 1000);
+
+    kill_TCP_connection(client);
+    kill_networking(node_net);
+    kill_TCP_server(relay.server);
+    kill_onion(relay.onion);
+    kill_dht(relay.dht);
+    kill_networking(relay.net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
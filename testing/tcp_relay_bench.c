@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* TCP relay throughput benchmark
+ *
+ * Connects two TCP clients to a TCP relay server on loopback, routes them to
+ * each other and has one of them send data packets to the other through the
+ * relay as fast as the sockets accept them. Prints how many packets per second
+ * arrive, for small and for large packets. The relay and both clients run in
+ * this process, so the CPU time covers both ends and the relay.
+ *
+ * Usage: ./tcp_relay_bench [num_packets]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/TCP_client.h"
+#include "../toxcore/TCP_server.h"
+#include "../toxcore/mono_time.h"
+
+#define BENCH_PORT 33545
+#define BENCH_SETUP_ROUNDS 100000
+
+typedef struct Bench_Client {
+    TCP_Client_Connection *con;
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+    uint8_t connection_id;
+    bool online;
+    uint32_t received;
+} Bench_Client;
+
+static int handle_response(void *object, uint8_t connection_id, const uint8_t *public_key)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    client->connection_id = connection_id;
+    return 0;
+}
+
+static int handle_status(void *object, uint32_t number, uint8_t connection_id, uint8_t status)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    client->online = status == 2;
+    return 0;
+}
+
+static int handle_data(void *object, uint32_t number, uint8_t connection_id, const uint8_t *data, uint16_t length,
+                       void *userdata)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    ++client->received;
+    return 0;
+}
+
+static void run_all(const Logger *log, Mono_Time *mono_time, TCP_Server *server, Bench_Client *clients)
+{
+    mono_time_update(mono_time);
+    do_TCP_connection(log, mono_time, clients[0].con, nullptr);
+    do_TCP_server(server, mono_time);
+    do_TCP_connection(log, mono_time, clients[1].con, nullptr);
+}
+
+static void bench_relay(const Logger *log, Mono_Time *mono_time, uint32_t num_packets, uint16_t packet_size)
+{
+    uint8_t server_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t server_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(server_public_key, server_secret_key);
+
+    const uint16_t port = BENCH_PORT;
+    TCP_Server *server = new_TCP_server(log, false, 1, &port, server_secret_key, nullptr);
+
+    if (server == nullptr) {
+        fprintf(stderr, "failed to start TCP server on port %u\n", port);
+        exit(1);
+    }
+
+    IP_Port ip_port;
+    ip_init(&ip_port.ip, false);
+    ip_port.ip.ip.v4 = get_ip4_loopback();
+    ip_port.port = net_htons(port);
+
+    Bench_Client clients[2];
+    memset(clients, 0, sizeof(clients));
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        crypto_new_keypair(clients[i].public_key, clients[i].secret_key);
+        clients[i].con = new_TCP_connection(mono_time, ip_port, server_public_key, clients[i].public_key,
+                                            clients[i].secret_key, nullptr);
+
+        if (clients[i].con == nullptr) {
+            fprintf(stderr, "failed to connect client %u\n", i);
+            exit(1);
+        }
+
+        routing_response_handler(clients[i].con, &handle_response, &clients[i]);
+        routing_status_handler(clients[i].con, &handle_status, &clients[i]);
+        routing_data_handler(clients[i].con, &handle_data, &clients[i]);
+    }
+
+    bool requested = false;
+
+    for (uint32_t round = 0; round < BENCH_SETUP_ROUNDS && !(clients[0].online && clients[1].online); ++round) {
+        run_all(log, mono_time, server, clients);
+
+        if (!requested && tcp_con_status(clients[0].con) == TCP_CLIENT_CONFIRMED
+                && tcp_con_status(clients[1].con) == TCP_CLIENT_CONFIRMED) {
+            send_routing_request(clients[0].con, clients[1].public_key);
+            send_routing_request(clients[1].con, clients[0].public_key);
+            requested = true;
+        }
+    }
+
+    if (!clients[0].online || !clients[1].online) {
+        fprintf(stderr, "clients did not get routed to each other\n");
+        exit(1);
+    }
+
+    uint8_t *packet = (uint8_t *)calloc(1, packet_size);
+
+    if (packet == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    uint32_t sent = 0;
+    const clock_t start = clock();
+
+    while (clients[1].received < num_packets) {
+        while (sent < num_packets && send_data(clients[0].con, clients[0].connection_id, packet, packet_size) == 1) {
+            ++sent;
+        }
+
+        const uint32_t received = clients[1].received;
+        run_all(log, mono_time, server, clients);
+
+        /* The relay drops packets it cannot pass on, so top up when nothing moves. */
+        if (sent == num_packets && clients[1].received == received) {
+            sent = clients[1].received;
+        }
+    }
+
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%4u byte packets: %8u relayed in %7.3f s CPU, %10.0f packets/s\n", packet_size, clients[1].received,
+           seconds, seconds > 0 ? clients[1].received / seconds : 0.0);
+
+    free(packet);
+    kill_TCP_connection(clients[1].con);
+    kill_TCP_connection(clients[0].con);
+    kill_TCP_server(server);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_packets = 200000;
+
+    if (argc > 1) {
+        num_packets = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+
+    bench_relay(log, mono_time, num_packets, 64);
+    bench_relay(log, mono_time, num_packets, 1024);
+
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
@@ -0,0 +1,397 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* TCP relay worker scaling benchmark
+ *
+ * Connects pairs of TCP clients to a TCP relay server on loopback, routes the
+ * clients of each pair to each other and has one of them send data packets to
+ * the other through the relay. The clients are run by several threads, the
+ * relay first by a single thread calling do_TCP_server and then by 1, 2, 4 and
+ * 8 workers. Since the kernel spreads connections over the workers, most pairs
+ * are routed between two workers. Prints how many packets per second arrive in
+ * wall clock time, so the numbers only grow with the workers when there are
+ * enough cores for them and the client threads. Workers need epoll, so only the
+ * single thread runs elsewhere.
+ *
+ * Usage: ./tcp_relay_scaling_bench [num_packets] [num_pairs]
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/TCP_client.h"
+#include "../toxcore/TCP_server.h"
+#include "../toxcore/mono_time.h"
+
+#define BENCH_PORT 33546
+#define BENCH_PACKET_SIZE 256
+#define BENCH_CLIENT_THREADS 4
+#define BENCH_MAX_SOCKETS 1024
+#define BENCH_SETUP_SECONDS 30
+#define BENCH_STALL_MS 1000
+
+typedef struct Bench_Client {
+    TCP_Client_Connection *con;
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+    uint8_t connection_id;
+    bool online;
+    uint32_t received;
+} Bench_Client;
+
+typedef struct Bench_Pair {
+    Bench_Client clients[2];
+    uint32_t sent;
+    uint32_t last_received;
+    uint64_t last_progress;
+} Bench_Pair;
+
+typedef struct Bench_Thread {
+    pthread_t thread;
+    const Logger *log;
+    Mono_Time *mono_time;
+    Bench_Pair *pairs;
+    uint32_t num_pairs;
+    uint32_t num_packets;
+} Bench_Thread;
+
+typedef struct Bench_Server {
+    pthread_t thread;
+    TCP_Server *server;
+    Mono_Time *mono_time;
+    pthread_mutex_t mutex;
+    bool stopping;
+} Bench_Server;
+
+static uint64_t wall_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int handle_response(void *object, uint8_t connection_id, const uint8_t *public_key)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    client->connection_id = connection_id;
+    return 0;
+}
+
+static int handle_status(void *object, uint32_t number, uint8_t connection_id, uint8_t status)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    client->online = status == 2;
+    return 0;
+}
+
+static int handle_data(void *object, uint32_t number, uint8_t connection_id, const uint8_t *data, uint16_t length,
+                       void *userdata)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    ++client->received;
+    return 0;
+}
+
+/* Run a relay without workers the way a bootstrap node would, waiting on its sockets. */
+static void *server_thread(void *arg)
+{
+    Bench_Server *bench = (Bench_Server *)arg;
+    Socket socks[BENCH_MAX_SOCKETS];
+    struct pollfd fds[BENCH_MAX_SOCKETS];
+
+    while (true) {
+        pthread_mutex_lock(&bench->mutex);
+        const bool stopping = bench->stopping;
+        pthread_mutex_unlock(&bench->mutex);
+
+        if (stopping) {
+            break;
+        }
+
+        mono_time_update(bench->mono_time);
+        do_TCP_server(bench->server, bench->mono_time);
+
+        uint32_t num_socks = tcp_server_sockets(bench->server, socks, BENCH_MAX_SOCKETS);
+
+        if (num_socks > BENCH_MAX_SOCKETS) {
+            num_socks = BENCH_MAX_SOCKETS;
+        }
+
+        for (uint32_t i = 0; i < num_socks; ++i) {
+            fds[i].fd = socks[i].socket;
+            fds[i].events = POLLIN;
+        }
+
+        poll(fds, num_socks, 1);
+    }
+
+    return nullptr;
+}
+
+static void run_clients(const Logger *log, Mono_Time *mono_time, Bench_Pair *pairs, uint32_t num_pairs)
+{
+    mono_time_update(mono_time);
+
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        do_TCP_connection(log, mono_time, pairs[i].clients[0].con, nullptr);
+        do_TCP_connection(log, mono_time, pairs[i].clients[1].con, nullptr);
+    }
+}
+
+static void *client_thread(void *arg)
+{
+    Bench_Thread *thread = (Bench_Thread *)arg;
+    uint8_t packet[BENCH_PACKET_SIZE] = {0};
+    bool done = false;
+
+    while (!done) {
+        done = true;
+
+        for (uint32_t i = 0; i < thread->num_pairs; ++i) {
+            Bench_Pair *pair = &thread->pairs[i];
+            Bench_Client *sender = &pair->clients[0];
+
+            while (pair->sent < thread->num_packets
+                    && send_data(sender->con, sender->connection_id, packet, sizeof(packet)) == 1) {
+                ++pair->sent;
+            }
+        }
+
+        run_clients(thread->log, thread->mono_time, thread->pairs, thread->num_pairs);
+        const uint64_t now = wall_time_ms();
+
+        for (uint32_t i = 0; i < thread->num_pairs; ++i) {
+            Bench_Pair *pair = &thread->pairs[i];
+            const uint32_t received = pair->clients[1].received;
+
+            if (received >= thread->num_packets) {
+                continue;
+            }
+
+            done = false;
+
+            if (received != pair->last_received || pair->last_progress == 0) {
+                pair->last_received = received;
+                pair->last_progress = now;
+                continue;
+            }
+
+            /* The relay drops packets it cannot pass on, so top up when nothing moves. */
+            if (pair->sent == thread->num_packets && now - pair->last_progress > BENCH_STALL_MS) {
+                pair->sent = received;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+static bool all_online(const Bench_Pair *pairs, uint32_t num_pairs)
+{
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        if (!pairs[i].clients[0].online || !pairs[i].clients[1].online) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool connect_pairs(const Logger *log, Mono_Time *mono_time, Bench_Pair *pairs, uint32_t num_pairs,
+                          const uint8_t *server_public_key)
+{
+    IP_Port ip_port;
+    ip_init(&ip_port.ip, false);
+    ip_port.ip.ip.v4 = get_ip4_loopback();
+    ip_port.port = net_htons(BENCH_PORT);
+
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        for (uint32_t j = 0; j < 2; ++j) {
+            Bench_Client *client = &pairs[i].clients[j];
+            crypto_new_keypair(client->public_key, client->secret_key);
+            client->con = new_TCP_connection(mono_time, ip_port, server_public_key, client->public_key,
+                                             client->secret_key, nullptr);
+
+            if (client->con == nullptr) {
+                return false;
+            }
+
+            routing_response_handler(client->con, &handle_response, client);
+            routing_status_handler(client->con, &handle_status, client);
+            routing_data_handler(client->con, &handle_data, client);
+        }
+    }
+
+    const uint64_t start = wall_time_ms();
+    uint32_t requested = 0;
+
+    while (!all_online(pairs, num_pairs)) {
+        if (wall_time_ms() - start > BENCH_SETUP_SECONDS * 1000) {
+            return false;
+        }
+
+        run_clients(log, mono_time, pairs, num_pairs);
+
+        while (requested < num_pairs && tcp_con_status(pairs[requested].clients[0].con) == TCP_CLIENT_CONFIRMED
+                && tcp_con_status(pairs[requested].clients[1].con) == TCP_CLIENT_CONFIRMED) {
+            send_routing_request(pairs[requested].clients[0].con, pairs[requested].clients[1].public_key);
+            send_routing_request(pairs[requested].clients[1].con, pairs[requested].clients[0].public_key);
+            ++requested;
+        }
+
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, nullptr);
+    }
+
+    return true;
+}
+
+/* Relay num_packets packets for each pair through a server with num_workers
+ * workers, or through one run by a single thread if num_workers is 0.
+ */
+static void bench_scaling(const Logger *log, uint16_t num_workers, uint32_t num_pairs, uint32_t num_packets)
+{
+    uint8_t server_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t server_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(server_public_key, server_secret_key);
+
+    const uint16_t port = BENCH_PORT;
+    Bench_Server server;
+    memset(&server, 0, sizeof(server));
+    server.mono_time = mono_time_new();
+    pthread_mutex_init(&server.mutex, nullptr);
+
+    if (num_workers == 0) {
+        server.server = new_TCP_server(log, false, 1, &port, server_secret_key, nullptr);
+    } else {
+        server.server = new_TCP_server_workers(log, false, 1, &port, server_secret_key, nullptr, num_workers);
+    }
+
+    if (server.server == nullptr) {
+        printf("%u workers: not available\n", num_workers);
+        pthread_mutex_destroy(&server.mutex);
+        mono_time_free(server.mono_time);
+        return;
+    }
+
+    if (num_workers == 0 && pthread_create(&server.thread, nullptr, &server_thread, &server) != 0) {
+        fprintf(stderr, "failed to start server thread\n");
+        exit(1);
+    }
+
+    Bench_Pair *pairs = (Bench_Pair *)calloc(num_pairs, sizeof(Bench_Pair));
+    Bench_Thread threads[BENCH_CLIENT_THREADS];
+    memset(threads, 0, sizeof(threads));
+
+    if (pairs == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    Mono_Time *mono_time = mono_time_new();
+
+    if (!connect_pairs(log, mono_time, pairs, num_pairs, server_public_key)) {
+        fprintf(stderr, "clients did not get routed to each other\n");
+        exit(1);
+    }
+
+    const uint64_t start = wall_time_ms();
+    const clock_t cpu_start = clock();
+    uint32_t first_pair = 0;
+
+    for (uint32_t i = 0; i < BENCH_CLIENT_THREADS; ++i) {
+        Bench_Thread *thread = &threads[i];
+        thread->log = log;
+        thread->mono_time = mono_time;
+        thread->pairs = pairs + first_pair;
+        thread->num_pairs = (num_pairs - first_pair) / (BENCH_CLIENT_THREADS - i);
+        thread->num_packets = num_packets;
+        first_pair += thread->num_pairs;
+
+        if (pthread_create(&thread->thread, nullptr, &client_thread, thread) != 0) {
+            fprintf(stderr, "failed to start client thread\n");
+            exit(1);
+        }
+    }
+
+    uint64_t received = 0;
+
+    for (uint32_t i = 0; i < BENCH_CLIENT_THREADS; ++i) {
+        pthread_join(threads[i].thread, nullptr);
+    }
+
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        received += pairs[i].clients[1].received;
+    }
+
+    const double seconds = (double)(wall_time_ms() - start) / 1000;
+    const double cpu_seconds = (double)(clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    if (num_workers == 0) {
+        printf("single thread: ");
+    } else {
+        printf("%u workers:     ", num_workers);
+    }
+
+    printf("%8llu relayed in %7.3f s (%7.3f s CPU), %10.0f packets/s\n", (unsigned long long)received, seconds,
+           cpu_seconds, seconds > 0 ? received / seconds : 0.0);
+
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        kill_TCP_connection(pairs[i].clients[0].con);
+        kill_TCP_connection(pairs[i].clients[1].con);
+    }
+
+    if (num_workers == 0) {
+        pthread_mutex_lock(&server.mutex);
+        server.stopping = true;
+        pthread_mutex_unlock(&server.mutex);
+        pthread_join(server.thread, nullptr);
+    }
+
+    kill_TCP_server(server.server);
+    pthread_mutex_destroy(&server.mutex);
+    mono_time_free(server.mono_time);
+    mono_time_free(mono_time);
+    free(pairs);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_packets = 20000;
+    uint32_t num_pairs = 16;
+
+    if (argc > 1) {
+        num_packets = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    if (argc > 2) {
+        num_pairs = (uint32_t)strtoul(argv[2], nullptr, 10);
+    }
+
+    if (num_packets == 0 || num_pairs < BENCH_CLIENT_THREADS || num_pairs > BENCH_MAX_SOCKETS / 2) {
+        fprintf(stderr, "usage: %s [num_packets] [num_pairs]\n", argv[0]);
+        return 1;
+    }
+
+    Logger *log = logger_new();
+
+    printf("%u pairs, %u packets of %u bytes each\n", num_pairs, num_packets, BENCH_PACKET_SIZE);
+
+    const uint16_t workers[] = {0, 1, 2, 4, 8};
+
+    for (size_t i = 0; i < sizeof(workers) / sizeof(workers[0]); ++i) {
+        bench_scaling(log, workers[i], num_pairs, num_packets);
+    }
+
+    logger_kill(log);
+    return 0;
+}
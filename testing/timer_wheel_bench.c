@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Periodic timer tick benchmark
+ *
+ * Gives 1000, 10000 and 100000 simulated connections a ping every 30 seconds,
+ * the way the TCP relay pings its clients, with their first pings spread over
+ * the first 30 seconds. The server loop runs 20 times a second, and each run
+ * either checks every connection, as a full sweep does, or lets a Timer_Wheel
+ * hand out only the connections that are due. Prints the average and the
+ * longest time a run took.
+ *
+ * Usage: ./timer_wheel_bench [num_seconds]
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/timer_wheel.h"
+
+#define BENCH_PING_FREQUENCY 30
+#define BENCH_RUNS_PER_SECOND 20
+
+/* Stands in for a connection of the server, whose other fields put the ones a
+ * sweep reads on a cache line of their own. */
+typedef struct Bench_Connection {
+    uint64_t last_pinged;
+    uint8_t other[248];
+} Bench_Connection;
+
+typedef struct Bench_State {
+    Bench_Connection *connections;
+    uint32_t num_connections;
+    Timer_Wheel *wheel;
+    uint64_t pings;
+} Bench_State;
+
+static uint64_t wall_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void reset_state(Bench_State *state)
+{
+    for (uint32_t i = 0; i < state->num_connections; ++i) {
+        state->connections[i].last_pinged = i % BENCH_PING_FREQUENCY;
+    }
+
+    state->pings = 0;
+}
+
+static void sweep_tick(Bench_State *state, uint64_t now)
+{
+    for (uint32_t i = 0; i < state->num_connections; ++i) {
+        if (state->connections[i].last_pinged + BENCH_PING_FREQUENCY <= now) {
+            state->connections[i].last_pinged = now;
+            ++state->pings;
+        }
+    }
+}
+
+static void ping_connection(void *object, uint32_t id, uint64_t now)
+{
+    Bench_State *state = (Bench_State *)object;
+    state->connections[id].last_pinged = now;
+    ++state->pings;
+    timer_wheel_set(state->wheel, id, now + BENCH_PING_FREQUENCY);
+}
+
+static void wheel_tick(Bench_State *state, uint64_t now)
+{
+    timer_wheel_expire(state->wheel, now, &ping_connection, state);
+}
+
+static void print_result(const char *name, const Bench_State *state, uint32_t num_runs, uint64_t total_ns,
+                         uint64_t max_ns)
+{
+    printf("%-6s %6u connections: %10.0f ns/run average, %9.0f ns longest run, %8lu pings\n", name,
+           state->num_connections, (double)total_ns / num_runs, (double)max_ns, (unsigned long)state->pings);
+}
+
+static void run_ticks(const char *name, Bench_State *state, uint32_t num_seconds,
+                      void (*tick)(Bench_State *state, uint64_t now))
+{
+    const uint32_t num_runs = num_seconds * BENCH_RUNS_PER_SECOND;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    for (uint32_t run = 0; run < num_runs; ++run) {
+        const uint64_t now = 1 + run / BENCH_RUNS_PER_SECOND;
+        const uint64_t start = wall_time_ns();
+        tick(state, now);
+        const uint64_t elapsed = wall_time_ns() - start;
+
+        total_ns += elapsed;
+
+        if (elapsed > max_ns) {
+            max_ns = elapsed;
+        }
+    }
+
+    print_result(name, state, num_runs, total_ns, max_ns);
+}
+
+static void bench_connections(uint32_t num_connections, uint32_t num_seconds)
+{
+    Bench_State state;
+    state.num_connections = num_connections;
+    state.connections = (Bench_Connection *)calloc(num_connections, sizeof(Bench_Connection));
+    state.wheel = timer_wheel_new(0);
+
+    if (state.connections == nullptr || state.wheel == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    reset_state(&state);
+    run_ticks("sweep", &state, num_seconds, &sweep_tick);
+
+    reset_state(&state);
+
+    for (uint32_t i = 0; i < num_connections; ++i) {
+        if (!timer_wheel_set(state.wheel, i, state.connections[i].last_pinged + BENCH_PING_FREQUENCY)) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    run_ticks("wheel", &state, num_seconds, &wheel_tick);
+
+    timer_wheel_kill(state.wheel);
+    free(state.connections);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_seconds = 300;
+
+    if (argc > 1) {
+        num_seconds = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    if (num_seconds == 0) {
+        fprintf(stderr, "usage: %s [num_seconds]\n", argv[0]);
+        return 1;
+    }
+
+    bench_connections(1000, num_seconds);
+    bench_connections(10000, num_seconds);
+    bench_connections(100000, num_seconds);
+    return 0;
+}
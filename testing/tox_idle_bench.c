@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/* Idle Tox instance benchmark
+ *
+ * Starts 100 Tox instances on loopback, bootstraps them off each other and
+ * makes pairs of them friends. Once the friends are connected, runs all of
+ * them for a while without sending anything and prints how much CPU time they
+ * use, first sleeping for tox_iteration_interval() between iterations and then
+ * waiting in epoll on the descriptors from tox_get_fds() until one is readable
+ * or tox_iteration_deadline() has passed. Only Linux has epoll.
+ *
+ * Usage: ./tox_idle_bench [num_instances] [seconds]
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+
+#define BENCH_MAX_FDS 64
+#define BENCH_CONNECT_TIMEOUT 120
+
+typedef struct Bench_Instance {
+    Tox *tox;
+    int fds[BENCH_MAX_FDS];
+    uint32_t num_fds;
+    uint64_t next_run;
+    uint64_t iterations;
+} Bench_Instance;
+
+static uint64_t wall_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(uint32_t ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep(&ts, nullptr);
+}
+
+static void print_result(const char *mode, const Bench_Instance *instances, uint32_t num_instances, clock_t cpu,
+                         uint64_t wall_ms)
+{
+    uint64_t iterations = 0;
+
+    for (uint32_t i = 0; i < num_instances; ++i) {
+        iterations += instances[i].iterations;
+    }
+
+    const double cpu_seconds = (double)cpu / CLOCKS_PER_SEC;
+    const double wall_seconds = (double)wall_ms / 1000;
+
+    printf("%-6s %3u instances: %6.3f s CPU in %5.1f s, %5.2f%% of a core, %7.1f iterations/s per instance\n", mode,
+           num_instances, cpu_seconds, wall_seconds, 100 * cpu_seconds / wall_seconds,
+           iterations / wall_seconds / num_instances);
+}
+
+static void run_sleeping(Bench_Instance *instances, uint32_t num_instances, uint32_t seconds)
+{
+    const uint64_t start = wall_time_ms();
+    const clock_t cpu_start = clock();
+
+    for (uint32_t i = 0; i < num_instances; ++i) {
+        instances[i].iterations = 0;
+    }
+
+    while (wall_time_ms() - start < seconds * 1000) {
+        uint32_t interval = UINT32_MAX;
+
+        for (uint32_t i = 0; i < num_instances; ++i) {
+            tox_iterate(instances[i].tox, nullptr);
+            ++instances[i].iterations;
+
+            const uint32_t tox_interval = tox_iteration_interval(instances[i].tox);
+
+            if (tox_interval < interval) {
+                interval = tox_interval;
+            }
+        }
+
+        sleep_ms(interval);
+    }
+
+    print_result("sleep", instances, num_instances, clock() - cpu_start, wall_time_ms() - start);
+}
+
+#ifdef __linux__
+/* Replace the descriptors of an instance in the epoll set with the ones it waits on now. */
+static void update_fds(int efd, Bench_Instance *instances, uint32_t index)
+{
+    Bench_Instance *instance = &instances[index];
+    int fds[BENCH_MAX_FDS];
+    uint32_t num_fds = tox_get_fds(instance->tox, fds, BENCH_MAX_FDS);
+
+    if (num_fds > BENCH_MAX_FDS) {
+        num_fds = BENCH_MAX_FDS;
+    }
+
+    if (num_fds == instance->num_fds && memcmp(fds, instance->fds, num_fds * sizeof(int)) == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < instance->num_fds; ++i) {
+        epoll_ctl(efd, EPOLL_CTL_DEL, instance->fds[i], nullptr);
+    }
+
+    for (uint32_t i = 0; i < num_fds; ++i) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = index;
+        epoll_ctl(efd, EPOLL_CTL_ADD, fds[i], &ev);
+    }
+
+    memcpy(instance->fds, fds, num_fds * sizeof(int));
+    instance->num_fds = num_fds;
+}
+
+static void run_instance(int efd, Bench_Instance *instances, uint32_t index, uint64_t now)
+{
+    Bench_Instance *instance = &instances[index];
+    tox_iterate(instance->tox, nullptr);
+    ++instance->iterations;
+    instance->next_run = now + tox_iteration_deadline(instance->tox);
+    update_fds(efd, instances, index);
+}
+
+static void run_epoll(Bench_Instance *instances, uint32_t num_instances, uint32_t seconds)
+{
+    const int efd = epoll_create(num_instances);
+
+    if (efd == -1) {
+        fprintf(stderr, "epoll_create failed\n");
+        exit(1);
+    }
+
+    struct epoll_event *events = (struct epoll_event *)calloc(num_instances, sizeof(struct epoll_event));
+
+    if (events == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    const uint64_t start = wall_time_ms();
+    const clock_t cpu_start = clock();
+
+    for (uint32_t i = 0; i < num_instances; ++i) {
+        instances[i].num_fds = 0;
+        instances[i].iterations = 0;
+        run_instance(efd, instances, i, start);
+    }
+
+    uint64_t now = start;
+
+    while (now - start < seconds * 1000) {
+        uint64_t next_run = UINT64_MAX;
+
+        for (uint32_t i = 0; i < num_instances; ++i) {
+            if (instances[i].next_run < next_run) {
+                next_run = instances[i].next_run;
+            }
+        }
+
+        const int timeout = next_run > now ? (int)(next_run - now) : 0;
+        const int nfds = epoll_wait(efd, events, num_instances, timeout);
+        now = wall_time_ms();
+
+        /* Several descriptors of one instance may be ready at once, run it only once. */
+        for (int n = 0; n < nfds; ++n) {
+            instances[events[n].data.u32].next_run = 0;
+        }
+
+        for (uint32_t i = 0; i < num_instances; ++i) {
+            if (instances[i].next_run <= now) {
+                run_instance(efd, instances, i, now);
+            }
+        }
+    }
+
+    print_result("epoll", instances, num_instances, clock() - cpu_start, wall_time_ms() - start);
+
+    free(events);
+    close(efd);
+}
+#endif
+
+static bool all_friends_connected(const Bench_Instance *instances, uint32_t num_instances)
+{
+    for (uint32_t i = 0; i + 1 < num_instances; i += 2) {
+        if (tox_friend_get_connection_status(instances[i].tox, 0, nullptr) == TOX_CONNECTION_NONE
+                || tox_friend_get_connection_status(instances[i + 1].tox, 0, nullptr) == TOX_CONNECTION_NONE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_instances = 100;
+    uint32_t seconds = 10;
+
+    if (argc > 1) {
+        num_instances = (uint32_t)strtoul(argv[1], nullptr, 10);
+    }
+
+    if (argc > 2) {
+        seconds = (uint32_t)strtoul(argv[2], nullptr, 10);
+    }
+
+    if (num_instances < 2 || seconds == 0) {
+        fprintf(stderr, "usage: %s [num_instances] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    Bench_Instance *instances = (Bench_Instance *)calloc(num_instances, sizeof(Bench_Instance));
+    struct Tox_Options *options = tox_options_new(nullptr);
+
+    if (instances == nullptr || options == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    tox_options_set_ipv6_enabled(options, false);
+    tox_options_set_local_discovery_enabled(options, false);
+    tox_options_set_start_port(options, 33445);
+    tox_options_set_end_port(options, 33445 + 2 * num_instances);
+
+    for (uint32_t i = 0; i < num_instances; ++i) {
+        instances[i].tox = tox_new(options, nullptr);
+
+        if (instances[i].tox == nullptr) {
+            fprintf(stderr, "failed to create instance %u\n", i);
+            return 1;
+        }
+    }
+
+    tox_options_free(options);
+
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE];
+    uint8_t address[TOX_ADDRESS_SIZE];
+
+    for (uint32_t i = 0; i < num_instances; ++i) {
+        const Bench_Instance *node = &instances[i > 0 ? i - 1 : num_instances - 1];
+        tox_self_get_dht_id(node->tox, dht_key);
+        tox_bootstrap(instances[i].tox, "127.0.0.1", tox_self_get_udp_port(node->tox, nullptr), dht_key, nullptr);
+    }
+
+    for (uint32_t i = 0; i + 1 < num_instances; i += 2) {
+        tox_self_get_address(instances[i + 1].tox, address);
+        tox_friend_add_norequest(instances[i].tox, address, nullptr);
+        tox_self_get_address(instances[i].tox, address);
+        tox_friend_add_norequest(instances[i + 1].tox, address, nullptr);
+    }
+
+    const uint64_t connect_start = wall_time_ms();
+
+    while (!all_friends_connected(instances, num_instances)) {
+        if (wall_time_ms() - connect_start > BENCH_CONNECT_TIMEOUT * 1000) {
+            fprintf(stderr, "friends did not connect within %u seconds\n", BENCH_CONNECT_TIMEOUT);
+            return 1;
+        }
+
+        for (uint32_t i = 0; i < num_instances; ++i) {
+            tox_iterate(instances[i].tox, nullptr);
+        }
+
+        sleep_ms(tox_iteration_interval(instances[0].tox));
+    }
+
+    printf("%u instances connected in %.1f s\n", num_instances, (wall_time_ms() - connect_start) / 1000.0);
+
+    run_sleeping(instances, num_instances, seconds);
+#ifdef __linux__
+    run_epoll(instances, num_instances, seconds);
+#endif
+
+    for (uint32_t i = 0; i < num_instances; ++i) {
+        tox_kill(instances[i].tox);
+    }
+
+    free(instances);
+    return 0;
+}
@@ -13,10 +13,12 @@
 #include "DHT.h"
 
 #include "LAN_discovery.h"
+#include "key_map.h"
 #include "logger.h"
 #include "mono_time.h"
 #include "network.h"
 #include "ping.h"
+#include "pk_distance.h"
 #include "state.h"
 #include "util.h"
 
@@ -86,6 +88,14 @@ struct DHT {
     Client_data    close_clientlist[LCLIENT_LIST];
     uint64_t       close_lastgetnodes;
     uint32_t       close_bootstrap_times;
+    /* Indices into close_clientlist by public key, and by packed IP_Port twice
+     * the index, plus 1 for the IPv6 address. */
+    Key_Map        close_by_key;
+    Key_Map        close_by_ip_port;
+    /* Addresses left out of close_by_ip_port because another node of the close
+     * list has them too, by the same ids, and how many there are. */
+    bool           close_ip_port_shared[LCLIENT_LIST * 2];
+    uint32_t       close_num_shared;
 
     /* DHT keypair */
     uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
@@ -98,8 +108,8 @@ struct DHT {
     uint32_t       loaded_num_nodes;
     unsigned int   loaded_nodes_index;
 
-    Shared_Keys shared_keys_recv;
-    Shared_Keys shared_keys_sent;
+    Shared_Keys   *shared_keys_recv;
+    Shared_Keys   *shared_keys_sent;
 
     struct Ping   *ping;
     Ping_Array    *dht_ping_array;
@@ -178,6 +188,12 @@ static bool assoc_timeout(const Mono_Time *mono_time, const IPPTsPng *assoc)
     return mono_time_is_timeout(mono_time, assoc->timestamp, BAD_NODE_TIMEOUT);
 }
 
+/* assoc_timeout for loops over many nodes, which read the time only once. */
+static bool assoc_timeout_at(uint64_t cur_time, const IPPTsPng *assoc)
+{
+    return assoc->timestamp + BAD_NODE_TIMEOUT <= cur_time;
+}
+
 /* Compares pk1 and pk2 with pk.
  *
  *  return 0 if both are same distance.
@@ -186,46 +202,173 @@ static bool assoc_timeout(const Mono_Time *mono_time, const IPPTsPng *assoc)
  */
 int id_closest(const uint8_t *pk, const uint8_t *pk1, const uint8_t *pk2)
 {
-    for (size_t i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; ++i) {
-        const uint8_t distance1 = pk[i] ^ pk1[i];
-        const uint8_t distance2 = pk[i] ^ pk2[i];
+    return pk_closest(pk, pk1, pk2);
+}
 
-        if (distance1 < distance2) {
-            return 1;
-        }
+typedef struct Shared_Key {
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    uint64_t time_last_requested;
+    uint32_t hash;
+    /* Set on every request, cleared when the clock hand passes over the key. */
+    bool referenced;
+} Shared_Key;
+
+struct Shared_Keys {
+    /* The first num_keys entries are in use. */
+    Shared_Key *keys;
+    uint32_t capacity;
+    uint32_t num_keys;
+    uint32_t clock_hand;
+
+    /* Open addressing table of key index + 1, 0 marks an empty slot. It has at
+     * least twice as many slots as there are keys so probe sequences stay short.
+     */
+    uint32_t *table;
+    uint32_t table_mask;
+    uint64_t seed;
 
-        if (distance1 > distance2) {
-            return 2;
-        }
+    Shared_Keys_Stats stats;
+};
+
+Shared_Keys *shared_keys_new(uint32_t capacity)
+{
+    if (capacity == 0 || capacity > UINT32_MAX / 4) {
+        return nullptr;
     }
 
-    return 0;
+    uint32_t table_size = 1;
+
+    while (table_size < capacity * 2) {
+        table_size *= 2;
+    }
+
+    Shared_Keys *shared_keys = (Shared_Keys *)calloc(1, sizeof(Shared_Keys));
+
+    if (shared_keys == nullptr) {
+        return nullptr;
+    }
+
+    shared_keys->keys = (Shared_Key *)calloc(capacity, sizeof(Shared_Key));
+    shared_keys->table = (uint32_t *)calloc(table_size, sizeof(uint32_t));
+
+    if (shared_keys->keys == nullptr || shared_keys->table == nullptr) {
+        shared_keys_free(shared_keys);
+        return nullptr;
+    }
+
+    shared_keys->capacity = capacity;
+    shared_keys->table_mask = table_size - 1;
+    /* Random so that nobody can pick public keys which all land in one probe sequence. */
+    shared_keys->seed = random_u64();
+
+    return shared_keys;
+}
+
+void shared_keys_free(Shared_Keys *shared_keys)
+{
+    if (shared_keys == nullptr) {
+        return;
+    }
+
+    crypto_memzero(shared_keys->keys, shared_keys->capacity * sizeof(Shared_Key));
+    free(shared_keys->keys);
+    free(shared_keys->table);
+    free(shared_keys);
+}
+
+void shared_keys_get_stats(const Shared_Keys *shared_keys, Shared_Keys_Stats *stats)
+{
+    *stats = shared_keys->stats;
 }
 
-/* Return index of first unequal bit number.
+static uint32_t shared_keys_hash(const Shared_Keys *shared_keys, const uint8_t *public_key)
+{
+    uint64_t hash = shared_keys->seed;
+
+    for (uint32_t i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, public_key + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+
+    return (uint32_t)hash;
+}
+
+/* Find the table slot of public_key, or the empty slot where it would be inserted.
+ *
+ * return index of the key if it is in the cache.
+ * return UINT32_MAX if it is not.
  */
-static unsigned int bit_by_bit_cmp(const uint8_t *pk1, const uint8_t *pk2)
+static uint32_t shared_keys_find(const Shared_Keys *shared_keys, const uint8_t *public_key, uint32_t hash,
+                                 uint32_t *slot)
 {
-    unsigned int i;
-    unsigned int j = 0;
+    uint32_t pos = hash & shared_keys->table_mask;
 
-    for (i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; ++i) {
-        if (pk1[i] == pk2[i]) {
-            continue;
+    while (shared_keys->table[pos] != 0) {
+        const uint32_t index = shared_keys->table[pos] - 1;
+        const Shared_Key *const key = &shared_keys->keys[index];
+
+        if (key->hash == hash && id_equal(public_key, key->public_key)) {
+            *slot = pos;
+            return index;
         }
 
-        for (j = 0; j < 8; ++j) {
-            const uint8_t mask = 1 << (7 - j);
+        pos = (pos + 1) & shared_keys->table_mask;
+    }
 
-            if ((pk1[i] & mask) != (pk2[i] & mask)) {
-                break;
-            }
+    *slot = pos;
+    return UINT32_MAX;
+}
+
+/* Remove the key with the given index from the table, moving later keys of the
+ * probe sequence back so that no lookup runs into the hole.
+ */
+static void shared_keys_unlink(Shared_Keys *shared_keys, uint32_t index)
+{
+    const uint32_t mask = shared_keys->table_mask;
+    uint32_t hole = shared_keys->keys[index].hash & mask;
+
+    while (shared_keys->table[hole] != index + 1) {
+        hole = (hole + 1) & mask;
+    }
+
+    uint32_t next = (hole + 1) & mask;
+
+    while (shared_keys->table[next] != 0) {
+        const uint32_t ideal = shared_keys->keys[shared_keys->table[next] - 1].hash & mask;
+
+        if (((next - ideal) & mask) >= ((next - hole) & mask)) {
+            shared_keys->table[hole] = shared_keys->table[next];
+            hole = next;
         }
 
-        break;
+        next = (next + 1) & mask;
     }
 
-    return i * 8 + j;
+    shared_keys->table[hole] = 0;
+}
+
+/* Pick the key to replace in a full cache: the first one under the clock hand
+ * which was not requested since the hand last passed it or which timed out.
+ */
+static uint32_t shared_keys_evict(const Mono_Time *mono_time, Shared_Keys *shared_keys)
+{
+    while (true) {
+        const uint32_t index = shared_keys->clock_hand;
+        Shared_Key *const key = &shared_keys->keys[index];
+        shared_keys->clock_hand = (index + 1) % shared_keys->capacity;
+
+        if (key->referenced && !mono_time_is_timeout(mono_time, key->time_last_requested, KEYS_TIMEOUT)) {
+            key->referenced = false;
+            continue;
+        }
+
+        shared_keys_unlink(shared_keys, index);
+        ++shared_keys->stats.evictions;
+        return index;
+    }
 }
 
 /* Shared key generations are costly, it is therefore smart to store commonly used
@@ -237,46 +380,38 @@ static unsigned int bit_by_bit_cmp(const uint8_t *pk1, const uint8_t *pk2)
 void get_shared_key(const Mono_Time *mono_time, Shared_Keys *shared_keys, uint8_t *shared_key,
                     const uint8_t *secret_key, const uint8_t *public_key)
 {
-    uint32_t num = -1;
-    uint32_t curr = 0;
+    const uint32_t hash = shared_keys_hash(shared_keys, public_key);
+    uint32_t slot;
+    uint32_t index = shared_keys_find(shared_keys, public_key, hash, &slot);
 
-    for (uint32_t i = 0; i < MAX_KEYS_PER_SLOT; ++i) {
-        const int index = public_key[30] * MAX_KEYS_PER_SLOT + i;
+    if (index != UINT32_MAX) {
         Shared_Key *const key = &shared_keys->keys[index];
-
-        if (key->stored) {
-            if (id_equal(public_key, key->public_key)) {
-                memcpy(shared_key, key->shared_key, CRYPTO_SHARED_KEY_SIZE);
-                ++key->times_requested;
-                key->time_last_requested = mono_time_get(mono_time);
-                return;
-            }
-
-            if (num != 0) {
-                if (mono_time_is_timeout(mono_time, key->time_last_requested, KEYS_TIMEOUT)) {
-                    num = 0;
-                    curr = index;
-                } else if (num > key->times_requested) {
-                    num = key->times_requested;
-                    curr = index;
-                }
-            }
-        } else if (num != 0) {
-            num = 0;
-            curr = index;
-        }
+        memcpy(shared_key, key->shared_key, CRYPTO_SHARED_KEY_SIZE);
+        key->referenced = true;
+        key->time_last_requested = mono_time_get(mono_time);
+        ++shared_keys->stats.hits;
+        return;
     }
 
+    ++shared_keys->stats.misses;
     encrypt_precompute(public_key, secret_key, shared_key);
 
-    if (num != UINT32_MAX) {
-        Shared_Key *const key = &shared_keys->keys[curr];
-        key->stored = true;
-        key->times_requested = 1;
-        memcpy(key->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-        memcpy(key->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
-        key->time_last_requested = mono_time_get(mono_time);
+    if (shared_keys->num_keys < shared_keys->capacity) {
+        index = shared_keys->num_keys;
+        ++shared_keys->num_keys;
+    } else {
+        index = shared_keys_evict(mono_time, shared_keys);
+        /* Unlinking may have moved other keys into our slot. */
+        shared_keys_find(shared_keys, public_key, hash, &slot);
     }
+
+    Shared_Key *const key = &shared_keys->keys[index];
+    memcpy(key->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(key->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+    key->time_last_requested = mono_time_get(mono_time);
+    key->hash = hash;
+    key->referenced = false;
+    shared_keys->table[slot] = index + 1;
 }
 
 /* Copy shared_key to encrypt/decrypt DHT packet from public_key into shared_key
@@ -284,7 +419,7 @@ void get_shared_key(const Mono_Time *mono_time, Shared_Keys *shared_keys, uint8_
  */
 void dht_get_shared_key_recv(DHT *dht, uint8_t *shared_key, const uint8_t *public_key)
 {
-    get_shared_key(dht->mono_time, &dht->shared_keys_recv, shared_key, dht->self_secret_key, public_key);
+    get_shared_key(dht->mono_time, dht->shared_keys_recv, shared_key, dht->self_secret_key, public_key);
 }
 
 /* Copy shared_key to encrypt/decrypt DHT packet from public_key into shared_key
@@ -292,7 +427,7 @@ void dht_get_shared_key_recv(DHT *dht, uint8_t *shared_key, const uint8_t *publi
  */
 void dht_get_shared_key_sent(DHT *dht, uint8_t *shared_key, const uint8_t *public_key)
 {
-    get_shared_key(dht->mono_time, &dht->shared_keys_sent, shared_key, dht->self_secret_key, public_key);
+    get_shared_key(dht->mono_time, dht->shared_keys_sent, shared_key, dht->self_secret_key, public_key);
 }
 
 #define CRYPTO_SIZE 1 + CRYPTO_PUBLIC_KEY_SIZE * 2 + CRYPTO_NONCE_SIZE
@@ -662,6 +797,146 @@ static uint32_t index_of_client_ip_port(const Client_data *array, uint32_t size,
     return UINT32_MAX;
 }
 
+/* Pack ip_port into the key of close_by_ip_port.
+ *
+ * return false if it has no key because ipport_equal would never match it.
+ */
+static bool close_ip_port_key(uint8_t *key, const IP_Port *ip_port)
+{
+    memset(key, 0, SIZE_IPPORT);
+    return ip_port->port != 0 && pack_ip_port(key, SIZE_IPPORT, ip_port) != -1;
+}
+
+/* The address of the close list node behind an id of close_by_ip_port. */
+static const IP_Port *close_id_ip_port(const DHT *dht, uint32_t id)
+{
+    const Client_data *const client = &dht->close_clientlist[id / 2];
+    return id % 2 == 0 ? &client->assoc4.ip_port : &client->assoc6.ip_port;
+}
+
+/* Put the first node that was left out of close_by_ip_port because id had the
+ * same address, packed into key, into the map in place of id.
+ */
+static void close_index_take_over(DHT *dht, const uint8_t *key, uint32_t id)
+{
+    for (uint32_t other = id % 2; other < LCLIENT_LIST * 2; other += 2) {
+        uint8_t other_key[SIZE_IPPORT];
+
+        if (!dht->close_ip_port_shared[other] || !close_ip_port_key(other_key, close_id_ip_port(dht, other))
+                || memcmp(other_key, key, SIZE_IPPORT) != 0) {
+            continue;
+        }
+
+        dht->close_ip_port_shared[other] = false;
+        --dht->close_num_shared;
+        key_map_add(&dht->close_by_ip_port, key, other);
+        return;
+    }
+}
+
+/* Take the close list node with the given index out of the maps, before its
+ * public key or one of its addresses changes. Another node with the same
+ * address takes its place in close_by_ip_port.
+ */
+static void close_index_remove(DHT *dht, uint32_t index)
+{
+    const Client_data *const client = &dht->close_clientlist[index];
+    key_map_remove(&dht->close_by_key, client->public_key, index);
+
+    for (uint32_t id = index * 2; id < index * 2 + 2; ++id) {
+        if (dht->close_ip_port_shared[id]) {
+            dht->close_ip_port_shared[id] = false;
+            --dht->close_num_shared;
+            continue;
+        }
+
+        uint8_t key[SIZE_IPPORT];
+
+        if (close_ip_port_key(key, close_id_ip_port(dht, id)) && key_map_remove(&dht->close_by_ip_port, key, id)
+                && dht->close_num_shared > 0) {
+            close_index_take_over(dht, key, id);
+        }
+    }
+}
+
+/* Put the close list node with the given index back into the maps after it
+ * changed. A node whose address another node already has stays out of that map
+ * until the other node leaves it.
+ *
+ * new_dht makes both maps big enough for the whole close list, so adding to them
+ * never allocates and a failed add always means the key is already there.
+ */
+static void close_index_add(DHT *dht, uint32_t index)
+{
+    const Client_data *const client = &dht->close_clientlist[index];
+    key_map_add(&dht->close_by_key, client->public_key, index);
+
+    for (uint32_t id = index * 2; id < index * 2 + 2; ++id) {
+        uint8_t key[SIZE_IPPORT];
+
+        if (close_ip_port_key(key, close_id_ip_port(dht, id)) && key_map_add(&dht->close_by_ip_port, key, id) == 0) {
+            dht->close_ip_port_shared[id] = true;
+            ++dht->close_num_shared;
+        }
+    }
+}
+
+/* Find the close list node with public_key.
+ *
+ * return index or UINT32_MAX if not found.
+ */
+static uint32_t close_index_of_pk(const DHT *dht, const uint8_t *public_key)
+{
+    const int index = key_map_find(&dht->close_by_key, public_key);
+
+    if (index == -1) {
+        return UINT32_MAX;
+    }
+
+    return index;
+}
+
+/* Find a close list node with ip_port.
+ *
+ * return index or UINT32_MAX if not found.
+ */
+static uint32_t close_index_of_ip_port(const DHT *dht, const IP_Port *ip_port)
+{
+    if (!net_family_is_ipv4(ip_port->ip.family) && !net_family_is_ipv6(ip_port->ip.family)) {
+        return UINT32_MAX;
+    }
+
+    uint8_t key[SIZE_IPPORT];
+
+    if (!close_ip_port_key(key, ip_port)) {
+        return UINT32_MAX;
+    }
+
+    const int id = key_map_find(&dht->close_by_ip_port, key);
+
+    if (id == -1) {
+        return UINT32_MAX;
+    }
+
+    // The address of a node that changed behind our back may still be in the map.
+    if (!ipport_equal(close_id_ip_port(dht, id), ip_port)) {
+        return UINT32_MAX;
+    }
+
+    return id / 2;
+}
+
+const Client_data *dht_find_close_client(const DHT *dht, const uint8_t *public_key)
+{
+    const uint32_t index = close_index_of_pk(dht, public_key);
+
+    if (index == UINT32_MAX) {
+        return nullptr;
+    }
+
+    return &dht->close_clientlist[index];
+}
+
 /* Update ip_port of client if it's needed.
  */
 static void update_client(const Logger *log, const Mono_Time *mono_time, int index, Client_data *client,
@@ -698,17 +973,42 @@ static void update_client(const Logger *log, const Mono_Time *mono_time, int ind
     assoc->timestamp = mono_time_get(mono_time);
 }
 
+/* Give the client with the given index in list, which has ip_port, the new
+ * public_key.
+ */
+static void switch_client_public_key(const Logger *log, const Mono_Time *mono_time, Client_data *list,
+                                     uint32_t index, const uint8_t *public_key, IP_Port ip_port)
+{
+    IPPTsPng *assoc;
+    int ip_version;
+
+    if (net_family_is_ipv4(ip_port.ip.family)) {
+        assoc = &list[index].assoc4;
+        ip_version = 4;
+    } else {
+        assoc = &list[index].assoc6;
+        ip_version = 6;
+    }
+
+    /* Initialize client timestamp. */
+    assoc->timestamp = mono_time_get(mono_time);
+    memcpy(list[index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    LOGGER_DEBUG(log, "coipil[%u]: switching public_key (ipv%d)", index, ip_version);
+
+    /* kill the other address, if it was set */
+    memset(assoc, 0, sizeof(IPPTsPng));
+}
+
 /* Check if client with public_key is already in list of length length.
  * If it is then set its corresponding timestamp to current time.
  * If the id is already in the list with a different ip_port, update it.
- * TODO(irungentoo): Maybe optimize this.
  *
  *  return True(1) or False(0)
  */
 static int client_or_ip_port_in_list(const Logger *log, const Mono_Time *mono_time, Client_data *list, uint16_t length,
                                      const uint8_t *public_key, IP_Port ip_port)
 {
-    const uint64_t temp_time = mono_time_get(mono_time);
     uint32_t index = index_of_client_pk(list, length, public_key);
 
     /* if public_key is in list, find it and maybe overwrite ip_port */
@@ -728,25 +1028,33 @@ static int client_or_ip_port_in_list(const Logger *log, const Mono_Time *mono_ti
         return 0;
     }
 
-    IPPTsPng *assoc;
-    int ip_version;
+    switch_client_public_key(log, mono_time, list, index, public_key, ip_port);
+    return 1;
+}
 
-    if (net_family_is_ipv4(ip_port.ip.family)) {
-        assoc = &list[index].assoc4;
-        ip_version = 4;
-    } else {
-        assoc = &list[index].assoc6;
-        ip_version = 6;
+/* client_or_ip_port_in_list for the close list, finding the node through the
+ * tables instead of scanning the list.
+ */
+static int client_or_ip_port_in_close_list(DHT *dht, const uint8_t *public_key, IP_Port ip_port)
+{
+    uint32_t index = close_index_of_pk(dht, public_key);
+
+    if (index != UINT32_MAX) {
+        close_index_remove(dht, index);
+        update_client(dht->log, dht->mono_time, index, &dht->close_clientlist[index], ip_port);
+        close_index_add(dht, index);
+        return 1;
     }
 
-    /* Initialize client timestamp. */
-    assoc->timestamp = temp_time;
-    memcpy(list[index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    index = close_index_of_ip_port(dht, &ip_port);
 
-    LOGGER_DEBUG(log, "coipil[%u]: switching public_key (ipv%d)", index, ip_version);
+    if (index == UINT32_MAX) {
+        return 0;
+    }
 
-    /* kill the other address, if it was set */
-    memset(assoc, 0, sizeof(IPPTsPng));
+    close_index_remove(dht, index);
+    switch_client_public_key(dht->log, dht->mono_time, dht->close_clientlist, index, public_key, ip_port);
+    close_index_add(dht, index);
     return 1;
 }
 
@@ -785,99 +1093,190 @@ static uint8_t hardening_correct(const Hardening *h)
     return h->routes_requests_ok + (h->send_nodes_ok << 1) + (h->testing_requests << 2);
 }
 
+/* The nodes closest to public_key found so far, from the closest on. */
+typedef struct Close_Nodes {
+    const uint8_t *public_key;
+    Node_format *nodes;
+    Pk_Distance distances[MAX_SENT_NODES];
+    uint32_t num_nodes;
+} Close_Nodes;
+
+/* return true if a node at distance would go into close_nodes. */
+static bool close_nodes_closer(const Close_Nodes *close_nodes, const Pk_Distance *distance)
+{
+    return close_nodes->num_nodes < MAX_SENT_NODES
+           || pk_distance_cmp(distance, &close_nodes->distances[MAX_SENT_NODES - 1]) < 0;
+}
+
+/* Add the node at distance to close_nodes, keeping them in order. The caller
+ * checks that it is closer than one of them, or that there is room. A node
+ * that is there already is left alone.
+ */
+static void close_nodes_add(Close_Nodes *close_nodes, const Pk_Distance *distance, const uint8_t *public_key,
+                            const IP_Port *ip_port)
+{
+    uint32_t i = close_nodes->num_nodes;
+
+    for (; i > 0; --i) {
+        const int cmp = pk_distance_cmp(distance, &close_nodes->distances[i - 1]);
+
+        // Only the same key is at the same distance.
+        if (cmp == 0) {
+            return;
+        }
+
+        if (cmp > 0) {
+            break;
+        }
+    }
+
+    const uint32_t last = min_u32(close_nodes->num_nodes, MAX_SENT_NODES - 1);
+    memmove(&close_nodes->nodes[i + 1], &close_nodes->nodes[i], (last - i) * sizeof(Node_format));
+    memmove(&close_nodes->distances[i + 1], &close_nodes->distances[i], (last - i) * sizeof(Pk_Distance));
+
+    memcpy(close_nodes->nodes[i].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    close_nodes->nodes[i].ip_port = *ip_port;
+    close_nodes->distances[i] = *distance;
+
+    if (close_nodes->num_nodes < MAX_SENT_NODES) {
+        ++close_nodes->num_nodes;
+    }
+}
+
 /*
  * helper for get_close_nodes(). argument list is a monster :D
  */
-static void get_close_nodes_inner(const Mono_Time *mono_time, const uint8_t *public_key, Node_format *nodes_list,
-                                  Family sa_family, const Client_data *client_list, uint32_t client_list_length,
-                                  uint32_t *num_nodes_ptr, bool is_LAN, uint8_t want_good)
+static void get_close_nodes_inner(uint64_t cur_time, Close_Nodes *close_nodes, Family sa_family,
+                                  const Client_data *client_list, uint32_t client_list_length, bool is_LAN,
+                                  uint8_t want_good)
 {
     if (!net_family_is_ipv4(sa_family) && !net_family_is_ipv6(sa_family) && !net_family_is_unspec(sa_family)) {
         return;
     }
 
-    uint32_t num_nodes = *num_nodes_ptr;
+    for (uint32_t start = 0; start < client_list_length; start += 32) {
+        const uint32_t num_clients = min_u32(client_list_length - start, 32);
+        const Client_data *const clients = &client_list[start];
 
-    for (uint32_t i = 0; i < client_list_length; ++i) {
-        const Client_data *const client = &client_list[i];
+        // Once there are enough nodes only those closer than the furthest of
+        // them are looked at. That one gets closer as nodes are added, so some
+        // of the candidates may still be dropped by close_nodes_closer.
+        const uint32_t candidates = close_nodes->num_nodes < MAX_SENT_NODES
+                                    ? UINT32_MAX
+                                    : pk_closer_than(close_nodes->public_key, &close_nodes->distances[MAX_SENT_NODES - 1],
+                                                     clients[0].public_key, sizeof(Client_data), num_clients);
 
-        /* node already in list? */
-        if (index_of_node_pk(nodes_list, MAX_SENT_NODES, client->public_key) != UINT32_MAX) {
-            continue;
-        }
+        for (uint32_t i = 0; i < num_clients; ++i) {
+            if ((candidates & (UINT32_C(1) << i)) == 0) {
+                continue;
+            }
 
-        const IPPTsPng *ipptp;
+            const Client_data *const client = &clients[i];
 
-        if (net_family_is_ipv4(sa_family)) {
-            ipptp = &client->assoc4;
-        } else if (net_family_is_ipv6(sa_family)) {
-            ipptp = &client->assoc6;
-        } else if (client->assoc4.timestamp >= client->assoc6.timestamp) {
-            ipptp = &client->assoc4;
-        } else {
-            ipptp = &client->assoc6;
-        }
+            const IPPTsPng *ipptp;
 
-        /* node not in a good condition? */
-        if (assoc_timeout(mono_time, ipptp)) {
-            continue;
-        }
+            if (net_family_is_ipv4(sa_family)) {
+                ipptp = &client->assoc4;
+            } else if (net_family_is_ipv6(sa_family)) {
+                ipptp = &client->assoc6;
+            } else if (client->assoc4.timestamp >= client->assoc6.timestamp) {
+                ipptp = &client->assoc4;
+            } else {
+                ipptp = &client->assoc6;
+            }
 
-        /* don't send LAN ips to non LAN peers */
-        if (ip_is_lan(ipptp->ip_port.ip) && !is_LAN) {
-            continue;
-        }
+            /* node not in a good condition? */
+            if (assoc_timeout_at(cur_time, ipptp)) {
+                continue;
+            }
 
-        if (!ip_is_lan(ipptp->ip_port.ip) && want_good && hardening_correct(&ipptp->hardening) != HARDENING_ALL_OK
-                && !id_equal(public_key, client->public_key)) {
-            continue;
-        }
+            Pk_Distance distance;
+            pk_distance(&distance, close_nodes->public_key, client->public_key);
 
-        if (num_nodes < MAX_SENT_NODES) {
-            memcpy(nodes_list[num_nodes].public_key, client->public_key, CRYPTO_PUBLIC_KEY_SIZE);
-            nodes_list[num_nodes].ip_port = ipptp->ip_port;
-            ++num_nodes;
-        } else {
-            add_to_list(nodes_list, MAX_SENT_NODES, client->public_key, ipptp->ip_port, public_key);
+            if (!close_nodes_closer(close_nodes, &distance)) {
+                continue;
+            }
+
+            /* don't send LAN ips to non LAN peers */
+            if (ip_is_lan(ipptp->ip_port.ip) && !is_LAN) {
+                continue;
+            }
+
+            if (!ip_is_lan(ipptp->ip_port.ip) && want_good && hardening_correct(&ipptp->hardening) != HARDENING_ALL_OK
+                    && !id_equal(close_nodes->public_key, client->public_key)) {
+                continue;
+            }
+
+            close_nodes_add(close_nodes, &distance, client->public_key, &ipptp->ip_port);
         }
     }
+}
 
-    *num_nodes_ptr = num_nodes;
+/* get_close_nodes_inner for the close list, going through its buckets from the
+ * closest to public_key outwards and stopping once no further bucket can have
+ * closer nodes than those found.
+ */
+static void get_close_nodes_close_list(const DHT *dht, uint64_t cur_time, Close_Nodes *close_nodes, Family sa_family,
+                                       bool is_LAN)
+{
+    unsigned int bucket = pk_common_prefix(close_nodes->public_key, dht->self_public_key);
+
+    if (bucket >= LCLIENT_LENGTH) {
+        bucket = LCLIENT_LENGTH - 1;
+    }
+
+    // Nodes in the bucket of public_key share a longer prefix with it than any others.
+    get_close_nodes_inner(cur_time, close_nodes, sa_family, &dht->close_clientlist[bucket * LCLIENT_NODES],
+                          LCLIENT_NODES, is_LAN, 0);
+
+    if (close_nodes->num_nodes >= MAX_SENT_NODES) {
+        return;
+    }
+
+    // Nodes in the later buckets all share the prefix that public_key shares with us.
+    get_close_nodes_inner(cur_time, close_nodes, sa_family, &dht->close_clientlist[(bucket + 1) * LCLIENT_NODES],
+                          (LCLIENT_LENGTH - bucket - 1) * LCLIENT_NODES, is_LAN, 0);
+
+    // Nodes in each earlier bucket share a shorter prefix with it than those before.
+    while (bucket > 0 && close_nodes->num_nodes < MAX_SENT_NODES) {
+        --bucket;
+        get_close_nodes_inner(cur_time, close_nodes, sa_family, &dht->close_clientlist[bucket * LCLIENT_NODES],
+                              LCLIENT_NODES, is_LAN, 0);
+    }
 }
 
 /* Find MAX_SENT_NODES nodes closest to the public_key for the send nodes request:
- * put them in the nodes_list and return how many were found.
- *
- * TODO(irungentoo): For the love of based <your favorite deity, in doubt use
- * "love"> make this function cleaner and much more efficient.
+ * put them in the nodes_list, closest first, and return how many were found.
  *
  * want_good : do we want only good nodes as checked with the hardening returned or not?
  */
 static int get_somewhat_close_nodes(const DHT *dht, const uint8_t *public_key, Node_format *nodes_list,
                                     Family sa_family, bool is_LAN, uint8_t want_good)
 {
-    uint32_t num_nodes = 0;
-    get_close_nodes_inner(dht->mono_time, public_key, nodes_list, sa_family,
-                          dht->close_clientlist, LCLIENT_LIST, &num_nodes, is_LAN, 0);
+    Close_Nodes close_nodes;
+    close_nodes.public_key = public_key;
+    close_nodes.nodes = nodes_list;
+    close_nodes.num_nodes = 0;
+
+    const uint64_t cur_time = mono_time_get(dht->mono_time);
+    get_close_nodes_close_list(dht, cur_time, &close_nodes, sa_family, is_LAN);
 
     /* TODO(irungentoo): uncomment this when hardening is added to close friend clients */
 #if 0
 
     for (uint32_t i = 0; i < dht->num_friends; ++i) {
-        get_close_nodes_inner(dht->mono_time, public_key, nodes_list, sa_family,
-                              dht->friends_list[i].client_list, MAX_FRIEND_CLIENTS,
-                              &num_nodes, is_LAN, want_good);
+        get_close_nodes_inner(cur_time, &close_nodes, sa_family, dht->friends_list[i].client_list,
+                              MAX_FRIEND_CLIENTS, is_LAN, want_good);
     }
 
 #endif
 
     for (uint32_t i = 0; i < dht->num_friends; ++i) {
-        get_close_nodes_inner(dht->mono_time, public_key, nodes_list, sa_family,
-                              dht->friends_list[i].client_list, MAX_FRIEND_CLIENTS,
-                              &num_nodes, is_LAN, 0);
+        get_close_nodes_inner(cur_time, &close_nodes, sa_family, dht->friends_list[i].client_list,
+                              MAX_FRIEND_CLIENTS, is_LAN, 0);
     }
 
-    return num_nodes;
+    return close_nodes.num_nodes;
 }
 
 int get_close_nodes(const DHT *dht, const uint8_t *public_key, Node_format *nodes_list, Family sa_family,
@@ -887,66 +1286,11 @@ int get_close_nodes(const DHT *dht, const uint8_t *public_key, Node_format *node
     return get_somewhat_close_nodes(dht, public_key, nodes_list, sa_family, is_LAN, want_good);
 }
 
-typedef struct DHT_Cmp_data {
-    const Mono_Time *mono_time;
-    const uint8_t *base_public_key;
-    Client_data entry;
-} DHT_Cmp_data;
-
 static bool incorrect_hardening(const IPPTsPng *assoc)
 {
     return hardening_correct(&assoc->hardening) != HARDENING_ALL_OK;
 }
 
-static int cmp_dht_entry(const void *a, const void *b)
-{
-    DHT_Cmp_data cmp1;
-    DHT_Cmp_data cmp2;
-    memcpy(&cmp1, a, sizeof(DHT_Cmp_data));
-    memcpy(&cmp2, b, sizeof(DHT_Cmp_data));
-    const Client_data entry1 = cmp1.entry;
-    const Client_data entry2 = cmp2.entry;
-    const uint8_t *cmp_public_key = cmp1.base_public_key;
-
-    bool t1 = assoc_timeout(cmp1.mono_time, &entry1.assoc4) && assoc_timeout(cmp1.mono_time, &entry1.assoc6);
-    bool t2 = assoc_timeout(cmp2.mono_time, &entry2.assoc4) && assoc_timeout(cmp2.mono_time, &entry2.assoc6);
-
-    if (t1 && t2) {
-        return 0;
-    }
-
-    if (t1) {
-        return -1;
-    }
-
-    if (t2) {
-        return 1;
-    }
-
-    t1 = incorrect_hardening(&entry1.assoc4) && incorrect_hardening(&entry1.assoc6);
-    t2 = incorrect_hardening(&entry2.assoc4) && incorrect_hardening(&entry2.assoc6);
-
-    if (t1 && !t2) {
-        return -1;
-    }
-
-    if (!t1 && t2) {
-        return 1;
-    }
-
-    const int close = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
-
-    if (close == 1) {
-        return 1;
-    }
-
-    if (close == 2) {
-        return -1;
-    }
-
-    return 0;
-}
-
 /* Is it ok to store node with public_key in client.
  *
  * return 0 if node can't be stored.
@@ -960,24 +1304,79 @@ static unsigned int store_node_ok(const Client_data *client, const Mono_Time *mo
            || id_closest(comp_public_key, client->public_key, public_key) == 2;
 }
 
+/* What a client list is sorted by, worked out once per node rather than at
+ * each comparison.
+ */
+typedef struct DHT_Sort_Key {
+    /* 0 if the node timed out, 1 if its hardening is incorrect, 2 if it is good. */
+    uint8_t rank;
+    Pk_Distance distance;
+    uint32_t index;
+} DHT_Sort_Key;
+
+/* return true if the node of key1 goes before the one of key2: nodes that timed
+ * out first, then those with incorrect hardening, then the rest from the one
+ * furthest from the key the list is sorted for.
+ */
+static bool sort_key_before(const DHT_Sort_Key *key1, const DHT_Sort_Key *key2)
+{
+    if (key1->rank != key2->rank) {
+        return key1->rank < key2->rank;
+    }
+
+    if (key1->rank == 0) {
+        return false;
+    }
+
+    return pk_distance_cmp(&key1->distance, &key2->distance) > 0;
+}
+
 static void sort_client_list(Client_data *list, const Mono_Time *mono_time, unsigned int length,
                              const uint8_t *comp_public_key)
 {
-    // Pass comp_public_key to qsort with each Client_data entry, so the
-    // comparison function can use it as the base of comparison.
-    VLA(DHT_Cmp_data, cmp_list, length);
+    const uint64_t cur_time = mono_time_get(mono_time);
+    VLA(DHT_Sort_Key, keys, length);
+    bool sorted = true;
 
+    // Client lists are short and mostly sorted already, so an insertion sort
+    // of the keys does few comparisons and moves no nodes that are in place.
     for (uint32_t i = 0; i < length; ++i) {
-        cmp_list[i].mono_time = mono_time;
-        cmp_list[i].base_public_key = comp_public_key;
-        cmp_list[i].entry = list[i];
+        const Client_data *const client = &list[i];
+        DHT_Sort_Key key;
+
+        if (assoc_timeout_at(cur_time, &client->assoc4) && assoc_timeout_at(cur_time, &client->assoc6)) {
+            key.rank = 0;
+        } else if (incorrect_hardening(&client->assoc4) && incorrect_hardening(&client->assoc6)) {
+            key.rank = 1;
+        } else {
+            key.rank = 2;
+        }
+
+        pk_distance(&key.distance, comp_public_key, client->public_key);
+        key.index = i;
+
+        uint32_t j = i;
+
+        while (j > 0 && sort_key_before(&key, &keys[j - 1])) {
+            keys[j] = keys[j - 1];
+            --j;
+        }
+
+        keys[j] = key;
+        sorted = sorted && j == i;
+    }
+
+    if (sorted) {
+        return;
     }
 
-    qsort(cmp_list, length, sizeof(DHT_Cmp_data), cmp_dht_entry);
+    VLA(Client_data, sorted_list, length);
 
     for (uint32_t i = 0; i < length; ++i) {
-        list[i] = cmp_list[i].entry;
+        sorted_list[i] = list[keys[i].index];
     }
+
+    memcpy(list, sorted_list, length * sizeof(Client_data));
 }
 
 static void update_client_with_reset(const Mono_Time *mono_time, Client_data *client, const IP_Port *ip_port)
@@ -1052,7 +1451,7 @@ static bool replace_all(const Mono_Time *mono_time,
  */
 static int add_to_close(DHT *dht, const uint8_t *public_key, IP_Port ip_port, bool simulate)
 {
-    unsigned int index = bit_by_bit_cmp(public_key, dht->self_public_key);
+    unsigned int index = pk_common_prefix(public_key, dht->self_public_key);
 
     if (index >= LCLIENT_LENGTH) {
         index = LCLIENT_LENGTH - 1;
@@ -1072,8 +1471,10 @@ static int add_to_close(DHT *dht, const uint8_t *public_key, IP_Port ip_port, bo
             return 0;
         }
 
+        close_index_remove(dht, (index * LCLIENT_NODES) + i);
         id_copy(client->public_key, public_key);
         update_client_with_reset(dht->mono_time, client, &ip_port);
+        close_index_add(dht, (index * LCLIENT_NODES) + i);
         return 0;
     }
 
@@ -1103,16 +1504,27 @@ static bool is_pk_in_client_list(const Client_data *list, unsigned int client_li
     return !assoc_timeout(mono_time, assoc);
 }
 
-static bool is_pk_in_close_list(DHT *dht, const uint8_t *public_key, IP_Port ip_port)
+static bool is_pk_in_close_list(const DHT *dht, const uint8_t *public_key, IP_Port ip_port)
 {
-    unsigned int index = bit_by_bit_cmp(public_key, dht->self_public_key);
+    const Client_data *const client = dht_find_close_client(dht, public_key);
 
-    if (index >= LCLIENT_LENGTH) {
-        index = LCLIENT_LENGTH - 1;
+    return client != nullptr && is_pk_in_client_list(client, 1, dht->mono_time, public_key, ip_port);
+}
+
+bool dht_node_is_alive(const DHT *dht, const uint8_t *public_key, IP_Port ip_port)
+{
+    if (is_pk_in_close_list(dht, public_key, ip_port)) {
+        return true;
     }
 
-    return is_pk_in_client_list(dht->close_clientlist + index * LCLIENT_NODES, LCLIENT_NODES, dht->mono_time, public_key,
-                                ip_port);
+    for (uint32_t i = 0; i < dht->num_friends; ++i) {
+        if (is_pk_in_client_list(dht->friends_list[i].client_list, MAX_FRIEND_CLIENTS, dht->mono_time, public_key,
+                                 ip_port)) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /* Check if the node obtained with a get_nodes with public_key should be pinged.
@@ -1199,8 +1611,7 @@ uint32_t addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *public_key)
     /* NOTE: Current behavior if there are two clients with the same id is
      * to replace the first ip by the second.
      */
-    const bool in_close_list = client_or_ip_port_in_list(dht->log, dht->mono_time, dht->close_clientlist, LCLIENT_LIST,
-                               public_key, ip_port);
+    const bool in_close_list = client_or_ip_port_in_close_list(dht, public_key, ip_port);
 
     /* add_to_close should be called only if !in_list (don't extract to variable) */
     if (in_close_list || add_to_close(dht, public_key, ip_port, 0)) {
@@ -1281,7 +1692,12 @@ static void returnedip_ports(DHT *dht, IP_Port ip_port, const uint8_t *public_ke
     }
 
     if (id_equal(public_key, dht->self_public_key)) {
-        update_client_data(dht->mono_time, dht->close_clientlist, LCLIENT_LIST, ip_port, nodepublic_key, true);
+        const uint32_t index = close_index_of_pk(dht, nodepublic_key);
+
+        if (index != UINT32_MAX) {
+            update_client_data(dht->mono_time, &dht->close_clientlist[index], 1, ip_port, nodepublic_key, true);
+        }
+
         return;
     }
 
@@ -1867,20 +2283,19 @@ int dht_bootstrap_from_address(DHT *dht, const char *address, uint8_t ipv6enable
  */
 int route_packet(const DHT *dht, const uint8_t *public_key, const uint8_t *packet, uint16_t length)
 {
-    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
-        if (id_equal(public_key, dht->close_clientlist[i].public_key)) {
-            const Client_data *const client = &dht->close_clientlist[i];
-            const IPPTsPng *const assocs[] = { &client->assoc6, &client->assoc4, nullptr };
+    const Client_data *const client = dht_find_close_client(dht, public_key);
 
-            for (const IPPTsPng * const *it = assocs; *it; ++it) {
-                const IPPTsPng *const assoc = *it;
+    if (client == nullptr) {
+        return -1;
+    }
 
-                if (ip_isset(&assoc->ip_port.ip)) {
-                    return sendpacket(dht->net, assoc->ip_port, packet, length);
-                }
-            }
+    const IPPTsPng *const assocs[] = { &client->assoc6, &client->assoc4, nullptr };
 
-            break;
+    for (const IPPTsPng * const *it = assocs; *it; ++it) {
+        const IPPTsPng *const assoc = *it;
+
+        if (ip_isset(&assoc->ip_port.ip)) {
+            return sendpacket(dht->net, assoc->ip_port, packet, length);
         }
     }
 
@@ -2357,21 +2772,20 @@ static int send_hardening_getnode_res(const DHT *dht, const Node_format *sendto,
     return sendpacket(dht->net, sendto->ip_port, packet, len);
 }
 
-/* TODO(irungentoo): improve */
 static IPPTsPng *get_closelist_IPPTsPng(DHT *dht, const uint8_t *public_key, Family sa_family)
 {
-    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
-        if (!id_equal(dht->close_clientlist[i].public_key, public_key)) {
-            continue;
-        }
+    const uint32_t index = close_index_of_pk(dht, public_key);
 
-        if (net_family_is_ipv4(sa_family)) {
-            return &dht->close_clientlist[i].assoc4;
-        }
+    if (index == UINT32_MAX) {
+        return nullptr;
+    }
 
-        if (net_family_is_ipv6(sa_family)) {
-            return &dht->close_clientlist[i].assoc6;
-        }
+    if (net_family_is_ipv4(sa_family)) {
+        return &dht->close_clientlist[index].assoc4;
+    }
+
+    if (net_family_is_ipv6(sa_family)) {
+        return &dht->close_clientlist[index].assoc6;
     }
 
     return nullptr;
@@ -2727,7 +3141,13 @@ DHT *new_dht(const Logger *log, Mono_Time *mono_time, Networking_Core *net, bool
     dht->dht_ping_array = ping_array_new(DHT_PING_ARRAY_SIZE, PING_TIMEOUT);
     dht->dht_harden_ping_array = ping_array_new(DHT_PING_ARRAY_SIZE, PING_TIMEOUT);
 
-    if (dht->dht_ping_array == nullptr || dht->dht_harden_ping_array == nullptr) {
+    dht->shared_keys_recv = shared_keys_new(SHARED_KEYS_CAPACITY);
+    dht->shared_keys_sent = shared_keys_new(SHARED_KEYS_CAPACITY);
+
+    if (dht->dht_ping_array == nullptr || dht->dht_harden_ping_array == nullptr
+            || dht->shared_keys_recv == nullptr || dht->shared_keys_sent == nullptr
+            || !key_map_init(&dht->close_by_key, CRYPTO_PUBLIC_KEY_SIZE, LCLIENT_LIST)
+            || !key_map_init(&dht->close_by_ip_port, SIZE_IPPORT, LCLIENT_LIST * 2)) {
         kill_dht(dht);
         return nullptr;
     }
@@ -2777,6 +3197,10 @@ void kill_dht(DHT *dht)
     ping_array_kill(dht->dht_ping_array);
     ping_array_kill(dht->dht_harden_ping_array);
     ping_kill(dht->ping);
+    shared_keys_free(dht->shared_keys_recv);
+    shared_keys_free(dht->shared_keys_sent);
+    key_map_free(&dht->close_by_key);
+    key_map_free(&dht->close_by_ip_port);
     free(dht->friends_list);
     free(dht->loaded_nodes_list);
     free(dht);
@@ -3010,6 +3434,30 @@ bool dht_non_lan_connected(const DHT *dht)
     return false;
 }
 
+void dht_get_stats(const DHT *dht, DHT_Stats *stats)
+{
+    memset(stats, 0, sizeof(DHT_Stats));
+
+    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
+        const Client_data *const client = &dht->close_clientlist[i];
+
+        if (!assoc_timeout(dht->mono_time, &client->assoc4) ||
+                !assoc_timeout(dht->mono_time, &client->assoc6)) {
+            ++stats->close_nodes;
+        }
+    }
+
+    stats->friends = dht->num_friends;
+
+    Shared_Keys_Stats recv_stats;
+    Shared_Keys_Stats sent_stats;
+    shared_keys_get_stats(dht->shared_keys_recv, &recv_stats);
+    shared_keys_get_stats(dht->shared_keys_sent, &sent_stats);
+    stats->shared_keys.hits = recv_stats.hits + sent_stats.hits;
+    stats->shared_keys.misses = recv_stats.misses + sent_stats.misses;
+    stats->shared_keys.evictions = recv_stats.evictions + sent_stats.evictions;
+}
+
 /* Copies our own ip_port structure to dest. WAN addresses take priority over LAN addresses.
  *
  * Return 0 if our ip port can't be found (this usually means we're not connected to the DHT).
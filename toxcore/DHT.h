@@ -17,6 +17,10 @@
 
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Encryption and signature keys definition */
 #define ENC_PUBLIC_KEY CRYPTO_PUBLIC_KEY_SIZE
 #define ENC_SECRET_KEY CRYPTO_SECRET_KEY_SIZE
@@ -202,21 +206,34 @@ int unpack_nodes(Node_format *nodes, uint16_t max_num_nodes, uint16_t *processed
 
 
 /*----------------------------------------------------------------------------------*/
-/* struct to store some shared keys so we don't have to regenerate them for each request. */
-#define MAX_KEYS_PER_SLOT 4
+/* Cache of shared keys so we don't have to regenerate them for each request.
+ *
+ * Keys are found by a hash of the full public key. When the cache is full the
+ * least recently used key (approximated with the CLOCK algorithm) is evicted.
+ */
+#ifndef SHARED_KEYS_CAPACITY
+#define SHARED_KEYS_CAPACITY 1024
+#endif
 #define KEYS_TIMEOUT 600
 
-typedef struct Shared_Key {
-    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
-    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    uint32_t times_requested;
-    bool stored;
-    uint64_t time_last_requested;
-} Shared_Key;
+typedef struct Shared_Keys Shared_Keys;
+
+typedef struct Shared_Keys_Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} Shared_Keys_Stats;
+
+/* Create a shared key cache holding at most capacity keys.
+ *
+ * return nullptr on failure.
+ */
+Shared_Keys *shared_keys_new(uint32_t capacity);
+
+void shared_keys_free(Shared_Keys *shared_keys);
 
-typedef struct Shared_Keys {
-    Shared_Key keys[256 * MAX_KEYS_PER_SLOT];
-} Shared_Keys;
+/* Copy the hit, miss and eviction counters of the cache into stats. */
+void shared_keys_get_stats(const Shared_Keys *shared_keys, Shared_Keys_Stats *stats);
 
 /*----------------------------------------------------------------------------------*/
 
@@ -235,6 +252,8 @@ Networking_Core *dht_get_net(const DHT *dht);
 struct Ping *dht_get_ping(const DHT *dht);
 const Client_data *dht_get_close_clientlist(const DHT *dht);
 const Client_data *dht_get_close_client(const DHT *dht, uint32_t client_num);
+/* Return the node of the close list with public_key, or NULL if there is none. */
+const Client_data *dht_find_close_client(const DHT *dht, const uint8_t *public_key);
 uint16_t dht_get_num_friends(const DHT *dht);
 
 DHT_Friend *dht_get_friend(DHT *dht, uint32_t friend_num);
@@ -319,6 +338,11 @@ bool add_to_list(Node_format *nodes_list, uint32_t length, const uint8_t *pk, IP
  */
 bool node_addable_to_close_list(DHT *dht, const uint8_t *public_key, IP_Port ip_port);
 
+/* return true if the node with public_key is in the close list or the list of
+ * a friend, and we heard from it over the family of ip_port recently.
+ */
+bool dht_node_is_alive(const DHT *dht, const uint8_t *public_key, IP_Port ip_port);
+
 /* Get the (maximum MAX_SENT_NODES) closest nodes to public_key we know
  * and put them in nodes_list (must be MAX_SENT_NODES big).
  *
@@ -424,6 +448,14 @@ bool dht_isconnected(const DHT *dht);
  */
 bool dht_non_lan_connected(const DHT *dht);
 
+typedef struct DHT_Stats {
+    uint32_t close_nodes; /* nodes in the close list that answered recently */
+    uint16_t friends;
+    Shared_Keys_Stats shared_keys; /* of the caches for received and sent packets */
+} DHT_Stats;
+
+void dht_get_stats(const DHT *dht, DHT_Stats *stats);
+
 
 uint32_t addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *public_key);
 
@@ -435,4 +467,8 @@ uint32_t addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *public_key);
  */
 unsigned int ipport_self_copy(const DHT *dht, IP_Port *dest);
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif
@@ -0,0 +1,100 @@
+#include "DHT.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "crypto_core.h"
+#include "mono_time.h"
+
+namespace {
+
+struct Shared_Keys_Deleter {
+  void operator()(Shared_Keys *keys) { shared_keys_free(keys); }
+};
+
+using Shared_Keys_Ptr = std::unique_ptr<Shared_Keys, Shared_Keys_Deleter>;
+
+struct Mono_Time_Deleter {
+  void operator()(Mono_Time *mono_time) { mono_time_free(mono_time); }
+};
+
+using Mono_Time_Ptr = std::unique_ptr<Mono_Time, Mono_Time_Deleter>;
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+using SecretKey = std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE>;
+using SharedKey = std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE>;
+
+PublicKey random_pk() {
+  PublicKey pk;
+  SecretKey sk;
+  crypto_new_keypair(pk.data(), sk.data());
+  return pk;
+}
+
+TEST(SharedKeys, MinimumCapacityIsOne) {
+  EXPECT_EQ(shared_keys_new(0), nullptr);
+  EXPECT_NE(Shared_Keys_Ptr(shared_keys_new(1)), nullptr);
+}
+
+TEST(SharedKeys, SecondRequestIsAHit) {
+  Mono_Time_Ptr mono_time(mono_time_new());
+  Shared_Keys_Ptr keys(shared_keys_new(4));
+  PublicKey self_pk;
+  SecretKey self_sk;
+  crypto_new_keypair(self_pk.data(), self_sk.data());
+
+  const PublicKey pk = random_pk();
+  SharedKey first, second, expected;
+  encrypt_precompute(pk.data(), self_sk.data(), expected.data());
+
+  get_shared_key(mono_time.get(), keys.get(), first.data(), self_sk.data(), pk.data());
+  get_shared_key(mono_time.get(), keys.get(), second.data(), self_sk.data(), pk.data());
+
+  EXPECT_EQ(first, expected);
+  EXPECT_EQ(second, expected);
+
+  Shared_Keys_Stats stats;
+  shared_keys_get_stats(keys.get(), &stats);
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.evictions, 0);
+}
+
+TEST(SharedKeys, EvictionKeepsReturningCorrectKeys) {
+  Mono_Time_Ptr mono_time(mono_time_new());
+  Shared_Keys_Ptr keys(shared_keys_new(8));
+  PublicKey self_pk;
+  SecretKey self_sk;
+  crypto_new_keypair(self_pk.data(), self_sk.data());
+
+  std::vector<PublicKey> pks;
+  std::vector<SharedKey> expected;
+
+  for (int i = 0; i < 32; ++i) {
+    pks.push_back(random_pk());
+    SharedKey shared;
+    encrypt_precompute(pks.back().data(), self_sk.data(), shared.data());
+    expected.push_back(shared);
+  }
+
+  for (int round = 0; round < 4; ++round) {
+    for (size_t i = 0; i < pks.size(); ++i) {
+      // Request the first few keys much more often so they stay cached.
+      const size_t index = (i % 2 == 0) ? i % 4 : i;
+      SharedKey shared;
+      get_shared_key(mono_time.get(), keys.get(), shared.data(), self_sk.data(), pks[index].data());
+      ASSERT_EQ(shared, expected[index]);
+    }
+  }
+
+  Shared_Keys_Stats stats;
+  shared_keys_get_stats(keys.get(), &stats);
+  EXPECT_EQ(stats.hits + stats.misses, 4 * pks.size());
+  EXPECT_EQ(stats.evictions, stats.misses - 8);
+  EXPECT_GE(stats.hits, 4 * 16 - 4);
+}
+
+}  // namespace
@@ -449,6 +449,8 @@ static int do_receipts(Messenger *m, int32_t friendnumber, void *userdata)
     return 0;
 }
 
+static void clear_file_transfers(Messenger *m, int32_t friendnumber);
+
 /* Remove a friend.
  *
  *  return 0 if success.
@@ -465,6 +467,7 @@ int m_delfriend(Messenger *m, int32_t friendnumber)
     }
 
     clear_receipts(m, friendnumber);
+    clear_file_transfers(m, friendnumber);
     remove_request_received(m->fr, m->friendlist[friendnumber].real_pk);
     friend_connection_callbacks(m->fr_c, m->friendlist[friendnumber].friendcon_id, MESSENGER_CALLBACK_INDEX, nullptr,
                                 nullptr, nullptr, nullptr, 0);
@@ -970,7 +973,7 @@ static void check_friend_tcp_udp(Messenger *m, int32_t friendnumber, void *userd
     m->friendlist[friendnumber].last_connection_udp_tcp = ret;
 }
 
-static void break_files(const Messenger *m, int32_t friendnumber);
+static void break_files(Messenger *m, int32_t friendnumber);
 static void check_friend_connectionstatus(Messenger *m, int32_t friendnumber, uint8_t status, void *userdata)
 {
     if (status == NOFRIEND) {
@@ -1107,6 +1110,109 @@ void callback_file_reqchunk(Messenger *m, m_file_chunk_request_cb *function)
 
 #define MAX_FILENAME_LENGTH 255
 
+/* Return the transfer with filenumber in list, or NULL if there is none.
+ * The transfer may have ended (FILESTATUS_NONE) without having been released yet.
+ */
+static struct File_Transfers *find_file_transfer(struct File_Transfers *list, uint8_t filenumber)
+{
+    for (struct File_Transfers *ft = list; ft != nullptr && ft->filenumber <= filenumber; ft = ft->next) {
+        if (ft->filenumber == filenumber) {
+            return ft;
+        }
+    }
+
+    return nullptr;
+}
+
+/* Return a cleared transfer with filenumber in list, taking a new one from the pool if the
+ * list does not hold an ended transfer with that number.
+ *
+ * return NULL on allocation failure or if filenumber is still in use.
+ */
+static struct File_Transfers *new_file_transfer(Messenger *m, struct File_Transfers **list, uint8_t filenumber)
+{
+    while (*list != nullptr && (*list)->filenumber < filenumber) {
+        list = &(*list)->next;
+    }
+
+    struct File_Transfers *ft = *list;
+
+    if (ft != nullptr && ft->filenumber == filenumber) {
+        if (ft->status != FILESTATUS_NONE) {
+            return nullptr;
+        }
+
+        struct File_Transfers *const next = ft->next;
+        memset(ft, 0, sizeof(struct File_Transfers));
+        ft->filenumber = filenumber;
+        ft->next = next;
+        return ft;
+    }
+
+    if (m->file_transfer_pool != nullptr) {
+        ft = m->file_transfer_pool;
+        m->file_transfer_pool = ft->next;
+        memset(ft, 0, sizeof(struct File_Transfers));
+    } else {
+        ft = (struct File_Transfers *)calloc(1, sizeof(struct File_Transfers));
+
+        if (ft == nullptr) {
+            return nullptr;
+        }
+    }
+
+    ft->filenumber = filenumber;
+    ft->next = *list;
+    *list = ft;
+    return ft;
+}
+
+/* Give the ended transfers in list back to the pool. Transfers are only released here so
+ * that callbacks ending a transfer never free one that is being iterated over.
+ */
+static void release_file_transfers(Messenger *m, struct File_Transfers **list)
+{
+    while (*list != nullptr) {
+        struct File_Transfers *const ft = *list;
+
+        if (ft->status != FILESTATUS_NONE) {
+            list = &ft->next;
+            continue;
+        }
+
+        *list = ft->next;
+        ft->next = m->file_transfer_pool;
+        m->file_transfer_pool = ft;
+    }
+}
+
+static void free_file_transfers(struct File_Transfers *list)
+{
+    while (list != nullptr) {
+        struct File_Transfers *const next = list->next;
+        free(list);
+        list = next;
+    }
+}
+
+/* Give all transfers of a friend that is being removed back to the pool. */
+static void clear_file_transfers(Messenger *m, int32_t friendnumber)
+{
+    Friend *const f = &m->friendlist[friendnumber];
+
+    for (struct File_Transfers *ft = f->file_sending; ft != nullptr; ft = ft->next) {
+        ft->status = FILESTATUS_NONE;
+    }
+
+    for (struct File_Transfers *ft = f->file_receiving; ft != nullptr; ft = ft->next) {
+        ft->status = FILESTATUS_NONE;
+    }
+
+    release_file_transfers(m, &f->file_sending);
+    release_file_transfers(m, &f->file_receiving);
+    f->num_sending_files = 0;
+}
+
 /* Copy the file transfer file id to file_id
  *
  * return 0 on success.
@@ -1144,12 +1250,12 @@ int file_get_id(const Messenger *m, int32_t friendnumber, uint32_t filenumber, u
     struct File_Transfers *ft;
 
     if (send_receive) {
-        ft = &m->friendlist[friendnumber].file_receiving[file_number];
+        ft = find_file_transfer(m->friendlist[friendnumber].file_receiving, file_number);
     } else {
-        ft = &m->friendlist[friendnumber].file_sending[file_number];
+        ft = find_file_transfer(m->friendlist[friendnumber].file_sending, file_number);
     }
 
-    if (ft->status == FILESTATUS_NONE) {
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
         return -2;
     }
 
@@ -1196,7 +1302,7 @@ static int file_sendrequest(const Messenger *m, int32_t friendnumber, uint8_t fi
  *  return -4 if could not send packet (friend offline).
  *
  */
-long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
+long int new_filesender(Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
                         const uint8_t *file_id, const uint8_t *filename, uint16_t filename_length)
 {
     if (!friend_is_valid(m, friendnumber)) {
@@ -1207,24 +1313,31 @@ long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_
         return -2;
     }
 
-    uint32_t i;
+    uint32_t i = 0;
 
-    for (i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
-        if (m->friendlist[friendnumber].file_sending[i].status == FILESTATUS_NONE) {
+    /* The list is sorted, so the first gap or ended transfer is the lowest free number. */
+    for (const struct File_Transfers *ft = m->friendlist[friendnumber].file_sending; ft != nullptr; ft = ft->next) {
+        if (ft->filenumber != i || ft->status == FILESTATUS_NONE) {
             break;
         }
+
+        ++i;
     }
 
     if (i == MAX_CONCURRENT_FILE_PIPES) {
         return -3;
     }
 
+    struct File_Transfers *ft = new_file_transfer(m, &m->friendlist[friendnumber].file_sending, i);
+
+    if (ft == nullptr) {
+        return -3;
+    }
+
     if (file_sendrequest(m, friendnumber, i, file_type, filesize, file_id, filename, filename_length) == 0) {
         return -4;
     }
 
-    struct File_Transfers *ft = &m->friendlist[friendnumber].file_sending[i];
-
     ft->status = FILESTATUS_NOT_ACCEPTED;
 
     ft->size = filesize;
@@ -1307,12 +1420,12 @@ int file_control(const Messenger *m, int32_t friendnumber, uint32_t filenumber,
     struct File_Transfers *ft;
 
     if (send_receive) {
-        ft = &m->friendlist[friendnumber].file_receiving[file_number];
+        ft = find_file_transfer(m->friendlist[friendnumber].file_receiving, file_number);
     } else {
-        ft = &m->friendlist[friendnumber].file_sending[file_number];
+        ft = find_file_transfer(m->friendlist[friendnumber].file_sending, file_number);
     }
 
-    if (ft->status == FILESTATUS_NONE) {
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
         return -3;
     }
 
@@ -1403,9 +1516,9 @@ int file_seek(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uin
     uint8_t file_number = temp_filenum;
 
     // We're always receiving at this point.
-    struct File_Transfers *ft = &m->friendlist[friendnumber].file_receiving[file_number];
+    struct File_Transfers *ft = find_file_transfer(m->friendlist[friendnumber].file_receiving, file_number);
 
-    if (ft->status == FILESTATUS_NONE) {
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
         return -3;
     }
 
@@ -1480,9 +1593,9 @@ int file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uin
         return -3;
     }
 
-    struct File_Transfers *ft = &m->friendlist[friendnumber].file_sending[filenumber];
+    struct File_Transfers *ft = find_file_transfer(m->friendlist[friendnumber].file_sending, filenumber);
 
-    if (ft->status != FILESTATUS_TRANSFERRING) {
+    if (ft == nullptr || ft->status != FILESTATUS_TRANSFERRING) {
         return -4;
     }
 
@@ -1548,19 +1661,17 @@ int file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uin
 static bool do_all_filetransfers(Messenger *m, int32_t friendnumber, void *userdata, uint32_t *free_slots)
 {
     Friend *const friendcon = &m->friendlist[friendnumber];
-    uint32_t num = friendcon->num_sending_files;
 
     bool any_active_fts = false;
 
-    // Iterate over all file transfers, including inactive ones. I.e. we always
-    // iterate exactly MAX_CONCURRENT_FILE_PIPES times.
-    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
-        struct File_Transfers *const ft = &friendcon->file_sending[i];
+    // Iterate over the transfers we started. Ended ones are only released
+    // outside this loop, so callbacks killing a transfer are safe.
+    for (struct File_Transfers *ft = friendcon->file_sending; ft != nullptr; ft = ft->next) {
+        const uint8_t i = ft->filenumber;
 
         // Any status other than NONE means the file transfer is active.
         if (ft->status != FILESTATUS_NONE) {
             any_active_fts = true;
-            --num;
 
             // If the file transfer is complete, we request a chunk of size 0.
             if (ft->status == FILESTATUS_FINISHED && friend_received_packet(m, friendnumber, ft->last_packet_number) == 0) {
@@ -1612,10 +1723,6 @@ static bool do_all_filetransfers(Messenger *m, int32_t friendnumber, void *userd
             // The allocated slot is no longer free.
             --*free_slots;
         }
-
-        if (num == 0) {
-            continue;
-        }
     }
 
     return any_active_fts;
@@ -1660,18 +1767,20 @@ static void do_reqchunk_filecb(Messenger *m, int32_t friendnumber, void *userdat
 /* Run this when the friend disconnects.
  *  Kill all current file transfers.
  */
-static void break_files(const Messenger *m, int32_t friendnumber)
+static void break_files(Messenger *m, int32_t friendnumber)
 {
     // TODO(irungentoo): Inform the client which file transfers get killed with a callback?
-    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
-        if (m->friendlist[friendnumber].file_sending[i].status != FILESTATUS_NONE) {
-            m->friendlist[friendnumber].file_sending[i].status = FILESTATUS_NONE;
-        }
+    Friend *const f = &m->friendlist[friendnumber];
 
-        if (m->friendlist[friendnumber].file_receiving[i].status != FILESTATUS_NONE) {
-            m->friendlist[friendnumber].file_receiving[i].status = FILESTATUS_NONE;
-        }
+    for (struct File_Transfers *ft = f->file_sending; ft != nullptr; ft = ft->next) {
+        ft->status = FILESTATUS_NONE;
     }
+
+    for (struct File_Transfers *ft = f->file_receiving; ft != nullptr; ft = ft->next) {
+        ft->status = FILESTATUS_NONE;
+    }
+
+    f->num_sending_files = 0;
 }
 
 static struct File_Transfers *get_file_transfer(uint8_t receive_send, uint8_t filenumber,
@@ -1681,13 +1790,13 @@ static struct File_Transfers *get_file_transfer(uint8_t receive_send, uint8_t fi
 
     if (receive_send == 0) {
         *real_filenumber = (filenumber + 1) << 16;
-        ft = &sender->file_receiving[filenumber];
+        ft = find_file_transfer(sender->file_receiving, filenumber);
     } else {
         *real_filenumber = filenumber;
-        ft = &sender->file_sending[filenumber];
+        ft = find_file_transfer(sender->file_sending, filenumber);
     }
 
-    if (ft->status == FILESTATUS_NONE) {
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
         return nullptr;
     }
 
@@ -2177,8 +2286,12 @@ void kill_messenger(Messenger *m)
 
     for (i = 0; i < m->numfriends; ++i) {
         clear_receipts(m, i);
+        free_file_transfers(m->friendlist[i].file_sending);
+        free_file_transfers(m->friendlist[i].file_receiving);
     }
 
+    free_file_transfers(m->file_transfer_pool);
+
     logger_kill(m->log);
     free(m->friendlist);
     friendreq_kill(m->fr);
@@ -2387,9 +2500,9 @@ static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t le
             file_type = net_ntohl(file_type);
 
             net_unpack_u64(data + 1 + sizeof(uint32_t), &filesize);
-            struct File_Transfers *ft = &m->friendlist[i].file_receiving[filenumber];
+            struct File_Transfers *ft = new_file_transfer(m, &m->friendlist[i].file_receiving, filenumber);
 
-            if (ft->status != FILESTATUS_NONE) {
+            if (ft == nullptr) {
                 break;
             }
 
@@ -2462,9 +2575,9 @@ static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t le
 
 #endif
 
-            struct File_Transfers *ft = &m->friendlist[i].file_receiving[filenumber];
+            struct File_Transfers *ft = find_file_transfer(m->friendlist[i].file_receiving, filenumber);
 
-            if (ft->status != FILESTATUS_TRANSFERRING) {
+            if (ft == nullptr || ft->status != FILESTATUS_TRANSFERRING) {
                 break;
             }
 
@@ -2561,6 +2674,9 @@ static void do_friends(Messenger *m, void *userdata)
     uint64_t temp_time = mono_time_get(m->mono_time);
 
     for (i = 0; i < m->numfriends; ++i) {
+        release_file_transfers(m, &m->friendlist[i].file_sending);
+        release_file_transfers(m, &m->friendlist[i].file_receiving);
+
         if (m->friendlist[i].status == FRIEND_ADDED) {
             int fr = send_friend_request_packet(m->fr_c, m->friendlist[i].friendcon_id, m->friendlist[i].friendrequest_nospam,
                                                 m->friendlist[i].info,
@@ -2637,6 +2753,9 @@ static void connection_status_callback(Messenger *m, void *userdata)
  * TODO(mannol): A/V */
 #define MIN_RUN_INTERVAL 50
 
+/* Messenger run interval in ms when nothing is waiting to be sent. */
+#define IDLE_RUN_INTERVAL 1000
+
 /* Return the time in milliseconds before do_messenger() should be called again
  * for optimal performance.
  *
@@ -2653,6 +2772,106 @@ uint32_t messenger_run_interval(const Messenger *m)
     return crypto_interval;
 }
 
+/* return the TCP connections of the group chat, nullptr if it does not run. */
+static const TCP_Connections *group_tcp_connections(const GC_Chat *chat)
+{
+    if (chat->connection_state == CS_NONE || chat->connection_state >= CS_INVALID) {
+        return nullptr;
+    }
+
+    return chat->tcp_conn;
+}
+
+/* Append the sockets of tcp_c to the count sockets already in socks.
+ *
+ * return the new number of sockets.
+ */
+static uint32_t add_relay_sockets(const TCP_Connections *tcp_c, Socket *socks, uint32_t max_socks, uint32_t count)
+{
+    if (count >= max_socks) {
+        return count + tcp_connections_sockets(tcp_c, nullptr, 0);
+    }
+
+    return count + tcp_connections_sockets(tcp_c, socks + count, max_socks - count);
+}
+
+uint32_t messenger_sockets(const Messenger *m, Socket *socks, uint32_t max_socks)
+{
+    uint32_t count = 0;
+    const Socket udp_sock = net_sock(m->net);
+
+    if (sock_valid(udp_sock)) {
+        if (count < max_socks) {
+            socks[count] = udp_sock;
+        }
+
+        ++count;
+    }
+
+    if (m->tcp_server) {
+        if (count < max_socks) {
+            count += tcp_server_sockets(m->tcp_server, socks + count, max_socks - count);
+        } else {
+            count += tcp_server_sockets(m->tcp_server, nullptr, 0);
+        }
+    }
+
+    count = add_relay_sockets(nc_get_tcp_c(m->net_crypto), socks, max_socks, count);
+
+    if (m->group_handler != nullptr) {
+        for (uint32_t i = 0; i < m->group_handler->num_chats; ++i) {
+            const TCP_Connections *tcp_c = group_tcp_connections(&m->group_handler->chats[i]);
+
+            if (tcp_c != nullptr) {
+                count = add_relay_sockets(tcp_c, socks, max_socks, count);
+            }
+        }
+    }
+
+    return count;
+}
+
+/* return true if a friend has file transfers waiting for chunks to send. */
+static bool files_sending(const Messenger *m)
+{
+    for (uint32_t i = 0; i < m->numfriends; ++i) {
+        if (m->friendlist[i].status == FRIEND_ONLINE && m->friendlist[i].num_sending_files > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t messenger_idle_interval(const Messenger *m)
+{
+    const uint32_t crypto_interval = crypto_run_interval(m->net_crypto);
+
+    if (crypto_interval < IDLE_RUN_INTERVAL || files_sending(m)) {
+        return messenger_run_interval(m);
+    }
+
+    if (tcp_connections_send_pending(nc_get_tcp_c(m->net_crypto))) {
+        return MIN_RUN_INTERVAL;
+    }
+
+    if (m->tcp_server && tcp_server_send_pending(m->tcp_server)) {
+        return MIN_RUN_INTERVAL;
+    }
+
+    if (m->group_handler != nullptr) {
+        for (uint32_t i = 0; i < m->group_handler->num_chats; ++i) {
+            const TCP_Connections *tcp_c = group_tcp_connections(&m->group_handler->chats[i]);
+
+            if (tcp_c != nullptr && tcp_connections_send_pending(tcp_c)) {
+                return MIN_RUN_INTERVAL;
+            }
+        }
+    }
+
+    return IDLE_RUN_INTERVAL;
+}
+
 /* Attempts to create a DHT announcement for a group chat with our connection info. An
  * announcement can only be created if we either have a UDP or TCP connection to the network.
  *
@@ -137,6 +137,8 @@ struct File_Transfers {
     uint64_t requested; /* total data requested by the request chunk callback */
     unsigned int slots_allocated; /* number of slots allocated to this transfer. */
     uint8_t id[FILE_ID_LENGTH];
+    uint8_t filenumber;
+    struct File_Transfers *next; /* next transfer in the same list, ordered by filenumber. */
 };
 typedef enum Filestatus {
     FILESTATUS_NONE,
@@ -231,9 +233,12 @@ typedef struct Friend {
     uint32_t friendrequest_nospam; // The nospam number used in the friend request.
     uint64_t last_seen_time;
     uint8_t last_connection_udp_tcp;
-    struct File_Transfers file_sending[MAX_CONCURRENT_FILE_PIPES];
+    /* Transfers are taken from the Messenger's file_transfer_pool when they start. Ended
+     * transfers (FILESTATUS_NONE) stay in these lists until do_messenger gives them back.
+     */
+    struct File_Transfers *file_sending;
     uint32_t num_sending_files;
-    struct File_Transfers file_receiving[MAX_CONCURRENT_FILE_PIPES];
+    struct File_Transfers *file_receiving;
 
     RTP_Packet_Handler lossy_rtp_packethandlers[PACKET_ID_RANGE_LOSSY_AV_SIZE];
 
@@ -268,6 +273,8 @@ struct Messenger {
     Friend *friendlist;
     uint32_t numfriends;
 
+    struct File_Transfers *file_transfer_pool; /* unused transfers, linked through next. */
+
     time_t lastdump;
 
     GC_Session *group_handler;
@@ -652,7 +659,7 @@ int file_get_id(const Messenger *m, int32_t friendnumber, uint32_t filenumber, u
  *  return -4 if could not send packet (friend offline).
  *
  */
-long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
+long int new_filesender(Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
                         const uint8_t *file_id, const uint8_t *filename, uint16_t filename_length);
 
 /* Send a file control request.
@@ -784,6 +791,20 @@ void do_messenger(Messenger *m, void *userdata);
  */
 uint32_t messenger_run_interval(const Messenger *m);
 
+/* Copy the sockets do_messenger() reads from into socks, at most max_socks of them:
+ * the UDP socket, the local TCP server and the connections to TCP relays.
+ *
+ * return the number of sockets, which may be larger than max_socks.
+ */
+uint32_t messenger_sockets(const Messenger *m, Socket *socks, uint32_t max_socks);
+
+/* Return the time in milliseconds before do_messenger() has timed work to do if
+ * none of the sockets returned by messenger_sockets() becomes readable meanwhile.
+ * This is never shorter than messenger_run_interval() and grows when no data is
+ * waiting to be sent, since all other timers in toxcore count whole seconds.
+ */
+uint32_t messenger_idle_interval(const Messenger *m);
+
 /* SAVING AND LOADING FUNCTIONS: */
 
 /* Registers a state plugin for saving, loadding, and getting the size of a section of the save
@@ -36,16 +36,11 @@ struct TCP_Client_Connection {
     uint8_t recv_nonce[CRYPTO_NONCE_SIZE]; /* Nonce of received packets. */
     uint8_t sent_nonce[CRYPTO_NONCE_SIZE]; /* Nonce of sent packets. */
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    uint16_t next_packet_length;
+    TCP_Recv_Buffer recv_buffer;
 
     uint8_t temp_secret_key[CRYPTO_SECRET_KEY_SIZE];
 
-    uint8_t last_packet[2 + MAX_PACKET_SIZE];
-    uint16_t last_packet_length;
-    uint16_t last_packet_sent;
-
-    TCP_Priority_List *priority_queue_start;
-    TCP_Priority_List *priority_queue_end;
+    TCP_Send_Queue send_queue;
 
     uint64_t kill_at;
 
@@ -87,6 +82,32 @@ TCP_Client_Status tcp_con_status(const TCP_Client_Connection *con)
 {
     return con->status;
 }
+
+Socket tcp_con_sock(const TCP_Client_Connection *con)
+{
+    return con->sock;
+}
+
+bool tcp_con_send_pending(const TCP_Client_Connection *con)
+{
+    if (con->status == TCP_CLIENT_DISCONNECTED) {
+        return false;
+    }
+
+    return con->send_queue.length != 0;
+}
+
+void tcp_con_set_send_queue_limit(TCP_Client_Connection *con, uint32_t limit)
+{
+    con->send_queue.limit = limit;
+}
+
+void tcp_con_get_send_queue_stats(const TCP_Client_Connection *con, TCP_Send_Queue_Stats *stats)
+{
+    memset(stats, 0, sizeof(TCP_Send_Queue_Stats));
+    tcp_send_queue_add_stats(&con->send_queue, stats);
+}
+
 void *tcp_con_custom_object(const TCP_Client_Connection *con)
 {
     return con->custom_object;
@@ -134,17 +155,14 @@ static int proxy_http_generate_connection_request(TCP_Client_Connection *tcp_con
     }
 
     const uint16_t port = net_ntohs(tcp_conn->ip_port.port);
-    const int written = snprintf((char *)tcp_conn->last_packet, MAX_PACKET_SIZE, "%s%s:%hu%s%s:%hu%s", one, ip, port, two,
-                                 ip, port, three);
+    char request[MAX_PACKET_SIZE];
+    const int written = snprintf(request, sizeof(request), "%s%s:%hu%s%s:%hu%s", one, ip, port, two, ip, port, three);
 
     if (written < 0 || MAX_PACKET_SIZE < written) {
         return 0;
     }
 
-    tcp_conn->last_packet_length = written;
-    tcp_conn->last_packet_sent = 0;
-
-    return 1;
+    return tcp_send_queue_add(&tcp_conn->send_queue, (const uint8_t *)request, written);
 }
 
 /* return 1 on success.
@@ -179,14 +197,17 @@ static int proxy_http_read_connection_response(const Logger *logger, TCP_Client_
     return -1;
 }
 
-static void proxy_socks5_generate_handshake(TCP_Client_Connection *tcp_conn)
+/* return 1 on success.
+ * return 0 on failure.
+ */
+static int proxy_socks5_generate_handshake(TCP_Client_Connection *tcp_conn)
 {
-    tcp_conn->last_packet[0] = 5; /* SOCKSv5 */
-    tcp_conn->last_packet[1] = 1; /* number of authentication methods supported */
-    tcp_conn->last_packet[2] = 0; /* No authentication */
+    uint8_t request[3];
+    request[0] = 5; /* SOCKSv5 */
+    request[1] = 1; /* number of authentication methods supported */
+    request[2] = 0; /* No authentication */
 
-    tcp_conn->last_packet_length = 3;
-    tcp_conn->last_packet_sent = 0;
+    return tcp_send_queue_add(&tcp_conn->send_queue, request, sizeof(request));
 }
 
 /* return 1 on success.
@@ -209,30 +230,33 @@ static int socks5_read_handshake_response(const Logger *logger, TCP_Client_Conne
     return -1;
 }
 
-static void proxy_socks5_generate_connection_request(TCP_Client_Connection *tcp_conn)
+/* return 1 on success.
+ * return 0 on failure.
+ */
+static int proxy_socks5_generate_connection_request(TCP_Client_Connection *tcp_conn)
 {
-    tcp_conn->last_packet[0] = 5; /* SOCKSv5 */
-    tcp_conn->last_packet[1] = 1; /* command code: establish a TCP/IP stream connection */
-    tcp_conn->last_packet[2] = 0; /* reserved, must be 0 */
+    uint8_t request[4 + sizeof(IP6) + sizeof(uint16_t)];
+    request[0] = 5; /* SOCKSv5 */
+    request[1] = 1; /* command code: establish a TCP/IP stream connection */
+    request[2] = 0; /* reserved, must be 0 */
     uint16_t length = 3;
 
     if (net_family_is_ipv4(tcp_conn->ip_port.ip.family)) {
-        tcp_conn->last_packet[3] = 1; /* IPv4 address */
+        request[3] = 1; /* IPv4 address */
         ++length;
-        memcpy(tcp_conn->last_packet + length, tcp_conn->ip_port.ip.ip.v4.uint8, sizeof(IP4));
+        memcpy(request + length, tcp_conn->ip_port.ip.ip.v4.uint8, sizeof(IP4));
         length += sizeof(IP4);
     } else {
-        tcp_conn->last_packet[3] = 4; /* IPv6 address */
+        request[3] = 4; /* IPv6 address */
         ++length;
-        memcpy(tcp_conn->last_packet + length, tcp_conn->ip_port.ip.ip.v6.uint8, sizeof(IP6));
+        memcpy(request + length, tcp_conn->ip_port.ip.ip.v6.uint8, sizeof(IP6));
         length += sizeof(IP6);
     }
 
-    memcpy(tcp_conn->last_packet + length, &tcp_conn->ip_port.port, sizeof(uint16_t));
+    memcpy(request + length, &tcp_conn->ip_port.port, sizeof(uint16_t));
     length += sizeof(uint16_t);
 
-    tcp_conn->last_packet_length = length;
-    tcp_conn->last_packet_sent = 0;
+    return tcp_send_queue_add(&tcp_conn->send_queue, request, length);
 }
 
 /* return 1 on success.
@@ -277,17 +301,20 @@ static int generate_handshake(TCP_Client_Connection *tcp_conn)
     crypto_new_keypair(plain, tcp_conn->temp_secret_key);
     random_nonce(tcp_conn->sent_nonce);
     memcpy(plain + CRYPTO_PUBLIC_KEY_SIZE, tcp_conn->sent_nonce, CRYPTO_NONCE_SIZE);
-    memcpy(tcp_conn->last_packet, tcp_conn->self_public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    random_nonce(tcp_conn->last_packet + CRYPTO_PUBLIC_KEY_SIZE);
-    int len = encrypt_data_symmetric(tcp_conn->shared_key, tcp_conn->last_packet + CRYPTO_PUBLIC_KEY_SIZE, plain,
-                                     sizeof(plain), tcp_conn->last_packet + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE);
+    uint8_t handshake[TCP_CLIENT_HANDSHAKE_SIZE];
+    memcpy(handshake, tcp_conn->self_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    random_nonce(handshake + CRYPTO_PUBLIC_KEY_SIZE);
+    int len = encrypt_data_symmetric(tcp_conn->shared_key, handshake + CRYPTO_PUBLIC_KEY_SIZE, plain,
+                                     sizeof(plain), handshake + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE);
 
     if (len != sizeof(plain) + CRYPTO_MAC_SIZE) {
         return -1;
     }
 
-    tcp_conn->last_packet_length = CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + sizeof(plain) + CRYPTO_MAC_SIZE;
-    tcp_conn->last_packet_sent = 0;
+    if (!tcp_send_queue_add(&tcp_conn->send_queue, handshake, sizeof(handshake))) {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -312,98 +339,6 @@ static int handle_handshake(TCP_Client_Connection *tcp_conn, const uint8_t *data
     return 0;
 }
 
-/* return 0 if pending data was sent completely
- * return -1 if it wasn't
- */
-static int client_send_pending_data_nonpriority(TCP_Client_Connection *con)
-{
-    if (con->last_packet_length == 0) {
-        return 0;
-    }
-
-    const uint16_t left = con->last_packet_length - con->last_packet_sent;
-    const int len = net_send(con->sock, con->last_packet + con->last_packet_sent, left);
-
-    if (len <= 0) {
-        return -1;
-    }
-
-    if (len == left) {
-        con->last_packet_length = 0;
-        con->last_packet_sent = 0;
-        return 0;
-    }
-
-    con->last_packet_sent += len;
-    return -1;
-}
-
-/* return 0 if pending data was sent completely
- * return -1 if it wasn't
- */
-static int client_send_pending_data(TCP_Client_Connection *con)
-{
-    /* finish sending current non-priority packet */
-    if (client_send_pending_data_nonpriority(con) == -1) {
-        return -1;
-    }
-
-    TCP_Priority_List *p = con->priority_queue_start;
-
-    while (p) {
-        const uint16_t left = p->size - p->sent;
-        const int len = net_send(con->sock, p->data + p->sent, left);
-
-        if (len != left) {
-            if (len > 0) {
-                p->sent += len;
-            }
-
-            break;
-        }
-
-        TCP_Priority_List *pp = p;
-        p = p->next;
-        free(pp);
-    }
-
-    con->priority_queue_start = p;
-
-    if (!p) {
-        con->priority_queue_end = nullptr;
-        return 0;
-    }
-
-    return -1;
-}
-
-/* return 0 on failure (only if malloc fails)
- * return 1 on success
- */
-static bool client_add_priority(TCP_Client_Connection *con, const uint8_t *packet, uint16_t size, uint16_t sent)
-{
-    TCP_Priority_List *p = con->priority_queue_end;
-    TCP_Priority_List *new_list = (TCP_Priority_List *)malloc(sizeof(TCP_Priority_List) + size);
-
-    if (!new_list) {
-        return 0;
-    }
-
-    new_list->next = nullptr;
-    new_list->size = size;
-    new_list->sent = sent;
-    memcpy(new_list->data, packet, size);
-
-    if (p) {
-        p->next = new_list;
-    } else {
-        con->priority_queue_start = new_list;
-    }
-
-    con->priority_queue_end = new_list;
-    return 1;
-}
-
 /* return 1 on success.
  * return 0 if could not send packet.
  * return -1 on failure (connection must be killed).
@@ -415,18 +350,12 @@ static int write_packet_TCP_client_secure_connection(TCP_Client_Connection *con,
         return -1;
     }
 
-    bool sendpriority = 1;
+    VLA(uint8_t, packet, sizeof(uint16_t) + length + CRYPTO_MAC_SIZE);
 
-    if (client_send_pending_data(con) == -1) {
-        if (priority) {
-            sendpriority = 0;
-        } else {
-            return 0;
-        }
+    if (!tcp_send_queue_reserve(&con->send_queue, con->sock, SIZEOF_VLA(packet), priority)) {
+        return 0;
     }
 
-    VLA(uint8_t, packet, sizeof(uint16_t) + length + CRYPTO_MAC_SIZE);
-
     uint16_t c_length = net_htons(length + CRYPTO_MAC_SIZE);
     memcpy(packet, &c_length, sizeof(uint16_t));
     int len = encrypt_data_symmetric(con->shared_key, con->sent_nonce, data, length, packet + sizeof(uint16_t));
@@ -435,37 +364,12 @@ static int write_packet_TCP_client_secure_connection(TCP_Client_Connection *con,
         return -1;
     }
 
-    if (priority) {
-        len = sendpriority ? net_send(con->sock, packet, SIZEOF_VLA(packet)) : 0;
-
-        if (len <= 0) {
-            len = 0;
-        }
-
-        increment_nonce(con->sent_nonce);
-
-        if ((unsigned int)len == SIZEOF_VLA(packet)) {
-            return 1;
-        }
-
-        return client_add_priority(con, packet, SIZEOF_VLA(packet), len);
-    }
-
-    len = net_send(con->sock, packet, SIZEOF_VLA(packet));
-
-    if (len <= 0) {
-        return 0;
-    }
-
     increment_nonce(con->sent_nonce);
 
-    if ((unsigned int)len == SIZEOF_VLA(packet)) {
-        return 1;
+    if (!tcp_send_queue_write(&con->send_queue, con->sock, packet, SIZEOF_VLA(packet))) {
+        return -1;
     }
 
-    memcpy(con->last_packet, packet, SIZEOF_VLA(packet));
-    con->last_packet_length = SIZEOF_VLA(packet);
-    con->last_packet_sent = len;
     return 1;
 }
 
@@ -715,16 +619,29 @@ TCP_Client_Connection *new_TCP_connection(const Mono_Time *mono_time, IP_Port ip
     encrypt_precompute(temp->public_key, self_secret_key, temp->shared_key);
     temp->ip_port = ip_port;
     temp->proxy_info = *proxy_info;
+    tcp_send_queue_init(&temp->send_queue, TCP_SEND_QUEUE_LIMIT);
 
     switch (proxy_info->proxy_type) {
         case TCP_PROXY_HTTP:
             temp->status = TCP_CLIENT_PROXY_HTTP_CONNECTING;
-            proxy_http_generate_connection_request(temp);
+
+            if (!proxy_http_generate_connection_request(temp)) {
+                kill_sock(sock);
+                free(temp);
+                return nullptr;
+            }
+
             break;
 
         case TCP_PROXY_SOCKS5:
             temp->status = TCP_CLIENT_PROXY_SOCKS5_CONNECTING;
-            proxy_socks5_generate_handshake(temp);
+
+            if (!proxy_socks5_generate_handshake(temp)) {
+                kill_sock(sock);
+                free(temp);
+                return nullptr;
+            }
+
             break;
 
         case TCP_PROXY_NONE:
@@ -903,7 +820,7 @@ static int handle_TCP_client_packet(TCP_Client_Connection *conn, const uint8_t *
 static bool tcp_process_packet(const Logger *logger, TCP_Client_Connection *conn, void *userdata)
 {
     uint8_t packet[MAX_PACKET_SIZE];
-    const int len = read_packet_TCP_secure_connection(logger, conn->sock, &conn->next_packet_length, conn->shared_key,
+    const int len = read_packet_TCP_secure_connection(logger, conn->sock, &conn->recv_buffer, conn->shared_key,
                     conn->recv_nonce, packet, sizeof(packet));
 
     if (len == 0) {
@@ -926,7 +843,7 @@ static bool tcp_process_packet(const Logger *logger, TCP_Client_Connection *conn
 static int do_confirmed_TCP(const Logger *logger, TCP_Client_Connection *conn, const Mono_Time *mono_time,
                             void *userdata)
 {
-    client_send_pending_data(conn);
+    tcp_send_queue_flush(&conn->send_queue, conn->sock);
     tcp_send_ping_response(conn);
     tcp_send_ping_request(conn);
 
@@ -966,7 +883,7 @@ void do_TCP_connection(const Logger *logger, Mono_Time *mono_time, TCP_Client_Co
     }
 
     if (tcp_connection->status == TCP_CLIENT_PROXY_HTTP_CONNECTING) {
-        if (client_send_pending_data(tcp_connection) == 0) {
+        if (tcp_send_queue_flush(&tcp_connection->send_queue, tcp_connection->sock)) {
             int ret = proxy_http_read_connection_response(logger, tcp_connection);
 
             if (ret == -1) {
@@ -975,14 +892,18 @@ void do_TCP_connection(const Logger *logger, Mono_Time *mono_time, TCP_Client_Co
             }
 
             if (ret == 1) {
-                generate_handshake(tcp_connection);
-                tcp_connection->status = TCP_CLIENT_CONNECTING;
+                if (generate_handshake(tcp_connection) == 0) {
+                    tcp_connection->status = TCP_CLIENT_CONNECTING;
+                } else {
+                    tcp_connection->kill_at = 0;
+                    tcp_connection->status = TCP_CLIENT_DISCONNECTED;
+                }
             }
         }
     }
 
     if (tcp_connection->status == TCP_CLIENT_PROXY_SOCKS5_CONNECTING) {
-        if (client_send_pending_data(tcp_connection) == 0) {
+        if (tcp_send_queue_flush(&tcp_connection->send_queue, tcp_connection->sock)) {
             int ret = socks5_read_handshake_response(logger, tcp_connection);
 
             if (ret == -1) {
@@ -991,14 +912,18 @@ void do_TCP_connection(const Logger *logger, Mono_Time *mono_time, TCP_Client_Co
             }
 
             if (ret == 1) {
-                proxy_socks5_generate_connection_request(tcp_connection);
-                tcp_connection->status = TCP_CLIENT_PROXY_SOCKS5_UNCONFIRMED;
+                if (proxy_socks5_generate_connection_request(tcp_connection)) {
+                    tcp_connection->status = TCP_CLIENT_PROXY_SOCKS5_UNCONFIRMED;
+                } else {
+                    tcp_connection->kill_at = 0;
+                    tcp_connection->status = TCP_CLIENT_DISCONNECTED;
+                }
             }
         }
     }
 
     if (tcp_connection->status == TCP_CLIENT_PROXY_SOCKS5_UNCONFIRMED) {
-        if (client_send_pending_data(tcp_connection) == 0) {
+        if (tcp_send_queue_flush(&tcp_connection->send_queue, tcp_connection->sock)) {
             int ret = proxy_socks5_read_connection_response(logger, tcp_connection);
 
             if (ret == -1) {
@@ -1007,14 +932,18 @@ void do_TCP_connection(const Logger *logger, Mono_Time *mono_time, TCP_Client_Co
             }
 
             if (ret == 1) {
-                generate_handshake(tcp_connection);
-                tcp_connection->status = TCP_CLIENT_CONNECTING;
+                if (generate_handshake(tcp_connection) == 0) {
+                    tcp_connection->status = TCP_CLIENT_CONNECTING;
+                } else {
+                    tcp_connection->kill_at = 0;
+                    tcp_connection->status = TCP_CLIENT_DISCONNECTED;
+                }
             }
         }
     }
 
     if (tcp_connection->status == TCP_CLIENT_CONNECTING) {
-        if (client_send_pending_data(tcp_connection) == 0) {
+        if (tcp_send_queue_flush(&tcp_connection->send_queue, tcp_connection->sock)) {
             tcp_connection->status = TCP_CLIENT_UNCONFIRMED;
         }
     }
@@ -1051,7 +980,7 @@ void kill_TCP_connection(TCP_Client_Connection *tcp_connection)
         return;
     }
 
-    wipe_priority_list(tcp_connection->priority_queue_start);
+    tcp_send_queue_free(&tcp_connection->send_queue);
     kill_sock(tcp_connection->sock);
     crypto_memzero(tcp_connection, sizeof(TCP_Client_Connection));
     free(tcp_connection);
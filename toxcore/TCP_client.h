@@ -41,6 +41,16 @@ typedef struct TCP_Client_Connection TCP_Client_Connection;
 const uint8_t *tcp_con_public_key(const TCP_Client_Connection *con);
 IP_Port tcp_con_ip_port(const TCP_Client_Connection *con);
 TCP_Client_Status tcp_con_status(const TCP_Client_Connection *con);
+Socket tcp_con_sock(const TCP_Client_Connection *con);
+
+/* return true if the connection has data queued that the socket did not accept yet. */
+bool tcp_con_send_pending(const TCP_Client_Connection *con);
+
+/* Set how many bytes the connection may queue before it refuses normal packets. */
+void tcp_con_set_send_queue_limit(TCP_Client_Connection *con, uint32_t limit);
+
+/* Fill stats with the state of the send queue of the connection. */
+void tcp_con_get_send_queue_stats(const TCP_Client_Connection *con, TCP_Send_Queue_Stats *stats);
 
 void *tcp_con_custom_object(const TCP_Client_Connection *con);
 uint32_t tcp_con_custom_uint(const TCP_Client_Connection *con);
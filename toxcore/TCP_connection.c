@@ -290,6 +290,40 @@ uint32_t tcp_connected_relays_count(const TCP_Connections *tcp_c)
     return count;
 }
 
+uint32_t tcp_connections_sockets(const TCP_Connections *tcp_c, Socket *socks, uint32_t max_socks)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+        const TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+
+        if (!tcp_con || tcp_con->connection == nullptr) {
+            continue;
+        }
+
+        if (count < max_socks) {
+            socks[count] = tcp_con_sock(tcp_con->connection);
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
+bool tcp_connections_send_pending(const TCP_Connections *tcp_c)
+{
+    for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+        const TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+
+        if (tcp_con && tcp_con->connection != nullptr && tcp_con_send_pending(tcp_con->connection)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /* Send a packet to the TCP connection.
  *
  * return -1 on failure.
@@ -394,6 +428,13 @@ int get_random_tcp_onion_conn_number(TCP_Connections *tcp_c)
     return -1;
 }
 
+bool tcp_onion_conn_is_connected(const TCP_Connections *tcp_c, unsigned int tcp_connections_number)
+{
+    const TCP_con *tcp_con = get_tcp_connection(tcp_c, tcp_connections_number);
+
+    return tcp_con != nullptr && tcp_con->onion && tcp_con->status == TCP_CONN_CONNECTED;
+}
+
 /* Send an onion packet via the TCP relay corresponding to tcp_connections_number.
  *
  * return 0 on success.
@@ -75,6 +75,16 @@ uint32_t tcp_connections_count(const TCP_Connections *tcp_c);
 /* Returns the number of connected TCP relays */
 uint32_t tcp_connected_relays_count(const TCP_Connections *tcp_c);
 
+/* Copy the sockets of all relay connections that are not sleeping into socks,
+ * at most max_socks of them.
+ *
+ * return the number of sockets, which may be larger than max_socks.
+ */
+uint32_t tcp_connections_sockets(const TCP_Connections *tcp_c, Socket *socks, uint32_t max_socks);
+
+/* return true if a relay connection has data queued that its socket did not accept yet. */
+bool tcp_connections_send_pending(const TCP_Connections *tcp_c);
+
 /* Send a packet to the TCP connection.
  *
  * return -1 on failure.
@@ -92,6 +102,11 @@ int send_packet_tcp_connection(TCP_Connections *tcp_c, int connections_number, c
  */
 int get_random_tcp_onion_conn_number(TCP_Connections *tcp_c);
 
+/* return true if tcp_connections_number is a TCP relay we are connected to and
+ * send onion packets through.
+ */
+bool tcp_onion_conn_is_connected(const TCP_Connections *tcp_c, unsigned int tcp_connections_number);
+
 /* Send an onion packet via the TCP relay corresponding to tcp_connections_number.
  *
  * return 0 on success.
@@ -19,11 +19,15 @@
 #endif
 
 #ifdef TCP_SERVER_USE_EPOLL
+#include <pthread.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #endif
 
+#include "key_map.h"
 #include "mono_time.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 #ifdef TCP_SERVER_USE_EPOLL
@@ -31,14 +35,38 @@
 #define TCP_SOCKET_INCOMING 1
 #define TCP_SOCKET_UNCONFIRMED 2
 #define TCP_SOCKET_CONFIRMED 3
+#define TCP_SOCKET_WAKEUP 4
+
+/* How long a worker waits for events, in milliseconds, and so how late a ping
+ * may be sent. */
+#define TCP_WORKER_WAIT 1000
 #endif
 
+/* Session keypairs each server (or worker) makes ahead of time. A handshake
+ * takes one, so during a burst of new connections only the key exchanges that
+ * depend on the client are left to do. */
+#define TCP_SESSION_KEYPAIRS 1024
+
+/* Most session keypairs made in one run of the server, so that refilling does
+ * not hold up the connections it serves for long. */
+#define TCP_SESSION_KEYPAIR_BATCH 16
+
+/* Bytes a receive buffer keeps free in front of the first packet, so that with
+ * the length of the packet they make up the padding for decrypting it in place. */
+#define TCP_RECV_BUFFER_HEADROOM (CRYPTO_ENCRYPTED_PADDING_SIZE - sizeof(uint16_t))
+
 typedef struct TCP_Secure_Conn {
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint32_t index;
     // TODO(iphydf): Add an enum for this (same as in TCP_client.c, probably).
     uint8_t status; /* 0 if not used, 1 if other is offline, 2 if other is online. */
     uint8_t other_id;
+#ifdef TCP_SERVER_USE_EPOLL
+    /* Worker the other connection belongs to, and its identifier, so that packets
+     * are not passed on to a connection that took its place. */
+    uint16_t shard;
+    uint64_t other_identifier;
+#endif
 } TCP_Secure_Conn;
 
 typedef struct TCP_Secure_Connection {
@@ -47,15 +75,13 @@ typedef struct TCP_Secure_Connection {
     uint8_t recv_nonce[CRYPTO_NONCE_SIZE]; /* Nonce of received packets. */
     uint8_t sent_nonce[CRYPTO_NONCE_SIZE]; /* Nonce of sent packets. */
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    uint16_t next_packet_length;
+    /* Allocated once the handshake succeeds, so the queues of connections that
+     * have not sent one yet stay small. */
+    TCP_Recv_Buffer *recv_buffer;
     TCP_Secure_Conn connections[NUM_CLIENT_CONNECTIONS];
-    uint8_t last_packet[2 + MAX_PACKET_SIZE];
     uint8_t status;
-    uint16_t last_packet_length;
-    uint16_t last_packet_sent;
 
-    TCP_Priority_List *priority_queue_start;
-    TCP_Priority_List *priority_queue_end;
+    TCP_Send_Queue send_queue;
 
     uint64_t identifier;
 
@@ -64,13 +90,87 @@ typedef struct TCP_Secure_Connection {
 } TCP_Secure_Connection;
 
 
+#ifdef TCP_SERVER_USE_EPOLL
+typedef enum TCP_Shard_Message_Type {
+    /* A client asked to be routed to public_key, which is not connected to its worker. */
+    TCP_SHARD_ROUTING_REQUEST,
+    /* The client with public_key accepted a TCP_SHARD_ROUTING_REQUEST. */
+    TCP_SHARD_ROUTING_RESPONSE,
+    /* The other end of connection con_number went away. */
+    TCP_SHARD_DISCONNECT,
+    /* Data for connection con_number, data[0] is already set to it. */
+    TCP_SHARD_ROUTED_PACKET,
+    /* Packet to send as it is to the client at index. */
+    TCP_SHARD_PACKET,
+    /* OOB packet for public_key. */
+    TCP_SHARD_OOB,
+    /* Another worker accepted a newer connection with public_key. */
+    TCP_SHARD_KILL,
+    /* Onion request to send from the thread that runs onion. */
+    TCP_SHARD_ONION_REQUEST,
+    /* New send queue limit, in index. */
+    TCP_SHARD_SEND_QUEUE_LIMIT,
+    /* Report the state of the send queues and the counters in send_queue_stats
+     * and published_stats. */
+    TCP_SHARD_STATS,
+} TCP_Shard_Message_Type;
+
+typedef struct TCP_Shard_Message TCP_Shard_Message;
+
+/* Message from one worker to another. The from_ fields name the connection on
+ * the worker that sent it, the others the connection on the one receiving it. */
+struct TCP_Shard_Message {
+    TCP_Shard_Message *next;
+    TCP_Shard_Message_Type type;
+
+    uint32_t index;
+    uint64_t identifier;
+    uint8_t con_number;
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+
+    uint16_t from_shard;
+    uint32_t from_index;
+    uint64_t from_identifier;
+    uint8_t from_con_number;
+    uint8_t from_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+
+    uint16_t length;
+    /* Room for encrypting data where it is when it is sent to a client. */
+    uint8_t padding[CRYPTO_PLAIN_PADDING_SIZE];
+    uint8_t data[];
+};
+#endif
+
 struct TCP_Server {
     const Logger *logger;
     Onion *onion;
 
 #ifdef TCP_SERVER_USE_EPOLL
     int efd;
-    uint64_t last_run_pinged;
+
+    /* With workers, the server returned to the caller owns one TCP_Server per
+     * worker, and each of those points back to it. */
+    TCP_Server **shards;
+    uint16_t num_shards;
+    TCP_Server *pool;
+    uint16_t shard_index;
+
+    /* Messages from other workers. Posting one to an empty queue writes to
+     * wakeup_fd, which is in the epoll set of the worker. */
+    pthread_mutex_t queue_mutex;
+    TCP_Shard_Message *queue_start;
+    TCP_Shard_Message *queue_end;
+    int wakeup_fd;
+    bool stopping;
+
+    pthread_t thread;
+    bool thread_running;
+    Mono_Time *mono_time;
+
+    /* What the worker reported about its send queues and counters when it was
+     * last asked, under queue_mutex. */
+    TCP_Send_Queue_Stats send_queue_stats;
+    TCP_Server_Stats published_stats;
 #endif
     Socket *socks_listening;
     unsigned int num_listening_socks;
@@ -87,8 +187,21 @@ struct TCP_Server {
     uint32_t num_accepted_connections;
 
     uint64_t counter;
+    uint32_t send_queue_limit;
+
+    Key_Map accepted_key_list;
+
+    /* Unused session keypairs, each a public key followed by its secret key. */
+    uint8_t session_keypairs[TCP_SESSION_KEYPAIRS][CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_SECRET_KEY_SIZE];
+    uint16_t num_session_keypairs;
+
+    /* Counters of the packets this server (or worker) handled. The connection
+     * counts are filled in when they are read. */
+    TCP_Server_Stats stats;
 
-    BS_List accepted_key_list;
+    /* When each accepted connection, by index, next needs to be pinged or
+     * checked for a pong, in seconds. */
+    Timer_Wheel *ping_timers;
 };
 
 const uint8_t *tcp_server_public_key(const TCP_Server *tcp_server)
@@ -98,9 +211,118 @@ const uint8_t *tcp_server_public_key(const TCP_Server *tcp_server)
 
 size_t tcp_server_listen_count(const TCP_Server *tcp_server)
 {
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        return tcp_server->shards[0]->num_listening_socks;
+    }
+
+#endif
     return tcp_server->num_listening_socks;
 }
 
+#ifndef TCP_SERVER_USE_EPOLL
+static void add_connection_socket(const TCP_Secure_Connection *con, Socket *socks, uint32_t max_socks,
+                                  uint32_t *count)
+{
+    if (con->status == TCP_STATUS_NO_STATUS) {
+        return;
+    }
+
+    if (*count < max_socks) {
+        socks[*count] = con->sock;
+    }
+
+    ++*count;
+}
+#endif
+
+uint32_t tcp_server_sockets(const TCP_Server *tcp_server, Socket *socks, uint32_t max_socks)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    /* Workers wait on their sockets themselves. */
+    if (tcp_server->shards != nullptr) {
+        return 0;
+    }
+
+    if (max_socks > 0) {
+        socks[0].socket = tcp_server->efd;
+    }
+
+    return 1;
+#else
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
+        if (count < max_socks) {
+            socks[count] = tcp_server->socks_listening[i];
+        }
+
+        ++count;
+    }
+
+    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
+        add_connection_socket(&tcp_server->incoming_connection_queue[i], socks, max_socks, &count);
+        add_connection_socket(&tcp_server->unconfirmed_connection_queue[i], socks, max_socks, &count);
+    }
+
+    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
+        add_connection_socket(&tcp_server->accepted_connection_array[i], socks, max_socks, &count);
+    }
+
+    return count;
+#endif
+}
+
+bool tcp_server_send_pending(const TCP_Server *tcp_server)
+{
+    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
+        const TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[i];
+
+        if (con->status == TCP_STATUS_NO_STATUS) {
+            continue;
+        }
+
+        if (con->send_queue.length != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void get_send_queue_stats(const TCP_Server *tcp_server, TCP_Send_Queue_Stats *stats)
+{
+    memset(stats, 0, sizeof(TCP_Send_Queue_Stats));
+
+    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
+        const TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[i];
+
+        if (con->status != TCP_STATUS_NO_STATUS) {
+            tcp_send_queue_add_stats(&con->send_queue, stats);
+        }
+    }
+}
+
+static void get_server_stats(const TCP_Server *tcp_server, TCP_Server_Stats *stats)
+{
+    *stats = tcp_server->stats;
+    stats->incoming = 0;
+    stats->unconfirmed = 0;
+    stats->accepted = tcp_server->num_accepted_connections;
+
+    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
+        if (tcp_server->incoming_connection_queue[i].status != TCP_STATUS_NO_STATUS) {
+            ++stats->incoming;
+        }
+
+        if (tcp_server->unconfirmed_connection_queue[i].status != TCP_STATUS_NO_STATUS) {
+            ++stats->unconfirmed;
+        }
+    }
+}
+
 /* This is needed to compile on Android below API 21
  */
 #ifdef TCP_SERVER_USE_EPOLL
@@ -139,19 +361,16 @@ static int alloc_new_connections(TCP_Server *tcp_server, uint32_t num)
     return 0;
 }
 
-void wipe_priority_list(TCP_Priority_List *p)
-{
-    while (p) {
-        TCP_Priority_List *pp = p;
-        p = p->next;
-        free(pp);
-    }
-}
-
 static void wipe_secure_connection(TCP_Secure_Connection *con)
 {
     if (con->status) {
-        wipe_priority_list(con->priority_queue_start);
+        tcp_send_queue_free(&con->send_queue);
+
+        if (con->recv_buffer != nullptr) {
+            crypto_memzero(con->recv_buffer, sizeof(TCP_Recv_Buffer));
+            free(con->recv_buffer);
+        }
+
         crypto_memzero(con, sizeof(TCP_Secure_Connection));
     }
 }
@@ -177,12 +396,232 @@ static void free_accepted_connection_array(TCP_Server *tcp_server)
     tcp_server->size_accepted_connections = 0;
 }
 
+#ifdef TCP_SERVER_USE_EPOLL
+/* return a new message with room for length bytes of data, which are copied
+ * from data unless it is nullptr.
+ * return nullptr on failure.
+ */
+static TCP_Shard_Message *new_shard_message(TCP_Shard_Message_Type type, const uint8_t *data, uint16_t length)
+{
+    TCP_Shard_Message *msg = (TCP_Shard_Message *)calloc(1, sizeof(TCP_Shard_Message) + length);
+
+    if (msg == nullptr) {
+        return nullptr;
+    }
+
+    msg->type = type;
+    msg->length = length;
+
+    if (data != nullptr) {
+        memcpy(msg->data, data, length);
+    }
+
+    return msg;
+}
+
+static void free_shard_messages(TCP_Shard_Message *msg)
+{
+    while (msg != nullptr) {
+        TCP_Shard_Message *next = msg->next;
+        free(msg);
+        msg = next;
+    }
+}
+
+/* Append msg to the queue of tcp_server, which takes ownership of it, and wake
+ * up its worker if the queue was empty. Called from any thread.
+ */
+static void post_shard_message(TCP_Server *tcp_server, TCP_Shard_Message *msg)
+{
+    msg->next = nullptr;
+
+    pthread_mutex_lock(&tcp_server->queue_mutex);
+    const bool was_empty = tcp_server->queue_start == nullptr;
+
+    if (was_empty) {
+        tcp_server->queue_start = msg;
+    } else {
+        tcp_server->queue_end->next = msg;
+    }
+
+    tcp_server->queue_end = msg;
+    pthread_mutex_unlock(&tcp_server->queue_mutex);
+
+    if (was_empty && tcp_server->wakeup_fd != -1) {
+        const uint64_t one = 1;
+
+        if (write(tcp_server->wakeup_fd, &one, sizeof(one)) != sizeof(one)) {
+            LOGGER_WARNING(tcp_server->logger, "failed to wake up TCP worker %u", tcp_server->shard_index);
+        }
+    }
+}
+
+/* Post a copy of msg to every worker other than tcp_server, then free msg.
+ */
+static void broadcast_shard_message(TCP_Server *tcp_server, TCP_Shard_Message *msg)
+{
+    const TCP_Server *pool = tcp_server->pool;
+
+    for (uint16_t i = 0; i < pool->num_shards; ++i) {
+        if (i == tcp_server->shard_index) {
+            continue;
+        }
+
+        TCP_Shard_Message *copy = new_shard_message(msg->type, msg->data, msg->length);
+
+        if (copy == nullptr) {
+            continue;
+        }
+
+        memcpy(copy, msg, sizeof(TCP_Shard_Message));
+        post_shard_message(pool->shards[i], copy);
+    }
+
+    free(msg);
+}
+
+/* Take all messages out of the queue of tcp_server.
+ *
+ * return the first of them, nullptr if there are none.
+ */
+static TCP_Shard_Message *take_shard_messages(TCP_Server *tcp_server, bool *stopping)
+{
+    pthread_mutex_lock(&tcp_server->queue_mutex);
+    TCP_Shard_Message *msg = tcp_server->queue_start;
+    tcp_server->queue_start = nullptr;
+    tcp_server->queue_end = nullptr;
+    *stopping = tcp_server->stopping;
+    pthread_mutex_unlock(&tcp_server->queue_mutex);
+    return msg;
+}
+#endif
+
+void tcp_server_set_send_queue_limit(TCP_Server *tcp_server, uint32_t limit)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        for (uint16_t i = 0; i < tcp_server->num_shards; ++i) {
+            TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_SEND_QUEUE_LIMIT, nullptr, 0);
+
+            if (msg != nullptr) {
+                msg->index = limit;
+                post_shard_message(tcp_server->shards[i], msg);
+            }
+        }
+
+        return;
+    }
+
+#endif
+    tcp_server->send_queue_limit = limit;
+
+    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
+        tcp_server->unconfirmed_connection_queue[i].send_queue.limit = limit;
+    }
+
+    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
+        tcp_server->accepted_connection_array[i].send_queue.limit = limit;
+    }
+}
+
+#ifdef TCP_SERVER_USE_EPOLL
+/* Ask every worker to publish its statistics again. */
+static void request_shard_stats(const TCP_Server *pool)
+{
+    for (uint16_t i = 0; i < pool->num_shards; ++i) {
+        TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_STATS, nullptr, 0);
+
+        if (msg != nullptr) {
+            post_shard_message(pool->shards[i], msg);
+        }
+    }
+}
+#endif
+
+void tcp_server_get_send_queue_stats(const TCP_Server *tcp_server, TCP_Send_Queue_Stats *stats)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        memset(stats, 0, sizeof(TCP_Send_Queue_Stats));
+
+        for (uint16_t i = 0; i < tcp_server->num_shards; ++i) {
+            TCP_Server *shard = tcp_server->shards[i];
+            pthread_mutex_lock(&shard->queue_mutex);
+            stats->queued += shard->send_queue_stats.queued;
+            stats->connections += shard->send_queue_stats.connections;
+            stats->max_queued = max_u32(stats->max_queued, shard->send_queue_stats.max_queued);
+            stats->refused += shard->send_queue_stats.refused;
+            stats->dropped += shard->send_queue_stats.dropped;
+            pthread_mutex_unlock(&shard->queue_mutex);
+        }
+
+        request_shard_stats(tcp_server);
+        return;
+    }
+
+#endif
+    get_send_queue_stats(tcp_server, stats);
+}
+
+void tcp_server_get_stats(const TCP_Server *tcp_server, TCP_Server_Stats *stats)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        memset(stats, 0, sizeof(TCP_Server_Stats));
+
+        for (uint16_t i = 0; i < tcp_server->num_shards; ++i) {
+            TCP_Server *shard = tcp_server->shards[i];
+            pthread_mutex_lock(&shard->queue_mutex);
+            const TCP_Server_Stats *published = &shard->published_stats;
+            stats->incoming += published->incoming;
+            stats->unconfirmed += published->unconfirmed;
+            stats->accepted += published->accepted;
+            stats->packets_received += published->packets_received;
+            stats->bytes_received += published->bytes_received;
+            stats->packets_relayed += published->packets_relayed;
+            stats->bytes_relayed += published->bytes_relayed;
+            stats->oob_relayed += published->oob_relayed;
+            stats->onion_requests += published->onion_requests;
+            stats->onion_responses += published->onion_responses;
+            pthread_mutex_unlock(&shard->queue_mutex);
+        }
+
+        request_shard_stats(tcp_server);
+        return;
+    }
+
+#endif
+    get_server_stats(tcp_server, stats);
+}
+
+/* Identifiers of connections are unique among all workers of a server, and
+ * newer connections have larger ones.
+ */
+static uint64_t new_connection_identifier(TCP_Server *tcp_server)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->pool != nullptr) {
+        TCP_Server *pool = tcp_server->pool;
+        pthread_mutex_lock(&pool->queue_mutex);
+        const uint64_t identifier = ++pool->counter;
+        pthread_mutex_unlock(&pool->queue_mutex);
+        return identifier;
+    }
+
+#endif
+    return ++tcp_server->counter;
+}
+
 /* return index corresponding to connection with peer on success
  * return -1 on failure.
  */
 static int get_TCP_connection_index(const TCP_Server *tcp_server, const uint8_t *public_key)
 {
-    return bs_list_find(&tcp_server->accepted_key_list, public_key);
+    return key_map_find(&tcp_server->accepted_key_list, public_key);
 }
 
 
@@ -224,7 +663,12 @@ static int add_accepted(TCP_Server *tcp_server, const Mono_Time *mono_time, TCP_
         return -1;
     }
 
-    if (!bs_list_add(&tcp_server->accepted_key_list, con->public_key, index)) {
+    if (key_map_add(&tcp_server->accepted_key_list, con->public_key, index) != 1) {
+        return -1;
+    }
+
+    if (!timer_wheel_set(tcp_server->ping_timers, index, mono_time_get(mono_time) + TCP_PING_FREQUENCY)) {
+        key_map_remove(&tcp_server->accepted_key_list, con->public_key, index);
         return -1;
     }
 
@@ -232,10 +676,24 @@ static int add_accepted(TCP_Server *tcp_server, const Mono_Time *mono_time, TCP_
 
     tcp_server->accepted_connection_array[index].status = TCP_STATUS_CONFIRMED;
     ++tcp_server->num_accepted_connections;
-    tcp_server->accepted_connection_array[index].identifier = ++tcp_server->counter;
+    tcp_server->accepted_connection_array[index].identifier = new_connection_identifier(tcp_server);
     tcp_server->accepted_connection_array[index].last_pinged = mono_time_get(mono_time);
     tcp_server->accepted_connection_array[index].ping_id = 0;
 
+#ifdef TCP_SERVER_USE_EPOLL
+
+    /* Other workers may still hold an older connection with the same key. */
+    if (tcp_server->pool != nullptr) {
+        TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_KILL, nullptr, 0);
+
+        if (msg != nullptr) {
+            memcpy(msg->public_key, tcp_server->accepted_connection_array[index].public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            msg->from_identifier = tcp_server->accepted_connection_array[index].identifier;
+            broadcast_shard_message(tcp_server, msg);
+        }
+    }
+
+#endif
     return index;
 }
 
@@ -254,10 +712,11 @@ static int del_accepted(TCP_Server *tcp_server, int index)
         return -1;
     }
 
-    if (!bs_list_remove(&tcp_server->accepted_key_list, tcp_server->accepted_connection_array[index].public_key, index)) {
+    if (!key_map_remove(&tcp_server->accepted_key_list, tcp_server->accepted_connection_array[index].public_key, index)) {
         return -1;
     }
 
+    timer_wheel_cancel(tcp_server->ping_timers, index);
     wipe_secure_connection(&tcp_server->accepted_connection_array[index]);
     --tcp_server->num_accepted_connections;
 
@@ -268,38 +727,6 @@ static int del_accepted(TCP_Server *tcp_server, int index)
     return 0;
 }
 
-/* Read the next two bytes in TCP stream then convert them to
- * length (host byte order).
- *
- * return length on success
- * return 0 if nothing has been read from socket.
- * return -1 on failure.
- */
-uint16_t read_TCP_length(const Logger *logger, Socket sock)
-{
-    const unsigned int count = net_socket_data_recv_buffer(sock);
-
-    if (count >= sizeof(uint16_t)) {
-        uint16_t length;
-        const int len = net_recv(sock, &length, sizeof(uint16_t));
-
-        if (len != sizeof(uint16_t)) {
-            LOGGER_ERROR(logger, "FAIL recv packet");
-            return 0;
-        }
-
-        length = net_ntohs(length);
-
-        if (length > MAX_PACKET_SIZE) {
-            return -1;
-        }
-
-        return length;
-    }
-
-    return 0;
-}
-
 /* Read length bytes from socket.
  *
  * return length on success
@@ -323,206 +750,287 @@ int read_TCP_packet(const Logger *logger, Socket sock, uint8_t *data, uint16_t l
     return -1;
 }
 
-/* return length of received packet on success.
- * return 0 if could not read any packet.
- * return -1 on failure (connection must be killed).
+/* Return the length of the next packet in recv_buffer, receiving from sock
+ * until a complete packet is buffered or the socket has no more data.
+ *
+ * return length of the packet after its length prefix on success.
+ * return 0 if no complete packet is buffered.
+ * return -1 on failure.
  */
-int read_packet_TCP_secure_connection(const Logger *logger, Socket sock, uint16_t *next_packet_length,
-                                      const uint8_t *shared_key, uint8_t *recv_nonce, uint8_t *data, uint16_t max_len)
+static int buffered_TCP_packet_length(Socket sock, TCP_Recv_Buffer *recv_buffer)
 {
-    if (*next_packet_length == 0) {
-        uint16_t len = read_TCP_length(logger, sock);
+    while (true) {
+        const uint16_t buffered = recv_buffer->end - recv_buffer->start;
 
-        if (len == (uint16_t) -1) {
-            return -1;
+        if (buffered >= sizeof(uint16_t)) {
+            uint16_t length;
+            memcpy(&length, recv_buffer->data + recv_buffer->start, sizeof(uint16_t));
+            length = net_ntohs(length);
+
+            if (length > MAX_PACKET_SIZE) {
+                return -1;
+            }
+
+            if (buffered >= sizeof(uint16_t) + length) {
+                return length;
+            }
+        }
+
+        /* Make room for a whole packet after the partial one. */
+        if (recv_buffer->start == recv_buffer->end) {
+            recv_buffer->start = TCP_RECV_BUFFER_HEADROOM;
+            recv_buffer->end = TCP_RECV_BUFFER_HEADROOM;
+        } else if ((size_t)(TCP_RECV_BUFFER_SIZE - recv_buffer->end) < sizeof(uint16_t) + MAX_PACKET_SIZE) {
+            memmove(recv_buffer->data + TCP_RECV_BUFFER_HEADROOM, recv_buffer->data + recv_buffer->start, buffered);
+            recv_buffer->start = TCP_RECV_BUFFER_HEADROOM;
+            recv_buffer->end = TCP_RECV_BUFFER_HEADROOM + buffered;
         }
 
-        if (len == 0) {
+        const int len = net_recv(sock, recv_buffer->data + recv_buffer->end, TCP_RECV_BUFFER_SIZE - recv_buffer->end);
+
+        if (len <= 0) {
             return 0;
         }
 
-        *next_packet_length = len;
+        recv_buffer->end += len;
     }
+}
 
-    if (max_len + CRYPTO_MAC_SIZE < *next_packet_length) {
-        return -1;
+/* Decrypt the next packet in recv_buffer where it is and point *data at it. It
+ * stays there until recv_buffer is read from again, with CRYPTO_PLAIN_PADDING_SIZE
+ * bytes in front of it that are free to use.
+ *
+ * return length of packet on success.
+ * return 0 if could not read any packet.
+ * return -1 on failure (connection must be killed).
+ */
+static int read_packet_TCP_secure_connection_in_place(Socket sock, TCP_Recv_Buffer *recv_buffer,
+        const uint8_t *shared_key, uint8_t *recv_nonce, uint8_t **data)
+{
+    const int len_packet = buffered_TCP_packet_length(sock, recv_buffer);
+
+    if (len_packet <= 0) {
+        return len_packet;
     }
 
-    VLA(uint8_t, data_encrypted, *next_packet_length);
-    int len_packet = read_TCP_packet(logger, sock, data_encrypted, *next_packet_length);
+    /* The headroom and the length in front of the packet are used as padding. */
+    uint8_t *buffer = recv_buffer->data + recv_buffer->start + sizeof(uint16_t) - CRYPTO_ENCRYPTED_PADDING_SIZE;
+    recv_buffer->start += sizeof(uint16_t) + len_packet;
 
-    if (len_packet != *next_packet_length) {
-        return 0;
+    const int len = decrypt_data_symmetric_in_place(shared_key, recv_nonce, buffer, len_packet);
+
+    if (len == -1 || len + CRYPTO_MAC_SIZE != len_packet) {
+        return -1;
     }
 
-    *next_packet_length = 0;
+    increment_nonce(recv_nonce);
 
-    int len = decrypt_data_symmetric(shared_key, recv_nonce, data_encrypted, len_packet, data);
+    *data = buffer + CRYPTO_PLAIN_PADDING_SIZE;
+    return len;
+}
 
-    if (len + CRYPTO_MAC_SIZE != len_packet) {
-        return -1;
+int read_packet_TCP_secure_connection(const Logger *logger, Socket sock, TCP_Recv_Buffer *recv_buffer,
+                                      const uint8_t *shared_key, uint8_t *recv_nonce, uint8_t *data, uint16_t max_len)
+{
+    uint8_t *packet;
+    const int len = read_packet_TCP_secure_connection_in_place(sock, recv_buffer, shared_key, recv_nonce, &packet);
+
+    if (len <= 0) {
+        return len;
     }
 
-    increment_nonce(recv_nonce);
+    if (len > max_len) {
+        return -1;
+    }
 
+    memcpy(data, packet, len);
     return len;
 }
 
-/* return 0 if pending data was sent completely
- * return -1 if it wasn't
- */
-static int send_pending_data_nonpriority(TCP_Secure_Connection *con)
+void tcp_send_queue_init(TCP_Send_Queue *queue, uint32_t limit)
 {
-    if (con->last_packet_length == 0) {
-        return 0;
+    memset(queue, 0, sizeof(TCP_Send_Queue));
+    queue->limit = limit;
+}
+
+void tcp_send_queue_free(TCP_Send_Queue *queue)
+{
+    free(queue->data);
+    queue->data = nullptr;
+    queue->size = 0;
+    queue->start = 0;
+    queue->length = 0;
+}
+
+bool tcp_send_queue_flush(TCP_Send_Queue *queue, Socket sock)
+{
+    if (queue->length == 0) {
+        return true;
     }
 
-    const uint16_t left = con->last_packet_length - con->last_packet_sent;
-    const int len = net_send(con->sock, con->last_packet + con->last_packet_sent, left);
+    const uint32_t first = min_u32(queue->length, queue->size - queue->start);
+    int len;
+
+    if (first < queue->length) {
+        len = net_send2(sock, queue->data + queue->start, first, queue->data, queue->length - first);
+    } else {
+        len = net_send(sock, queue->data + queue->start, first);
+    }
 
     if (len <= 0) {
-        return -1;
+        return false;
     }
 
-    if (len == left) {
-        con->last_packet_length = 0;
-        con->last_packet_sent = 0;
-        return 0;
+    queue->start = (queue->start + len) % queue->size;
+    queue->length -= len;
+
+    if (queue->length != 0) {
+        return false;
     }
 
-    con->last_packet_sent += len;
-    return -1;
+    tcp_send_queue_free(queue);
+    return true;
 }
 
-/* return 0 if pending data was sent completely
- * return -1 if it wasn't
- */
-static int send_pending_data(TCP_Secure_Connection *con)
+bool tcp_send_queue_reserve(TCP_Send_Queue *queue, Socket sock, uint16_t length, bool priority)
 {
-    /* finish sending current non-priority packet */
-    if (send_pending_data_nonpriority(con) == -1) {
-        return -1;
+    if (tcp_send_queue_flush(queue, sock)) {
+        return true;
     }
 
-    TCP_Priority_List *p = con->priority_queue_start;
+    uint32_t room = priority ? queue->limit + TCP_SEND_QUEUE_PRIORITY_SIZE : queue->limit;
 
-    while (p) {
-        const uint16_t left = p->size - p->sent;
-        const int len = net_send(con->sock, p->data + p->sent, left);
+    if (room > queue->size) {
+        room = queue->size;
+    }
 
-        if (len != left) {
-            if (len > 0) {
-                p->sent += len;
-            }
+    if (queue->length + length <= room) {
+        return true;
+    }
 
-            break;
+    if (priority) {
+        ++queue->dropped;
+    } else {
+        ++queue->refused;
+    }
+
+    return false;
+}
+
+bool tcp_send_queue_add(TCP_Send_Queue *queue, const uint8_t *data, uint16_t length)
+{
+    if (queue->data == nullptr) {
+        const uint32_t size = max_u32(queue->limit, sizeof(uint16_t) + MAX_PACKET_SIZE) + TCP_SEND_QUEUE_PRIORITY_SIZE;
+        queue->data = (uint8_t *)malloc(size);
+
+        if (queue->data == nullptr) {
+            return false;
         }
 
-        TCP_Priority_List *pp = p;
-        p = p->next;
-        free(pp);
+        queue->size = size;
+        queue->start = 0;
+        queue->length = 0;
+    }
+
+    if (queue->size - queue->length < length) {
+        return false;
     }
 
-    con->priority_queue_start = p;
+    const uint32_t end = (queue->start + queue->length) % queue->size;
+    const uint32_t first = min_u32(length, queue->size - end);
+    memcpy(queue->data + end, data, first);
+    memcpy(queue->data, data + first, length - first);
+    queue->length += length;
 
-    if (!p) {
-        con->priority_queue_end = nullptr;
-        return 0;
+    if (queue->length > queue->max_length) {
+        queue->max_length = queue->length;
     }
 
-    return -1;
+    return true;
 }
 
-/* return 0 on failure (only if malloc fails)
- * return 1 on success
- */
-static bool add_priority(TCP_Secure_Connection *con, const uint8_t *packet, uint16_t size, uint16_t sent)
+bool tcp_send_queue_write(TCP_Send_Queue *queue, Socket sock, const uint8_t *data, uint16_t length)
 {
-    TCP_Priority_List *p = con->priority_queue_end;
-    TCP_Priority_List *new_list = (TCP_Priority_List *)malloc(sizeof(TCP_Priority_List) + size);
+    if (queue->length != 0) {
+        return tcp_send_queue_add(queue, data, length);
+    }
 
-    if (!new_list) {
-        return 0;
+    const int len = net_send(sock, data, length);
+
+    if (len == length) {
+        return true;
     }
 
-    new_list->next = nullptr;
-    new_list->size = size;
-    new_list->sent = sent;
-    memcpy(new_list->data, packet, size);
+    const uint16_t sent = len > 0 ? len : 0;
+    return tcp_send_queue_add(queue, data + sent, length - sent);
+}
 
-    if (p) {
-        p->next = new_list;
-    } else {
-        con->priority_queue_start = new_list;
+void tcp_send_queue_add_stats(const TCP_Send_Queue *queue, TCP_Send_Queue_Stats *stats)
+{
+    stats->queued += queue->length;
+
+    if (queue->length != 0) {
+        ++stats->connections;
     }
 
-    con->priority_queue_end = new_list;
-    return 1;
+    stats->max_queued = max_u32(stats->max_queued, queue->max_length);
+    stats->refused += queue->refused;
+    stats->dropped += queue->dropped;
 }
 
-/* return 1 on success.
+/* Send the length bytes of data at buffer + CRYPTO_PLAIN_PADDING_SIZE, which
+ * are encrypted where they are. The bytes in front of them are overwritten.
+ *
+ * return 1 on success.
  * return 0 if could not send packet.
  * return -1 on failure (connection must be killed).
  */
-static int write_packet_TCP_secure_connection(TCP_Secure_Connection *con, const uint8_t *data, uint16_t length,
+static int write_padded_packet_TCP_secure_connection(TCP_Secure_Connection *con, uint8_t *buffer, uint16_t length,
         bool priority)
 {
     if (length + CRYPTO_MAC_SIZE > MAX_PACKET_SIZE) {
         return -1;
     }
 
-    bool sendpriority = 1;
+    const uint16_t packet_length = sizeof(uint16_t) + CRYPTO_MAC_SIZE + length;
 
-    if (send_pending_data(con) == -1) {
-        if (priority) {
-            sendpriority = 0;
-        } else {
-            return 0;
-        }
+    if (!tcp_send_queue_reserve(&con->send_queue, con->sock, packet_length, priority)) {
+        return 0;
     }
 
-    VLA(uint8_t, packet, sizeof(uint16_t) + length + CRYPTO_MAC_SIZE);
+    const int len = encrypt_data_symmetric_in_place(con->shared_key, con->sent_nonce, buffer, length);
 
-    const uint16_t c_length = net_htons(length + CRYPTO_MAC_SIZE);
-    memcpy(packet, &c_length, sizeof(uint16_t));
-    int len = encrypt_data_symmetric(con->shared_key, con->sent_nonce, data, length, packet + sizeof(uint16_t));
-
-    if ((unsigned int)len != (SIZEOF_VLA(packet) - sizeof(uint16_t))) {
+    if (len != length + CRYPTO_MAC_SIZE) {
         return -1;
     }
 
-    if (priority) {
-        len = sendpriority ? net_send(con->sock, packet, SIZEOF_VLA(packet)) : 0;
-
-        if (len <= 0) {
-            len = 0;
-        }
-
-        increment_nonce(con->sent_nonce);
-
-        if ((unsigned int)len == SIZEOF_VLA(packet)) {
-            return 1;
-        }
-
-        return add_priority(con, packet, SIZEOF_VLA(packet), len);
-    }
+    increment_nonce(con->sent_nonce);
 
-    len = net_send(con->sock, packet, SIZEOF_VLA(packet));
+    uint8_t *packet = buffer + CRYPTO_ENCRYPTED_PADDING_SIZE - sizeof(uint16_t);
+    const uint16_t c_length = net_htons(len);
+    memcpy(packet, &c_length, sizeof(uint16_t));
 
-    if (len <= 0) {
-        return 0;
+    if (!tcp_send_queue_write(&con->send_queue, con->sock, packet, packet_length)) {
+        return -1;
     }
 
-    increment_nonce(con->sent_nonce);
+    return 1;
+}
 
-    if ((unsigned int)len == SIZEOF_VLA(packet)) {
-        return 1;
+/* return 1 on success.
+ * return 0 if could not send packet.
+ * return -1 on failure (connection must be killed).
+ */
+static int write_packet_TCP_secure_connection(TCP_Secure_Connection *con, const uint8_t *data, uint16_t length,
+        bool priority)
+{
+    if (length + CRYPTO_MAC_SIZE > MAX_PACKET_SIZE) {
+        return -1;
     }
 
-    memcpy(con->last_packet, packet, SIZEOF_VLA(packet));
-    con->last_packet_length = SIZEOF_VLA(packet);
-    con->last_packet_sent = len;
-    return 1;
+    VLA(uint8_t, buffer, CRYPTO_PLAIN_PADDING_SIZE + length);
+    memcpy(buffer + CRYPTO_PLAIN_PADDING_SIZE, data, length);
+    return write_padded_packet_TCP_secure_connection(con, buffer, length, priority);
 }
 
 /* Kill a TCP_Secure_Connection
@@ -562,11 +1070,38 @@ static int kill_accepted(TCP_Server *tcp_server, int index)
     return 0;
 }
 
+/* Make up to max session keypairs for later handshakes.
+ */
+static void make_session_keypairs(TCP_Server *tcp_server, uint32_t max)
+{
+    for (uint32_t i = 0; i < max && tcp_server->num_session_keypairs < TCP_SESSION_KEYPAIRS; ++i) {
+        uint8_t *keypair = tcp_server->session_keypairs[tcp_server->num_session_keypairs];
+        crypto_new_keypair(keypair, keypair + CRYPTO_PUBLIC_KEY_SIZE);
+        ++tcp_server->num_session_keypairs;
+    }
+}
+
+/* Take a session keypair made ahead of time, or make one if none are left.
+ */
+static void take_session_keypair(TCP_Server *tcp_server, uint8_t *public_key, uint8_t *secret_key)
+{
+    if (tcp_server->num_session_keypairs == 0) {
+        crypto_new_keypair(public_key, secret_key);
+        return;
+    }
+
+    --tcp_server->num_session_keypairs;
+    uint8_t *keypair = tcp_server->session_keypairs[tcp_server->num_session_keypairs];
+    memcpy(public_key, keypair, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(secret_key, keypair + CRYPTO_PUBLIC_KEY_SIZE, CRYPTO_SECRET_KEY_SIZE);
+    crypto_memzero(keypair, sizeof(tcp_server->session_keypairs[0]));
+}
+
 /* return 1 if everything went well.
  * return -1 if the connection must be killed.
  */
-static int handle_TCP_handshake(TCP_Secure_Connection *con, const uint8_t *data, uint16_t length,
-                                const uint8_t *self_secret_key)
+static int handle_TCP_handshake(TCP_Server *tcp_server, TCP_Secure_Connection *con, const uint8_t *data,
+                                uint16_t length)
 {
     if (length != TCP_CLIENT_HANDSHAKE_SIZE) {
         return -1;
@@ -577,7 +1112,7 @@ static int handle_TCP_handshake(TCP_Secure_Connection *con, const uint8_t *data,
     }
 
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    encrypt_precompute(data, self_secret_key, shared_key);
+    encrypt_precompute(data, tcp_server->secret_key, shared_key);
     uint8_t plain[TCP_HANDSHAKE_PLAIN_SIZE];
     int len = decrypt_data_symmetric(shared_key, data + CRYPTO_PUBLIC_KEY_SIZE,
                                      data + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE, TCP_HANDSHAKE_PLAIN_SIZE + CRYPTO_MAC_SIZE, plain);
@@ -589,7 +1124,7 @@ static int handle_TCP_handshake(TCP_Secure_Connection *con, const uint8_t *data,
     memcpy(con->public_key, data, CRYPTO_PUBLIC_KEY_SIZE);
     uint8_t temp_secret_key[CRYPTO_SECRET_KEY_SIZE];
     uint8_t resp_plain[TCP_HANDSHAKE_PLAIN_SIZE];
-    crypto_new_keypair(resp_plain, temp_secret_key);
+    take_session_keypair(tcp_server, resp_plain, temp_secret_key);
     random_nonce(con->sent_nonce);
     memcpy(resp_plain + CRYPTO_PUBLIC_KEY_SIZE, con->sent_nonce, CRYPTO_NONCE_SIZE);
     memcpy(con->recv_nonce, plain + CRYPTO_PUBLIC_KEY_SIZE, CRYPTO_NONCE_SIZE);
@@ -604,6 +1139,12 @@ static int handle_TCP_handshake(TCP_Secure_Connection *con, const uint8_t *data,
         return -1;
     }
 
+    con->recv_buffer = (TCP_Recv_Buffer *)calloc(1, sizeof(TCP_Recv_Buffer));
+
+    if (con->recv_buffer == nullptr) {
+        return -1;
+    }
+
     if (TCP_SERVER_HANDSHAKE_SIZE != net_send(con->sock, response, TCP_SERVER_HANDSHAKE_SIZE)) {
         return -1;
     }
@@ -617,13 +1158,13 @@ static int handle_TCP_handshake(TCP_Secure_Connection *con, const uint8_t *data,
  * return 0 if we didn't get it yet.
  * return -1 if the connection must be killed.
  */
-static int read_connection_handshake(const Logger *logger, TCP_Secure_Connection *con, const uint8_t *self_secret_key)
+static int read_connection_handshake(TCP_Server *tcp_server, TCP_Secure_Connection *con)
 {
     uint8_t data[TCP_CLIENT_HANDSHAKE_SIZE];
-    const int len = read_TCP_packet(logger, con->sock, data, TCP_CLIENT_HANDSHAKE_SIZE);
+    const int len = read_TCP_packet(tcp_server->logger, con->sock, data, TCP_CLIENT_HANDSHAKE_SIZE);
 
     if (len != -1) {
-        return handle_TCP_handshake(con, data, len, self_secret_key);
+        return handle_TCP_handshake(tcp_server, con, data, len);
     }
 
     return 0;
@@ -663,6 +1204,86 @@ static int send_disconnect_notification(TCP_Secure_Connection *con, uint8_t id)
     return write_packet_TCP_secure_connection(con, data, sizeof(data), 1);
 }
 
+#ifdef TCP_SERVER_USE_EPOLL
+static void set_shard_message_from(const TCP_Server *tcp_server, TCP_Shard_Message *msg, uint32_t con_id,
+                                   uint8_t con_number)
+{
+    const TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[con_id];
+    msg->from_shard = tcp_server->shard_index;
+    msg->from_index = con_id;
+    msg->from_identifier = con->identifier;
+    msg->from_con_number = con_number;
+    memcpy(msg->from_public_key, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+}
+
+/* Ask the other workers for the client that connection con_number of con_id
+ * wants to be routed to.
+ */
+static void shard_routing_request(TCP_Server *tcp_server, uint32_t con_id, uint8_t con_number)
+{
+    TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_ROUTING_REQUEST, nullptr, 0);
+
+    if (msg == nullptr) {
+        return;
+    }
+
+    memcpy(msg->public_key, tcp_server->accepted_connection_array[con_id].connections[con_number].public_key,
+           CRYPTO_PUBLIC_KEY_SIZE);
+    set_shard_message_from(tcp_server, msg, con_id, con_number);
+    broadcast_shard_message(tcp_server, msg);
+}
+
+/* Pass a packet on connection con_number of con_id to the worker of the other end.
+ */
+static void shard_routed_packet(TCP_Server *tcp_server, uint32_t con_id, uint8_t con_number, const uint8_t *data,
+                                uint16_t length)
+{
+    const TCP_Secure_Conn *conn = &tcp_server->accepted_connection_array[con_id].connections[con_number];
+
+    if (conn->shard >= tcp_server->pool->num_shards) {
+        return;
+    }
+
+    TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_ROUTED_PACKET, data, length);
+
+    if (msg == nullptr) {
+        return;
+    }
+
+    msg->data[0] = conn->other_id + NUM_RESERVED_PORTS;
+    msg->index = conn->index;
+    msg->identifier = conn->other_identifier;
+    msg->con_number = conn->other_id;
+    set_shard_message_from(tcp_server, msg, con_id, con_number);
+    post_shard_message(tcp_server->pool->shards[conn->shard], msg);
+}
+
+/* Tell the worker of the other end of connection con_number of con that it went away.
+ */
+static void shard_disconnect(TCP_Server *tcp_server, const TCP_Secure_Connection *con, uint8_t con_number)
+{
+    const TCP_Secure_Conn *conn = &con->connections[con_number];
+
+    if (conn->shard >= tcp_server->pool->num_shards) {
+        return;
+    }
+
+    TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_DISCONNECT, nullptr, 0);
+
+    if (msg == nullptr) {
+        return;
+    }
+
+    msg->index = conn->index;
+    msg->identifier = conn->other_identifier;
+    msg->con_number = conn->other_id;
+    msg->from_shard = tcp_server->shard_index;
+    msg->from_identifier = con->identifier;
+    msg->from_con_number = con_number;
+    post_shard_message(tcp_server->pool->shards[conn->shard], msg);
+}
+#endif
+
 /* return 0 on success.
  * return -1 on failure (connection must be killed).
  */
@@ -717,6 +1338,15 @@ static int handle_TCP_routing_req(TCP_Server *tcp_server, uint32_t con_id, const
     memcpy(con->connections[index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
     int other_index = get_TCP_connection_index(tcp_server, public_key);
 
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (other_index == -1 && tcp_server->pool != nullptr) {
+        /* The other client may be connected to another worker. */
+        shard_routing_request(tcp_server, con_id, index);
+    }
+
+#endif
+
     if (other_index != -1) {
         uint32_t other_id = -1;
         TCP_Secure_Connection *other_conn = &tcp_server->accepted_connection_array[other_index];
@@ -736,6 +1366,10 @@ static int handle_TCP_routing_req(TCP_Server *tcp_server, uint32_t con_id, const
             other_conn->connections[other_id].status = 2;
             other_conn->connections[other_id].index = con_id;
             other_conn->connections[other_id].other_id = index;
+#ifdef TCP_SERVER_USE_EPOLL
+            con->connections[index].shard = tcp_server->shard_index;
+            other_conn->connections[other_id].shard = tcp_server->shard_index;
+#endif
             // TODO(irungentoo): return values?
             send_connect_notification(con, index);
             send_connect_notification(other_conn, other_id);
@@ -766,8 +1400,25 @@ static int handle_TCP_oob_send(TCP_Server *tcp_server, uint32_t con_id, const ui
         memcpy(resp_packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, data, length);
         write_packet_TCP_secure_connection(&tcp_server->accepted_connection_array[other_index], resp_packet,
                                            SIZEOF_VLA(resp_packet), 0);
+        ++tcp_server->stats.oob_relayed;
     }
 
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (other_index == -1 && tcp_server->pool != nullptr) {
+        TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_OOB, nullptr, 1 + CRYPTO_PUBLIC_KEY_SIZE + length);
+
+        if (msg != nullptr) {
+            msg->data[0] = TCP_PACKET_OOB_RECV;
+            memcpy(msg->data + 1, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            memcpy(msg->data + 1 + CRYPTO_PUBLIC_KEY_SIZE, data, length);
+            memcpy(msg->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            broadcast_shard_message(tcp_server, msg);
+            ++tcp_server->stats.oob_relayed;
+        }
+    }
+
+#endif
     return 0;
 }
 
@@ -787,6 +1438,15 @@ static int rm_connection_index(TCP_Server *tcp_server, TCP_Secure_Connection *co
         uint8_t other_id = con->connections[con_number].other_id;
 
         if (con->connections[con_number].status == 2) {
+#ifdef TCP_SERVER_USE_EPOLL
+
+            if (con->connections[con_number].shard != tcp_server->shard_index) {
+                shard_disconnect(tcp_server, con, con_number);
+                memset(&con->connections[con_number], 0, sizeof(TCP_Secure_Conn));
+                return 0;
+            }
+
+#endif
 
             if (index >= tcp_server->size_accepted_connections) {
                 return -1;
@@ -813,6 +1473,32 @@ static int handle_onion_recv_1(void *object, IP_Port dest, const uint8_t *data,
     TCP_Server *tcp_server = (TCP_Server *)object;
     uint32_t index = dest.ip.ip.v6.uint32[0];
 
+#ifdef TCP_SERVER_USE_EPOLL
+
+    /* The request came from a worker, which sent the number of its shard along. */
+    if (tcp_server->shards != nullptr) {
+        const uint32_t shard = dest.ip.ip.v6.uint32[1];
+
+        if (shard >= tcp_server->num_shards) {
+            return 1;
+        }
+
+        TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_PACKET, nullptr, 1 + length);
+
+        if (msg == nullptr) {
+            return 1;
+        }
+
+        msg->data[0] = TCP_PACKET_ONION_RESPONSE;
+        memcpy(msg->data + 1, data, length);
+        msg->index = index;
+        msg->identifier = dest.ip.ip.v6.uint64[1];
+        post_shard_message(tcp_server->shards[shard], msg);
+        return 0;
+    }
+
+#endif
+
     if (index >= tcp_server->size_accepted_connections) {
         return 1;
     }
@@ -823,21 +1509,25 @@ static int handle_onion_recv_1(void *object, IP_Port dest, const uint8_t *data,
         return 1;
     }
 
-    VLA(uint8_t, packet, 1 + length);
-    memcpy(packet + 1, data, length);
-    packet[0] = TCP_PACKET_ONION_RESPONSE;
+    VLA(uint8_t, buffer, CRYPTO_PLAIN_PADDING_SIZE + 1 + length);
+    buffer[CRYPTO_PLAIN_PADDING_SIZE] = TCP_PACKET_ONION_RESPONSE;
+    memcpy(buffer + CRYPTO_PLAIN_PADDING_SIZE + 1, data, length);
 
-    if (write_packet_TCP_secure_connection(con, packet, SIZEOF_VLA(packet), 0) != 1) {
+    if (write_padded_packet_TCP_secure_connection(con, buffer, 1 + length, 0) != 1) {
         return 1;
     }
 
+    ++tcp_server->stats.onion_responses;
     return 0;
 }
 
 /* return 0 on success
  * return -1 on failure
  */
-static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint8_t *data, uint16_t length)
+/* data was decrypted in place, so CRYPTO_PLAIN_PADDING_SIZE bytes in front of it
+ * are free to use for passing it on without copying it.
+ */
+static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, uint8_t *data, uint16_t length)
 {
     if (length == 0) {
         return -1;
@@ -845,6 +1535,9 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
 
     TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[con_id];
 
+    ++tcp_server->stats.packets_received;
+    tcp_server->stats.bytes_received += length;
+
     switch (data[0]) {
         case TCP_PACKET_ROUTING_REQUEST: {
             if (length != 1 + CRYPTO_PUBLIC_KEY_SIZE) {
@@ -911,6 +1604,27 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
         }
 
         case TCP_PACKET_ONION_REQUEST: {
+#ifdef TCP_SERVER_USE_EPOLL
+
+            /* Workers leave sending onion packets to the thread that runs onion. */
+            if (tcp_server->pool != nullptr) {
+                if (length <= 1 + CRYPTO_NONCE_SIZE + ONION_SEND_BASE * 2) {
+                    return -1;
+                }
+
+                TCP_Shard_Message *msg = new_shard_message(TCP_SHARD_ONION_REQUEST, data + 1, length - 1);
+
+                if (msg != nullptr) {
+                    set_shard_message_from(tcp_server, msg, con_id, 0);
+                    post_shard_message(tcp_server->pool, msg);
+                    ++tcp_server->stats.onion_requests;
+                }
+
+                return 0;
+            }
+
+#endif
+
             if (tcp_server->onion) {
                 if (length <= 1 + CRYPTO_NONCE_SIZE + ONION_SEND_BASE * 2) {
                     return -1;
@@ -922,8 +1636,11 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
                 source.ip.ip.v6.uint32[0] = con_id;
                 source.ip.ip.v6.uint32[1] = 0;
                 source.ip.ip.v6.uint64[1] = con->identifier;
-                onion_send_1(tcp_server->onion, data + 1 + CRYPTO_NONCE_SIZE, length - (1 + CRYPTO_NONCE_SIZE), source,
-                             data + 1);
+
+                if (onion_send_1(tcp_server->onion, data + 1 + CRYPTO_NONCE_SIZE, length - (1 + CRYPTO_NONCE_SIZE),
+                                 source, data + 1) == 0) {
+                    ++tcp_server->stats.onion_requests;
+                }
             }
 
             return 0;
@@ -952,12 +1669,22 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
                 return 0;
             }
 
+            ++tcp_server->stats.packets_relayed;
+            tcp_server->stats.bytes_relayed += length;
+
+#ifdef TCP_SERVER_USE_EPOLL
+
+            if (con->connections[c_id].shard != tcp_server->shard_index) {
+                shard_routed_packet(tcp_server, con_id, c_id, data, length);
+                return 0;
+            }
+
+#endif
+
             uint32_t index = con->connections[c_id].index;
-            uint8_t other_c_id = con->connections[c_id].other_id + NUM_RESERVED_PORTS;
-            VLA(uint8_t, new_data, length);
-            memcpy(new_data, data, length);
-            new_data[0] = other_c_id;
-            int ret = write_packet_TCP_secure_connection(&tcp_server->accepted_connection_array[index], new_data, length, 0);
+            data[0] = con->connections[c_id].other_id + NUM_RESERVED_PORTS;
+            int ret = write_padded_packet_TCP_secure_connection(&tcp_server->accepted_connection_array[index],
+                      data - CRYPTO_PLAIN_PADDING_SIZE, length, 0);
 
             if (ret == -1) {
                 return -1;
@@ -972,8 +1699,7 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
 
 
 static int confirm_TCP_connection(TCP_Server *tcp_server, const Mono_Time *mono_time, TCP_Secure_Connection *con,
-                                  const uint8_t *data,
-                                  uint16_t length)
+                                  uint8_t *data, uint16_t length)
 {
     int index = add_accepted(tcp_server, mono_time, con);
 
@@ -1021,13 +1747,12 @@ static int accept_connection(TCP_Server *tcp_server, Socket sock)
 
     conn->status = TCP_STATUS_CONNECTED;
     conn->sock = sock;
-    conn->next_packet_length = 0;
 
     ++tcp_server->incoming_connection_queue_index;
     return index;
 }
 
-static Socket new_listening_TCP_socket(Family family, uint16_t port)
+static Socket new_listening_TCP_socket(Family family, uint16_t port, bool reuseport)
 {
     Socket sock = net_socket(family, TOX_SOCK_STREAM, TOX_PROTO_TCP);
 
@@ -1045,6 +1770,10 @@ static Socket new_listening_TCP_socket(Family family, uint16_t port)
         ok = set_socket_reuseaddr(sock);
     }
 
+    if (ok && reuseport) {
+        ok = set_socket_reuseport(sock);
+    }
+
     ok = ok && bind_to_port(sock, family, port) && (net_listen(sock, TCP_MAX_BACKLOG) == 0);
 
     if (!ok) {
@@ -1055,8 +1784,8 @@ static Socket new_listening_TCP_socket(Family family, uint16_t port)
     return sock;
 }
 
-TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
-                           const uint8_t *secret_key, Onion *onion)
+static TCP_Server *tcp_server_new(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets,
+                                  const uint16_t *ports, const uint8_t *secret_key, bool reuseport)
 {
     if (num_sockets == 0 || ports == nullptr) {
         return nullptr;
@@ -1073,6 +1802,7 @@ TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t
     }
 
     temp->logger = logger;
+    temp->send_queue_limit = TCP_SEND_QUEUE_LIMIT;
 
     temp->socks_listening = (Socket *)calloc(num_sockets, sizeof(Socket));
 
@@ -1090,6 +1820,7 @@ TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t
         return nullptr;
     }
 
+    temp->wakeup_fd = -1;
 #endif
 
     const Family family = ipv6_enabled ? net_family_ipv6 : net_family_ipv4;
@@ -1100,7 +1831,7 @@ TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t
 #endif
 
     for (i = 0; i < num_sockets; ++i) {
-        Socket sock = new_listening_TCP_socket(family, ports[i]);
+        Socket sock = new_listening_TCP_socket(family, ports[i], reuseport);
 
         if (sock_valid(sock)) {
 #ifdef TCP_SERVER_USE_EPOLL
@@ -1119,21 +1850,44 @@ TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t
     }
 
     if (temp->num_listening_socks == 0) {
+#ifdef TCP_SERVER_USE_EPOLL
+        close(temp->efd);
+#endif
         free(temp->socks_listening);
         free(temp);
         return nullptr;
     }
 
+    memcpy(temp->secret_key, secret_key, CRYPTO_SECRET_KEY_SIZE);
+    crypto_derive_public_key(temp->public_key, temp->secret_key);
+
+    temp->ping_timers = timer_wheel_new(0);
+
+    if (!key_map_init(&temp->accepted_key_list, CRYPTO_PUBLIC_KEY_SIZE, 8) || temp->ping_timers == nullptr) {
+        kill_TCP_server(temp);
+        return nullptr;
+    }
+
+    /* Clients that were connected before a restart all come back at once. */
+    make_session_keypairs(temp, TCP_SESSION_KEYPAIRS);
+
+    return temp;
+}
+
+TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                           const uint8_t *secret_key, Onion *onion)
+{
+    TCP_Server *temp = tcp_server_new(logger, ipv6_enabled, num_sockets, ports, secret_key, false);
+
+    if (temp == nullptr) {
+        return nullptr;
+    }
+
     if (onion) {
         temp->onion = onion;
         set_callback_handle_recv_1(onion, &handle_onion_recv_1, temp);
     }
 
-    memcpy(temp->secret_key, secret_key, CRYPTO_SECRET_KEY_SIZE);
-    crypto_derive_public_key(temp->public_key, temp->secret_key);
-
-    bs_list_init(&temp->accepted_key_list, CRYPTO_PUBLIC_KEY_SIZE, 8);
-
     return temp;
 }
 
@@ -1158,8 +1912,7 @@ static int do_incoming(TCP_Server *tcp_server, uint32_t i)
         return -1;
     }
 
-    int ret = read_connection_handshake(tcp_server->logger, &tcp_server->incoming_connection_queue[i],
-                                        tcp_server->secret_key);
+    int ret = read_connection_handshake(tcp_server, &tcp_server->incoming_connection_queue[i]);
 
     if (ret == -1) {
         kill_TCP_secure_connection(&tcp_server->incoming_connection_queue[i]);
@@ -1172,6 +1925,7 @@ static int do_incoming(TCP_Server *tcp_server, uint32_t i)
             kill_TCP_secure_connection(conn_new);
         }
 
+        tcp_send_queue_init(&conn_old->send_queue, tcp_server->send_queue_limit);
         move_secure_connection(conn_new, conn_old);
         ++tcp_server->unconfirmed_connection_queue_index;
 
@@ -1189,9 +1943,9 @@ static int do_unconfirmed(TCP_Server *tcp_server, const Mono_Time *mono_time, ui
         return -1;
     }
 
-    uint8_t packet[MAX_PACKET_SIZE];
-    int len = read_packet_TCP_secure_connection(tcp_server->logger, conn->sock, &conn->next_packet_length, conn->shared_key,
-              conn->recv_nonce, packet, sizeof(packet));
+    uint8_t *packet;
+    const int len = read_packet_TCP_secure_connection_in_place(conn->sock, conn->recv_buffer, conn->shared_key,
+                    conn->recv_nonce, &packet);
 
     if (len == 0) {
         return -1;
@@ -1209,9 +1963,9 @@ static bool tcp_process_secure_packet(TCP_Server *tcp_server, uint32_t i)
 {
     TCP_Secure_Connection *const conn = &tcp_server->accepted_connection_array[i];
 
-    uint8_t packet[MAX_PACKET_SIZE];
-    int len = read_packet_TCP_secure_connection(tcp_server->logger, conn->sock, &conn->next_packet_length, conn->shared_key,
-              conn->recv_nonce, packet, sizeof(packet));
+    uint8_t *packet;
+    const int len = read_packet_TCP_secure_connection_in_place(conn->sock, conn->recv_buffer, conn->shared_key,
+                    conn->recv_nonce, &packet);
 
     if (len == 0) {
         return false;
@@ -1254,69 +2008,87 @@ static void do_TCP_unconfirmed(TCP_Server *tcp_server, const Mono_Time *mono_tim
 }
 #endif
 
-static void do_TCP_confirmed(TCP_Server *tcp_server, const Mono_Time *mono_time)
+/* Ping the accepted connection at index if it is due, kill it if it did not
+ * answer the last ping in time, and set its timer for when it next needs either.
+ */
+static void do_TCP_ping(void *object, uint32_t index, uint64_t now)
 {
-#ifdef TCP_SERVER_USE_EPOLL
+    TCP_Server *tcp_server = (TCP_Server *)object;
 
-    if (tcp_server->last_run_pinged == mono_time_get(mono_time)) {
+    if (index >= tcp_server->size_accepted_connections) {
         return;
     }
 
-    tcp_server->last_run_pinged = mono_time_get(mono_time);
-#endif
-    uint32_t i;
+    TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[index];
 
-    for (i = 0; i < tcp_server->size_accepted_connections; ++i) {
-        TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[i];
+    if (conn->status != TCP_STATUS_CONFIRMED) {
+        return;
+    }
 
-        if (conn->status != TCP_STATUS_CONFIRMED) {
-            continue;
+    if (conn->last_pinged + TCP_PING_FREQUENCY <= now) {
+        uint8_t ping[1 + sizeof(uint64_t)];
+        ping[0] = TCP_PACKET_PING;
+        uint64_t ping_id = random_u64();
+
+        if (!ping_id) {
+            ++ping_id;
         }
 
-        if (mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_FREQUENCY)) {
-            uint8_t ping[1 + sizeof(uint64_t)];
-            ping[0] = TCP_PACKET_PING;
-            uint64_t ping_id = random_u64();
+        memcpy(ping + 1, &ping_id, sizeof(uint64_t));
+        int ret = write_packet_TCP_secure_connection(conn, ping, sizeof(ping), 1);
 
-            if (!ping_id) {
-                ++ping_id;
+        if (ret == 1) {
+            conn->last_pinged = now;
+            conn->ping_id = ping_id;
+        } else {
+            if (conn->last_pinged + TCP_PING_FREQUENCY + TCP_PING_TIMEOUT <= now) {
+                kill_accepted(tcp_server, index);
+                return;
             }
+        }
+    }
 
-            memcpy(ping + 1, &ping_id, sizeof(uint64_t));
-            int ret = write_packet_TCP_secure_connection(conn, ping, sizeof(ping), 1);
+    if (conn->ping_id && conn->last_pinged + TCP_PING_TIMEOUT <= now) {
+        kill_accepted(tcp_server, index);
+        return;
+    }
 
-            if (ret == 1) {
-                conn->last_pinged = mono_time_get(mono_time);
-                conn->ping_id = ping_id;
-            } else {
-                if (mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_FREQUENCY + TCP_PING_TIMEOUT)) {
-                    kill_accepted(tcp_server, i);
-                    continue;
-                }
-            }
-        }
+    uint64_t deadline = conn->last_pinged + (conn->ping_id ? TCP_PING_TIMEOUT : TCP_PING_FREQUENCY);
 
-        if (conn->ping_id && mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_TIMEOUT)) {
-            kill_accepted(tcp_server, i);
-            continue;
-        }
+    /* The ping could not be sent, try again on the next tick. */
+    if (deadline <= now) {
+        deadline = now + 1;
+    }
+
+    timer_wheel_set(tcp_server->ping_timers, index, deadline);
+}
 
-        send_pending_data(conn);
+static void do_TCP_confirmed(TCP_Server *tcp_server, const Mono_Time *mono_time)
+{
+    timer_wheel_expire(tcp_server->ping_timers, mono_time_get(mono_time), &do_TCP_ping, tcp_server);
 
 #ifndef TCP_SERVER_USE_EPOLL
 
+    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
+        TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[i];
+
+        if (conn->status != TCP_STATUS_CONFIRMED) {
+            continue;
+        }
+
+        tcp_send_queue_flush(&conn->send_queue, conn->sock);
         do_confirmed_recv(tcp_server, i);
+    }
 
 #endif
-    }
 }
 
 #ifdef TCP_SERVER_USE_EPOLL
-static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time)
+static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time, int timeout)
 {
 #define MAX_EVENTS 16
     struct epoll_event events[MAX_EVENTS];
-    const int nfds = epoll_wait(tcp_server->efd, events, MAX_EVENTS, 0);
+    const int nfds = epoll_wait(tcp_server->efd, events, MAX_EVENTS, timeout);
 #undef MAX_EVENTS
 
     for (int n = 0; n < nfds; ++n) {
@@ -1350,6 +2122,11 @@ static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time
             continue;
         }
 
+        if ((events[n].events & EPOLLOUT) && status == TCP_SOCKET_CONFIRMED) {
+            // the socket has room again for the data it did not take before
+            TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[index];
+            tcp_send_queue_flush(&con->send_queue, con->sock);
+        }
 
         if (!(events[n].events & EPOLLIN)) {
             continue;
@@ -1406,7 +2183,7 @@ static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time
                 const int index_new = do_unconfirmed(tcp_server, mono_time, index);
 
                 if (index_new != -1) {
-                    events[n].events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+                    events[n].events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
                     events[n].data.u64 = sock.socket | ((uint64_t)TCP_SOCKET_CONFIRMED << 32) | ((uint64_t)index_new << 40);
 
                     if (epoll_ctl(tcp_server->efd, EPOLL_CTL_MOD, sock.socket, &events[n]) == -1) {
@@ -1414,6 +2191,10 @@ static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time
                         kill_accepted(tcp_server, index_new);
                         break;
                     }
+
+                    // Packets that arrived with the first one may already be buffered
+                    // and will not trigger another edge.
+                    do_confirmed_recv(tcp_server, index_new);
                 }
 
                 break;
@@ -1423,6 +2204,17 @@ static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time
                 do_confirmed_recv(tcp_server, index);
                 break;
             }
+
+            case TCP_SOCKET_WAKEUP: {
+                // reset the eventfd, the worker takes its messages after processing the events
+                uint64_t count;
+
+                if (read(sock.socket, &count, sizeof(count)) != sizeof(count)) {
+                    LOGGER_TRACE(tcp_server->logger, "TCP worker %u woken up without messages", tcp_server->shard_index);
+                }
+
+                break;
+            }
         }
     }
 
@@ -1431,16 +2223,445 @@ static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time
 
 static void do_TCP_epoll(TCP_Server *tcp_server, const Mono_Time *mono_time)
 {
-    while (tcp_epoll_process(tcp_server, mono_time)) {
+    while (tcp_epoll_process(tcp_server, mono_time, 0)) {
         // Keep processing packets until there are no more FDs ready for reading.
         continue;
     }
 }
+
+/* return the connection a message from another worker is for.
+ * return nullptr if it went away since the message was sent.
+ */
+static TCP_Secure_Connection *shard_message_connection(TCP_Server *tcp_server, const TCP_Shard_Message *msg)
+{
+    if (msg->index >= tcp_server->size_accepted_connections) {
+        return nullptr;
+    }
+
+    TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[msg->index];
+
+    if (con->status != TCP_STATUS_CONFIRMED || con->identifier != msg->identifier) {
+        return nullptr;
+    }
+
+    return con;
+}
+
+/* return the connection number the message is for if it is still routed to the
+ * connection that sent the message.
+ * return -1 otherwise.
+ */
+static int shard_message_con_number(const TCP_Secure_Connection *con, const TCP_Shard_Message *msg)
+{
+    if (msg->con_number >= NUM_CLIENT_CONNECTIONS) {
+        return -1;
+    }
+
+    const TCP_Secure_Conn *conn = &con->connections[msg->con_number];
+
+    if (conn->status != 2 || conn->shard != msg->from_shard || conn->other_identifier != msg->from_identifier
+            || conn->other_id != msg->from_con_number) {
+        return -1;
+    }
+
+    return msg->con_number;
+}
+
+static void set_shard_link(TCP_Secure_Conn *conn, const TCP_Shard_Message *msg)
+{
+    conn->status = 2;
+    conn->index = msg->from_index;
+    conn->other_id = msg->from_con_number;
+    conn->shard = msg->from_shard;
+    conn->other_identifier = msg->from_identifier;
+}
+
+/* Link the client the request is for to the one that sent it, if it asked to be
+ * routed to it too.
+ */
+static void handle_shard_routing_request(TCP_Server *tcp_server, const TCP_Shard_Message *msg)
+{
+    const int index = get_TCP_connection_index(tcp_server, msg->public_key);
+
+    if (index == -1) {
+        return;
+    }
+
+    TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[index];
+
+    for (uint32_t i = 0; i < NUM_CLIENT_CONNECTIONS; ++i) {
+        TCP_Secure_Conn *conn = &con->connections[i];
+
+        if (conn->status != 1 || public_key_cmp(conn->public_key, msg->from_public_key) != 0) {
+            continue;
+        }
+
+        set_shard_link(conn, msg);
+        send_connect_notification(con, i);
+
+        TCP_Shard_Message *response = new_shard_message(TCP_SHARD_ROUTING_RESPONSE, nullptr, 0);
+
+        if (response != nullptr) {
+            response->index = msg->from_index;
+            response->identifier = msg->from_identifier;
+            response->con_number = msg->from_con_number;
+            set_shard_message_from(tcp_server, response, index, i);
+            post_shard_message(tcp_server->pool->shards[msg->from_shard], response);
+        }
+
+        return;
+    }
+}
+
+static void handle_shard_routing_response(TCP_Server *tcp_server, const TCP_Shard_Message *msg)
+{
+    TCP_Secure_Connection *con = shard_message_connection(tcp_server, msg);
+
+    if (con != nullptr && msg->con_number < NUM_CLIENT_CONNECTIONS) {
+        TCP_Secure_Conn *conn = &con->connections[msg->con_number];
+
+        /* Both clients asked at the same time and are linked already. */
+        if (shard_message_con_number(con, msg) != -1) {
+            return;
+        }
+
+        if (conn->status == 1 && public_key_cmp(conn->public_key, msg->from_public_key) == 0) {
+            set_shard_link(conn, msg);
+            send_connect_notification(con, msg->con_number);
+            return;
+        }
+    }
+
+    /* The client went away or dropped the connection in the meantime, so unlink
+     * the other end again. */
+    TCP_Shard_Message *disconnect = new_shard_message(TCP_SHARD_DISCONNECT, nullptr, 0);
+
+    if (disconnect == nullptr) {
+        return;
+    }
+
+    disconnect->index = msg->from_index;
+    disconnect->identifier = msg->from_identifier;
+    disconnect->con_number = msg->from_con_number;
+    disconnect->from_shard = tcp_server->shard_index;
+    disconnect->from_identifier = msg->identifier;
+    disconnect->from_con_number = msg->con_number;
+    post_shard_message(tcp_server->pool->shards[msg->from_shard], disconnect);
+}
+
+static void handle_shard_message(TCP_Server *tcp_server, TCP_Shard_Message *msg)
+{
+    switch (msg->type) {
+        case TCP_SHARD_ROUTING_REQUEST: {
+            handle_shard_routing_request(tcp_server, msg);
+            break;
+        }
+
+        case TCP_SHARD_ROUTING_RESPONSE: {
+            handle_shard_routing_response(tcp_server, msg);
+            break;
+        }
+
+        case TCP_SHARD_DISCONNECT: {
+            TCP_Secure_Connection *con = shard_message_connection(tcp_server, msg);
+
+            if (con == nullptr || shard_message_con_number(con, msg) == -1) {
+                break;
+            }
+
+            TCP_Secure_Conn *conn = &con->connections[msg->con_number];
+            conn->status = 1;
+            conn->index = 0;
+            conn->other_id = 0;
+            conn->shard = 0;
+            conn->other_identifier = 0;
+            send_disconnect_notification(con, msg->con_number);
+            break;
+        }
+
+        case TCP_SHARD_ROUTED_PACKET: {
+            TCP_Secure_Connection *con = shard_message_connection(tcp_server, msg);
+
+            if (con == nullptr || shard_message_con_number(con, msg) == -1) {
+                break;
+            }
+
+            write_padded_packet_TCP_secure_connection(con, msg->padding, msg->length, 0);
+            break;
+        }
+
+        case TCP_SHARD_PACKET: {
+            TCP_Secure_Connection *con = shard_message_connection(tcp_server, msg);
+            const bool onion_response = msg->data[0] == TCP_PACKET_ONION_RESPONSE;
+
+            if (con != nullptr && write_padded_packet_TCP_secure_connection(con, msg->padding, msg->length, 0) == 1
+                    && onion_response) {
+                ++tcp_server->stats.onion_responses;
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_OOB: {
+            const int index = get_TCP_connection_index(tcp_server, msg->public_key);
+
+            if (index != -1) {
+                write_padded_packet_TCP_secure_connection(&tcp_server->accepted_connection_array[index], msg->padding,
+                        msg->length, 0);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_KILL: {
+            const int index = get_TCP_connection_index(tcp_server, msg->public_key);
+
+            if (index != -1 && tcp_server->accepted_connection_array[index].identifier < msg->from_identifier) {
+                kill_accepted(tcp_server, index);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_ONION_REQUEST: {
+            // only posted to the pool
+            break;
+        }
+
+        case TCP_SHARD_SEND_QUEUE_LIMIT: {
+            tcp_server_set_send_queue_limit(tcp_server, msg->index);
+            break;
+        }
+
+        case TCP_SHARD_STATS: {
+            TCP_Send_Queue_Stats send_queue_stats;
+            TCP_Server_Stats stats;
+            get_send_queue_stats(tcp_server, &send_queue_stats);
+            get_server_stats(tcp_server, &stats);
+            pthread_mutex_lock(&tcp_server->queue_mutex);
+            tcp_server->send_queue_stats = send_queue_stats;
+            tcp_server->published_stats = stats;
+            pthread_mutex_unlock(&tcp_server->queue_mutex);
+            break;
+        }
+    }
+}
+
+static void *tcp_worker_thread(void *arg)
+{
+    TCP_Server *tcp_server = (TCP_Server *)arg;
+    bool stopping = false;
+
+    while (!stopping) {
+        mono_time_update(tcp_server->mono_time);
+
+        /* Refill the session keypairs whenever there is nothing else to do. */
+        const bool full = tcp_server->num_session_keypairs == TCP_SESSION_KEYPAIRS;
+
+        if (!tcp_epoll_process(tcp_server, tcp_server->mono_time, full ? TCP_WORKER_WAIT : 0) && !full) {
+            make_session_keypairs(tcp_server, TCP_SESSION_KEYPAIR_BATCH);
+        }
+
+        TCP_Shard_Message *msg = take_shard_messages(tcp_server, &stopping);
+
+        while (msg != nullptr) {
+            TCP_Shard_Message *next = msg->next;
+            handle_shard_message(tcp_server, msg);
+            free(msg);
+            msg = next;
+        }
+
+        do_TCP_confirmed(tcp_server, tcp_server->mono_time);
+    }
+
+    return nullptr;
+}
+
+/* Send the onion requests that workers passed on.
+ */
+static void do_TCP_pool(TCP_Server *pool)
+{
+    bool stopping;
+    TCP_Shard_Message *msg = take_shard_messages(pool, &stopping);
+
+    while (msg != nullptr) {
+        TCP_Shard_Message *next = msg->next;
+
+        if (msg->type == TCP_SHARD_ONION_REQUEST && pool->onion != nullptr) {
+            IP_Port source;
+            source.port = 0;  // dummy initialise
+            source.ip.family = net_family_tcp_onion;
+            source.ip.ip.v6.uint32[0] = msg->from_index;
+            source.ip.ip.v6.uint32[1] = msg->from_shard;
+            source.ip.ip.v6.uint64[1] = msg->from_identifier;
+            onion_send_1(pool->onion, msg->data + CRYPTO_NONCE_SIZE, msg->length - CRYPTO_NONCE_SIZE, source, msg->data);
+        }
+
+        free(msg);
+        msg = next;
+    }
+}
+
+/* Create the TCP server of one worker. Its thread is started once all workers exist.
+ */
+static TCP_Server *new_TCP_shard(TCP_Server *pool, uint16_t shard_index, uint8_t ipv6_enabled, uint16_t num_sockets,
+                                 const uint16_t *ports)
+{
+    TCP_Server *shard = tcp_server_new(pool->logger, ipv6_enabled, num_sockets, ports, pool->secret_key, true);
+
+    if (shard == nullptr) {
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(&shard->queue_mutex, nullptr) != 0) {
+        kill_TCP_server(shard);
+        return nullptr;
+    }
+
+    shard->pool = pool;
+    shard->shard_index = shard_index;
+    shard->mono_time = mono_time_new();
+    shard->wakeup_fd = eventfd(0, EFD_NONBLOCK);
+
+    if (shard->mono_time == nullptr || shard->wakeup_fd == -1) {
+        kill_TCP_server(shard);
+        return nullptr;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = shard->wakeup_fd | ((uint64_t)TCP_SOCKET_WAKEUP << 32);
+
+    if (epoll_ctl(shard->efd, EPOLL_CTL_ADD, shard->wakeup_fd, &ev) == -1) {
+        kill_TCP_server(shard);
+        return nullptr;
+    }
+
+    return shard;
+}
+
+static void kill_TCP_pool(TCP_Server *pool)
+{
+    for (uint16_t i = 0; i < pool->num_shards; ++i) {
+        TCP_Server *shard = pool->shards[i];
+
+        if (!shard->thread_running) {
+            continue;
+        }
+
+        pthread_mutex_lock(&shard->queue_mutex);
+        shard->stopping = true;
+        pthread_mutex_unlock(&shard->queue_mutex);
+
+        const uint64_t one = 1;
+
+        if (write(shard->wakeup_fd, &one, sizeof(one)) != sizeof(one)) {
+            LOGGER_WARNING(pool->logger, "failed to wake up TCP worker %u", i);
+        }
+    }
+
+    /* Workers post to each other until they stop, so none is freed before all are joined. */
+    for (uint16_t i = 0; i < pool->num_shards; ++i) {
+        if (pool->shards[i]->thread_running) {
+            pthread_join(pool->shards[i]->thread, nullptr);
+        }
+    }
+
+    for (uint16_t i = 0; i < pool->num_shards; ++i) {
+        kill_TCP_server(pool->shards[i]);
+    }
+
+    if (pool->onion) {
+        set_callback_handle_recv_1(pool->onion, nullptr, nullptr);
+    }
+
+    free_shard_messages(pool->queue_start);
+    pthread_mutex_destroy(&pool->queue_mutex);
+    free(pool->shards);
+    free(pool);
+}
 #endif
 
+TCP_Server *new_TCP_server_workers(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets,
+                                   const uint16_t *ports, const uint8_t *secret_key, Onion *onion, uint16_t num_workers)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (num_workers == 0 || num_sockets == 0 || ports == nullptr) {
+        return nullptr;
+    }
+
+    if (networking_at_startup() != 0) {
+        return nullptr;
+    }
+
+    TCP_Server *pool = (TCP_Server *)calloc(1, sizeof(TCP_Server));
+
+    if (pool == nullptr) {
+        return nullptr;
+    }
+
+    pool->logger = logger;
+    pool->efd = -1;
+    pool->wakeup_fd = -1;
+    pool->shards = (TCP_Server **)calloc(num_workers, sizeof(TCP_Server *));
+
+    if (pool->shards == nullptr || pthread_mutex_init(&pool->queue_mutex, nullptr) != 0) {
+        free(pool->shards);
+        free(pool);
+        return nullptr;
+    }
+
+    memcpy(pool->secret_key, secret_key, CRYPTO_SECRET_KEY_SIZE);
+    crypto_derive_public_key(pool->public_key, pool->secret_key);
+
+    for (uint16_t i = 0; i < num_workers; ++i) {
+        TCP_Server *shard = new_TCP_shard(pool, i, ipv6_enabled, num_sockets, ports);
+
+        if (shard == nullptr) {
+            kill_TCP_pool(pool);
+            return nullptr;
+        }
+
+        pool->shards[i] = shard;
+        ++pool->num_shards;
+    }
+
+    for (uint16_t i = 0; i < num_workers; ++i) {
+        TCP_Server *shard = pool->shards[i];
+
+        if (pthread_create(&shard->thread, nullptr, &tcp_worker_thread, shard) != 0) {
+            kill_TCP_pool(pool);
+            return nullptr;
+        }
+
+        shard->thread_running = true;
+    }
+
+    if (onion) {
+        pool->onion = onion;
+        set_callback_handle_recv_1(onion, &handle_onion_recv_1, pool);
+    }
+
+    return pool;
+#else
+    return nullptr;
+#endif
+}
+
 void do_TCP_server(TCP_Server *tcp_server, Mono_Time *mono_time)
 {
+    if (tcp_server->onion != nullptr) {
+        do_onion_workers(tcp_server->onion);
+    }
+
 #ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        do_TCP_pool(tcp_server);
+        return;
+    }
+
     do_TCP_epoll(tcp_server, mono_time);
 
 #else
@@ -1450,10 +2671,20 @@ void do_TCP_server(TCP_Server *tcp_server, Mono_Time *mono_time)
 #endif
 
     do_TCP_confirmed(tcp_server, mono_time);
+    make_session_keypairs(tcp_server, TCP_SESSION_KEYPAIR_BATCH);
 }
 
 void kill_TCP_server(TCP_Server *tcp_server)
 {
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        kill_TCP_pool(tcp_server);
+        return;
+    }
+
+#endif
+
     for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
         kill_sock(tcp_server->socks_listening[i]);
     }
@@ -1462,10 +2693,25 @@ void kill_TCP_server(TCP_Server *tcp_server)
         set_callback_handle_recv_1(tcp_server->onion, nullptr, nullptr);
     }
 
-    bs_list_free(&tcp_server->accepted_key_list);
+    key_map_free(&tcp_server->accepted_key_list);
+    timer_wheel_kill(tcp_server->ping_timers);
 
 #ifdef TCP_SERVER_USE_EPOLL
     close(tcp_server->efd);
+
+    if (tcp_server->wakeup_fd != -1) {
+        close(tcp_server->wakeup_fd);
+    }
+
+    if (tcp_server->pool != nullptr) {
+        free_shard_messages(tcp_server->queue_start);
+        pthread_mutex_destroy(&tcp_server->queue_mutex);
+    }
+
+    if (tcp_server->mono_time != nullptr) {
+        mono_time_free(tcp_server->mono_time);
+    }
+
 #endif
 
     for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
@@ -1473,6 +2719,8 @@ void kill_TCP_server(TCP_Server *tcp_server)
         wipe_secure_connection(&tcp_server->unconfirmed_connection_queue[i]);
     }
 
+    crypto_memzero(tcp_server->session_keypairs, sizeof(tcp_server->session_keypairs));
+
     free_accepted_connection_array(tcp_server);
 
     free(tcp_server->socks_listening);
@@ -10,7 +10,6 @@
 #define C_TOXCORE_TOXCORE_TCP_SERVER_H
 
 #include "crypto_core.h"
-#include "list.h"
 #include "onion.h"
 
 #define MAX_INCOMING_CONNECTIONS 256
@@ -64,44 +63,161 @@ typedef enum TCP_Status {
     TCP_STATUS_CONFIRMED,
 } TCP_Status;
 
-typedef struct TCP_Priority_List TCP_Priority_List;
+/* Size of the receive buffer of a connection. It must hold at least one
+ * length-prefixed packet of MAX_PACKET_SIZE bytes.
+ */
+#define TCP_RECV_BUFFER_SIZE (4 * MAX_PACKET_SIZE)
 
-struct TCP_Priority_List {
-    TCP_Priority_List *next;
-    uint16_t size;
-    uint16_t sent;
-    uint8_t data[];
-};
+/* Bytes received on a secure connection that were not yet taken out as packets.
+ * Receiving into it fetches all packets that have arrived in one system call.
+ */
+typedef struct TCP_Recv_Buffer {
+    uint8_t data[TCP_RECV_BUFFER_SIZE];
+    uint16_t start;
+    uint16_t end;
+} TCP_Recv_Buffer;
+
+/* Default number of bytes a connection queues for its socket before it refuses
+ * to send more normal packets.
+ */
+#define TCP_SEND_QUEUE_LIMIT (8 * MAX_PACKET_SIZE)
+
+/* Room a send queue keeps beyond its limit for priority packets, which are only
+ * dropped once that is full too.
+ */
+#define TCP_SEND_QUEUE_PRIORITY_SIZE (4 * MAX_PACKET_SIZE)
 
-void wipe_priority_list(TCP_Priority_List *p);
+/* Encrypted packets of a secure connection that its socket did not take yet, in
+ * the order they were encrypted. The ring buffer is allocated when the socket
+ * first takes less than it is given and freed once it is empty again. Queued
+ * data is sent with one system call even if it wraps around the end.
+ */
+typedef struct TCP_Send_Queue {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t start;
+    uint32_t length;
+    uint32_t limit;
+
+    uint32_t max_length;
+    uint64_t refused;
+    uint64_t dropped;
+} TCP_Send_Queue;
+
+typedef struct TCP_Send_Queue_Stats {
+    uint64_t queued;      /* bytes waiting in send queues */
+    uint32_t connections; /* connections with bytes waiting */
+    uint32_t max_queued;  /* most bytes that one queue held at once */
+    uint64_t refused;     /* normal packets refused because a queue was over its limit */
+    uint64_t dropped;     /* priority packets dropped because a queue was full */
+} TCP_Send_Queue_Stats;
+
+void tcp_send_queue_init(TCP_Send_Queue *queue, uint32_t limit);
+void tcp_send_queue_free(TCP_Send_Queue *queue);
+
+/* Send as much of the queue to sock as it takes.
+ *
+ * return true if the queue is empty.
+ */
+bool tcp_send_queue_flush(TCP_Send_Queue *queue, Socket sock);
+
+/* Flush the queue and check that a packet of length bytes may be added to it.
+ * Normal packets fit while the queue is below its limit, priority packets while
+ * it has room. A packet always fits in an empty queue.
+ *
+ * return true if the packet may be sent.
+ */
+bool tcp_send_queue_reserve(TCP_Send_Queue *queue, Socket sock, uint16_t length, bool priority);
+
+/* Queue length bytes of data after the queued ones without sending anything.
+ *
+ * return false if they do not fit or memory allocation fails.
+ */
+bool tcp_send_queue_add(TCP_Send_Queue *queue, const uint8_t *data, uint16_t length);
+
+/* Send data to sock, or queue it if there already is queued data, and queue
+ * whatever the socket does not take.
+ *
+ * return false if the rest of data could not be queued (connection must be killed).
+ */
+bool tcp_send_queue_write(TCP_Send_Queue *queue, Socket sock, const uint8_t *data, uint16_t length);
+
+/* Add the state of queue to stats. */
+void tcp_send_queue_add_stats(const TCP_Send_Queue *queue, TCP_Send_Queue_Stats *stats);
 
 typedef struct TCP_Server TCP_Server;
 
 const uint8_t *tcp_server_public_key(const TCP_Server *tcp_server);
 size_t tcp_server_listen_count(const TCP_Server *tcp_server);
 
+/* Copy the sockets that do_TCP_server reads from into socks, at most max_socks of
+ * them. With epoll this is the single epoll descriptor, which becomes readable
+ * whenever one of the server's sockets does.
+ *
+ * return the number of sockets, which may be larger than max_socks.
+ */
+uint32_t tcp_server_sockets(const TCP_Server *tcp_server, Socket *socks, uint32_t max_socks);
+
+/* return true if a client connection has data queued that its socket did not accept yet. */
+bool tcp_server_send_pending(const TCP_Server *tcp_server);
+
+/* Set how many bytes each client connection may queue before normal packets to
+ * it are refused. Applies to existing connections too.
+ */
+void tcp_server_set_send_queue_limit(TCP_Server *tcp_server, uint32_t limit);
+
+/* Fill stats with the send queues of the connected clients. With workers, the
+ * numbers are those each worker collected when it was last asked, and this asks
+ * them again, so the first call returns zeros.
+ */
+void tcp_server_get_send_queue_stats(const TCP_Server *tcp_server, TCP_Send_Queue_Stats *stats);
+
+typedef struct TCP_Server_Stats {
+    uint32_t incoming;         /* connections that did not finish the handshake yet */
+    uint32_t unconfirmed;      /* connections that did not send their first packet yet */
+    uint32_t accepted;         /* connected clients */
+    uint64_t packets_received; /* packets from clients */
+    uint64_t bytes_received;
+    uint64_t packets_relayed;  /* data packets passed on to another client */
+    uint64_t bytes_relayed;
+    uint64_t oob_relayed;      /* out of band packets passed on to another client */
+    uint64_t onion_requests;   /* onion requests of clients sent on */
+    uint64_t onion_responses;  /* onion responses passed back to clients */
+} TCP_Server_Stats;
+
+/* Fill stats with the connections and packet counters of the server. With
+ * workers, the numbers are as old as those of tcp_server_get_send_queue_stats.
+ */
+void tcp_server_get_stats(const TCP_Server *tcp_server, TCP_Server_Stats *stats);
+
 /* Create new TCP server instance.
  */
 TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
                            const uint8_t *secret_key, Onion *onion);
 
+/* Create a TCP server that spreads its connections over num_workers threads.
+ *
+ * Every worker listens on all ports with SO_REUSEPORT, so the kernel hands each
+ * new connection to one of them, and runs its own epoll loop for the connections
+ * it accepted. Packets for a client on another worker are passed to it through
+ * that worker's message queue.
+ *
+ * The workers run by themselves. do_TCP_server must still be called from the
+ * thread that runs onion, because onion requests of clients are sent from there.
+ *
+ * Only available with TCP_SERVER_USE_EPOLL, returns nullptr otherwise.
+ */
+TCP_Server *new_TCP_server_workers(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets,
+                                   const uint16_t *ports, const uint8_t *secret_key, Onion *onion, uint16_t num_workers);
+
 /* Run the TCP_server
  */
 void do_TCP_server(TCP_Server *tcp_server, Mono_Time *mono_time);
 
-/* Kill the TCP server
+/* Kill the TCP server. With workers, this stops their threads first.
  */
 void kill_TCP_server(TCP_Server *tcp_server);
 
-/* Read the next two bytes in TCP stream then convert them to
- * length (host byte order).
- *
- * return length on success
- * return 0 if nothing has been read from socket.
- * return -1 on failure.
- */
-uint16_t read_TCP_length(const Logger *logger, Socket sock);
-
 /* Read length bytes from socket.
  *
  * return length on success
@@ -109,11 +225,14 @@ uint16_t read_TCP_length(const Logger *logger, Socket sock);
  */
 int read_TCP_packet(const Logger *logger, Socket sock, uint8_t *data, uint16_t length);
 
-/* return length of received packet on success.
+/* Take the next packet out of recv_buffer and decrypt it into data, receiving
+ * more data from sock first if no complete packet is buffered.
+ *
+ * return length of received packet on success.
  * return 0 if could not read any packet.
  * return -1 on failure (connection must be killed).
  */
-int read_packet_TCP_secure_connection(const Logger *logger, Socket sock, uint16_t *next_packet_length,
+int read_packet_TCP_secure_connection(const Logger *logger, Socket sock, TCP_Recv_Buffer *recv_buffer,
                                       const uint8_t *shared_key, uint8_t *recv_nonce, uint8_t *data, uint16_t max_len);
 
 
@@ -65,6 +65,20 @@ const CRYPTO_MAC_SIZE = 16;
  */
 const CRYPTO_NONCE_SIZE = 24;
 
+/**
+ * The number of bytes in front of the plain text that
+ * encrypt_data_symmetric_in_place uses, and where
+ * decrypt_data_symmetric_in_place leaves it.
+ */
+const CRYPTO_PLAIN_PADDING_SIZE = 32;
+
+/**
+ * The number of bytes in front of the encrypted data that
+ * decrypt_data_symmetric_in_place uses, and where
+ * encrypt_data_symmetric_in_place leaves it.
+ */
+const CRYPTO_ENCRYPTED_PADDING_SIZE = 16;
+
 /**
  * The number of bytes in a SHA256 hash.
  */
@@ -254,6 +268,36 @@ static int32_t decrypt_data_symmetric(
     const uint8_t[length] encrypted,
     uint8_t *plain);
 
+/**
+ * Like encrypt_data_symmetric, but without copying the data: encrypts the
+ * length bytes of plain text at buffer + $CRYPTO_PLAIN_PADDING_SIZE where they
+ * are. The first $CRYPTO_PLAIN_PADDING_SIZE bytes of buffer are overwritten.
+ *
+ * @return -1 if there was a problem, length of the encrypted data, which starts
+ * at buffer + $CRYPTO_ENCRYPTED_PADDING_SIZE, if everything was fine.
+ */
+static int32_t encrypt_data_symmetric_in_place(
+    const uint8_t[CRYPTO_SHARED_KEY_SIZE] shared_key,
+    const uint8_t[CRYPTO_NONCE_SIZE] nonce,
+    uint8_t *buffer,
+    size_t length);
+
+/**
+ * Like decrypt_data_symmetric, but without copying the data: decrypts the
+ * length bytes of encrypted data at buffer + $CRYPTO_ENCRYPTED_PADDING_SIZE
+ * where they are. The first $CRYPTO_ENCRYPTED_PADDING_SIZE bytes of buffer are
+ * overwritten.
+ *
+ * @return -1 if there was a problem (decryption failed), length of the plain
+ * data, which starts at buffer + $CRYPTO_PLAIN_PADDING_SIZE, if everything was
+ * fine.
+ */
+static int32_t decrypt_data_symmetric_in_place(
+    const uint8_t[CRYPTO_SHARED_KEY_SIZE] shared_key,
+    const uint8_t[CRYPTO_NONCE_SIZE] nonce,
+    uint8_t *buffer,
+    size_t length);
+
 /**
  * Increment the given nonce by 1 in big endian (rightmost byte incremented
  * first).
@@ -77,6 +77,14 @@
 #error "CRYPTO_NONCE_SIZE should be equal to crypto_box_NONCEBYTES"
 #endif
 
+#if CRYPTO_PLAIN_PADDING_SIZE != crypto_box_ZEROBYTES
+#error "CRYPTO_PLAIN_PADDING_SIZE should be equal to crypto_box_ZEROBYTES"
+#endif
+
+#if CRYPTO_ENCRYPTED_PADDING_SIZE != crypto_box_BOXZEROBYTES
+#error "CRYPTO_ENCRYPTED_PADDING_SIZE should be equal to crypto_box_BOXZEROBYTES"
+#endif
+
 #if CRYPTO_SHA256_SIZE != crypto_hash_sha256_BYTES
 #error "CRYPTO_SHA256_SIZE should be equal to crypto_hash_sha256_BYTES"
 #endif
@@ -260,6 +268,42 @@ int32_t decrypt_data_symmetric(const uint8_t *secret_key, const uint8_t *nonce,
     return length - crypto_box_MACBYTES;
 }
 
+int32_t encrypt_data_symmetric_in_place(const uint8_t *shared_key, const uint8_t *nonce, uint8_t *buffer,
+                                        size_t length)
+{
+    if (length == 0 || !shared_key || !nonce || !buffer) {
+        return -1;
+    }
+
+    memset(buffer, 0, crypto_box_ZEROBYTES);
+
+    // The box is made where the padded message is; the first
+    // crypto_box_BOXZEROBYTES of it are zero.
+    if (crypto_box_afternm(buffer, buffer, length + crypto_box_ZEROBYTES, nonce, shared_key) != 0) {
+        return -1;
+    }
+
+    return length + crypto_box_MACBYTES;
+}
+
+int32_t decrypt_data_symmetric_in_place(const uint8_t *shared_key, const uint8_t *nonce, uint8_t *buffer,
+                                        size_t length)
+{
+    if (length <= crypto_box_BOXZEROBYTES || !shared_key || !nonce || !buffer) {
+        return -1;
+    }
+
+    memset(buffer, 0, crypto_box_BOXZEROBYTES);
+
+    // The message is opened where the padded box is; the first
+    // crypto_box_ZEROBYTES of it are zero.
+    if (crypto_box_open_afternm(buffer, buffer, length + crypto_box_BOXZEROBYTES, nonce, shared_key) != 0) {
+        return -1;
+    }
+
+    return length - crypto_box_MACBYTES;
+}
+
 int32_t encrypt_data(const uint8_t *public_key, const uint8_t *secret_key, const uint8_t *nonce,
                      const uint8_t *plain, size_t length, uint8_t *encrypted)
 {
@@ -81,6 +81,24 @@ uint32_t crypto_mac_size(void);
 
 uint32_t crypto_nonce_size(void);
 
+/**
+ * The number of bytes in front of the plain text that
+ * encrypt_data_symmetric_in_place uses, and where
+ * decrypt_data_symmetric_in_place leaves it.
+ */
+#define CRYPTO_PLAIN_PADDING_SIZE      32
+
+uint32_t crypto_plain_padding_size(void);
+
+/**
+ * The number of bytes in front of the encrypted data that
+ * decrypt_data_symmetric_in_place uses, and where
+ * encrypt_data_symmetric_in_place leaves it.
+ */
+#define CRYPTO_ENCRYPTED_PADDING_SIZE  16
+
+uint32_t crypto_encrypted_padding_size(void);
+
 /**
  * The number of bytes in a SHA256 hash.
  */
@@ -246,6 +264,30 @@ int32_t encrypt_data_symmetric(const uint8_t *shared_key, const uint8_t *nonce,
 int32_t decrypt_data_symmetric(const uint8_t *shared_key, const uint8_t *nonce, const uint8_t *encrypted, size_t length,
                                uint8_t *plain);
 
+/**
+ * Like encrypt_data_symmetric, but without copying the data: encrypts the
+ * length bytes of plain text at buffer + CRYPTO_PLAIN_PADDING_SIZE where they
+ * are. The first CRYPTO_PLAIN_PADDING_SIZE bytes of buffer are overwritten.
+ *
+ * @return -1 if there was a problem, length of the encrypted data, which starts
+ * at buffer + CRYPTO_ENCRYPTED_PADDING_SIZE, if everything was fine.
+ */
+int32_t encrypt_data_symmetric_in_place(const uint8_t *shared_key, const uint8_t *nonce, uint8_t *buffer,
+                                        size_t length);
+
+/**
+ * Like decrypt_data_symmetric, but without copying the data: decrypts the
+ * length bytes of encrypted data at buffer + CRYPTO_ENCRYPTED_PADDING_SIZE
+ * where they are. The first CRYPTO_ENCRYPTED_PADDING_SIZE bytes of buffer are
+ * overwritten.
+ *
+ * @return -1 if there was a problem (decryption failed), length of the plain
+ * data, which starts at buffer + CRYPTO_PLAIN_PADDING_SIZE, if everything was
+ * fine.
+ */
+int32_t decrypt_data_symmetric_in_place(const uint8_t *shared_key, const uint8_t *nonce, uint8_t *buffer,
+                                        size_t length);
+
 /**
  * Increment the given nonce by 1 in big endian (rightmost byte incremented
  * first).
@@ -89,4 +89,49 @@ TEST(CryptoCore, MemcmpTimingIsDataIndependent) {
       << "Time of the different data comparison: " << result.second << " clocks";
 }
 
+TEST(CryptoCore, EncryptInPlaceMatchesEncrypt) {
+  uint8_t key[CRYPTO_SHARED_KEY_SIZE];
+  uint8_t nonce[CRYPTO_NONCE_SIZE];
+  random_bytes(key, sizeof(key));
+  random_nonce(nonce);
+
+  std::vector<uint8_t> plain(100);
+  random_bytes(plain.data(), plain.size());
+
+  std::vector<uint8_t> encrypted(plain.size() + CRYPTO_MAC_SIZE);
+  ASSERT_EQ(encrypt_data_symmetric(key, nonce, plain.data(), plain.size(), encrypted.data()),
+            static_cast<int32_t>(encrypted.size()));
+
+  std::vector<uint8_t> buffer(CRYPTO_PLAIN_PADDING_SIZE + plain.size());
+  std::copy(plain.begin(), plain.end(), buffer.begin() + CRYPTO_PLAIN_PADDING_SIZE);
+  ASSERT_EQ(encrypt_data_symmetric_in_place(key, nonce, buffer.data(), plain.size()),
+            static_cast<int32_t>(encrypted.size()));
+  EXPECT_TRUE(std::equal(encrypted.begin(), encrypted.end(),
+                         buffer.begin() + CRYPTO_ENCRYPTED_PADDING_SIZE));
+}
+
+TEST(CryptoCore, DecryptInPlaceRecoversPlainText) {
+  uint8_t key[CRYPTO_SHARED_KEY_SIZE];
+  uint8_t nonce[CRYPTO_NONCE_SIZE];
+  random_bytes(key, sizeof(key));
+  random_nonce(nonce);
+
+  std::vector<uint8_t> plain(100);
+  random_bytes(plain.data(), plain.size());
+
+  std::vector<uint8_t> buffer(CRYPTO_ENCRYPTED_PADDING_SIZE + plain.size() + CRYPTO_MAC_SIZE);
+  ASSERT_EQ(encrypt_data_symmetric(key, nonce, plain.data(), plain.size(),
+                                   buffer.data() + CRYPTO_ENCRYPTED_PADDING_SIZE),
+            static_cast<int32_t>(plain.size() + CRYPTO_MAC_SIZE));
+
+  std::vector<uint8_t> tampered = buffer;
+  tampered.back() ^= 1;
+  EXPECT_EQ(decrypt_data_symmetric_in_place(key, nonce, tampered.data(), plain.size() + CRYPTO_MAC_SIZE),
+            -1);
+
+  ASSERT_EQ(decrypt_data_symmetric_in_place(key, nonce, buffer.data(), plain.size() + CRYPTO_MAC_SIZE),
+            static_cast<int32_t>(plain.size()));
+  EXPECT_TRUE(std::equal(plain.begin(), plain.end(), buffer.begin() + CRYPTO_PLAIN_PADDING_SIZE));
+}
+
 }  // namespace
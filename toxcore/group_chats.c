@@ -834,17 +834,9 @@ static int unwrap_group_packet(const Logger *logger, const uint8_t *shared_key,
     return plain_len;
 }
 
-/* Encrypts data of length using the peer's shared key and a new nonce.
- *
- * Adds encrypted header consisting of: packet type, message_id (only for lossless packets)
- * Adds plaintext header consisting of: packet identifier, chat_id_hash, self public encryption key, nonce.
- *
- * Returns length of encrypted packet on success.
- * Returns -1 on failure.
- */
-static int wrap_group_packet(const Logger *logger, const uint8_t *self_pk, const uint8_t *shared_key, uint8_t *packet,
-                             uint32_t packet_size, const uint8_t *data, uint32_t length, uint64_t message_id, uint8_t packet_type,
-                             uint32_t chat_id_hash, uint8_t packet_id)
+int wrap_group_packet(const Logger *logger, const uint8_t *self_pk, const uint8_t *shared_key, uint8_t *packet,
+                      uint32_t packet_size, const uint8_t *data, uint32_t length, uint64_t message_id, uint8_t packet_type,
+                      uint32_t chat_id_hash, uint8_t packet_id)
 {
     uint16_t padding_len = gc_packet_padding_length(length);
 
@@ -865,35 +857,29 @@ static int wrap_group_packet(const Logger *logger, const uint8_t *self_pk, const
 
     memcpy(plain + padding_len + enc_header_len, data, length);
 
-    uint8_t nonce[CRYPTO_NONCE_SIZE];
-    random_nonce(nonce);
-
     uint16_t plain_len = padding_len + enc_header_len + length;
-    size_t encrypt_buf_size = plain_len + CRYPTO_MAC_SIZE;
+    const uint32_t header_len = sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY + CRYPTO_NONCE_SIZE;
 
-    uint8_t *encrypt = (uint8_t *)malloc(encrypt_buf_size);
-
-    if (encrypt == nullptr) {
+    if (header_len + plain_len + CRYPTO_MAC_SIZE > packet_size) {
         return -1;
     }
 
-    int enc_len = encrypt_data_symmetric(shared_key, nonce, plain, plain_len, encrypt);
+    uint8_t *nonce = packet + sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY;
+    random_nonce(nonce);
 
-    if (enc_len != encrypt_buf_size) {
+    /* Encrypt straight into the packet, this runs once per peer for every broadcast. */
+    int enc_len = encrypt_data_symmetric(shared_key, nonce, plain, plain_len, packet + header_len);
+
+    if (enc_len != plain_len + CRYPTO_MAC_SIZE) {
         LOGGER_ERROR(logger, "encryption failed. packet type: %d, enc_len: %d", packet_type, enc_len);
-        free(encrypt);
         return -1;
     }
 
     packet[0] = packet_id;
     net_pack_u32(packet + sizeof(uint8_t), chat_id_hash);
     memcpy(packet + sizeof(uint8_t) + HASH_ID_BYTES, self_pk, ENC_PUBLIC_KEY);
-    memcpy(packet + sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY, nonce, CRYPTO_NONCE_SIZE);
-    memcpy(packet + sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY + CRYPTO_NONCE_SIZE, encrypt, enc_len);
 
-    free(encrypt);
-
-    return 1 + HASH_ID_BYTES + ENC_PUBLIC_KEY + CRYPTO_NONCE_SIZE + enc_len;
+    return header_len + enc_len;
 }
 
 /* Sends a lossy packet to peer_number in chat instance.
@@ -929,33 +915,31 @@ static int send_lossy_group_packet(const GC_Chat *chat, const GC_Connection *gco
     return 0;
 }
 
-/* Sends a lossless packet to peer_number in chat instance.
+/* Sends the lossless message held by buffer to peer_number in chat instance. The peer's
+ * send_array keeps a reference to buffer until the message is acked.
  *
  * Returns 0 on success.
  * Returns -1 on failure.
  */
-static int send_lossless_group_packet(const GC_Chat *chat, GC_Connection *gconn, const uint8_t *data, uint32_t length,
+static int send_lossless_group_buffer(const GC_Chat *chat, GC_Connection *gconn, GC_Message_Buffer *buffer,
                                       uint8_t packet_type)
 {
     if (!gconn->handshaked || gconn->pending_delete) {
         return -1;
     }
 
-    if (data == nullptr || length == 0) {
-        return -1;
-    }
-
     uint64_t message_id = gconn->send_message_id;
     uint8_t packet[MAX_GC_PACKET_SIZE];
-    int len = wrap_group_packet(chat->logger, chat->self_public_key, gconn->shared_key, packet, sizeof(packet), data,
-                                length, message_id, packet_type, chat->chat_id_hash, NET_PACKET_GC_LOSSLESS);
+    int len = wrap_group_packet(chat->logger, chat->self_public_key, gconn->shared_key, packet, sizeof(packet),
+                                buffer->data, buffer->length, message_id, packet_type, chat->chat_id_hash,
+                                NET_PACKET_GC_LOSSLESS);
 
     if (len == -1) {
         LOGGER_ERROR(chat->logger, "wrap_group_packet() failed (type: %u, len: %d)", packet_type, len);
         return -1;
     }
 
-    if (gcc_add_to_send_array(chat->logger, chat->mono_time, gconn, packet, len, packet_type) == -1) {
+    if (gcc_add_to_send_array(chat->logger, chat->mono_time, gconn, buffer, packet_type) == -1) {
         LOGGER_ERROR(chat->logger, "gcc_add_to_send_array() failed (type: %u, len: %d)", packet_type, len);
         return -1;
     }
@@ -968,6 +952,35 @@ static int send_lossless_group_packet(const GC_Chat *chat, GC_Connection *gconn,
     return 0;
 }
 
+/* Sends a lossless packet to peer_number in chat instance.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int send_lossless_group_packet(const GC_Chat *chat, GC_Connection *gconn, const uint8_t *data, uint32_t length,
+                                      uint8_t packet_type)
+{
+    if (!gconn->handshaked || gconn->pending_delete) {
+        return -1;
+    }
+
+    if (data == nullptr || length == 0) {
+        return -1;
+    }
+
+    GC_Message_Buffer *buffer = gcc_message_buffer_new(data, length);
+
+    if (buffer == nullptr) {
+        return -1;
+    }
+
+    int ret = send_lossless_group_buffer(chat, gconn, buffer, packet_type);
+
+    gcc_message_buffer_release(buffer);
+
+    return ret;
+}
+
 /* Sends a group sync request to peer. */
 static int send_gc_sync_request(const GC_Chat *chat, GC_Connection *gconn, uint16_t sync_flags)
 {
@@ -1544,14 +1557,28 @@ FAILED_INVITE:
     return -1;
 }
 
-/* Sends a lossless packet of type and length to all confirmed peers. */
+/* Sends a lossless packet of type and length to all confirmed peers. The data is copied once
+ * and shared by the send arrays of all peers.
+ */
 static void send_gc_lossless_packet_all_peers(const GC_Chat *chat, const uint8_t *data, uint32_t length, uint8_t type)
 {
+    if (data == nullptr || length == 0) {
+        return;
+    }
+
+    GC_Message_Buffer *buffer = gcc_message_buffer_new(data, length);
+
+    if (buffer == nullptr) {
+        return;
+    }
+
     for (uint32_t i = 1; i < chat->numpeers; ++i) {
         if (chat->gcc[i].confirmed) {
-            send_lossless_group_packet(chat, &chat->gcc[i], data, length, type);
+            send_lossless_group_buffer(chat, &chat->gcc[i], buffer, type);
         }
     }
+
+    gcc_message_buffer_release(buffer);
 }
 
 /* Sends a lossy packet of type and length to all confirmed peers. */
@@ -3989,14 +4016,14 @@ static int handle_gc_message_ack(const GC_Chat *chat, GC_Connection *gconn, cons
     }
 
     uint64_t tm = mono_time_get(chat->mono_time);
-    uint16_t idx = gcc_get_array_index(request_id);
+    GC_Message_Array_Entry *array_entry = gcc_get_send_array_entry(gconn, request_id);
 
     /* re-send requested packet */
-    if (gconn->send_array[idx].message_id == request_id) {
-        int ret = gcc_send_group_packet(chat, gconn, gconn->send_array[idx].data, gconn->send_array[idx].data_length);
+    if (array_entry != nullptr) {
+        int ret = gcc_encrypt_and_send_lossless_packet(chat, gconn, array_entry);
 
         if (ret == 0) {
-            gconn->send_array[idx].last_send_try = tm;
+            array_entry->last_send_try = tm;
             LOGGER_ERROR(chat->logger, "Re-sent requested packet %lu", request_id);
         }
 
@@ -399,6 +399,18 @@ void pack_group_info(const GC_Chat *chat, Saved_Group *temp, bool can_use_cached
 
 bool is_public_chat(const GC_Chat *chat);
 
+/* Encrypts data of length using the peer's shared key and a new nonce.
+ *
+ * Adds encrypted header consisting of: packet type, message_id (only for lossless packets)
+ * Adds plaintext header consisting of: packet identifier, chat_id_hash, self public encryption key, nonce.
+ *
+ * Returns length of encrypted packet on success.
+ * Returns -1 on failure.
+ */
+int wrap_group_packet(const Logger *logger, const uint8_t *self_pk, const uint8_t *shared_key, uint8_t *packet,
+                      uint32_t packet_size, const uint8_t *data, uint32_t length, uint64_t message_id, uint8_t packet_type,
+                      uint32_t chat_id_hash, uint8_t packet_id);
+
 /* Sends a plain message or an action, depending on type.
  *
  * Returns 0 on success.
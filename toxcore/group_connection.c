@@ -47,24 +47,141 @@ static bool array_entry_is_empty(const GC_Message_Array_Entry *array_entry)
     return array_entry->time_added == 0;
 }
 
-/* Clears an array entry.
+/* Clears an array entry. */
+static void clear_array_entry(GC_Message_Array *array, GC_Message_Array_Entry *array_entry)
+{
+    if (array_entry_is_empty(array_entry)) {
+        return;
+    }
+
+    gcc_message_buffer_release(array_entry->buffer);
+    memset(array_entry, 0, sizeof(GC_Message_Array_Entry));
+    --array->num_entries;
+}
+
+/* Frees all entries of array along with their data. */
+static void clear_message_array(GC_Message_Array *array)
+{
+    for (uint32_t i = 0; i < array->capacity; ++i) {
+        gcc_message_buffer_release(array->entries[i].buffer);
+    }
+
+    free(array->entries);
+    memset(array, 0, sizeof(GC_Message_Array));
+}
+
+/* Returns the slot of array message_id maps to, or NULL if the array has no storage yet. */
+static GC_Message_Array_Entry *message_array_slot(const GC_Message_Array *array, uint64_t message_id)
+{
+    if (array->capacity == 0) {
+        return nullptr;
+    }
+
+    return &array->entries[message_id & (array->capacity - 1)];
+}
+
+/* Returns the entry holding message_id, or NULL if it is not in array. */
+static GC_Message_Array_Entry *message_array_get(const GC_Message_Array *array, uint64_t message_id)
+{
+    GC_Message_Array_Entry *array_entry = message_array_slot(array, message_id);
+
+    if (array_entry == nullptr || array_entry_is_empty(array_entry) || array_entry->message_id != message_id) {
+        return nullptr;
+    }
+
+    return array_entry;
+}
+
+/* Moves the entries of array into a new ring of the given capacity. Entries whose message_id
+ * lies outside [first_id, first_id + capacity) can never be reached again and are dropped.
  *
  * Return 0 on success.
  * Return -1 on failure.
  */
-static void clear_array_entry(GC_Message_Array_Entry *array_entry)
+static int resize_message_array(GC_Message_Array *array, uint16_t capacity, uint64_t first_id)
 {
-    if (array_entry->data) {
-        free(array_entry->data);
+    GC_Message_Array_Entry *entries = (GC_Message_Array_Entry *)calloc(capacity, sizeof(GC_Message_Array_Entry));
+
+    if (entries == nullptr) {
+        return -1;
     }
 
-    memset(array_entry, 0, sizeof(GC_Message_Array_Entry));
+    uint16_t num_entries = 0;
+
+    for (uint32_t i = 0; i < array->capacity; ++i) {
+        GC_Message_Array_Entry *array_entry = &array->entries[i];
+
+        if (array_entry_is_empty(array_entry)) {
+            continue;
+        }
+
+        if (array_entry->message_id - first_id >= capacity) {
+            gcc_message_buffer_release(array_entry->buffer);
+            continue;
+        }
+
+        entries[array_entry->message_id & (capacity - 1)] = *array_entry;
+        ++num_entries;
+    }
+
+    free(array->entries);
+    array->entries = entries;
+    array->capacity = capacity;
+    array->num_entries = num_entries;
+
+    return 0;
 }
 
-/* Returns ary index for message_id */
-uint16_t gcc_get_array_index(uint64_t message_id)
+/* Makes sure array can hold message_id while also holding all messages from first_id onwards.
+ *
+ * Return 0 on success.
+ * Return -1 on failure.
+ */
+static int reserve_message_array(GC_Message_Array *array, uint64_t first_id, uint64_t message_id)
 {
-    return message_id % GCC_BUFFER_SIZE;
+    const uint64_t span = message_id - first_id + 1;
+
+    if (span > GCC_BUFFER_SIZE) {
+        return -1;
+    }
+
+    if (span <= array->capacity) {
+        return 0;
+    }
+
+    uint32_t capacity = array->capacity == 0 ? GCC_MIN_BUFFER_SIZE : array->capacity;
+
+    while (capacity < span) {
+        capacity *= 2;
+    }
+
+    return resize_message_array(array, (uint16_t)capacity, first_id);
+}
+
+/* Gives memory back once the messages stored in array span a small part of it. */
+static void shrink_message_array(GC_Message_Array *array, uint64_t first_id, uint64_t span)
+{
+    if (array->capacity <= GCC_MIN_BUFFER_SIZE || span > array->capacity / 8) {
+        return;
+    }
+
+    uint32_t capacity = array->capacity / 4;
+
+    while (capacity > GCC_MIN_BUFFER_SIZE && capacity / 2 >= span) {
+        capacity /= 2;
+    }
+
+    if (capacity < GCC_MIN_BUFFER_SIZE) {
+        capacity = GCC_MIN_BUFFER_SIZE;
+    }
+
+    /* Failing to shrink is harmless, the old ring stays in use. */
+    resize_message_array(array, (uint16_t)capacity, first_id);
+}
+
+GC_Message_Array_Entry *gcc_get_send_array_entry(GC_Connection *gconn, uint64_t message_id)
+{
+    return message_array_get(&gconn->send_array, message_id);
 }
 
 /*
@@ -74,77 +191,107 @@ uint16_t gcc_get_array_index(uint64_t message_id)
 void gcc_set_send_message_id(GC_Connection *gconn, uint16_t id)
 {
     gconn->send_message_id = id;
-    gconn->send_array_start = id % GCC_BUFFER_SIZE;
+    gconn->send_array_start = id;
 }
 
-/* Puts packet data in ary_entry.
- *
- * Return 0 on success.
- * Return -1 on failure.
- */
-static int create_array_entry(const Logger *logger, const Mono_Time *mono_time,
-                              GC_Message_Array_Entry *array_entry, const uint8_t *data, uint32_t length, uint8_t packet_type,
-                              uint64_t message_id)
+GC_Message_Buffer *gcc_message_buffer_new(const uint8_t *data, uint32_t length)
 {
+    GC_Message_Buffer *buffer = (GC_Message_Buffer *)malloc(sizeof(GC_Message_Buffer) + length);
+
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+
+    buffer->data = (uint8_t *)(buffer + 1);
+    buffer->length = length;
+    buffer->refcount = 1;
+
     if (length > 0) {
-        if (data == nullptr) {
-            return -1;
-        }
+        memcpy(buffer->data, data, length);
+    }
 
-        array_entry->data = (uint8_t *)malloc(sizeof(uint8_t) * length);
+    return buffer;
+}
 
-        if (array_entry->data == nullptr) {
-            return -1;
-        }
+void gcc_message_buffer_release(GC_Message_Buffer *buffer)
+{
+    if (buffer == nullptr) {
+        return;
+    }
 
-        memcpy(array_entry->data, data, length);
+    --buffer->refcount;
+
+    if (buffer->refcount == 0) {
+        free(buffer);
     }
+}
 
+/* Puts a reference to buffer in ary_entry. */
+static void create_array_entry(const Mono_Time *mono_time, GC_Message_Array *array, GC_Message_Array_Entry *array_entry,
+                               GC_Message_Buffer *buffer, uint8_t packet_type, uint64_t message_id)
+{
     uint64_t tm = mono_time_get(mono_time);
 
-    array_entry->data_length = length;
+    ++buffer->refcount;
+    array_entry->buffer = buffer;
     array_entry->packet_type = packet_type;
     array_entry->message_id = message_id;
     array_entry->time_added = tm;
     array_entry->last_send_try = tm;
-
-    return 0;
+    ++array->num_entries;
 }
 
-/* Adds data of length to gconn's send_array.
+/* Adds the message held by buffer to gconn's send_array, taking a reference to buffer.
  *
  * Returns 0 on success and increments gconn's send_message_id.
  * Returns -1 on failure.
  */
-int gcc_add_to_send_array(const Logger *logger, const Mono_Time *mono_time, GC_Connection *gconn, const uint8_t *data,
-                          uint32_t length, uint8_t packet_type)
+int gcc_add_to_send_array(const Logger *logger, const Mono_Time *mono_time, GC_Connection *gconn,
+                          GC_Message_Buffer *buffer, uint8_t packet_type)
 {
-    if (length == 0 || data == nullptr) {
+    if (buffer == nullptr || buffer->length == 0) {
         return -1;
     }
 
     /* check if send_array is full */
-    if ((gconn->send_message_id % GCC_BUFFER_SIZE) == (uint16_t)(gconn->send_array_start - 1)) {
+    if (gconn->send_message_id - gconn->send_array_start >= GCC_BUFFER_SIZE - 1) {
         LOGGER_DEBUG(logger, "Send array is full");
         return -1;
     }
 
-    uint16_t idx = gcc_get_array_index(gconn->send_message_id);
-    GC_Message_Array_Entry *array_entry = &gconn->send_array[idx];
-
-    if (!array_entry_is_empty(array_entry)) {
+    if (reserve_message_array(&gconn->send_array, gconn->send_array_start, gconn->send_message_id) == -1) {
         return -1;
     }
 
-    if (create_array_entry(logger, mono_time, array_entry, data, length, packet_type, gconn->send_message_id) == -1) {
+    GC_Message_Array_Entry *array_entry = message_array_slot(&gconn->send_array, gconn->send_message_id);
+
+    if (!array_entry_is_empty(array_entry)) {
         return -1;
     }
 
+    create_array_entry(mono_time, &gconn->send_array, array_entry, buffer, packet_type, gconn->send_message_id);
+
     ++gconn->send_message_id;
 
     return 0;
 }
 
+int gcc_encrypt_and_send_lossless_packet(const GC_Chat *chat, const GC_Connection *gconn,
+        const GC_Message_Array_Entry *array_entry)
+{
+    uint8_t packet[MAX_GC_PACKET_SIZE];
+    int len = wrap_group_packet(chat->logger, chat->self_public_key, gconn->shared_key, packet, sizeof(packet),
+                                array_entry->buffer->data, array_entry->buffer->length, array_entry->message_id,
+                                array_entry->packet_type, chat->chat_id_hash, NET_PACKET_GC_LOSSLESS);
+
+    if (len == -1) {
+        LOGGER_ERROR(chat->logger, "wrap_group_packet() failed (type: %u)", array_entry->packet_type);
+        return -1;
+    }
+
+    return gcc_send_group_packet(chat, gconn, packet, len);
+}
+
 /* Removes send_array item with message_id.
  *
  * Returns 0 if success.
@@ -152,10 +299,9 @@ int gcc_add_to_send_array(const Logger *logger, const Mono_Time *mono_time, GC_C
  */
 int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
 {
-    uint16_t idx = gcc_get_array_index(message_id);
-    GC_Message_Array_Entry *array_entry = &gconn->send_array[idx];
+    GC_Message_Array_Entry *array_entry = message_array_slot(&gconn->send_array, message_id);
 
-    if (array_entry_is_empty(array_entry)) {
+    if (array_entry == nullptr || array_entry_is_empty(array_entry)) {
         return 0;
     }
 
@@ -163,16 +309,17 @@ int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
         return -1;
     }
 
-    clear_array_entry(array_entry);
+    clear_array_entry(&gconn->send_array, array_entry);
 
     /* Put send_array_start in proper position */
-    if (idx == gconn->send_array_start) {
-        uint16_t end = gconn->send_message_id % GCC_BUFFER_SIZE;
-
-        while (array_entry_is_empty(&gconn->send_array[idx]) && gconn->send_array_start != end) {
-            gconn->send_array_start = (gconn->send_array_start + 1) % GCC_BUFFER_SIZE;
-            idx = (idx + 1) % GCC_BUFFER_SIZE;
+    if (message_id == gconn->send_array_start) {
+        while (gconn->send_array_start != gconn->send_message_id
+                && message_array_get(&gconn->send_array, gconn->send_array_start) == nullptr) {
+            ++gconn->send_array_start;
         }
+
+        shrink_message_array(&gconn->send_array, gconn->send_array_start,
+                             gconn->send_message_id - gconn->send_array_start);
     }
 
     return 0;
@@ -283,17 +430,25 @@ int gcc_handle_received_message(const GC_Chat *chat, uint32_t peer_number, const
 
     /* we're missing an older message from this peer so we store it in received_array */
     if (message_id > gconn->received_message_id + 1) {
-        uint16_t idx = gcc_get_array_index(message_id);
-        GC_Message_Array_Entry *ary_entry = &gconn->received_array[idx];
+        if (reserve_message_array(&gconn->received_array, gconn->received_message_id + 1, message_id) == -1) {
+            return -1;
+        }
+
+        GC_Message_Array_Entry *ary_entry = message_array_slot(&gconn->received_array, message_id);
 
         if (!array_entry_is_empty(ary_entry)) {
             return -1;
         }
 
-        if (create_array_entry(chat->logger, chat->mono_time, ary_entry, data, length, packet_type, message_id) == -1) {
+        GC_Message_Buffer *buffer = gcc_message_buffer_new(data, length);
+
+        if (buffer == nullptr) {
             return -1;
         }
 
+        create_array_entry(chat->mono_time, &gconn->received_array, ary_entry, buffer, packet_type, message_id);
+        gcc_message_buffer_release(buffer);
+
         return 1;
     }
 
@@ -320,16 +475,25 @@ static int process_received_array_entry(const GC_Chat *chat, Messenger *m, int g
         return -1;
     }
 
-    int ret = handle_gc_lossless_helper(m, group_number, peer_number, array_entry->data, array_entry->data_length,
-                                        array_entry->message_id, array_entry->packet_type);
-    clear_array_entry(array_entry);
+    /* Take the message out of the array before handling it, the handler may change it. */
+    const GC_Message_Array_Entry entry = *array_entry;
+    memset(array_entry, 0, sizeof(GC_Message_Array_Entry));
+    --gconn->received_array.num_entries;
+
+    if (gconn->received_array.num_entries == 0) {
+        shrink_message_array(&gconn->received_array, gconn->received_message_id + 1, 0);
+    }
+
+    int ret = handle_gc_lossless_helper(m, group_number, peer_number, entry.buffer->data, entry.buffer->length,
+                                        entry.message_id, entry.packet_type);
+    gcc_message_buffer_release(entry.buffer);
 
     if (ret == -1) {
-        gc_send_message_ack(chat, gconn, 0, array_entry->message_id);
+        gc_send_message_ack(chat, gconn, 0, entry.message_id);
         return -1;
     }
 
-    gc_send_message_ack(chat, gconn, array_entry->message_id, 0);
+    gc_send_message_ack(chat, gconn, entry.message_id, 0);
     ++gconn->received_message_id;
 
     return 0;
@@ -355,10 +519,9 @@ int gcc_check_received_array(Messenger *m, int group_number, uint32_t peer_numbe
         return -1;
     }
 
-    uint16_t idx = (gconn->received_message_id + 1) % GCC_BUFFER_SIZE;
-    GC_Message_Array_Entry *array_entry = &gconn->received_array[idx];
+    GC_Message_Array_Entry *array_entry = message_array_get(&gconn->received_array, gconn->received_message_id + 1);
 
-    if (!array_entry_is_empty(array_entry)) {
+    if (array_entry != nullptr) {
         return process_received_array_entry(chat, m, group_number, peer_number, array_entry);
     }
 
@@ -374,13 +537,11 @@ void gcc_resend_packets(Messenger *m, const GC_Chat *chat, uint32_t peer_number)
     }
 
     uint64_t tm = mono_time_get(m->mono_time);
-    uint16_t start = gconn->send_array_start;
-    uint16_t end = gconn->send_message_id % GCC_BUFFER_SIZE;
 
-    for (uint16_t i = start; i != end; i = (i + 1) % GCC_BUFFER_SIZE) {
-        GC_Message_Array_Entry *array_entry = &gconn->send_array[i];
+    for (uint64_t i = gconn->send_array_start; i != gconn->send_message_id; ++i) {
+        GC_Message_Array_Entry *array_entry = message_array_get(&gconn->send_array, i);
 
-        if (array_entry_is_empty(array_entry)) {
+        if (array_entry == nullptr) {
             continue;
         }
 
@@ -393,7 +554,7 @@ void gcc_resend_packets(Messenger *m, const GC_Chat *chat, uint32_t peer_number)
 
         /* if this occurrs less than once per second this won't be reliable */
         if (delta > 1 && is_power_of_2(delta)) {
-            gcc_send_group_packet(chat, gconn, array_entry->data, array_entry->data_length);
+            gcc_encrypt_and_send_lossless_packet(chat, gconn, array_entry);
             continue;
         }
 
@@ -476,15 +637,8 @@ void gcc_mark_for_deletion(GC_Connection *gconn, TCP_Connections *tcp_conn, Grou
 /* called when a peer leaves the group */
 void gcc_peer_cleanup(GC_Connection *gconn)
 {
-    for (size_t i = 0; i < GCC_BUFFER_SIZE; ++i) {
-        if (gconn->send_array[i].data) {
-            free(gconn->send_array[i].data);
-        }
-
-        if (gconn->received_array[i].data) {
-            free(gconn->received_array[i].data);
-        }
-    }
+    clear_message_array(&gconn->send_array);
+    clear_message_array(&gconn->received_array);
 
     memset(gconn, 0, sizeof(GC_Connection));
 }
@@ -15,18 +15,36 @@
 /* Max number of messages to store in the send/recv arrays (must fit inside an uint16) */
 #define GCC_BUFFER_SIZE 8192
 
+/* Number of entries the send/recv arrays start with once a message is stored in them */
+#define GCC_MIN_BUFFER_SIZE 16
+
 /* Max number of TCP relays we share with a peer */
 #define GCC_MAX_TCP_SHARED_RELAYS 3
 
-typedef struct GC_Message_Array_Entry {
+/* Plaintext of a lossless message. Broadcasts share one buffer between the send arrays of all peers. */
+typedef struct GC_Message_Buffer {
     uint8_t *data;
-    uint32_t data_length;
+    uint32_t length;
+    uint32_t refcount;
+} GC_Message_Buffer;
+
+typedef struct GC_Message_Array_Entry {
+    GC_Message_Buffer *buffer;
     uint8_t  packet_type;
     uint64_t message_id;
     uint64_t time_added;
     uint64_t last_send_try;
 } GC_Message_Array_Entry;
 
+/* Ring of messages indexed by message_id modulo capacity. The capacity is a power of two
+ * that grows with the span of stored message ids, up to GCC_BUFFER_SIZE.
+ */
+typedef struct GC_Message_Array {
+    GC_Message_Array_Entry *entries;
+    uint16_t capacity;   /* 0 until the first message is stored */
+    uint16_t num_entries;
+} GC_Message_Array;
+
 struct GC_Exit_Info {
     uint8_t part_message[MAX_GC_PART_MESSAGE_SIZE];
     size_t  length;
@@ -36,11 +54,11 @@ struct GC_Exit_Info {
 struct GC_Connection {
     uint64_t send_message_id;   /* message_id of the next message we send to peer */
 
-    uint16_t send_array_start;   /* send_array index of oldest item */
-    GC_Message_Array_Entry send_array[GCC_BUFFER_SIZE];
+    uint64_t send_array_start;   /* message_id of oldest item in send_array */
+    GC_Message_Array send_array;
 
     uint64_t received_message_id;   /* message_id of peer's last message to us */
-    GC_Message_Array_Entry received_array[GCC_BUFFER_SIZE];
+    GC_Message_Array received_array;
 
     GC_PeerAddress   addr;   /* holds peer's extended real public key and ip_port */
     uint32_t    public_key_hash;   /* hash of peer's real encryption public key */
@@ -80,13 +98,29 @@ GC_Connection *gcc_get_connection(const GC_Chat *chat, int peer_number);
 void gcc_mark_for_deletion(GC_Connection *gconn, TCP_Connections *tcp_conn, Group_Exit_Type type,
                            const uint8_t *part_message, size_t length);
 
-/* Adds data of length to gconn's send_array.
+/* Returns a new message buffer holding a copy of data with a reference count of 1.
+ * Returns NULL on allocation failure.
+ */
+GC_Message_Buffer *gcc_message_buffer_new(const uint8_t *data, uint32_t length);
+
+/* Drops a reference to buffer, freeing it when no references are left. */
+void gcc_message_buffer_release(GC_Message_Buffer *buffer);
+
+/* Adds the message held by buffer to gconn's send_array, taking a reference to buffer.
  *
  * Returns 0 on success and increments gconn's send_message_id.
  * Returns -1 on failure.
  */
-int gcc_add_to_send_array(const Logger *logger, const Mono_Time *mono_time, GC_Connection *gconn, const uint8_t *data,
-                          uint32_t length, uint8_t packet_type);
+int gcc_add_to_send_array(const Logger *logger, const Mono_Time *mono_time, GC_Connection *gconn,
+                          GC_Message_Buffer *buffer, uint8_t packet_type);
+
+/* Encrypts the message in array_entry for the peer associated with gconn and sends it.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+int gcc_encrypt_and_send_lossless_packet(const GC_Chat *chat, const GC_Connection *gconn,
+        const GC_Message_Array_Entry *array_entry);
 
 /* Decides if message need to be put in received_array or immediately handled.
  *
@@ -98,8 +132,10 @@ int gcc_add_to_send_array(const Logger *logger, const Mono_Time *mono_time, GC_C
 int gcc_handle_received_message(const GC_Chat *chat, uint32_t peer_number, const uint8_t *data, uint32_t length,
                                 uint8_t packet_type, uint64_t message_id, bool direct_conn);
 
-/* Return array index for message_id */
-uint16_t gcc_get_array_index(uint64_t message_id);
+/* Return send_array entry holding message_id.
+ * Return NULL if message_id is not in send_array.
+ */
+GC_Message_Array_Entry *gcc_get_send_array_entry(GC_Connection *gconn, uint64_t message_id);
 
 /* Removes send_array item with message_id.
  *
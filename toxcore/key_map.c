@@ -0,0 +1,255 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * Hash table that associates ids with fixed size keys.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "key_map.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccompat.h"
+#include "crypto_core.h"
+
+/* Keys are kept in open addressing slots with linear probing:
+ * -a key lives in the first free slot at or after the one its hash selects
+ * -the hash of every key is kept next to it, so probing only compares keys
+ *   whose hashes match
+ * -removing a key moves the keys after it back into the hole instead of leaving
+ *   a marker, so lookups stay short however often keys come and go
+ * -the table doubles when it is 3/4 full and halves when it is 1/8 full
+ */
+
+#define KEY_MAP_EMPTY (-1)
+#define KEY_MAP_MIN_CAPACITY 8
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint32_t key_hash(const Key_Map *map, const uint8_t *key)
+{
+    uint64_t h = map->seed;
+    uint32_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= map->key_size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, key + i, sizeof(word));
+        h = mix(h ^ word);
+    }
+
+    if (i < map->key_size) {
+        uint64_t word = 0;
+        memcpy(&word, key + i, map->key_size - i);
+        h = mix(h ^ word);
+    }
+
+    return (uint32_t)h;
+}
+
+/* return the slot of key.
+ * return -1 if key is not in the map.
+ */
+static int64_t find_slot(const Key_Map *map, const uint8_t *key, uint32_t hash)
+{
+    if (map->capacity == 0) {
+        return -1;
+    }
+
+    const uint32_t mask = map->capacity - 1;
+
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        if (map->ids[i] == KEY_MAP_EMPTY) {
+            return -1;
+        }
+
+        if (map->hashes[i] == hash && memcmp(map->keys + (size_t)i * map->key_size, key, map->key_size) == 0) {
+            return i;
+        }
+    }
+}
+
+static void insert_slot(Key_Map *map, const uint8_t *key, uint32_t hash, int id)
+{
+    const uint32_t mask = map->capacity - 1;
+    uint32_t i = hash & mask;
+
+    while (map->ids[i] != KEY_MAP_EMPTY) {
+        i = (i + 1) & mask;
+    }
+
+    memcpy(map->keys + (size_t)i * map->key_size, key, map->key_size);
+    map->hashes[i] = hash;
+    map->ids[i] = id;
+}
+
+/* Move all keys into a table with capacity slots.
+ *
+ * return true on success.
+ */
+static bool resize(Key_Map *map, uint32_t capacity)
+{
+    uint8_t *keys = (uint8_t *)malloc((size_t)capacity * map->key_size);
+    uint32_t *hashes = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    int *ids = (int *)malloc(capacity * sizeof(int));
+
+    if (keys == nullptr || hashes == nullptr || ids == nullptr) {
+        free(keys);
+        free(hashes);
+        free(ids);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < capacity; ++i) {
+        ids[i] = KEY_MAP_EMPTY;
+    }
+
+    uint8_t *old_keys = map->keys;
+    uint32_t *old_hashes = map->hashes;
+    int *old_ids = map->ids;
+    const uint32_t old_capacity = map->capacity;
+
+    map->keys = keys;
+    map->hashes = hashes;
+    map->ids = ids;
+    map->capacity = capacity;
+
+    for (uint32_t i = 0; i < old_capacity; ++i) {
+        if (old_ids[i] != KEY_MAP_EMPTY) {
+            insert_slot(map, old_keys + (size_t)i * map->key_size, old_hashes[i], old_ids[i]);
+        }
+    }
+
+    free(old_keys);
+    free(old_hashes);
+    free(old_ids);
+    return true;
+}
+
+int key_map_init(Key_Map *map, uint32_t key_size, uint32_t initial_capacity)
+{
+    uint32_t capacity = KEY_MAP_MIN_CAPACITY;
+
+    while (capacity / 4 * 3 < initial_capacity) {
+        if (capacity > UINT32_MAX / 2) {
+            return 0;
+        }
+
+        capacity *= 2;
+    }
+
+    map->n = 0;
+    map->capacity = 0;
+    map->min_capacity = capacity;
+    map->key_size = key_size;
+    map->seed = random_u64();
+    map->keys = nullptr;
+    map->hashes = nullptr;
+    map->ids = nullptr;
+
+    if (!resize(map, capacity)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+void key_map_free(Key_Map *map)
+{
+    if (map == nullptr) {
+        return;
+    }
+
+    free(map->keys);
+    map->keys = nullptr;
+
+    free(map->hashes);
+    map->hashes = nullptr;
+
+    free(map->ids);
+    map->ids = nullptr;
+
+    map->n = 0;
+    map->capacity = 0;
+}
+
+int key_map_find(const Key_Map *map, const uint8_t *key)
+{
+    const int64_t slot = find_slot(map, key, key_hash(map, key));
+
+    if (slot < 0) {
+        return -1;
+    }
+
+    return map->ids[slot];
+}
+
+int key_map_add(Key_Map *map, const uint8_t *key, int id)
+{
+    if (id < 0) {
+        return 0;
+    }
+
+    const uint32_t hash = key_hash(map, key);
+
+    if (find_slot(map, key, hash) >= 0) {
+        return 0;
+    }
+
+    if (map->n + 1 > map->capacity / 4 * 3) {
+        if (map->capacity > UINT32_MAX / 2 || !resize(map, map->capacity * 2)) {
+            return -1;
+        }
+    }
+
+    insert_slot(map, key, hash, id);
+    ++map->n;
+    return 1;
+}
+
+int key_map_remove(Key_Map *map, const uint8_t *key, int id)
+{
+    const int64_t slot = find_slot(map, key, key_hash(map, key));
+
+    if (slot < 0 || map->ids[slot] != id) {
+        return 0;
+    }
+
+    const uint32_t mask = map->capacity - 1;
+    uint32_t hole = (uint32_t)slot;
+
+    for (uint32_t i = (hole + 1) & mask; map->ids[i] != KEY_MAP_EMPTY; i = (i + 1) & mask) {
+        const uint32_t home = map->hashes[i] & mask;
+
+        // The key at i may fill the hole if the hole is not before its own slot.
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            memcpy(map->keys + (size_t)hole * map->key_size, map->keys + (size_t)i * map->key_size, map->key_size);
+            map->hashes[hole] = map->hashes[i];
+            map->ids[hole] = map->ids[i];
+            hole = i;
+        }
+    }
+
+    map->ids[hole] = KEY_MAP_EMPTY;
+    --map->n;
+
+    if (map->capacity > map->min_capacity && map->n < map->capacity / 8) {
+        // Keeping the larger table is fine if memory is short.
+        resize(map, map->capacity / 2);
+    }
+
+    return 1;
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * Hash table that associates ids with fixed size keys such as public keys or
+ * IP_Ports. It has the same interface as BS_List, but adding, removing and
+ * finding keys take constant time on average however many keys there are, so
+ * it suits sets with many keys that come and go often.
+ */
+#ifndef C_TOXCORE_TOXCORE_KEY_MAP_H
+#define C_TOXCORE_TOXCORE_KEY_MAP_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Key_Map {
+    uint32_t n; // number of keys
+    uint32_t capacity; // number of slots, a power of 2
+    uint32_t min_capacity; // the table does not shrink below this
+    uint32_t key_size; // size of the keys
+    uint64_t seed; // random, so that peers can not choose keys that collide
+    uint8_t *keys; // array of capacity keys
+    uint32_t *hashes; // hash of the key in each slot
+    int *ids; // id of the key in each slot, -1 if the slot is empty
+} Key_Map;
+
+/* Initialize a map, key_size is the size of the keys in the map and
+ * initial_capacity is the number of keys the memory will be initially allocated for
+ *
+ * return value:
+ *  1 : success
+ *  0 : failure
+ */
+int key_map_init(Key_Map *map, uint32_t key_size, uint32_t initial_capacity);
+
+/* Free a map initiated with key_map_init */
+void key_map_free(Key_Map *map);
+
+/* Retrieve the id associated with a key
+ *
+ * return value:
+ *  >= 0 : id associated with key
+ *  -1   : failure
+ */
+int key_map_find(const Key_Map *map, const uint8_t *key);
+
+/* Add a key with associated id to the map, id must not be negative
+ *
+ * return value:
+ *  1  : success
+ *  0  : failure (key already in map)
+ *  -1 : failure (could not allocate a larger table)
+ */
+int key_map_add(Key_Map *map, const uint8_t *key, int id);
+
+/* Remove key from the map
+ *
+ * return value:
+ *  1 : success
+ *  0 : failure (key not found or id does not match)
+ */
+int key_map_remove(Key_Map *map, const uint8_t *key, int id);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+#include "key_map.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <vector>
+
+#include "crypto_core.h"
+
+namespace {
+
+using Key = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+Key random_key() {
+  Key key;
+  random_bytes(key.data(), key.size());
+  return key;
+}
+
+TEST(KeyMap, FindsAddedKeys) {
+  Key_Map map;
+  ASSERT_EQ(key_map_init(&map, CRYPTO_PUBLIC_KEY_SIZE, 8), 1);
+
+  const Key key1 = random_key();
+  const Key key2 = random_key();
+  EXPECT_EQ(key_map_find(&map, key1.data()), -1);
+
+  EXPECT_EQ(key_map_add(&map, key1.data(), 0), 1);
+  EXPECT_EQ(key_map_add(&map, key2.data(), 7), 1);
+  EXPECT_EQ(key_map_find(&map, key1.data()), 0);
+  EXPECT_EQ(key_map_find(&map, key2.data()), 7);
+
+  key_map_free(&map);
+}
+
+TEST(KeyMap, AddingAKeyTwiceFails) {
+  Key_Map map;
+  ASSERT_EQ(key_map_init(&map, CRYPTO_PUBLIC_KEY_SIZE, 8), 1);
+
+  const Key key = random_key();
+  EXPECT_EQ(key_map_add(&map, key.data(), 1), 1);
+  EXPECT_EQ(key_map_add(&map, key.data(), 2), 0);
+  EXPECT_EQ(key_map_find(&map, key.data()), 1);
+
+  key_map_free(&map);
+}
+
+TEST(KeyMap, RemoveNeedsMatchingId) {
+  Key_Map map;
+  ASSERT_EQ(key_map_init(&map, CRYPTO_PUBLIC_KEY_SIZE, 8), 1);
+
+  const Key key = random_key();
+  EXPECT_EQ(key_map_add(&map, key.data(), 3), 1);
+  EXPECT_EQ(key_map_remove(&map, key.data(), 4), 0);
+  EXPECT_EQ(key_map_find(&map, key.data()), 3);
+  EXPECT_EQ(key_map_remove(&map, key.data(), 3), 1);
+  EXPECT_EQ(key_map_find(&map, key.data()), -1);
+  EXPECT_EQ(key_map_remove(&map, key.data(), 3), 0);
+
+  key_map_free(&map);
+}
+
+TEST(KeyMap, InitialCapacityTakesThatManyKeysWithoutGrowing) {
+  Key_Map map;
+  ASSERT_EQ(key_map_init(&map, CRYPTO_PUBLIC_KEY_SIZE, 32), 1);
+  const uint32_t capacity = map.capacity;
+
+  for (int i = 0; i < 32; ++i) {
+    const Key key = random_key();
+    ASSERT_EQ(key_map_add(&map, key.data(), i), 1);
+  }
+
+  EXPECT_EQ(map.capacity, capacity);
+
+  key_map_free(&map);
+}
+
+TEST(KeyMap, KeysOfAnySizeWork) {
+  Key_Map map;
+  ASSERT_EQ(key_map_init(&map, 3, 1), 1);
+
+  const uint8_t key1[3] = {1, 2, 3};
+  const uint8_t key2[3] = {1, 2, 4};
+  EXPECT_EQ(key_map_add(&map, key1, 1), 1);
+  EXPECT_EQ(key_map_add(&map, key2, 2), 1);
+  EXPECT_EQ(key_map_find(&map, key1), 1);
+  EXPECT_EQ(key_map_find(&map, key2), 2);
+
+  key_map_free(&map);
+}
+
+TEST(KeyMap, ChurnKeepsAllKeysFindable) {
+  Key_Map map;
+  ASSERT_EQ(key_map_init(&map, CRYPTO_PUBLIC_KEY_SIZE, 8), 1);
+
+  std::vector<Key> keys;
+
+  for (int i = 0; i < 2000; ++i) {
+    keys.push_back(random_key());
+    ASSERT_EQ(key_map_add(&map, keys.back().data(), i), 1);
+  }
+
+  // Remove every other key, so the table shrinks with holes in every probe sequence.
+  for (int i = 0; i < 2000; i += 2) {
+    ASSERT_EQ(key_map_remove(&map, keys[i].data(), i), 1);
+  }
+
+  for (int i = 0; i < 2000; ++i) {
+    EXPECT_EQ(key_map_find(&map, keys[i].data()), i % 2 == 0 ? -1 : i);
+  }
+
+  for (int i = 1; i < 1990; i += 2) {
+    ASSERT_EQ(key_map_remove(&map, keys[i].data(), i), 1);
+  }
+
+  EXPECT_EQ(map.n, 5u);
+  EXPECT_LE(map.capacity, 64u);
+
+  for (int i = 1991; i < 2000; i += 2) {
+    EXPECT_EQ(key_map_find(&map, keys[i].data()), i);
+  }
+
+  key_map_free(&map);
+}
+
+}  // namespace
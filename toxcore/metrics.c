@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * Building blocks for load counters.
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#if !defined(OS_WIN32) && (defined(_WIN32) || defined(__WIN32__) || defined(WIN32))
+#define OS_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include "metrics.h"
+
+#include <time.h>
+
+#include "ccompat.h"
+
+static uint32_t bucket_of(uint64_t value)
+{
+    uint32_t bucket = 0;
+    uint64_t bound = METRICS_HISTOGRAM_MIN;
+
+    while (value >= bound && bucket < METRICS_HISTOGRAM_BUCKETS - 1) {
+        bound <<= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+void metrics_histogram_add(Metrics_Histogram *histogram, uint64_t value)
+{
+    ++histogram->count;
+    histogram->sum += value;
+    ++histogram->buckets[bucket_of(value)];
+}
+
+void metrics_histogram_merge(Metrics_Histogram *histogram, const Metrics_Histogram *other)
+{
+    histogram->count += other->count;
+    histogram->sum += other->sum;
+
+    for (uint32_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+        histogram->buckets[i] += other->buckets[i];
+    }
+}
+
+uint64_t metrics_histogram_bound(uint32_t bucket)
+{
+    if (bucket >= METRICS_HISTOGRAM_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+
+    return ((uint64_t)METRICS_HISTOGRAM_MIN << bucket) - 1;
+}
+
+uint64_t metrics_time_ns(void)
+{
+#ifdef OS_WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL
+           + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
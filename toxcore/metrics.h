@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * Building blocks for the load counters that modules keep about themselves:
+ * a histogram of durations and a clock precise enough to measure single packet
+ * handlers. Each module keeps its own counters in its own state, so counting
+ * needs no locks, and copies them out through a *_get_stats function.
+ */
+#ifndef C_TOXCORE_TOXCORE_METRICS_H
+#define C_TOXCORE_TOXCORE_METRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Upper bound of the first histogram bucket, in nanoseconds. Each further
+ * bucket ends at twice the bound of the one before it.
+ */
+#define METRICS_HISTOGRAM_MIN 256
+
+/* Number of histogram buckets. The last one has no upper bound; the one before
+ * it ends at METRICS_HISTOGRAM_MIN << (METRICS_HISTOGRAM_BUCKETS - 2), about
+ * 67 milliseconds.
+ */
+#define METRICS_HISTOGRAM_BUCKETS 20
+
+typedef struct Metrics_Histogram {
+    uint64_t count;
+    uint64_t sum;
+    /* Number of values in each bucket, not including those of earlier ones. */
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+} Metrics_Histogram;
+
+void metrics_histogram_add(Metrics_Histogram *histogram, uint64_t value);
+
+/* Add the values counted in other to histogram. */
+void metrics_histogram_merge(Metrics_Histogram *histogram, const Metrics_Histogram *other);
+
+/* return the largest value that falls into bucket, or UINT64_MAX for the last one. */
+uint64_t metrics_histogram_bound(uint32_t bucket);
+
+/* return a monotonic time in nanoseconds, for measuring durations. */
+uint64_t metrics_time_ns(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif
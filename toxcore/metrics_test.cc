@@ -0,0 +1,65 @@
+#include "metrics.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+TEST(MetricsHistogram, CountsValuesIntoPowerOfTwoBuckets) {
+  Metrics_Histogram histogram = {};
+
+  metrics_histogram_add(&histogram, 0);
+  metrics_histogram_add(&histogram, METRICS_HISTOGRAM_MIN - 1);
+  metrics_histogram_add(&histogram, METRICS_HISTOGRAM_MIN);
+  metrics_histogram_add(&histogram, 2 * METRICS_HISTOGRAM_MIN - 1);
+  metrics_histogram_add(&histogram, 2 * METRICS_HISTOGRAM_MIN);
+
+  EXPECT_EQ(histogram.count, 5u);
+  EXPECT_EQ(histogram.sum, 6u * METRICS_HISTOGRAM_MIN - 2);
+  EXPECT_EQ(histogram.buckets[0], 2u);
+  EXPECT_EQ(histogram.buckets[1], 2u);
+  EXPECT_EQ(histogram.buckets[2], 1u);
+}
+
+TEST(MetricsHistogram, LastBucketTakesEverythingLarger) {
+  Metrics_Histogram histogram = {};
+
+  metrics_histogram_add(&histogram, metrics_histogram_bound(METRICS_HISTOGRAM_BUCKETS - 2));
+  metrics_histogram_add(&histogram, metrics_histogram_bound(METRICS_HISTOGRAM_BUCKETS - 2) + 1);
+  metrics_histogram_add(&histogram, UINT64_MAX / 2);
+
+  EXPECT_EQ(histogram.buckets[METRICS_HISTOGRAM_BUCKETS - 2], 1u);
+  EXPECT_EQ(histogram.buckets[METRICS_HISTOGRAM_BUCKETS - 1], 2u);
+  EXPECT_EQ(metrics_histogram_bound(METRICS_HISTOGRAM_BUCKETS - 1), UINT64_MAX);
+}
+
+TEST(MetricsHistogram, BoundsMatchBuckets) {
+  for (uint32_t i = 0; i + 1 < METRICS_HISTOGRAM_BUCKETS; ++i) {
+    Metrics_Histogram histogram = {};
+    metrics_histogram_add(&histogram, metrics_histogram_bound(i));
+    metrics_histogram_add(&histogram, metrics_histogram_bound(i) + 1);
+    EXPECT_EQ(histogram.buckets[i], 1u) << "bucket " << i;
+    EXPECT_EQ(histogram.buckets[i + 1], 1u) << "bucket " << i;
+  }
+}
+
+TEST(MetricsHistogram, MergeAddsUp) {
+  Metrics_Histogram a = {};
+  Metrics_Histogram b = {};
+
+  metrics_histogram_add(&a, 10);
+  metrics_histogram_add(&b, 20);
+  metrics_histogram_add(&b, 1000000);
+  metrics_histogram_merge(&a, &b);
+
+  EXPECT_EQ(a.count, 3u);
+  EXPECT_EQ(a.sum, 1000030u);
+  EXPECT_EQ(a.buckets[0], 2u);
+}
+
+TEST(MetricsTime, IsMonotonic) {
+  const uint64_t start = metrics_time_ns();
+  const uint64_t end = metrics_time_ns();
+  EXPECT_GE(end, start);
+}
+
+}  // namespace
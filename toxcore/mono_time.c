@@ -29,6 +29,14 @@
 
 #include "ccompat.h"
 
+/* Use lock-free 64 bit loads and stores for the cached time where the compiler
+ * can do them natively. Readers then never touch a lock; mono_time_update is the
+ * only writer, so a plain atomic store is sufficient.
+ */
+#if defined(__GNUC__) && defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define MONO_TIME_ATOMIC
+#endif
+
 /* don't call into system billions of times for no reason */
 struct Mono_Time {
     uint64_t time;
@@ -40,8 +48,10 @@ struct Mono_Time {
     bool last_clock_update;
 #endif
 
+#ifndef MONO_TIME_ATOMIC
     /* protect `time` from concurrent access */
     pthread_rwlock_t *time_update_lock;
+#endif
 
     mono_time_current_time_cb *current_time_callback;
     void *user_data;
@@ -103,6 +113,7 @@ Mono_Time *mono_time_new(void)
         return nullptr;
     }
 
+#ifndef MONO_TIME_ATOMIC
     mono_time->time_update_lock = (pthread_rwlock_t *)malloc(sizeof(pthread_rwlock_t));
 
     if (mono_time->time_update_lock == nullptr) {
@@ -116,6 +127,8 @@ Mono_Time *mono_time_new(void)
         return nullptr;
     }
 
+#endif
+
     mono_time->current_time_callback = current_time_monotonic_default;
     mono_time->user_data = nullptr;
 
@@ -125,7 +138,10 @@ Mono_Time *mono_time_new(void)
     mono_time->last_clock_update = false;
 
     if (pthread_mutex_init(&mono_time->last_clock_lock, nullptr) < 0) {
+#ifndef MONO_TIME_ATOMIC
+        pthread_rwlock_destroy(mono_time->time_update_lock);
         free(mono_time->time_update_lock);
+#endif
         free(mono_time);
         return nullptr;
     }
@@ -145,8 +161,10 @@ void mono_time_free(Mono_Time *mono_time)
 #ifdef OS_WIN32
     pthread_mutex_destroy(&mono_time->last_clock_lock);
 #endif
+#ifndef MONO_TIME_ATOMIC
     pthread_rwlock_destroy(mono_time->time_update_lock);
     free(mono_time->time_update_lock);
+#endif
     free(mono_time);
 }
 
@@ -164,18 +182,26 @@ void mono_time_update(Mono_Time *mono_time)
     pthread_mutex_unlock(&mono_time->last_clock_lock);
 #endif
 
+#ifdef MONO_TIME_ATOMIC
+    __atomic_store_n(&mono_time->time, time, __ATOMIC_RELEASE);
+#else
     pthread_rwlock_wrlock(mono_time->time_update_lock);
     mono_time->time = time;
     pthread_rwlock_unlock(mono_time->time_update_lock);
+#endif
 }
 
 uint64_t mono_time_get(const Mono_Time *mono_time)
 {
+#ifdef MONO_TIME_ATOMIC
+    return __atomic_load_n(&mono_time->time, __ATOMIC_ACQUIRE);
+#else
     uint64_t time = 0;
     pthread_rwlock_rdlock(mono_time->time_update_lock);
     time = mono_time->time;
     pthread_rwlock_unlock(mono_time->time_update_lock);
     return time;
+#endif
 }
 
 bool mono_time_is_timeout(const Mono_Time *mono_time, uint64_t timestamp, uint64_t timeout)
@@ -2,6 +2,10 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 namespace {
 
 TEST(MonoTime, UnixTimeIncreasesOverTime) {
@@ -61,4 +65,46 @@ TEST(MonoTime, CustomTime) {
   mono_time_free(mono_time);
 }
 
+// Readers racing against a writer see the time only go forward.
+TEST(MonoTime, ConcurrentReadsAreMonotonic) {
+  Mono_Time *mono_time = mono_time_new();
+
+  std::atomic<bool> done{false};
+  std::thread writer([&]() {
+    while (!done) {
+      mono_time_update(mono_time);
+    }
+  });
+
+  std::atomic<uint32_t> backwards{0};
+  std::vector<std::thread> readers;
+
+  for (unsigned i = 0; i < 4; ++i) {
+    readers.emplace_back([mono_time, &backwards]() {
+      uint64_t last = mono_time_get(mono_time);
+
+      for (uint32_t j = 0; j < 100000; ++j) {
+        uint64_t const now = mono_time_get(mono_time);
+
+        if (now < last) {
+          ++backwards;
+        }
+
+        last = now;
+      }
+    });
+  }
+
+  for (std::thread &reader : readers) {
+    reader.join();
+  }
+
+  done = true;
+  writer.join();
+
+  EXPECT_EQ(backwards, 0);
+
+  mono_time_free(mono_time);
+}
+
 }  // namespace
@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "list.h"
+
 #include "mono_time.h"
 #include "util.h"
 
@@ -27,12 +29,38 @@ typedef struct Packet_Data {
     uint8_t data[MAX_CRYPTO_DATA_SIZE];
 } Packet_Data;
 
+/* Window of packets indexed by packet number.
+ *
+ * The slot table is allocated lazily and grows (by powers of 2, up to
+ * CRYPTO_PACKET_BUFFER_SIZE) with the range of packets actually stored, so
+ * idle connections don't pay for a full size pointer table. Only packet numbers
+ * in `{buffer_start, buffer_start + capacity)` can hold data; anything past
+ * that but before buffer_end is an empty hole.
+ */
 typedef struct Packets_Array {
-    Packet_Data *buffer[CRYPTO_PACKET_BUFFER_SIZE];
+    Packet_Data **buffer;
+    uint32_t  capacity; /* number of slots in buffer, 0 or a power of 2 */
     uint32_t  buffer_start;
     uint32_t  buffer_end; /* packet numbers in array: `{buffer_start, buffer_end)` */
 } Packets_Array;
 
+/* Free list of Packet_Data buffers shared by all connections of a Net_Crypto.
+ *
+ * Lossless packets are copied into a heap allocated Packet_Data while they sit
+ * in the send or receive array. Instead of returning them to malloc when they
+ * are acked or read, up to CRYPTO_PACKET_POOL_SIZE buffers are kept here and
+ * handed out again, so a connection in a steady state doesn't allocate.
+ */
+typedef struct Packet_Pool {
+    pthread_mutex_t mutex;
+    Packet_Data *packets[CRYPTO_PACKET_POOL_SIZE];
+    uint32_t num_packets;
+
+    uint64_t allocated;
+    uint64_t reused;
+    uint64_t released;
+} Packet_Pool;
+
 typedef enum Crypto_Conn_State {
     CRYPTO_CONN_FREE = 0,            /* the connection slot is free. This value is 0 so it is valid after
                                       * `crypto_memzero(...)` of the parent struct
@@ -152,6 +180,8 @@ struct Net_Crypto {
     uint32_t current_sleep_time;
 
     BS_List ip_port_list;
+
+    Packet_Pool packet_pool;
 };
 
 const uint8_t *nc_get_self_public_key(const Net_Crypto *c)
@@ -164,6 +194,16 @@ const uint8_t *nc_get_self_secret_key(const Net_Crypto *c)
     return c->self_secret_key;
 }
 
+void nc_packet_pool_stats(Net_Crypto *c, Packet_Pool_Stats *stats)
+{
+    pthread_mutex_lock(&c->packet_pool.mutex);
+    stats->allocated = c->packet_pool.allocated;
+    stats->reused = c->packet_pool.reused;
+    stats->released = c->packet_pool.released;
+    stats->pooled = c->packet_pool.num_packets;
+    pthread_mutex_unlock(&c->packet_pool.mutex);
+}
+
 TCP_Connections *nc_get_tcp_c(const Net_Crypto *c)
 {
     return c->tcp_c;
@@ -728,6 +768,68 @@ static int send_packet_to(Net_Crypto *c, int crypt_connection_id, const uint8_t
 
 /** START: Array Related functions */
 
+/* Get a Packet_Data buffer from pool, allocating a new one if it is empty.
+ *
+ * return nullptr on failure.
+ */
+static Packet_Data *packet_pool_get(Packet_Pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->num_packets > 0) {
+        --pool->num_packets;
+        Packet_Data *packet = pool->packets[pool->num_packets];
+        ++pool->reused;
+        pthread_mutex_unlock(&pool->mutex);
+        return packet;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    Packet_Data *packet = (Packet_Data *)malloc(sizeof(Packet_Data));
+
+    if (packet == nullptr) {
+        return nullptr;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    ++pool->allocated;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return packet;
+}
+
+/* Give a Packet_Data buffer back to pool, freeing it if the pool is full. */
+static void packet_pool_put(Packet_Pool *pool, Packet_Data *packet)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->num_packets < CRYPTO_PACKET_POOL_SIZE) {
+        pool->packets[pool->num_packets] = packet;
+        ++pool->num_packets;
+        pthread_mutex_unlock(&pool->mutex);
+        return;
+    }
+
+    ++pool->released;
+    pthread_mutex_unlock(&pool->mutex);
+
+    free(packet);
+}
+
+/* Free all buffers held by pool. */
+static void packet_pool_clear(Packet_Pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    for (uint32_t i = 0; i < pool->num_packets; ++i) {
+        free(pool->packets[i]);
+    }
+
+    pool->released += pool->num_packets;
+    pool->num_packets = 0;
+    pthread_mutex_unlock(&pool->mutex);
+}
 
 /* Return number of packets in array
  * Note that holes are counted too.
@@ -737,31 +839,136 @@ static uint32_t num_packets_array(const Packets_Array *array)
     return array->buffer_end - array->buffer_start;
 }
 
+/* Return pointer to the slot of packet number in array.
+ * return nullptr if the slot lies outside the allocated window (i.e. it is empty).
+ */
+static Packet_Data **packets_array_slot(const Packets_Array *array, uint32_t number)
+{
+    if (number - array->buffer_start >= array->capacity) {
+        return nullptr;
+    }
+
+    return &array->buffer[number & (array->capacity - 1)];
+}
+
+/* Return packet stored at packet number, or nullptr if there is none. */
+static Packet_Data *packets_array_get(const Packets_Array *array, uint32_t number)
+{
+    Packet_Data *const *slot = packets_array_slot(array, number);
+
+    if (slot == nullptr) {
+        return nullptr;
+    }
+
+    return *slot;
+}
+
+/* Resize the slot table of array to hold capacity packets, keeping the packets
+ * in it at their packet numbers. capacity must be a power of 2 that is large
+ * enough for every stored packet.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int resize_packets_array(Packets_Array *array, uint32_t capacity)
+{
+    Packet_Data **new_buffer = (Packet_Data **)calloc(capacity, sizeof(Packet_Data *));
+
+    if (new_buffer == nullptr) {
+        return -1;
+    }
+
+    const uint32_t num = min_u32(num_packets_array(array), array->capacity);
+
+    for (uint32_t i = 0; i < num; ++i) {
+        const uint32_t number = array->buffer_start + i;
+        new_buffer[number & (capacity - 1)] = array->buffer[number & (array->capacity - 1)];
+    }
+
+    free(array->buffer);
+    array->buffer = new_buffer;
+    array->capacity = capacity;
+    return 0;
+}
+
+/* Make sure array has a slot for packet number, growing it if needed.
+ * number must be less than CRYPTO_PACKET_BUFFER_SIZE after buffer_start.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int reserve_packets_array(Packets_Array *array, uint32_t number)
+{
+    const uint32_t needed = number - array->buffer_start + 1;
+
+    if (needed <= array->capacity) {
+        return 0;
+    }
+
+    uint32_t capacity = array->capacity == 0 ? CRYPTO_MIN_PACKET_BUFFER_SIZE : array->capacity;
+
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    return resize_packets_array(array, capacity);
+}
+
+/* Give memory back once most of the window has been consumed. Only shrinks
+ * when the stored range uses at most an eighth of the slots so that a
+ * connection hovering around a boundary doesn't reallocate on every packet.
+ */
+static void shrink_packets_array(Packets_Array *array)
+{
+    if (array->capacity <= CRYPTO_MIN_PACKET_BUFFER_SIZE) {
+        return;
+    }
+
+    const uint32_t used = min_u32(num_packets_array(array), array->capacity);
+
+    if (used > array->capacity / 8) {
+        return;
+    }
+
+    uint32_t capacity = array->capacity / 2;
+
+    while (capacity > CRYPTO_MIN_PACKET_BUFFER_SIZE && used <= capacity / 4) {
+        capacity /= 2;
+    }
+
+    /* On failure we just keep the larger table. */
+    resize_packets_array(array, capacity);
+}
+
 /* Add data with packet number to array.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int add_data_to_buffer(const Logger *log, Packets_Array *array, uint32_t number, const Packet_Data *data)
+static int add_data_to_buffer(const Logger *log, Packet_Pool *pool, Packets_Array *array, uint32_t number, const Packet_Data *data)
 {
     if (number - array->buffer_start >= CRYPTO_PACKET_BUFFER_SIZE) {
         return -1;
     }
 
-    uint32_t num = number % CRYPTO_PACKET_BUFFER_SIZE;
+    if (reserve_packets_array(array, number) != 0) {
+        return -1;
+    }
 
-    if (array->buffer[num]) {
+    Packet_Data **slot = packets_array_slot(array, number);
+
+    if (*slot) {
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)malloc(sizeof(Packet_Data));
+    Packet_Data *new_d = packet_pool_get(pool);
 
     if (new_d == nullptr) {
         return -1;
     }
 
     memcpy(new_d, data, sizeof(Packet_Data));
-    array->buffer[num] = new_d;
+    *slot = new_d;
 
     if (number - array->buffer_start >= num_packets_array(array)) {
         array->buffer_end = number + 1;
@@ -784,13 +991,13 @@ static int get_data_pointer(const Logger *log, const Packets_Array *array, Packe
         return -1;
     }
 
-    uint32_t num = number % CRYPTO_PACKET_BUFFER_SIZE;
+    Packet_Data *packet = packets_array_get(array, number);
 
-    if (!array->buffer[num]) {
+    if (!packet) {
         return 0;
     }
 
-    *data = array->buffer[num];
+    *data = packet;
     return 1;
 }
 
@@ -799,7 +1006,7 @@ static int get_data_pointer(const Logger *log, const Packets_Array *array, Packe
  * return -1 on failure.
  * return packet number on success.
  */
-static int64_t add_data_end_of_buffer(const Logger *log, Packets_Array *array, const Packet_Data *data)
+static int64_t add_data_end_of_buffer(const Logger *log, Packet_Pool *pool, Packets_Array *array, const Packet_Data *data)
 {
     const uint32_t num_spots = num_packets_array(array);
 
@@ -807,15 +1014,20 @@ static int64_t add_data_end_of_buffer(const Logger *log, Packets_Array *array, c
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)malloc(sizeof(Packet_Data));
+    const uint32_t id = array->buffer_end;
+
+    if (reserve_packets_array(array, id) != 0) {
+        return -1;
+    }
+
+    Packet_Data *new_d = packet_pool_get(pool);
 
     if (new_d == nullptr) {
         return -1;
     }
 
     memcpy(new_d, data, sizeof(Packet_Data));
-    uint32_t id = array->buffer_end;
-    array->buffer[id % CRYPTO_PACKET_BUFFER_SIZE] = new_d;
+    *packets_array_slot(array, id) = new_d;
     ++array->buffer_end;
     return id;
 }
@@ -825,23 +1037,24 @@ static int64_t add_data_end_of_buffer(const Logger *log, Packets_Array *array, c
  * return -1 on failure.
  * return packet number on success.
  */
-static int64_t read_data_beg_buffer(const Logger *log, Packets_Array *array, Packet_Data *data)
+static int64_t read_data_beg_buffer(const Logger *log, Packet_Pool *pool, Packets_Array *array, Packet_Data *data)
 {
     if (array->buffer_end == array->buffer_start) {
         return -1;
     }
 
-    const uint32_t num = array->buffer_start % CRYPTO_PACKET_BUFFER_SIZE;
+    Packet_Data **slot = packets_array_slot(array, array->buffer_start);
 
-    if (!array->buffer[num]) {
+    if (slot == nullptr || !*slot) {
         return -1;
     }
 
-    memcpy(data, array->buffer[num], sizeof(Packet_Data));
+    memcpy(data, *slot, sizeof(Packet_Data));
     uint32_t id = array->buffer_start;
     ++array->buffer_start;
-    free(array->buffer[num]);
-    array->buffer[num] = nullptr;
+    packet_pool_put(pool, *slot);
+    *slot = nullptr;
+    shrink_packets_array(array);
     return id;
 }
 
@@ -850,7 +1063,7 @@ static int64_t read_data_beg_buffer(const Logger *log, Packets_Array *array, Pac
  * return -1 on failure.
  * return 0 on success
  */
-static int clear_buffer_until(const Logger *log, Packets_Array *array, uint32_t number)
+static int clear_buffer_until(const Logger *log, Packet_Pool *pool, Packets_Array *array, uint32_t number)
 {
     const uint32_t num_spots = num_packets_array(array);
 
@@ -861,32 +1074,48 @@ static int clear_buffer_until(const Logger *log, Packets_Array *array, uint32_t
     uint32_t i;
 
     for (i = array->buffer_start; i != number; ++i) {
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        Packet_Data **slot = packets_array_slot(array, i);
 
-        if (array->buffer[num]) {
-            free(array->buffer[num]);
-            array->buffer[num] = nullptr;
+        if (slot == nullptr) {
+            /* Nothing is stored past the allocated window. */
+            i = number;
+            break;
+        }
+
+        if (*slot) {
+            packet_pool_put(pool, *slot);
+            *slot = nullptr;
         }
     }
 
     array->buffer_start = i;
+    shrink_packets_array(array);
     return 0;
 }
 
-static int clear_buffer(Packets_Array *array)
+/* Delete all packets in array and release its slot table. */
+static int clear_buffer(Packet_Pool *pool, Packets_Array *array)
 {
     uint32_t i;
 
     for (i = array->buffer_start; i != array->buffer_end; ++i) {
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        Packet_Data **slot = packets_array_slot(array, i);
+
+        if (slot == nullptr) {
+            i = array->buffer_end;
+            break;
+        }
 
-        if (array->buffer[num]) {
-            free(array->buffer[num]);
-            array->buffer[num] = nullptr;
+        if (*slot) {
+            packet_pool_put(pool, *slot);
+            *slot = nullptr;
         }
     }
 
     array->buffer_start = i;
+    free(array->buffer);
+    array->buffer = nullptr;
+    array->capacity = 0;
     return 0;
 }
 
@@ -936,9 +1165,7 @@ static int generate_request_packet(const Logger *log, uint8_t *data, uint16_t le
     uint32_t n = 1;
 
     for (uint32_t i = recv_array->buffer_start; i != recv_array->buffer_end; ++i) {
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
-
-        if (!recv_array->buffer[num]) {
+        if (!packets_array_get(recv_array, i)) {
             data[cur_len] = n;
             n = 0;
             ++cur_len;
@@ -968,7 +1195,7 @@ static int generate_request_packet(const Logger *log, uint8_t *data, uint16_t le
  * return -1 on failure.
  * return number of requested packets on success.
  */
-static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packets_Array *send_array,
+static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packet_Pool *pool, Packets_Array *send_array,
                                  const uint8_t *data, uint16_t length, uint64_t *latest_send_time, uint64_t rtt_time)
 {
     if (length == 0) {
@@ -997,14 +1224,14 @@ static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packet
             break;
         }
 
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        Packet_Data **slot = packets_array_slot(send_array, i);
 
         if (n == data[0]) {
-            if (send_array->buffer[num]) {
-                uint64_t sent_time = send_array->buffer[num]->sent_time;
+            if (slot && *slot) {
+                uint64_t sent_time = (*slot)->sent_time;
 
                 if ((sent_time + rtt_time) < temp_time) {
-                    send_array->buffer[num]->sent_time = 0;
+                    (*slot)->sent_time = 0;
                 }
             }
 
@@ -1013,15 +1240,15 @@ static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packet
             n = 0;
             ++requested;
         } else {
-            if (send_array->buffer[num]) {
-                uint64_t sent_time = send_array->buffer[num]->sent_time;
+            if (slot && *slot) {
+                uint64_t sent_time = (*slot)->sent_time;
 
                 if (l_sent_time < sent_time) {
                     l_sent_time = sent_time;
                 }
 
-                free(send_array->buffer[num]);
-                send_array->buffer[num] = nullptr;
+                packet_pool_put(pool, *slot);
+                *slot = nullptr;
             }
         }
 
@@ -1169,7 +1396,7 @@ static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, cons
     dt.length = length;
     memcpy(dt.data, data, length);
     pthread_mutex_lock(conn->mutex);
-    int64_t packet_num = add_data_end_of_buffer(c->log, &conn->send_array, &dt);
+    int64_t packet_num = add_data_end_of_buffer(c->log, &c->packet_pool, &conn->send_array, &dt);
     pthread_mutex_unlock(conn->mutex);
 
     if (packet_num == -1) {
@@ -1528,7 +1755,7 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
             rtt_calc_time = packet_time->sent_time;
         }
 
-        if (clear_buffer_until(c->log, &conn->send_array, buffer_start) != 0) {
+        if (clear_buffer_until(c->log, &c->packet_pool, &conn->send_array, buffer_start) != 0) {
             return -1;
         }
     }
@@ -1569,7 +1796,7 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
             rtt_time = DEFAULT_TCP_PING_CONNECTION;
         }
 
-        int requested = handle_request_packet(c->mono_time, c->log, &conn->send_array, real_data, real_length, &rtt_calc_time,
+        int requested = handle_request_packet(c->mono_time, c->log, &c->packet_pool, &conn->send_array, real_data, real_length, &rtt_calc_time,
                                               rtt_time);
 
         if (requested == -1) {
@@ -1582,13 +1809,13 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
         dt.length = real_length;
         memcpy(dt.data, real_data, real_length);
 
-        if (add_data_to_buffer(c->log, &conn->recv_array, num, &dt) != 0) {
+        if (add_data_to_buffer(c->log, &c->packet_pool, &conn->recv_array, num, &dt) != 0) {
             return -1;
         }
 
         while (1) {
             pthread_mutex_lock(conn->mutex);
-            int ret = read_data_beg_buffer(c->log, &conn->recv_array, &dt);
+            int ret = read_data_beg_buffer(c->log, &c->packet_pool, &conn->recv_array, &dt);
             pthread_mutex_unlock(conn->mutex);
 
             if (ret == -1) {
@@ -2248,6 +2475,15 @@ int get_random_tcp_con_number(Net_Crypto *c)
     return ret;
 }
 
+bool tcp_con_number_is_connected(Net_Crypto *c, unsigned int tcp_connections_number)
+{
+    pthread_mutex_lock(&c->tcp_mutex);
+    const bool ret = tcp_onion_conn_is_connected(c->tcp_c, tcp_connections_number);
+    pthread_mutex_unlock(&c->tcp_mutex);
+
+    return ret;
+}
+
 /* Send an onion packet via the TCP relay corresponding to tcp_connections_number.
  *
  * return 0 on success.
@@ -2905,8 +3141,8 @@ int crypto_kill(Net_Crypto *c, int crypt_connection_id)
         bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv4, crypt_connection_id);
         bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv6, crypt_connection_id);
         clear_temp_packet(c, crypt_connection_id);
-        clear_buffer(&conn->send_array);
-        clear_buffer(&conn->recv_array);
+        clear_buffer(&c->packet_pool, &conn->send_array);
+        clear_buffer(&c->packet_pool, &conn->recv_array);
         ret = wipe_crypto_connection(c, crypt_connection_id);
     }
 
@@ -3003,6 +3239,14 @@ Net_Crypto *new_net_crypto(const Logger *log, Mono_Time *mono_time, DHT *dht, TC
         return nullptr;
     }
 
+    if (pthread_mutex_init(&temp->packet_pool.mutex, nullptr) != 0) {
+        pthread_mutex_destroy(&temp->tcp_mutex);
+        pthread_mutex_destroy(&temp->connections_mutex);
+        kill_tcp_connections(temp->tcp_c);
+        free(temp);
+        return nullptr;
+    }
+
     temp->dht = dht;
 
     new_keys(temp);
@@ -3072,6 +3316,8 @@ void kill_net_crypto(Net_Crypto *c)
         crypto_kill(c, i);
     }
 
+    packet_pool_clear(&c->packet_pool);
+    pthread_mutex_destroy(&c->packet_pool.mutex);
     pthread_mutex_destroy(&c->tcp_mutex);
     pthread_mutex_destroy(&c->connections_mutex);
 
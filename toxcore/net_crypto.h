@@ -70,6 +70,12 @@
 /* Maximum size of receiving and sending packet buffers. */
 #define CRYPTO_PACKET_BUFFER_SIZE 32768 // Must be a power of 2
 
+/* Initial number of slots allocated for a packet buffer once it is first used. */
+#define CRYPTO_MIN_PACKET_BUFFER_SIZE 16 // Must be a power of 2
+
+/* Maximum number of freed packet buffers kept around for reuse. */
+#define CRYPTO_PACKET_POOL_SIZE 1024
+
 /* Minimum packet rate per second. */
 #define CRYPTO_PACKET_MIN_RATE 4.0
 
@@ -116,6 +122,16 @@ const uint8_t *nc_get_self_secret_key(const Net_Crypto *c);
 TCP_Connections *nc_get_tcp_c(const Net_Crypto *c);
 DHT *nc_get_dht(const Net_Crypto *c);
 
+typedef struct Packet_Pool_Stats {
+    uint64_t allocated; /* Packet buffers obtained from malloc. */
+    uint64_t reused;    /* Packet buffers handed out again from the pool. */
+    uint64_t released;  /* Packet buffers given back to the system. */
+    uint32_t pooled;    /* Packet buffers currently waiting in the pool. */
+} Packet_Pool_Stats;
+
+/* Copy the lossless packet buffer allocation counters of c into stats. */
+void nc_packet_pool_stats(Net_Crypto *c, Packet_Pool_Stats *stats);
+
 typedef struct New_Connection {
     IP_Port source;
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE]; /* The real public key of the peer. */
@@ -273,6 +289,11 @@ int add_tcp_relay(Net_Crypto *c, IP_Port ip_port, const uint8_t *public_key);
  */
 int get_random_tcp_con_number(Net_Crypto *c);
 
+/* return true if a TCP connection number returned by get_random_tcp_con_number
+ * is still a connected relay that onion packets can be sent through.
+ */
+bool tcp_con_number_is_connected(Net_Crypto *c, unsigned int tcp_connections_number);
+
 /* Send an onion packet via the TCP relay corresponding to TCP_conn_number.
  *
  * return 0 on success.
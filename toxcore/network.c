@@ -24,6 +24,11 @@
 #define _XOPEN_SOURCE 700
 #endif
 
+// For recvmmsg and sendmmsg on Linux.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #if defined(_WIN32) && _WIN32_WINNT >= _WIN32_WINNT_WINXP
 #undef _WIN32_WINNT
 #define _WIN32_WINNT  0x501
@@ -81,6 +86,12 @@
 #include <sys/filio.h>
 #endif
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define USE_RECVMMSG
+#define USE_SENDMMSG
+#include <pthread.h>
+#endif
+
 #define TOX_EWOULDBLOCK EWOULDBLOCK
 
 static const char *inet_ntop4(const struct in_addr *addr, char *buf, size_t bufsize)
@@ -412,6 +423,16 @@ bool set_socket_reuseaddr(Socket sock)
     return setsockopt(sock.socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&set, sizeof(set)) == 0;
 }
 
+bool set_socket_reuseport(Socket sock)
+{
+#ifdef SO_REUSEPORT
+    int set = 1;
+    return setsockopt(sock.socket, SOL_SOCKET, SO_REUSEPORT, (const char *)&set, sizeof(set)) == 0;
+#else
+    return false;
+#endif
+}
+
 bool set_socket_dualstack(Socket sock)
 {
     int ipv6only = 0;
@@ -479,6 +500,34 @@ typedef struct Packet_Handler {
     void *object;
 } Packet_Handler;
 
+#ifdef USE_RECVMMSG
+/* Preallocated buffers for draining several datagrams with one recvmmsg call. */
+typedef struct Recv_Batch {
+    struct mmsghdr msgs[NET_RECV_BATCH_SIZE];
+    struct iovec iovecs[NET_RECV_BATCH_SIZE];
+    struct sockaddr_storage addrs[NET_RECV_BATCH_SIZE];
+    uint8_t data[NET_RECV_BATCH_SIZE][MAX_UDP_PACKET_SIZE];
+} Recv_Batch;
+#endif
+
+#ifdef USE_SENDMMSG
+/* Datagrams queued by sendpacket until the next networking_flush. */
+typedef struct Send_Queue {
+    /* sendpacket may be called from other threads (e.g. toxav). */
+    pthread_mutex_t mutex;
+
+    struct mmsghdr msgs[NET_SEND_BATCH_SIZE];
+    struct iovec iovecs[NET_SEND_BATCH_SIZE];
+    struct sockaddr_storage addrs[NET_SEND_BATCH_SIZE];
+    IP_Port ip_ports[NET_SEND_BATCH_SIZE];
+    uint8_t data[NET_SEND_BATCH_SIZE][MAX_UDP_PACKET_SIZE];
+    uint32_t count;
+
+    uint64_t packets;
+    uint64_t syscalls;
+} Send_Queue;
+#endif
+
 struct Networking_Core {
     const Logger *log;
     Packet_Handler packethandlers[256];
@@ -487,6 +536,23 @@ struct Networking_Core {
     uint16_t port;
     /* Our UDP socket. */
     Socket sock;
+
+    /* Whether networking_poll may receive several datagrams per system call. */
+    bool batch_receive;
+
+    /* Received packets and bytes for each packet id. */
+    Net_Recv_Stats recv_stats[256];
+    /* How long the handler of each packet id took, allocated while handler
+     * timing is enabled. */
+    Metrics_Histogram *handler_times;
+#ifdef USE_RECVMMSG
+    /* Allocated on the first batched poll. */
+    Recv_Batch *recv_batch;
+#endif
+#ifdef USE_SENDMMSG
+    /* Non-null while outgoing packets are queued rather than sent immediately. */
+    Send_Queue *send_queue;
+#endif
 };
 
 Family net_family(const Networking_Core *net)
@@ -499,6 +565,20 @@ uint16_t net_port(const Networking_Core *net)
     return net->port;
 }
 
+Socket net_sock(const Networking_Core *net)
+{
+    if (net_family_is_unspec(net->family)) {
+        return net_invalid_socket;
+    }
+
+    return net->sock;
+}
+
+#ifdef USE_SENDMMSG
+static int queue_packet(Networking_Core *net, IP_Port ip_port, const struct sockaddr_storage *addr, size_t addrsize,
+                        const uint8_t *data, uint16_t length);
+#endif
+
 /* Basic network functions:
  * Function to send packet(data) of length length to ip_port.
  */
@@ -557,6 +637,14 @@ int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint1
         return -1;
     }
 
+#ifdef USE_SENDMMSG
+
+    if (net->send_queue != nullptr) {
+        return queue_packet(net, ip_port, &addr, addrsize, data, length);
+    }
+
+#endif
+
     const int res = sendto(net->sock.socket, (const char *)data, length, 0, (struct sockaddr *)&addr, addrsize);
 
     loglogdata(net->log, "O=>", data, length, ip_port, res);
@@ -564,6 +652,161 @@ int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint1
     return res;
 }
 
+#ifdef USE_SENDMMSG
+/* Send all packets in the send queue with as few sendmmsg calls as possible.
+ * sendmmsg stops at the first packet the kernel refuses, e.g. one to an
+ * unreachable address, so only that packet is dropped, like a failing sendto
+ * would, and the rest are sent. Only when the socket buffer is full are the
+ * remaining packets dropped too.
+ *
+ * The send queue mutex must be held.
+ */
+static void flush_send_queue(Networking_Core *net)
+{
+    Send_Queue *queue = net->send_queue;
+    uint32_t sent = 0;
+
+    while (sent < queue->count) {
+        const int res = sendmmsg(net->sock.socket, &queue->msgs[sent], queue->count - sent, 0);
+        ++queue->syscalls;
+
+        if (res <= 0) {
+            const int error = net_error();
+
+            if (res < 0 && error == EINTR) {
+                continue;
+            }
+
+            if (res < 0 && error == TOX_EWOULDBLOCK) {
+                for (uint32_t i = sent; i < queue->count; ++i) {
+                    loglogdata(net->log, "O=>", queue->data[i], (uint16_t)queue->iovecs[i].iov_len, queue->ip_ports[i],
+                               -1);
+                }
+
+                break;
+            }
+
+            loglogdata(net->log, "O=>", queue->data[sent], (uint16_t)queue->iovecs[sent].iov_len,
+                       queue->ip_ports[sent], -1);
+            ++sent;
+            continue;
+        }
+
+        for (uint32_t i = sent; i < sent + (uint32_t)res; ++i) {
+            loglogdata(net->log, "O=>", queue->data[i], (uint16_t)queue->iovecs[i].iov_len, queue->ip_ports[i],
+                       (int)queue->msgs[i].msg_len);
+        }
+
+        queue->packets += res;
+        sent += res;
+    }
+
+    queue->count = 0;
+}
+
+/* Copy a packet into the send queue, flushing the queue first if it is full.
+ *
+ * return length.
+ */
+static int queue_packet(Networking_Core *net, IP_Port ip_port, const struct sockaddr_storage *addr, size_t addrsize,
+                        const uint8_t *data, uint16_t length)
+{
+    Send_Queue *queue = net->send_queue;
+    pthread_mutex_lock(&queue->mutex);
+
+    if (queue->count == NET_SEND_BATCH_SIZE) {
+        flush_send_queue(net);
+    }
+
+    const uint32_t i = queue->count;
+    memcpy(queue->data[i], data, length);
+    memcpy(&queue->addrs[i], addr, addrsize);
+    queue->ip_ports[i] = ip_port;
+    queue->iovecs[i].iov_base = queue->data[i];
+    queue->iovecs[i].iov_len = length;
+    memset(&queue->msgs[i], 0, sizeof(queue->msgs[i]));
+    queue->msgs[i].msg_hdr.msg_name = &queue->addrs[i];
+    queue->msgs[i].msg_hdr.msg_namelen = addrsize;
+    queue->msgs[i].msg_hdr.msg_iov = &queue->iovecs[i];
+    queue->msgs[i].msg_hdr.msg_iovlen = 1;
+    ++queue->count;
+
+    pthread_mutex_unlock(&queue->mutex);
+    return length;
+}
+#endif
+
+bool networking_set_batch_send(Networking_Core *net, bool enabled)
+{
+#ifdef USE_SENDMMSG
+
+    if (!enabled) {
+        if (net->send_queue != nullptr) {
+            networking_flush(net);
+            pthread_mutex_destroy(&net->send_queue->mutex);
+            free(net->send_queue);
+            net->send_queue = nullptr;
+        }
+
+        return true;
+    }
+
+    if (net->send_queue != nullptr) {
+        return true;
+    }
+
+    Send_Queue *queue = (Send_Queue *)calloc(1, sizeof(Send_Queue));
+
+    if (queue == nullptr) {
+        return false;
+    }
+
+    if (pthread_mutex_init(&queue->mutex, nullptr) != 0) {
+        free(queue);
+        return false;
+    }
+
+    net->send_queue = queue;
+    return true;
+#else
+    return !enabled;
+#endif
+}
+
+void networking_flush(Networking_Core *net)
+{
+#ifdef USE_SENDMMSG
+
+    if (net->send_queue == nullptr) {
+        return;
+    }
+
+    pthread_mutex_lock(&net->send_queue->mutex);
+    flush_send_queue(net);
+    pthread_mutex_unlock(&net->send_queue->mutex);
+#endif
+}
+
+void networking_get_send_stats(Networking_Core *net, Net_Send_Stats *stats)
+{
+    stats->packets = 0;
+    stats->syscalls = 0;
+
+#ifdef USE_SENDMMSG
+
+    if (net->send_queue == nullptr) {
+        return;
+    }
+
+    pthread_mutex_lock(&net->send_queue->mutex);
+    stats->packets = net->send_queue->packets;
+    stats->syscalls = net->send_queue->syscalls;
+    pthread_mutex_unlock(&net->send_queue->mutex);
+#endif
+}
+
+static int get_ip_port(const struct sockaddr_storage *addr, IP_Port *ip_port);
+
 /* Function to receive data
  *  ip and port of sender is put into ip_port.
  *  Packet data is put into data.
@@ -595,8 +838,24 @@ static int receivepacket(const Logger *log, Socket sock, IP_Port *ip_port, uint8
 
     *length = (uint32_t)fail_or_len;
 
-    if (addr.ss_family == AF_INET) {
-        struct sockaddr_in *addr_in = (struct sockaddr_in *)&addr;
+    if (get_ip_port(&addr, ip_port) != 0) {
+        return -1;
+    }
+
+    loglogdata(log, "=>O", data, MAX_UDP_PACKET_SIZE, *ip_port, *length);
+
+    return 0;
+}
+
+/* Convert the source address of a received datagram to an IP_Port.
+ *
+ * return -1 if the address family is not supported.
+ * return 0 on success.
+ */
+static int get_ip_port(const struct sockaddr_storage *addr, IP_Port *ip_port)
+{
+    if (addr->ss_family == AF_INET) {
+        const struct sockaddr_in *addr_in = (const struct sockaddr_in *)addr;
 
         const Family *const family = make_tox_family(addr_in->sin_family);
         assert(family != nullptr);
@@ -608,8 +867,8 @@ static int receivepacket(const Logger *log, Socket sock, IP_Port *ip_port, uint8
         ip_port->ip.family = *family;
         get_ip4(&ip_port->ip.ip.v4, &addr_in->sin_addr);
         ip_port->port = addr_in->sin_port;
-    } else if (addr.ss_family == AF_INET6) {
-        struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *)&addr;
+    } else if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *addr_in6 = (const struct sockaddr_in6 *)addr;
         const Family *const family = make_tox_family(addr_in6->sin6_family);
         assert(family != nullptr);
 
@@ -629,8 +888,6 @@ static int receivepacket(const Logger *log, Socket sock, IP_Port *ip_port, uint8
         return -1;
     }
 
-    loglogdata(log, "=>O", data, MAX_UDP_PACKET_SIZE, *ip_port, *length);
-
     return 0;
 }
 
@@ -640,6 +897,134 @@ void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handl
     net->packethandlers[byte].object = object;
 }
 
+void networking_set_batch_receive(Networking_Core *net, bool enabled)
+{
+    net->batch_receive = enabled;
+}
+
+bool networking_set_handler_timing(Networking_Core *net, bool enabled)
+{
+    if (!enabled) {
+        free(net->handler_times);
+        net->handler_times = nullptr;
+        return true;
+    }
+
+    if (net->handler_times == nullptr) {
+        net->handler_times = (Metrics_Histogram *)calloc(256, sizeof(Metrics_Histogram));
+    }
+
+    return net->handler_times != nullptr;
+}
+
+void networking_get_recv_stats(const Networking_Core *net, uint8_t packet_id, Net_Recv_Stats *stats)
+{
+    *stats = net->recv_stats[packet_id];
+}
+
+bool networking_get_handler_times(const Networking_Core *net, uint8_t packet_id, Metrics_Histogram *times)
+{
+    if (net->handler_times == nullptr) {
+        return false;
+    }
+
+    *times = net->handler_times[packet_id];
+    return true;
+}
+
+/* Pass a received packet on to the handler registered for its first byte. */
+static void handle_received_packet(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint32_t length,
+                                   void *userdata)
+{
+    if (length < 1) {
+        return;
+    }
+
+    ++net->recv_stats[data[0]].packets;
+    net->recv_stats[data[0]].bytes += length;
+
+    if (!(net->packethandlers[data[0]].function)) {
+        LOGGER_WARNING(net->log, "[%02u] -- Packet has no handler", data[0]);
+        return;
+    }
+
+    if (net->handler_times == nullptr) {
+        net->packethandlers[data[0]].function(net->packethandlers[data[0]].object, ip_port, data, length, userdata);
+        return;
+    }
+
+    const uint64_t start = metrics_time_ns();
+    net->packethandlers[data[0]].function(net->packethandlers[data[0]].object, ip_port, data, length, userdata);
+    metrics_histogram_add(&net->handler_times[data[0]], metrics_time_ns() - start);
+}
+
+#ifdef USE_RECVMMSG
+/* Receive and handle all waiting packets, up to NET_RECV_BATCH_SIZE per recvmmsg call.
+ *
+ * Like the recvfrom loop this keeps going until the socket reports EAGAIN, so
+ * packets that arrive while the handlers run are still handled in this poll.
+ *
+ * return -1 if batched receiving is not available, in which case nothing was received.
+ * return 0 once the socket has been drained.
+ */
+static int networking_poll_batch(Networking_Core *net, void *userdata)
+{
+    if (net->recv_batch == nullptr) {
+        net->recv_batch = (Recv_Batch *)calloc(1, sizeof(Recv_Batch));
+
+        if (net->recv_batch == nullptr) {
+            return -1;
+        }
+    }
+
+    Recv_Batch *batch = net->recv_batch;
+
+    while (true) {
+        for (uint32_t i = 0; i < NET_RECV_BATCH_SIZE; ++i) {
+            batch->iovecs[i].iov_base = batch->data[i];
+            batch->iovecs[i].iov_len = MAX_UDP_PACKET_SIZE;
+            memset(&batch->msgs[i], 0, sizeof(batch->msgs[i]));
+            batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+            batch->msgs[i].msg_hdr.msg_iovlen = 1;
+            batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+            batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+        }
+
+        const int count = recvmmsg(net->sock.socket, batch->msgs, NET_RECV_BATCH_SIZE, 0, nullptr);
+
+        if (count < 0) {
+            const int error = net_error();
+
+            if (error == ENOSYS) {
+                net->batch_receive = false;
+                return -1;
+            }
+
+            if (error != TOX_EWOULDBLOCK && error != EINTR) {
+                const char *strerror = net_new_strerror(error);
+                LOGGER_ERROR(net->log, "Unexpected error reading from socket: %u, %s", error, strerror);
+                net_kill_strerror(strerror);
+            }
+
+            return 0;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            IP_Port ip_port;
+            memset(&ip_port, 0, sizeof(ip_port));
+
+            if (get_ip_port(&batch->addrs[i], &ip_port) != 0) {
+                continue;
+            }
+
+            const uint32_t length = batch->msgs[i].msg_len;
+            loglogdata(net->log, "=>O", batch->data[i], MAX_UDP_PACKET_SIZE, ip_port, length);
+            handle_received_packet(net, ip_port, batch->data[i], length, userdata);
+        }
+    }
+}
+#endif
+
 void networking_poll(Networking_Core *net, void *userdata)
 {
     if (net_family_is_unspec(net->family)) {
@@ -647,21 +1032,20 @@ void networking_poll(Networking_Core *net, void *userdata)
         return;
     }
 
+#ifdef USE_RECVMMSG
+
+    if (net->batch_receive && networking_poll_batch(net, userdata) == 0) {
+        return;
+    }
+
+#endif
+
     IP_Port ip_port;
     uint8_t data[MAX_UDP_PACKET_SIZE];
     uint32_t length;
 
     while (receivepacket(net->log, net->sock, &ip_port, data, &length) != -1) {
-        if (length < 1) {
-            continue;
-        }
-
-        if (!(net->packethandlers[data[0]].function)) {
-            LOGGER_WARNING(net->log, "[%02u] -- Packet has no handler", data[0]);
-            continue;
-        }
-
-        net->packethandlers[data[0]].function(net->packethandlers[data[0]].object, ip_port, data, length, userdata);
+        handle_received_packet(net, ip_port, data, length, userdata);
     }
 }
 
@@ -776,6 +1160,7 @@ Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from,
     temp->log = log;
     temp->family = ip.family;
     temp->port = 0;
+    temp->batch_receive = true;
 
     /* Initialize our socket. */
     /* add log message what we're creating */
@@ -979,11 +1364,17 @@ void kill_networking(Networking_Core *net)
         return;
     }
 
+    networking_set_batch_send(net, false);
+
     if (!net_family_is_unspec(net->family)) {
         /* Socket is initialized, so we close it. */
         kill_sock(net->sock);
     }
 
+#ifdef USE_RECVMMSG
+    free(net->recv_batch);
+#endif
+    free(net->handler_times);
     free(net);
 }
 
@@ -1459,6 +1850,33 @@ int net_send(Socket sock, const void *buf, size_t len)
     return send(sock.socket, (const char *)buf, len, MSG_NOSIGNAL);
 }
 
+int net_send2(Socket sock, const void *buf1, size_t len1, const void *buf2, size_t len2)
+{
+#ifdef OS_WIN32
+    const int len = net_send(sock, buf1, len1);
+
+    if (len != (int)len1 || len2 == 0) {
+        return len;
+    }
+
+    const int len_second = net_send(sock, buf2, len2);
+    return len_second > 0 ? len + len_second : len;
+#else
+    struct iovec iov[2];
+    iov[0].iov_base = (void *)buf1;
+    iov[0].iov_len = len1;
+    iov[1].iov_base = (void *)buf2;
+    iov[1].iov_len = len2;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    return sendmsg(sock.socket, &msg, MSG_NOSIGNAL);
+#endif
+}
+
 int net_recv(Socket sock, void *buf, size_t len)
 {
     return recv(sock.socket, (char *)buf, len, MSG_NOSIGNAL);
@@ -10,6 +10,7 @@
 #define C_TOXCORE_TOXCORE_NETWORK_H
 
 #include "logger.h"
+#include "metrics.h"
 
 #include <stdbool.h>    // bool
 #include <stddef.h>     // size_t
@@ -62,6 +63,13 @@ extern const Socket net_invalid_socket;
  * Calls send(sockfd, buf, len, MSG_NOSIGNAL).
  */
 int net_send(Socket sock, const void *buf, size_t len);
+/**
+ * Sends len1 bytes of buf1 followed by len2 bytes of buf2 in one system call,
+ * with sendmsg(sockfd, msg, MSG_NOSIGNAL) where it exists.
+ *
+ * @return the number of bytes sent, or -1 if none were.
+ */
+int net_send2(Socket sock, const void *buf1, size_t len1, const void *buf2, size_t len2);
 /**
  * Calls recv(sockfd, buf, len, MSG_NOSIGNAL).
  */
@@ -83,6 +91,12 @@ size_t net_socket_data_recv_buffer(Socket sock);
 
 #define MAX_UDP_PACKET_SIZE 2048
 
+/* Maximum number of UDP packets received by one system call in networking_poll. */
+#define NET_RECV_BATCH_SIZE 32
+
+/* Maximum number of UDP packets queued for one system call when batching sends. */
+#define NET_SEND_BATCH_SIZE 64
+
 #ifdef USE_TEST_NETWORK
 typedef enum Net_Packet_Type {
     NET_PACKET_PING_REQUEST         = 0x05, /* Ping request packet ID. */
@@ -371,6 +385,8 @@ typedef struct Networking_Core Networking_Core;
 
 Family net_family(const Networking_Core *net);
 uint16_t net_port(const Networking_Core *net);
+/* Return the UDP socket, net_invalid_socket if UDP is disabled. */
+Socket net_sock(const Networking_Core *net);
 
 /* Run this before creating sockets.
  *
@@ -404,6 +420,14 @@ bool set_socket_nosigpipe(Socket sock);
  */
 bool set_socket_reuseaddr(Socket sock);
 
+/**
+ * Enable SO_REUSEPORT on socket, so that several sockets can listen on the same
+ * port and the kernel spreads incoming connections between them.
+ *
+ * @return true on success, false on failure or if the system lacks SO_REUSEPORT.
+ */
+bool set_socket_reuseport(Socket sock);
+
 /**
  * Set socket to dual (IPv4 + IPv6 socket)
  *
@@ -422,6 +446,55 @@ void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handl
 /* Call this several times a second. */
 void networking_poll(Networking_Core *net, void *userdata);
 
+/* Enable or disable receiving several packets per system call in
+ * networking_poll (where the platform supports it, currently Linux recvmmsg).
+ * Enabled by default.
+ */
+void networking_set_batch_receive(Networking_Core *net, bool enabled);
+
+/* Queue packets given to sendpacket instead of sending them right away, and
+ * send the whole queue with as few system calls as possible (Linux sendmmsg)
+ * when networking_flush is called or the queue fills up. Disabled by default.
+ *
+ * Must not be called while another thread may be sending on net.
+ *
+ * return false if batching isn't supported on this platform or the queue
+ *   could not be allocated.
+ */
+bool networking_set_batch_send(Networking_Core *net, bool enabled);
+
+/* Send all packets queued by sendpacket. Does nothing if batching is disabled. */
+void networking_flush(Networking_Core *net);
+
+typedef struct Net_Send_Stats {
+    uint64_t packets;  /* Packets sent from the send queue. */
+    uint64_t syscalls; /* System calls made to send them. */
+} Net_Send_Stats;
+
+/* Copy the send queue counters of net into stats (zero if batching is disabled). */
+void networking_get_send_stats(Networking_Core *net, Net_Send_Stats *stats);
+
+typedef struct Net_Recv_Stats {
+    uint64_t packets;
+    uint64_t bytes;
+} Net_Recv_Stats;
+
+/* Copy the number of packets and bytes received with packet_id into stats. */
+void networking_get_recv_stats(const Networking_Core *net, uint8_t packet_id, Net_Recv_Stats *stats);
+
+/* Measure how long the handler of each packet id takes. Off by default, as it
+ * reads the clock twice for every packet.
+ *
+ * return false if memory allocation fails.
+ */
+bool networking_set_handler_timing(Networking_Core *net, bool enabled);
+
+/* Copy the handler durations of packet_id, in nanoseconds, into times.
+ *
+ * return false if handler timing is disabled.
+ */
+bool networking_get_handler_times(const Networking_Core *net, uint8_t packet_id, Metrics_Histogram *times);
+
 /* Connect a socket to the address specified by the ip_port. */
 int net_connect(Socket sock, IP_Port ip_port);
 
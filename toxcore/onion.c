@@ -12,6 +12,7 @@
 
 #include "onion.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -312,10 +313,8 @@ int send_onion_response(Networking_Core *net, IP_Port dest, const uint8_t *data,
     return 0;
 }
 
-static int handle_send_initial(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+static int handle_send_initial(Onion *onion, IP_Port source, const uint8_t *packet, uint16_t length)
 {
-    Onion *onion = (Onion *)object;
-
     if (length > ONION_MAX_PACKET_SIZE) {
         return 1;
     }
@@ -324,11 +323,9 @@ static int handle_send_initial(void *object, IP_Port source, const uint8_t *pack
         return 1;
     }
 
-    change_symmetric_key(onion);
-
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion->mono_time, &onion->shared_keys_1, shared_key, dht_get_self_secret_key(onion->dht),
+    get_shared_key(onion->mono_time, onion->shared_keys_1, shared_key, dht_get_self_secret_key(onion->dht),
                    packet + 1 + CRYPTO_NONCE_SIZE);
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
                                      length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE), plain);
@@ -337,7 +334,12 @@ static int handle_send_initial(void *object, IP_Port source, const uint8_t *pack
         return 1;
     }
 
-    return onion_send_1(onion, plain, len, source, packet + 1);
+    if (onion_send_1(onion, plain, len, source, packet + 1) != 0) {
+        return 1;
+    }
+
+    ++onion->stats.requests;
+    return 0;
 }
 
 int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, IP_Port source, const uint8_t *nonce)
@@ -382,10 +384,8 @@ int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, IP_Port
     return 0;
 }
 
-static int handle_send_1(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+static int handle_send_1(Onion *onion, IP_Port source, const uint8_t *packet, uint16_t length)
 {
-    Onion *onion = (Onion *)object;
-
     if (length > ONION_MAX_PACKET_SIZE) {
         return 1;
     }
@@ -394,11 +394,9 @@ static int handle_send_1(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
-    change_symmetric_key(onion);
-
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion->mono_time, &onion->shared_keys_2, shared_key, dht_get_self_secret_key(onion->dht),
+    get_shared_key(onion->mono_time, onion->shared_keys_2, shared_key, dht_get_self_secret_key(onion->dht),
                    packet + 1 + CRYPTO_NONCE_SIZE);
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
                                      length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + RETURN_1), plain);
@@ -436,13 +434,12 @@ static int handle_send_1(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
+    ++onion->stats.requests;
     return 0;
 }
 
-static int handle_send_2(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+static int handle_send_2(Onion *onion, IP_Port source, const uint8_t *packet, uint16_t length)
 {
-    Onion *onion = (Onion *)object;
-
     if (length > ONION_MAX_PACKET_SIZE) {
         return 1;
     }
@@ -451,11 +448,9 @@ static int handle_send_2(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
-    change_symmetric_key(onion);
-
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion->mono_time, &onion->shared_keys_3, shared_key, dht_get_self_secret_key(onion->dht),
+    get_shared_key(onion->mono_time, onion->shared_keys_3, shared_key, dht_get_self_secret_key(onion->dht),
                    packet + 1 + CRYPTO_NONCE_SIZE);
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
                                      length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + RETURN_2), plain);
@@ -502,14 +497,13 @@ static int handle_send_2(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
+    ++onion->stats.requests;
     return 0;
 }
 
 
-static int handle_recv_3(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+static int handle_recv_3(Onion *onion, IP_Port source, const uint8_t *packet, uint16_t length)
 {
-    Onion *onion = (Onion *)object;
-
     if (length > ONION_MAX_PACKET_SIZE) {
         return 1;
     }
@@ -525,8 +519,6 @@ static int handle_recv_3(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
-    change_symmetric_key(onion);
-
     uint8_t plain[SIZE_IPPORT + RETURN_2];
     int len = decrypt_data_symmetric(onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
                                      SIZE_IPPORT + RETURN_2 + CRYPTO_MAC_SIZE, plain);
@@ -551,13 +543,12 @@ static int handle_recv_3(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
+    ++onion->stats.responses;
     return 0;
 }
 
-static int handle_recv_2(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+static int handle_recv_2(Onion *onion, IP_Port source, const uint8_t *packet, uint16_t length)
 {
-    Onion *onion = (Onion *)object;
-
     if (length > ONION_MAX_PACKET_SIZE) {
         return 1;
     }
@@ -573,8 +564,6 @@ static int handle_recv_2(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
-    change_symmetric_key(onion);
-
     uint8_t plain[SIZE_IPPORT + RETURN_1];
     int len = decrypt_data_symmetric(onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
                                      SIZE_IPPORT + RETURN_1 + CRYPTO_MAC_SIZE, plain);
@@ -599,13 +588,12 @@ static int handle_recv_2(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
+    ++onion->stats.responses;
     return 0;
 }
 
-static int handle_recv_1(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+static int handle_recv_1(Onion *onion, IP_Port source, const uint8_t *packet, uint16_t length)
 {
-    Onion *onion = (Onion *)object;
-
     if (length > ONION_MAX_PACKET_SIZE) {
         return 1;
     }
@@ -621,8 +609,6 @@ static int handle_recv_1(void *object, IP_Port source, const uint8_t *packet, ui
         return 1;
     }
 
-    change_symmetric_key(onion);
-
     uint8_t plain[SIZE_IPPORT];
     int len = decrypt_data_symmetric(onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
                                      SIZE_IPPORT + CRYPTO_MAC_SIZE, plain);
@@ -642,16 +628,393 @@ static int handle_recv_1(void *object, IP_Port source, const uint8_t *packet, ui
     if (onion->recv_1_function &&
             !net_family_is_ipv4(send_to.ip.family) &&
             !net_family_is_ipv6(send_to.ip.family)) {
-        return onion->recv_1_function(onion->callback_object, send_to, packet + (1 + RETURN_1), data_len);
+        if (onion->recv_1_function(onion->callback_object, send_to, packet + (1 + RETURN_1), data_len) != 0) {
+            return 1;
+        }
+
+        ++onion->stats.responses;
+        return 0;
     }
 
     if ((uint32_t)sendpacket(onion->net, send_to, packet + (1 + RETURN_1), data_len) != data_len) {
         return 1;
     }
 
+    ++onion->stats.responses;
+    return 0;
+}
+
+/* Peel or wrap the layer of an onion packet that arrived from source. */
+static int peel_onion_packet(Onion *onion, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    switch (packet[0]) {
+        case NET_PACKET_ONION_SEND_INITIAL:
+            return handle_send_initial(onion, source, packet, length);
+
+        case NET_PACKET_ONION_SEND_1:
+            return handle_send_1(onion, source, packet, length);
+
+        case NET_PACKET_ONION_SEND_2:
+            return handle_send_2(onion, source, packet, length);
+
+        case NET_PACKET_ONION_RECV_3:
+            return handle_recv_3(onion, source, packet, length);
+
+        case NET_PACKET_ONION_RECV_2:
+            return handle_recv_2(onion, source, packet, length);
+
+        case NET_PACKET_ONION_RECV_1:
+            return handle_recv_1(onion, source, packet, length);
+    }
+
+    return 1;
+}
+
+/* Onion packets waiting for a worker. */
+#define ONION_WORKER_QUEUE_SIZE 256
+
+typedef struct Onion_Job {
+    IP_Port source;
+    /* The key of the onion when the packet arrived, so that the worker never
+     * sees it change halfway. */
+    uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
+    uint16_t length;
+    uint8_t packet[ONION_MAX_PACKET_SIZE];
+} Onion_Job;
+
+/* An onion response for a TCP relay client, which has to be passed on by the
+ * thread that runs the TCP relay. */
+typedef struct Onion_Response Onion_Response;
+
+struct Onion_Response {
+    Onion_Response *next;
+    IP_Port dest;
+    uint16_t length;
+    uint8_t data[];
+};
+
+struct Onion_Worker {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool stopping;
+
+    /* Ring of the packets for this worker, oldest first. count includes the
+     * packets the worker is busy with, so that their slots are not reused yet.
+     */
+    Onion_Job jobs[ONION_WORKER_QUEUE_SIZE];
+    uint32_t first;
+    uint32_t count;
+    uint64_t dropped;
+
+    Onion_Response *responses_start;
+    Onion_Response *responses_end;
+
+    /* The onion of the worker thread. It shares the keys and the network with
+     * the real one, but has its own shared key caches and counters. */
+    Onion onion;
+    /* Counters of onion, published for onion_get_stats. */
+    Onion_Stats stats;
+};
+
+static void add_onion_stats(Onion_Stats *total, const Onion_Stats *stats)
+{
+    total->requests += stats->requests;
+    total->responses += stats->responses;
+    total->dropped += stats->dropped;
+    total->shared_keys.hits += stats->shared_keys.hits;
+    total->shared_keys.misses += stats->shared_keys.misses;
+    total->shared_keys.evictions += stats->shared_keys.evictions;
+}
+
+static void get_shared_keys_stats(const Onion *onion, Shared_Keys_Stats *stats)
+{
+    memset(stats, 0, sizeof(Shared_Keys_Stats));
+
+    const Shared_Keys *const caches[3] = {onion->shared_keys_1, onion->shared_keys_2, onion->shared_keys_3};
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        Shared_Keys_Stats cache_stats;
+        shared_keys_get_stats(caches[i], &cache_stats);
+        stats->hits += cache_stats.hits;
+        stats->misses += cache_stats.misses;
+        stats->evictions += cache_stats.evictions;
+    }
+}
+
+/* Takes the place of recv_1_function in the onion of a worker. */
+static int queue_onion_response(void *object, IP_Port dest, const uint8_t *data, uint16_t length)
+{
+    Onion_Worker *worker = (Onion_Worker *)object;
+    Onion_Response *response = (Onion_Response *)malloc(sizeof(Onion_Response) + length);
+
+    if (response == nullptr) {
+        return 1;
+    }
+
+    response->next = nullptr;
+    response->dest = dest;
+    response->length = length;
+    memcpy(response->data, data, length);
+
+    pthread_mutex_lock(&worker->mutex);
+
+    if (worker->responses_end != nullptr) {
+        worker->responses_end->next = response;
+    } else {
+        worker->responses_start = response;
+    }
+
+    worker->responses_end = response;
+    pthread_mutex_unlock(&worker->mutex);
+    return 0;
+}
+
+static void *onion_worker_thread(void *arg)
+{
+    Onion_Worker *worker = (Onion_Worker *)arg;
+    pthread_mutex_lock(&worker->mutex);
+
+    while (true) {
+        while (worker->count == 0 && !worker->stopping) {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+
+        if (worker->stopping) {
+            break;
+        }
+
+        const uint32_t first = worker->first;
+        const uint32_t count = worker->count;
+        pthread_mutex_unlock(&worker->mutex);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const Onion_Job *job = &worker->jobs[(first + i) % ONION_WORKER_QUEUE_SIZE];
+            memcpy(worker->onion.secret_symmetric_key, job->secret_symmetric_key, CRYPTO_SYMMETRIC_KEY_SIZE);
+            peel_onion_packet(&worker->onion, job->source, job->packet, job->length);
+        }
+
+        Onion_Stats stats = worker->onion.stats;
+        get_shared_keys_stats(&worker->onion, &stats.shared_keys);
+
+        pthread_mutex_lock(&worker->mutex);
+        worker->first = (first + count) % ONION_WORKER_QUEUE_SIZE;
+        worker->count -= count;
+        worker->stats = stats;
+    }
+
+    pthread_mutex_unlock(&worker->mutex);
+    return nullptr;
+}
+
+/* Packets from the same source always go to the same worker, which handles
+ * them in the order they arrived. */
+static Onion_Worker *source_worker(const Onion *onion, const IP_Port *source)
+{
+    uint8_t ip_port[SIZE_IPPORT];
+    ipport_pack(ip_port, source);
+    return &onion->workers[jenkins_one_at_a_time_hash(ip_port, sizeof(ip_port)) % onion->num_workers];
+}
+
+static int queue_onion_packet(Onion *onion, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    if (length > ONION_MAX_PACKET_SIZE) {
+        return 1;
+    }
+
+    Onion_Worker *worker = source_worker(onion, &source);
+    pthread_mutex_lock(&worker->mutex);
+
+    if (worker->count == ONION_WORKER_QUEUE_SIZE) {
+        ++worker->dropped;
+        pthread_mutex_unlock(&worker->mutex);
+        return 1;
+    }
+
+    Onion_Job *job = &worker->jobs[(worker->first + worker->count) % ONION_WORKER_QUEUE_SIZE];
+    job->source = source;
+    memcpy(job->secret_symmetric_key, onion->secret_symmetric_key, CRYPTO_SYMMETRIC_KEY_SIZE);
+    job->length = length;
+    memcpy(job->packet, packet, length);
+
+    if (worker->count == 0) {
+        pthread_cond_signal(&worker->cond);
+    }
+
+    ++worker->count;
+    pthread_mutex_unlock(&worker->mutex);
     return 0;
 }
 
+static int handle_onion_packet(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    Onion *onion = (Onion *)object;
+
+    change_symmetric_key(onion);
+
+    if (onion->workers != nullptr) {
+        // Keeps the responses from piling up on nodes without a TCP relay.
+        do_onion_workers(onion);
+        return queue_onion_packet(onion, source, packet, length);
+    }
+
+    return peel_onion_packet(onion, source, packet, length);
+}
+
+static void free_onion_responses(Onion_Response *response)
+{
+    while (response != nullptr) {
+        Onion_Response *next = response->next;
+        free(response);
+        response = next;
+    }
+}
+
+static void stop_onion_worker_threads(Onion_Worker *workers, uint32_t num_started)
+{
+    for (uint32_t i = 0; i < num_started; ++i) {
+        pthread_mutex_lock(&workers[i].mutex);
+        workers[i].stopping = true;
+        pthread_cond_signal(&workers[i].cond);
+        pthread_mutex_unlock(&workers[i].mutex);
+    }
+
+    for (uint32_t i = 0; i < num_started; ++i) {
+        pthread_join(workers[i].thread, nullptr);
+    }
+}
+
+/* Frees stopped workers, adding their counters to totals if it is not null. */
+static void free_onion_workers(Onion_Worker *workers, uint32_t num_workers, Onion_Stats *totals)
+{
+    for (uint32_t i = 0; i < num_workers; ++i) {
+        if (totals != nullptr) {
+            add_onion_stats(totals, &workers[i].stats);
+            totals->dropped += workers[i].dropped;
+        }
+
+        free_onion_responses(workers[i].responses_start);
+        shared_keys_free(workers[i].onion.shared_keys_1);
+        shared_keys_free(workers[i].onion.shared_keys_2);
+        shared_keys_free(workers[i].onion.shared_keys_3);
+        pthread_cond_destroy(&workers[i].cond);
+        pthread_mutex_destroy(&workers[i].mutex);
+    }
+
+    free(workers);
+}
+
+static bool start_onion_worker(const Onion *onion, Onion_Worker *worker)
+{
+    worker->onion.mono_time = onion->mono_time;
+    worker->onion.dht = onion->dht;
+    worker->onion.net = onion->net;
+    worker->onion.shared_keys_1 = shared_keys_new(SHARED_KEYS_CAPACITY);
+    worker->onion.shared_keys_2 = shared_keys_new(SHARED_KEYS_CAPACITY);
+    worker->onion.shared_keys_3 = shared_keys_new(SHARED_KEYS_CAPACITY);
+    worker->onion.recv_1_function = &queue_onion_response;
+    worker->onion.callback_object = worker;
+
+    if (worker->onion.shared_keys_1 == nullptr || worker->onion.shared_keys_2 == nullptr
+            || worker->onion.shared_keys_3 == nullptr) {
+        return false;
+    }
+
+    return pthread_create(&worker->thread, nullptr, &onion_worker_thread, worker) == 0;
+}
+
+static void stop_onion_workers(Onion *onion)
+{
+    if (onion->workers == nullptr) {
+        return;
+    }
+
+    stop_onion_worker_threads(onion->workers, onion->num_workers);
+
+    // Pass on the responses the workers left and keep their counters.
+    do_onion_workers(onion);
+    free_onion_workers(onion->workers, onion->num_workers, &onion->retired_stats);
+
+    onion->workers = nullptr;
+    onion->num_workers = 0;
+}
+
+bool onion_set_workers(Onion *onion, uint32_t num_workers)
+{
+    stop_onion_workers(onion);
+
+    if (num_workers == 0) {
+        return true;
+    }
+
+    Onion_Worker *workers = (Onion_Worker *)calloc(num_workers, sizeof(Onion_Worker));
+
+    if (workers == nullptr) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < num_workers; ++i) {
+        pthread_mutex_init(&workers[i].mutex, nullptr);
+        pthread_cond_init(&workers[i].cond, nullptr);
+    }
+
+    for (uint32_t i = 0; i < num_workers; ++i) {
+        if (!start_onion_worker(onion, &workers[i])) {
+            stop_onion_worker_threads(workers, i);
+            free_onion_workers(workers, num_workers, nullptr);
+            return false;
+        }
+    }
+
+    onion->workers = workers;
+    onion->num_workers = num_workers;
+    return true;
+}
+
+uint32_t onion_get_workers(const Onion *onion)
+{
+    return onion->num_workers;
+}
+
+void do_onion_workers(Onion *onion)
+{
+    for (uint32_t i = 0; i < onion->num_workers; ++i) {
+        Onion_Worker *worker = &onion->workers[i];
+
+        pthread_mutex_lock(&worker->mutex);
+        Onion_Response *response = worker->responses_start;
+        worker->responses_start = nullptr;
+        worker->responses_end = nullptr;
+        pthread_mutex_unlock(&worker->mutex);
+
+        while (response != nullptr) {
+            if (onion->recv_1_function != nullptr) {
+                onion->recv_1_function(onion->callback_object, response->dest, response->data, response->length);
+            }
+
+            Onion_Response *next = response->next;
+            free(response);
+            response = next;
+        }
+    }
+}
+
+void onion_get_stats(const Onion *onion, Onion_Stats *stats)
+{
+    *stats = onion->stats;
+    get_shared_keys_stats(onion, &stats->shared_keys);
+    add_onion_stats(stats, &onion->retired_stats);
+
+    for (uint32_t i = 0; i < onion->num_workers; ++i) {
+        Onion_Worker *worker = &onion->workers[i];
+
+        pthread_mutex_lock(&worker->mutex);
+        add_onion_stats(stats, &worker->stats);
+        stats->dropped += worker->dropped;
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
 void set_callback_handle_recv_1(Onion *onion, onion_recv_1_cb *function, void *object)
 {
     onion->recv_1_function = function;
@@ -676,13 +1039,25 @@ Onion *new_onion(Mono_Time *mono_time, DHT *dht)
     new_symmetric_key(onion->secret_symmetric_key);
     onion->timestamp = mono_time_get(onion->mono_time);
 
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_INITIAL, &handle_send_initial, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_1, &handle_send_1, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_2, &handle_send_2, onion);
+    onion->shared_keys_1 = shared_keys_new(SHARED_KEYS_CAPACITY);
+    onion->shared_keys_2 = shared_keys_new(SHARED_KEYS_CAPACITY);
+    onion->shared_keys_3 = shared_keys_new(SHARED_KEYS_CAPACITY);
 
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_3, &handle_recv_3, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_2, &handle_recv_2, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, &handle_recv_1, onion);
+    if (onion->shared_keys_1 == nullptr || onion->shared_keys_2 == nullptr || onion->shared_keys_3 == nullptr) {
+        shared_keys_free(onion->shared_keys_1);
+        shared_keys_free(onion->shared_keys_2);
+        shared_keys_free(onion->shared_keys_3);
+        free(onion);
+        return nullptr;
+    }
+
+    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_INITIAL, &handle_onion_packet, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_1, &handle_onion_packet, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_2, &handle_onion_packet, onion);
+
+    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_3, &handle_onion_packet, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_2, &handle_onion_packet, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, &handle_onion_packet, onion);
 
     return onion;
 }
@@ -701,5 +1076,11 @@ void kill_onion(Onion *onion)
     networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_2, nullptr, nullptr);
     networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, nullptr, nullptr);
 
+    stop_onion_workers(onion);
+
+    shared_keys_free(onion->shared_keys_1);
+    shared_keys_free(onion->shared_keys_2);
+    shared_keys_free(onion->shared_keys_3);
+
     free(onion);
 }
@@ -14,6 +14,15 @@
 
 typedef int onion_recv_1_cb(void *object, IP_Port dest, const uint8_t *data, uint16_t length);
 
+typedef struct Onion_Stats {
+    uint64_t requests;  /* onion requests passed on to the next node */
+    uint64_t responses; /* onion responses passed back towards their sender */
+    uint64_t dropped;   /* onion packets dropped because a worker queue was full */
+    Shared_Keys_Stats shared_keys; /* of the caches of all three layers */
+} Onion_Stats;
+
+typedef struct Onion_Worker Onion_Worker;
+
 typedef struct Onion {
     Mono_Time *mono_time;
     DHT *dht;
@@ -21,12 +30,18 @@ typedef struct Onion {
     uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
     uint64_t timestamp;
 
-    Shared_Keys shared_keys_1;
-    Shared_Keys shared_keys_2;
-    Shared_Keys shared_keys_3;
+    Shared_Keys *shared_keys_1;
+    Shared_Keys *shared_keys_2;
+    Shared_Keys *shared_keys_3;
 
     onion_recv_1_cb *recv_1_function;
     void *callback_object;
+
+    Onion_Stats stats;
+
+    Onion_Worker *workers;
+    uint32_t num_workers;
+    Onion_Stats retired_stats; /* of the workers stopped so far */
 } Onion;
 
 #define ONION_MAX_PACKET_SIZE 1400
@@ -143,6 +158,30 @@ int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, IP_Port
  */
 void set_callback_handle_recv_1(Onion *onion, onion_recv_1_cb *function, void *object);
 
+/* Copy the counters of onion into stats. Requests that clients of a TCP server
+ * send through onion_send_1 are counted by the server.
+ */
+void onion_get_stats(const Onion *onion, Onion_Stats *stats);
+
+/* Peel and wrap the onion packets that arrive on the UDP socket on num_workers
+ * threads instead of in networking_poll. Packets from the same source always go
+ * to the same worker, so they are sent on in the order they came in. When a
+ * worker falls behind, packets that do not fit in its queue are dropped.
+ * 0 workers, the default, handles the packets in networking_poll again.
+ *
+ * return true on success.
+ * return false on failure, the onion is then left without workers.
+ */
+bool onion_set_workers(Onion *onion, uint32_t num_workers);
+
+uint32_t onion_get_workers(const Onion *onion);
+
+/* Pass the onion responses for TCP relay clients that the workers peeled to the
+ * recv_1 callback. Must be called on the thread that polls the networking, the
+ * TCP server does so in do_TCP_server.
+ */
+void do_onion_workers(Onion *onion);
+
 Onion *new_onion(Mono_Time *mono_time, DHT *dht);
 
 void kill_onion(Onion *onion);
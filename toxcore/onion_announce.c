@@ -16,7 +16,10 @@
 #include <string.h>
 
 #include "LAN_discovery.h"
+#include "key_map.h"
 #include "mono_time.h"
+#include "pk_distance.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 #define PING_ID_TIMEOUT ONION_ANNOUNCE_TIMEOUT
@@ -43,23 +46,26 @@ struct Onion_Announce {
     DHT     *dht;
     Networking_Core *net;
     GC_Announces_List *gc_announces_list;
-    Onion_Announce_Entry entries[ONION_ANNOUNCE_MAX_ENTRIES];
+
+    /* The announced keys are kept in capacity slots and found by key through
+     * entries_by_key. order lists the slots in use from the key closest to ours
+     * to the farthest one, which is the first to go when the store is full.
+     * Each entry has a timer in expiry_timers that removes it once it timed out.
+     */
+    Onion_Announce_Entry *entries;
+    uint32_t *order;
+    uint32_t *free_slots;
+    uint32_t num_entries;
+    uint32_t capacity;
+    Key_Map entries_by_key;
+    Timer_Wheel *expiry_timers;
+
     /* This is CRYPTO_SYMMETRIC_KEY_SIZE long just so we can use new_symmetric_key() to fill it */
     uint8_t secret_bytes[CRYPTO_SYMMETRIC_KEY_SIZE];
 
-    Shared_Keys shared_keys_recv;
+    Shared_Keys *shared_keys_recv;
 };
 
-uint8_t *onion_announce_entry_public_key(Onion_Announce *onion_a, uint32_t entry)
-{
-    return onion_a->entries[entry].public_key;
-}
-
-void onion_announce_entry_set_time(Onion_Announce *onion_a, uint32_t entry, uint64_t time)
-{
-    onion_a->entries[entry].time = time;
-}
-
 /* Create an onion announce request packet in packet of max_packet_length (recommended size ONION_ANNOUNCE_REQUEST_MIN_SIZE).
  *
  * dest_client_id is the public key of the node the packet will be sent to.
@@ -285,127 +291,200 @@ static void generate_ping_id(const Onion_Announce *onion_a, uint64_t time, const
     crypto_sha256(ping_id, data, sizeof(data));
 }
 
-/* check if public key is in entries list
- *
- * return -1 if no
- * return position in list if yes
+/* return the position in order at which public_key is or would be inserted,
+ * after all the keys that are closer to ours.
  */
-static int in_entries(const Onion_Announce *onion_a, const uint8_t *public_key)
+static uint32_t entry_position(const Onion_Announce *onion_a, const uint8_t *public_key)
 {
-    unsigned int i;
+    const uint8_t *self_public_key = dht_get_self_public_key(onion_a->dht);
+    uint32_t low = 0;
+    uint32_t high = onion_a->num_entries;
+
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
 
-    for (i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-        if (!mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].time, ONION_ANNOUNCE_TIMEOUT)
-                && public_key_cmp(onion_a->entries[i].public_key, public_key) == 0) {
-            return i;
+        if (pk_closest(self_public_key, onion_a->entries[onion_a->order[middle]].public_key, public_key) == 1) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
     }
 
-    return -1;
+    return low;
 }
 
-typedef struct Cmp_data {
-    const Mono_Time *mono_time;
-    const uint8_t *base_public_key;
-    Onion_Announce_Entry entry;
-} Cmp_data;
-
-static int cmp_entry(const void *a, const void *b)
+static void remove_entry(Onion_Announce *onion_a, uint32_t position)
 {
-    Cmp_data cmp1;
-    Cmp_data cmp2;
-    memcpy(&cmp1, a, sizeof(Cmp_data));
-    memcpy(&cmp2, b, sizeof(Cmp_data));
-    Onion_Announce_Entry entry1 = cmp1.entry;
-    Onion_Announce_Entry entry2 = cmp2.entry;
-    const uint8_t *cmp_public_key = cmp1.base_public_key;
-
-    int t1 = mono_time_is_timeout(cmp1.mono_time, entry1.time, ONION_ANNOUNCE_TIMEOUT);
-    int t2 = mono_time_is_timeout(cmp1.mono_time, entry2.time, ONION_ANNOUNCE_TIMEOUT);
+    const uint32_t slot = onion_a->order[position];
 
-    if (t1 && t2) {
-        return 0;
-    }
+    key_map_remove(&onion_a->entries_by_key, onion_a->entries[slot].public_key, slot);
+    timer_wheel_cancel(onion_a->expiry_timers, slot);
 
-    if (t1) {
-        return -1;
-    }
-
-    if (t2) {
-        return 1;
-    }
-
-    int close = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
-
-    if (close == 1) {
-        return 1;
-    }
-
-    if (close == 2) {
-        return -1;
-    }
-
-    return 0;
+    --onion_a->num_entries;
+    memmove(&onion_a->order[position], &onion_a->order[position + 1],
+            (onion_a->num_entries - position) * sizeof(uint32_t));
+    onion_a->free_slots[onion_a->capacity - onion_a->num_entries - 1] = slot;
 }
 
-static void sort_onion_announce_list(Onion_Announce_Entry *list, unsigned int length, const Mono_Time *mono_time,
-                                     const uint8_t *comp_public_key)
+static void expire_entry(void *object, uint32_t id, uint64_t now)
 {
-    // Pass comp_public_key to qsort with each Client_data entry, so the
-    // comparison function can use it as the base of comparison.
-    VLA(Cmp_data, cmp_list, length);
-
-    for (uint32_t i = 0; i < length; ++i) {
-        cmp_list[i].mono_time = mono_time;
-        cmp_list[i].base_public_key = comp_public_key;
-        cmp_list[i].entry = list[i];
-    }
+    Onion_Announce *onion_a = (Onion_Announce *)object;
+    remove_entry(onion_a, entry_position(onion_a, onion_a->entries[id].public_key));
+}
 
-    qsort(cmp_list, length, sizeof(Cmp_data), cmp_entry);
+static void expire_entries(Onion_Announce *onion_a)
+{
+    timer_wheel_expire(onion_a->expiry_timers, mono_time_get(onion_a->mono_time), &expire_entry, onion_a);
+}
 
-    for (uint32_t i = 0; i < length; ++i) {
-        list[i] = cmp_list[i].entry;
-    }
+/* check if public key is in entries list
+ *
+ * return -1 if no
+ * return its entry if yes
+ */
+static int in_entries(Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    expire_entries(onion_a);
+    return key_map_find(&onion_a->entries_by_key, public_key);
 }
 
 /* add entry to entries list
  *
  * return -1 if failure
- * return position if added
+ * return its entry if added
  */
 static int add_to_entries(Onion_Announce *onion_a, IP_Port ret_ip_port, const uint8_t *public_key,
                           const uint8_t *data_public_key, const uint8_t *ret)
 {
+    int slot = in_entries(onion_a, public_key);
 
-    int pos = in_entries(onion_a, public_key);
+    if (slot == -1) {
+        if (onion_a->num_entries == onion_a->capacity) {
+            const uint32_t farthest = onion_a->order[onion_a->num_entries - 1];
 
-    if (pos == -1) {
-        for (unsigned i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-            if (mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].time, ONION_ANNOUNCE_TIMEOUT)) {
-                pos = i;
+            if (pk_closest(dht_get_self_public_key(onion_a->dht), public_key,
+                           onion_a->entries[farthest].public_key) != 1) {
+                return -1;
             }
+
+            remove_entry(onion_a, onion_a->num_entries - 1);
         }
-    }
 
-    if (pos == -1) {
-        if (id_closest(dht_get_self_public_key(onion_a->dht), public_key, onion_a->entries[0].public_key) == 1) {
-            pos = 0;
+        slot = onion_a->free_slots[onion_a->capacity - onion_a->num_entries - 1];
+
+        if (key_map_add(&onion_a->entries_by_key, public_key, slot) != 1) {
+            return -1;
         }
+
+        const uint32_t position = entry_position(onion_a, public_key);
+        memmove(&onion_a->order[position + 1], &onion_a->order[position],
+                (onion_a->num_entries - position) * sizeof(uint32_t));
+        onion_a->order[position] = slot;
+        ++onion_a->num_entries;
+
+        memcpy(onion_a->entries[slot].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
     }
 
-    if (pos == -1) {
+    onion_a->entries[slot].ret_ip_port = ret_ip_port;
+    memcpy(onion_a->entries[slot].ret, ret, ONION_RETURN_3);
+    memcpy(onion_a->entries[slot].data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    onion_a->entries[slot].time = mono_time_get(onion_a->mono_time);
+
+    if (!timer_wheel_set(onion_a->expiry_timers, slot, onion_a->entries[slot].time + ONION_ANNOUNCE_TIMEOUT)) {
+        remove_entry(onion_a, entry_position(onion_a, public_key));
         return -1;
     }
 
-    memcpy(onion_a->entries[pos].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].ret_ip_port = ret_ip_port;
-    memcpy(onion_a->entries[pos].ret, ret, ONION_RETURN_3);
-    memcpy(onion_a->entries[pos].data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].time = mono_time_get(onion_a->mono_time);
+    return slot;
+}
+
+bool onion_announce_set_capacity(Onion_Announce *onion_a, uint32_t capacity)
+{
+    if (capacity == 0) {
+        return false;
+    }
+
+    if (onion_a->expiry_timers != nullptr) {
+        expire_entries(onion_a);
+    }
+
+    // Keep the closest keys that fit, in the first slots.
+    const uint32_t num_entries = min_u32(onion_a->num_entries, capacity);
+    Onion_Announce_Entry *entries = (Onion_Announce_Entry *)calloc(capacity, sizeof(Onion_Announce_Entry));
+    uint32_t *order = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+    uint32_t *free_slots = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+    Timer_Wheel *expiry_timers = timer_wheel_new(mono_time_get(onion_a->mono_time));
+    Key_Map entries_by_key;
+
+    if (entries == nullptr || order == nullptr || free_slots == nullptr || expiry_timers == nullptr
+            || !key_map_init(&entries_by_key, CRYPTO_PUBLIC_KEY_SIZE, num_entries)) {
+        timer_wheel_kill(expiry_timers);
+        free(free_slots);
+        free(order);
+        free(entries);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        entries[i] = onion_a->entries[onion_a->order[i]];
+        order[i] = i;
+
+        if (key_map_add(&entries_by_key, entries[i].public_key, i) != 1
+                || !timer_wheel_set(expiry_timers, i, entries[i].time + ONION_ANNOUNCE_TIMEOUT)) {
+            key_map_free(&entries_by_key);
+            timer_wheel_kill(expiry_timers);
+            free(free_slots);
+            free(order);
+            free(entries);
+            return false;
+        }
+    }
+
+    // Free slots are taken from the end, lowest first.
+    for (uint32_t i = num_entries; i < capacity; ++i) {
+        free_slots[capacity - i - 1] = i;
+    }
+
+    key_map_free(&onion_a->entries_by_key);
+    timer_wheel_kill(onion_a->expiry_timers);
+    free(onion_a->free_slots);
+    free(onion_a->order);
+    free(onion_a->entries);
 
-    sort_onion_announce_list(onion_a->entries, ONION_ANNOUNCE_MAX_ENTRIES, onion_a->mono_time,
-                             dht_get_self_public_key(onion_a->dht));
-    return in_entries(onion_a, public_key);
+    onion_a->entries = entries;
+    onion_a->order = order;
+    onion_a->free_slots = free_slots;
+    onion_a->num_entries = num_entries;
+    onion_a->capacity = capacity;
+    onion_a->entries_by_key = entries_by_key;
+    onion_a->expiry_timers = expiry_timers;
+    return true;
+}
+
+uint32_t onion_announce_capacity(const Onion_Announce *onion_a)
+{
+    return onion_a->capacity;
+}
+
+uint32_t onion_announce_num_entries(const Onion_Announce *onion_a)
+{
+    return onion_a->num_entries;
+}
+
+int onion_announce_add_entry(Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    IP_Port ret_ip_port = {{{0}}};
+    const uint8_t ret[ONION_RETURN_3] = {0};
+    return add_to_entries(onion_a, ret_ip_port, public_key, public_key, ret);
+}
+
+const uint8_t *onion_announce_entry_public_key(const Onion_Announce *onion_a, uint32_t entry)
+{
+    if (entry >= onion_a->num_entries) {
+        return nullptr;
+    }
+
+    return onion_a->entries[onion_a->order[entry]].public_key;
 }
 
 static int handle_gca_announce_request(Onion_Announce *onion_a, IP_Port source, const uint8_t *packet, uint16_t length)
@@ -420,7 +499,7 @@ static int handle_gca_announce_request(Onion_Announce *onion_a, IP_Port source,
 
     const uint8_t *packet_public_key = packet + 1 + CRYPTO_NONCE_SIZE;
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion_a->mono_time, &onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
+    get_shared_key(onion_a->mono_time, onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
                    packet_public_key);
 
     size_t minimal_size = ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE * 2 + ONION_ANNOUNCE_SENDBACK_DATA_LENGTH;
@@ -553,7 +632,7 @@ static int handle_announce_request(void *object, IP_Port source, const uint8_t *
 
     const uint8_t *packet_public_key = packet + 1 + CRYPTO_NONCE_SIZE;
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion_a->mono_time, &onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
+    get_shared_key(onion_a->mono_time, onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
                    packet_public_key);
 
     uint8_t plain[ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_PUBLIC_KEY_SIZE +
@@ -656,7 +735,7 @@ static int handle_announce_request_old(void *object, IP_Port source, const uint8
 
     const uint8_t *packet_public_key = packet + 1 + CRYPTO_NONCE_SIZE;
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion_a->mono_time, &onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
+    get_shared_key(onion_a->mono_time, onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
                    packet_public_key);
 
     uint8_t plain[ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_PUBLIC_KEY_SIZE +
@@ -802,6 +881,19 @@ Onion_Announce *new_onion_announce(Mono_Time *mono_time, DHT *dht, GC_Announces_
     onion_a->net = dht_get_net(dht);
     new_symmetric_key(onion_a->secret_bytes);
 
+    onion_a->shared_keys_recv = shared_keys_new(SHARED_KEYS_CAPACITY);
+
+    if (onion_a->shared_keys_recv == nullptr) {
+        free(onion_a);
+        return nullptr;
+    }
+
+    if (!onion_announce_set_capacity(onion_a, ONION_ANNOUNCE_MAX_ENTRIES)) {
+        shared_keys_free(onion_a->shared_keys_recv);
+        free(onion_a);
+        return nullptr;
+    }
+
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST, &handle_announce_request, onion_a);
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST_OLD, &handle_announce_request_old, onion_a);
     networking_registerhandler(onion_a->net, NET_PACKET_ONION_DATA_REQUEST, &handle_data_request, onion_a);
@@ -818,6 +910,12 @@ void kill_onion_announce(Onion_Announce *onion_a)
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST, nullptr, nullptr);
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST_OLD, nullptr, nullptr);
     networking_registerhandler(onion_a->net, NET_PACKET_ONION_DATA_REQUEST, nullptr, nullptr);
+    shared_keys_free(onion_a->shared_keys_recv);
+    key_map_free(&onion_a->entries_by_key);
+    timer_wheel_kill(onion_a->expiry_timers);
+    free(onion_a->free_slots);
+    free(onion_a->order);
+    free(onion_a->entries);
     free(onion_a);
 }
 
@@ -40,8 +40,14 @@
 typedef struct Onion_Announce Onion_Announce;
 
 /* These two are not public; they are for tests only! */
-uint8_t *onion_announce_entry_public_key(Onion_Announce *onion_a, uint32_t entry);
-void onion_announce_entry_set_time(Onion_Announce *onion_a, uint32_t entry, uint64_t time);
+/* Store public_key as if it had just announced itself.
+ *
+ * return -1 on failure.
+ * return 0 or more on success.
+ */
+int onion_announce_add_entry(Onion_Announce *onion_a, const uint8_t *public_key);
+/* return the public key of the entry-th closest stored key to ours, nullptr if fewer are stored. */
+const uint8_t *onion_announce_entry_public_key(const Onion_Announce *onion_a, uint32_t entry);
 
 /* Create an onion announce request packet in packet of max_packet_length (recommended size ONION_ANNOUNCE_REQUEST_MIN_SIZE).
  *
@@ -118,6 +124,21 @@ int send_data_request(Networking_Core *net, const Onion_Path *path, IP_Port dest
 
 Onion_Announce *new_onion_announce(Mono_Time *mono_time, DHT *dht, GC_Announces_List *gc_announces_list);
 
+/* Set the number of announced keys that are stored, ONION_ANNOUNCE_MAX_ENTRIES
+ * by default. Nodes that take many announce requests, such as bootstrap nodes,
+ * can store more to find more of the keys that are looked up. When the store
+ * shrinks, the keys closest to ours are kept.
+ *
+ * return false if capacity is 0 or memory allocation fails, the store is then
+ * left as it was.
+ */
+bool onion_announce_set_capacity(Onion_Announce *onion_a, uint32_t capacity);
+
+uint32_t onion_announce_capacity(const Onion_Announce *onion_a);
+
+/* return the number of announced keys that are stored and did not time out yet. */
+uint32_t onion_announce_num_entries(const Onion_Announce *onion_a);
+
 void kill_onion_announce(Onion_Announce *onion_a);
 
 
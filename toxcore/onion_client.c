@@ -19,6 +19,8 @@
 #include "LAN_discovery.h"
 #include "group_chats.h"
 #include "mono_time.h"
+#include "pk_distance.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 /* defines for the array size and
@@ -26,6 +28,10 @@
 #define ANNOUNCE_ARRAY_SIZE 256
 #define ANNOUNCE_TIMEOUT 10
 
+/* Friends that look for nodes every second on average. More of them would send
+ * more announce requests per second than announce_ping_array keeps. */
+#define ONION_FRIEND_SEARCHES_PER_SECOND (ANNOUNCE_ARRAY_SIZE / MAX_ONION_CLIENTS)
+
 typedef struct Onion_Node {
     uint8_t     public_key[CRYPTO_PUBLIC_KEY_SIZE];
     IP_Port     ip_port;
@@ -53,6 +59,30 @@ typedef struct Onion_Client_Paths {
     unsigned int last_path_used_times[NUMBER_ONION_PATHS];
 } Onion_Client_Paths;
 
+/* Onion paths built ahead of time, so that announces and friend lookups that
+ * need a new path find one ready instead of building it on the spot. A path is
+ * built ahead only for a self or friend path that has timed out or is about to
+ * reach ONION_PATH_MAX_LIFETIME. */
+#define ONION_PATH_POOL_SIZE (NUMBER_ONION_PATHS * 2)
+
+/* Most paths built ahead of time in one run of do_onion_client. */
+#define ONION_PATH_POOL_BATCH 4
+
+/* Seconds before a path reaches ONION_PATH_MAX_LIFETIME that its replacement is
+ * built. */
+#define ONION_PATH_POOL_LEAD 30
+
+/* Seconds a path built ahead of time is kept. A path taken from the pool keeps
+ * the time it was built as its creation time, so it has at least half of
+ * ONION_PATH_MAX_LIFETIME left when it is put to use. Whether its first node is
+ * still alive is checked again when it is taken. */
+#define ONION_PATH_POOL_TIMEOUT (ONION_PATH_MAX_LIFETIME / 2)
+
+typedef struct Onion_Pooled_Path {
+    Onion_Path path;
+    uint64_t build_time;
+} Onion_Pooled_Path;
+
 typedef struct Last_Pinged {
     uint8_t     public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint64_t    timestamp;
@@ -110,6 +140,8 @@ struct Onion_Client {
     Networking_Core *net;
     Onion_Friend    *friends_list;
     uint16_t       num_friends;
+    /* When each friend next has something to do in do_friend, by friend number. */
+    Timer_Wheel     *friend_timers;
 
     Onion_Node clients_announce_list[MAX_ONION_CLIENTS_ANNOUNCE];
     uint64_t last_announce;
@@ -117,6 +149,11 @@ struct Onion_Client {
     Onion_Client_Paths onion_paths_self;
     Onion_Client_Paths onion_paths_friends;
 
+    /* Paths built ahead of time, the newest last. */
+    Onion_Pooled_Path path_pool[ONION_PATH_POOL_SIZE];
+    uint16_t num_pooled_paths;
+    Onion_Path_Stats path_stats;
+
     uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
     uint64_t last_run;
     uint64_t first_run;
@@ -142,6 +179,34 @@ struct Onion_Client {
     bool udp_connected;
 };
 
+void onion_get_path_stats(const Onion_Client *onion_c, Onion_Path_Stats *stats)
+{
+    *stats = onion_c->path_stats;
+}
+
+/* How many seconds a friend that looks for nodes waits before the next search,
+ * so that with many friends their searches spread out.
+ */
+static uint64_t friend_search_delay(const Onion_Client *onion_c)
+{
+    const uint32_t spread = onion_c->num_friends / ONION_FRIEND_SEARCHES_PER_SECOND;
+
+    if (spread == 0) {
+        return 0;
+    }
+
+    return random_u32() % (2 * spread + 1);
+}
+
+/* Run do_friend for the friend on the next run of do_onion_client, after
+ * something changed that do_friend looks at.
+ */
+static void wake_friend(Onion_Client *onion_c, uint16_t friend_num)
+{
+    // Cannot fail: onion_addfriend made room for the timer of every friend.
+    timer_wheel_set(onion_c->friend_timers, friend_num, 0);
+}
+
 uint16_t onion_get_friend_count(Onion_Client *onion_c)
 {
     return onion_c->num_friends;
@@ -374,7 +439,7 @@ static int is_path_used(const Mono_Time *mono_time, const Onion_Client_Paths *on
 }
 
 /* is path timed out */
-static bool path_timed_out(const Mono_Time *mono_time, Onion_Client_Paths *onion_paths, uint32_t pathnum)
+static bool path_timed_out(const Mono_Time *mono_time, const Onion_Client_Paths *onion_paths, uint32_t pathnum)
 {
     pathnum = pathnum % NUMBER_ONION_PATHS;
 
@@ -394,6 +459,152 @@ static bool onion_node_timed_out(const Onion_Node *node, const Mono_Time *mono_t
                 && mono_time_is_timeout(mono_time, node->last_pinged, ONION_NODE_TIMEOUT)));
 }
 
+/* A path built ahead of time can be used while it is not too old and its first
+ * node is still reached the way we reach the network now, over UDP if
+ * dht_connected is true, otherwise over TCP.
+ */
+static bool pooled_path_usable(const Onion_Client *onion_c, const Onion_Pooled_Path *pooled, bool dht_connected)
+{
+    if (mono_time_is_timeout(onion_c->mono_time, pooled->build_time, ONION_PATH_POOL_TIMEOUT)) {
+        return false;
+    }
+
+    return net_family_is_tcp_family(pooled->path.ip_port1.ip.family) != dht_connected;
+}
+
+/* return true if we still hear from the first node of path, or are still
+ * connected to it if it is a TCP relay.
+ */
+static bool first_node_alive(Onion_Client *onion_c, const Onion_Path *path)
+{
+    if (net_family_is_tcp_family(path->ip_port1.ip.family)) {
+        return tcp_con_number_is_connected(onion_c->c, path->ip_port1.ip.ip.v4.uint32);
+    }
+
+    return dht_node_is_alive(onion_c->dht, path->node_public_key1, path->ip_port1);
+}
+
+/* return the number of paths of onion_paths that will have to be replaced
+ * soon, as they have timed out or are close to the end of their lifetime.
+ */
+static uint32_t paths_to_replace(const Mono_Time *mono_time, const Onion_Client_Paths *onion_paths)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < NUMBER_ONION_PATHS; ++i) {
+        if (path_timed_out(mono_time, onion_paths, i)
+                || mono_time_is_timeout(mono_time, onion_paths->path_creation_time[i],
+                                        ONION_PATH_MAX_LIFETIME - ONION_PATH_POOL_LEAD)) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+/* Throw away the paths built ahead of time that can no longer be used. */
+static void expire_path_pool(Onion_Client *onion_c)
+{
+    const bool dht_connected = dht_isconnected(onion_c->dht);
+    uint16_t kept = 0;
+
+    for (uint16_t i = 0; i < onion_c->num_pooled_paths; ++i) {
+        if (!pooled_path_usable(onion_c, &onion_c->path_pool[i], dht_connected)) {
+            ++onion_c->path_stats.expired;
+            continue;
+        }
+
+        if (kept != i) {
+            onion_c->path_pool[kept] = onion_c->path_pool[i];
+        }
+
+        ++kept;
+    }
+
+    crypto_memzero(&onion_c->path_pool[kept], (onion_c->num_pooled_paths - kept) * sizeof(Onion_Pooled_Path));
+    onion_c->num_pooled_paths = kept;
+}
+
+/* Build up to max paths out of random path nodes for later use, until there is
+ * one for every self and friend path that will have to be replaced soon. The
+ * paths of friends don't count while there are none, as nothing uses them.
+ */
+static void fill_path_pool(Onion_Client *onion_c, uint32_t max)
+{
+    expire_path_pool(onion_c);
+
+    uint32_t wanted = paths_to_replace(onion_c->mono_time, &onion_c->onion_paths_self);
+
+    if (onion_c->num_friends > 0) {
+        wanted += paths_to_replace(onion_c->mono_time, &onion_c->onion_paths_friends);
+    }
+
+    for (uint32_t i = 0; i < max && onion_c->num_pooled_paths < wanted; ++i) {
+        Node_format nodes[ONION_PATH_LENGTH] = {{{0}}};
+
+        if (random_nodes_path_onion(onion_c, nodes, ONION_PATH_LENGTH) != ONION_PATH_LENGTH) {
+            return;
+        }
+
+        Onion_Pooled_Path *pooled = &onion_c->path_pool[onion_c->num_pooled_paths];
+
+        if (create_onion_path(onion_c->dht, &pooled->path, nodes) == -1) {
+            return;
+        }
+
+        pooled->build_time = mono_time_get(onion_c->mono_time);
+        ++onion_c->num_pooled_paths;
+        ++onion_c->path_stats.built_ahead;
+    }
+}
+
+/* return the newest usable path built ahead of time whose first node is alive,
+ * or null if there is none.
+ */
+static const Onion_Pooled_Path *newest_pooled_path(Onion_Client *onion_c)
+{
+    const bool dht_connected = dht_isconnected(onion_c->dht);
+
+    while (onion_c->num_pooled_paths > 0) {
+        const Onion_Pooled_Path *pooled = &onion_c->path_pool[onion_c->num_pooled_paths - 1];
+
+        if (pooled_path_usable(onion_c, pooled, dht_connected) && first_node_alive(onion_c, &pooled->path)) {
+            return pooled;
+        }
+
+        --onion_c->num_pooled_paths;
+        crypto_memzero(&onion_c->path_pool[onion_c->num_pooled_paths], sizeof(Onion_Pooled_Path));
+        ++onion_c->path_stats.expired;
+    }
+
+    return nullptr;
+}
+
+/* Put a new path into new_path, taking the newest one built ahead of time if
+ * pooled is not null.
+ *
+ * return -1 on failure
+ * return 0 on success
+ */
+static int use_new_path(Onion_Client *onion_c, const Onion_Pooled_Path *pooled, const Node_format *nodes,
+                        Onion_Path *new_path)
+{
+    if (pooled == nullptr) {
+        if (create_onion_path(onion_c->dht, new_path, nodes) == -1) {
+            return -1;
+        }
+
+        ++onion_c->path_stats.built_inline;
+        return 0;
+    }
+
+    *new_path = pooled->path;
+    --onion_c->num_pooled_paths;
+    crypto_memzero(&onion_c->path_pool[onion_c->num_pooled_paths], sizeof(Onion_Pooled_Path));
+    ++onion_c->path_stats.taken;
+    return 0;
+}
+
 /* Create a new path or use an old suitable one (if pathnum is valid)
  * or a random one from onion_paths.
  *
@@ -403,7 +614,7 @@ static bool onion_node_timed_out(const Onion_Node *node, const Mono_Time *mono_t
  * TODO(irungentoo): Make this function better, it currently probably is
  * vulnerable to some attacks that could deanonimize us.
  */
-static int random_path(const Onion_Client *onion_c, Onion_Client_Paths *onion_paths, uint32_t pathnum, Onion_Path *path)
+static int random_path(Onion_Client *onion_c, Onion_Client_Paths *onion_paths, uint32_t pathnum, Onion_Path *path)
 {
     if (pathnum == UINT32_MAX) {
         pathnum = random_u32() % NUMBER_ONION_PATHS;
@@ -413,19 +624,26 @@ static int random_path(const Onion_Client *onion_c, Onion_Client_Paths *onion_pa
 
     if (path_timed_out(onion_c->mono_time, onion_paths, pathnum)) {
         Node_format nodes[ONION_PATH_LENGTH] = {{{0}}};
+        const Onion_Pooled_Path *pooled = newest_pooled_path(onion_c);
 
-        if (random_nodes_path_onion(onion_c, nodes, ONION_PATH_LENGTH) != ONION_PATH_LENGTH) {
+        if (pooled != nullptr) {
+            onion_path_to_nodes(nodes, ONION_PATH_LENGTH, &pooled->path);
+        } else if (random_nodes_path_onion(onion_c, nodes, ONION_PATH_LENGTH) != ONION_PATH_LENGTH) {
             return -1;
         }
 
         int n = is_path_used(onion_c->mono_time, onion_paths, nodes);
 
         if (n == -1) {
-            if (create_onion_path(onion_c->dht, &onion_paths->paths[pathnum], nodes) == -1) {
+            // A path taken from the pool is as old as it was when it was built,
+            // so that no path is used for longer than ONION_PATH_MAX_LIFETIME.
+            const uint64_t creation_time = pooled != nullptr ? pooled->build_time : mono_time_get(onion_c->mono_time);
+
+            if (use_new_path(onion_c, pooled, nodes, &onion_paths->paths[pathnum]) == -1) {
                 return -1;
             }
 
-            onion_paths->path_creation_time[pathnum] = mono_time_get(onion_c->mono_time);
+            onion_paths->path_creation_time[pathnum] = creation_time;
             onion_paths->last_path_success[pathnum] = onion_paths->path_creation_time[pathnum];
             onion_paths->last_path_used_times[pathnum] = ONION_PATH_MAX_NO_RESPONSE_USES / 2;
 
@@ -437,6 +655,7 @@ static int random_path(const Onion_Client *onion_c, Onion_Client_Paths *onion_pa
             onion_paths->paths[pathnum].path_num = path_num;
         } else {
             pathnum = n;
+            ++onion_c->path_stats.reused;
         }
     }
 
@@ -661,68 +880,64 @@ static int client_send_announce_request(Onion_Client *onion_c, uint32_t num, IP_
     return send_onion_packet_tcp_udp(onion_c, &path, dest, request, len);
 }
 
-typedef struct Onion_Client_Cmp_data {
-    const Mono_Time *mono_time;
-    const uint8_t *base_public_key;
-    Onion_Node entry;
-} Onion_Client_Cmp_data;
-
-static int onion_client_cmp_entry(const void *a, const void *b)
+/* What a list of onion nodes is sorted by, worked out once per node rather
+ * than at each comparison.
+ */
+typedef struct Onion_Node_Sort_Key {
+    bool timed_out;
+    Pk_Distance distance;
+    uint32_t index;
+} Onion_Node_Sort_Key;
+
+/* return true if the node of key1 goes before the one of key2: nodes that timed
+ * out first, then the rest from the one furthest from the key the list is
+ * sorted for.
+ */
+static bool onion_node_sort_key_before(const Onion_Node_Sort_Key *key1, const Onion_Node_Sort_Key *key2)
 {
-    Onion_Client_Cmp_data cmp1;
-    Onion_Client_Cmp_data cmp2;
-    memcpy(&cmp1, a, sizeof(Onion_Client_Cmp_data));
-    memcpy(&cmp2, b, sizeof(Onion_Client_Cmp_data));
-    Onion_Node entry1 = cmp1.entry;
-    Onion_Node entry2 = cmp2.entry;
-    const uint8_t *cmp_public_key = cmp1.base_public_key;
-
-    int t1 = onion_node_timed_out(&entry1, cmp1.mono_time);
-    int t2 = onion_node_timed_out(&entry2, cmp2.mono_time);
-
-    if (t1 && t2) {
-        return 0;
-    }
-
-    if (t1) {
-        return -1;
-    }
-
-    if (t2) {
-        return 1;
-    }
-
-    int close = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
-
-    if (close == 1) {
-        return 1;
-    }
-
-    if (close == 2) {
-        return -1;
+    if (key1->timed_out || key2->timed_out) {
+        return key1->timed_out && !key2->timed_out;
     }
 
-    return 0;
+    return pk_distance_cmp(&key1->distance, &key2->distance) > 0;
 }
 
 static void sort_onion_node_list(Onion_Node *list, unsigned int length, const Mono_Time *mono_time,
                                  const uint8_t *comp_public_key)
 {
-    // Pass comp_public_key to qsort with each Client_data entry, so the
-    // comparison function can use it as the base of comparison.
-    VLA(Onion_Client_Cmp_data, cmp_list, length);
+    VLA(Onion_Node_Sort_Key, keys, length);
+    bool sorted = true;
 
+    // The lists are short and mostly sorted already, so an insertion sort of
+    // the keys does few comparisons and moves no nodes that are in place.
     for (uint32_t i = 0; i < length; ++i) {
-        cmp_list[i].mono_time = mono_time;
-        cmp_list[i].base_public_key = comp_public_key;
-        cmp_list[i].entry = list[i];
+        Onion_Node_Sort_Key key;
+        key.timed_out = onion_node_timed_out(&list[i], mono_time);
+        pk_distance(&key.distance, comp_public_key, list[i].public_key);
+        key.index = i;
+
+        uint32_t j = i;
+
+        while (j > 0 && onion_node_sort_key_before(&key, &keys[j - 1])) {
+            keys[j] = keys[j - 1];
+            --j;
+        }
+
+        keys[j] = key;
+        sorted = sorted && j == i;
     }
 
-    qsort(cmp_list, length, sizeof(Onion_Client_Cmp_data), onion_client_cmp_entry);
+    if (sorted) {
+        return;
+    }
+
+    VLA(Onion_Node, sorted_list, length);
 
     for (uint32_t i = 0; i < length; ++i) {
-        list[i] = cmp_list[i].entry;
+        sorted_list[i] = list[keys[i].index];
     }
+
+    memcpy(list, sorted_list, length * sizeof(Onion_Node));
 }
 
 static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t *public_key, IP_Port ip_port,
@@ -765,7 +980,7 @@ static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t
     unsigned int i;
 
     if (onion_node_timed_out(&list_nodes[0], onion_c->mono_time)
-            || id_closest(reference_id, list_nodes[0].public_key, public_key) == 2) {
+            || pk_closest(reference_id, list_nodes[0].public_key, public_key) == 2) {
         index = 0;
     }
 
@@ -803,6 +1018,11 @@ static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t
     }
 
     list_nodes[index].path_used = path_used;
+
+    if (num != 0) {
+        wake_friend(onion_c, num - 1);
+    }
+
     return 0;
 }
 
@@ -867,9 +1087,9 @@ static int client_ping_nodes(Onion_Client *onion_c, uint32_t num, const Node_for
         }
 
         if (onion_node_timed_out(&list_nodes[0], onion_c->mono_time)
-                || id_closest(reference_id, list_nodes[0].public_key, nodes[i].public_key) == 2
+                || pk_closest(reference_id, list_nodes[0].public_key, nodes[i].public_key) == 2
                 || onion_node_timed_out(&list_nodes[1], onion_c->mono_time)
-                || id_closest(reference_id, list_nodes[1].public_key, nodes[i].public_key) == 2) {
+                || pk_closest(reference_id, list_nodes[1].public_key, nodes[i].public_key) == 2) {
             uint32_t j;
 
             /* check if node is already in list. */
@@ -1136,6 +1356,7 @@ static int handle_dhtpk_announce(void *object, const uint8_t *source_pubkey, con
 
     onion_set_friend_DHT_pubkey(onion_c, friend_num, data + 1 + sizeof(uint64_t));
     onion_c->friends_list[friend_num].last_seen = mono_time_get(onion_c->mono_time);
+    wake_friend(onion_c, friend_num);
 
     uint16_t len_nodes = length - DHTPK_DATA_MIN_LENGTH;
 
@@ -1192,6 +1413,38 @@ static int handle_tcp_onion(void *object, const uint8_t *data, uint16_t length,
     return 1;
 }
 
+/* Put the indices of the nodes of the friend that the friend announced itself to
+ * into good_nodes.
+ *
+ * return the number of them, or 0 if too few of the nodes have the friend to
+ * send data through them.
+ */
+static unsigned int data_nodes(const Onion_Client *onion_c, uint16_t friend_num, unsigned int *good_nodes)
+{
+    unsigned int num_good = 0;
+    unsigned int num_nodes = 0;
+    const Onion_Node *list_nodes = onion_c->friends_list[friend_num].clients_list;
+
+    for (unsigned int i = 0; i < MAX_ONION_CLIENTS; ++i) {
+        if (onion_node_timed_out(&list_nodes[i], onion_c->mono_time)) {
+            continue;
+        }
+
+        ++num_nodes;
+
+        if (list_nodes[i].is_stored) {
+            good_nodes[num_good] = i;
+            ++num_good;
+        }
+    }
+
+    if (num_good < (num_nodes - 1) / 4 + 1) {
+        return 0;
+    }
+
+    return num_good;
+}
+
 /* Send data of length length to friendnum.
  * This data will be received by the friend using the onion_data_handlers callbacks.
  *
@@ -1215,27 +1468,14 @@ int send_onion_data(Onion_Client *onion_c, int friend_num, const uint8_t *data,
     }
 
     unsigned int good_nodes[MAX_ONION_CLIENTS];
-    unsigned int num_good = 0;
-    unsigned int num_nodes = 0;
-    Onion_Node *list_nodes = onion_c->friends_list[friend_num].clients_list;
-
-    for (unsigned int i = 0; i < MAX_ONION_CLIENTS; ++i) {
-        if (onion_node_timed_out(&list_nodes[i], onion_c->mono_time)) {
-            continue;
-        }
+    const unsigned int num_good = data_nodes(onion_c, friend_num, good_nodes);
 
-        ++num_nodes;
-
-        if (list_nodes[i].is_stored) {
-            good_nodes[num_good] = i;
-            ++num_good;
-        }
-    }
-
-    if (num_good < (num_nodes - 1) / 4 + 1) {
+    if (num_good == 0) {
         return -1;
     }
 
+    const Onion_Node *list_nodes = onion_c->friends_list[friend_num].clients_list;
+
     uint8_t nonce[CRYPTO_NONCE_SIZE];
     random_nonce(nonce);
 
@@ -1460,7 +1700,7 @@ int onion_addfriend(Onion_Client *onion_c, const uint8_t *public_key)
         return num;
     }
 
-    unsigned int index = -1;
+    unsigned int index = onion_c->num_friends;
 
     for (unsigned int i = 0; i < onion_c->num_friends; ++i) {
         if (onion_c->friends_list[i].status == 0) {
@@ -1469,12 +1709,18 @@ int onion_addfriend(Onion_Client *onion_c, const uint8_t *public_key)
         }
     }
 
-    if (index == (uint32_t) -1) {
+    // Makes room for the timer, so that wake_friend cannot fail later.
+    if (!timer_wheel_set(onion_c->friend_timers, index,
+                         mono_time_get(onion_c->mono_time) + friend_search_delay(onion_c))) {
+        return -1;
+    }
+
+    if (index == onion_c->num_friends) {
         if (realloc_onion_friends(onion_c, onion_c->num_friends + 1) == -1) {
+            timer_wheel_cancel(onion_c->friend_timers, index);
             return -1;
         }
 
-        index = onion_c->num_friends;
         memset(&onion_c->friends_list[onion_c->num_friends], 0, sizeof(Onion_Friend));
         ++onion_c->num_friends;
     }
@@ -1505,6 +1751,7 @@ int onion_delfriend(Onion_Client *onion_c, int friend_num)
 #endif
 
     crypto_memzero(&onion_c->friends_list[friend_num], sizeof(Onion_Friend));
+    timer_wheel_cancel(onion_c->friend_timers, friend_num);
     unsigned int i;
 
     for (i = onion_c->num_friends; i != 0; --i) {
@@ -1587,6 +1834,7 @@ int onion_set_friend_DHT_pubkey(Onion_Client *onion_c, int friend_num, const uin
     onion_c->friends_list[friend_num].last_seen = mono_time_get(onion_c->mono_time);
     onion_c->friends_list[friend_num].know_dht_public_key = 1;
     memcpy(onion_c->friends_list[friend_num].dht_public_key, dht_key, CRYPTO_PUBLIC_KEY_SIZE);
+    wake_friend(onion_c, friend_num);
 
     return 0;
 }
@@ -1660,6 +1908,7 @@ int onion_set_friend_online(Onion_Client *onion_c, int friend_num, uint8_t is_on
         onion_c->friends_list[friend_num].run_count = 0;
     }
 
+    wake_friend(onion_c, friend_num);
     return 0;
 }
 
@@ -1696,6 +1945,30 @@ static void populate_path_nodes_tcp(Onion_Client *onion_c)
 #define ONION_FRIEND_BACKOFF_FACTOR 4
 #define ONION_FRIEND_MAX_PING_INTERVAL (5*60*MAX_ONION_CLIENTS)
 
+/* The interval at which to announce ourselves to the nodes of a friend, which
+ * grows the longer the friend has not been seen.
+ */
+static unsigned int friend_announce_interval(const Onion_Client *onion_c, const Onion_Friend *onion_friend)
+{
+    if (onion_friend->run_count < RUN_COUNT_FRIEND_ANNOUNCE_BEGINNING) {
+        return ANNOUNCE_FRIEND_BEGINNING;
+    }
+
+    unsigned int interval = ANNOUNCE_FRIEND;
+    uint64_t backoff_interval = (mono_time_get(onion_c->mono_time) - onion_friend->last_seen)
+                                / ONION_FRIEND_BACKOFF_FACTOR;
+
+    if (backoff_interval > ONION_FRIEND_MAX_PING_INTERVAL) {
+        backoff_interval = ONION_FRIEND_MAX_PING_INTERVAL;
+    }
+
+    if (interval < backoff_interval) {
+        interval = backoff_interval;
+    }
+
+    return interval;
+}
+
 static void do_friend(Onion_Client *onion_c, uint16_t friendnum)
 {
     if (friendnum >= onion_c->num_friends) {
@@ -1706,28 +1979,13 @@ static void do_friend(Onion_Client *onion_c, uint16_t friendnum)
         return;
     }
 
-    unsigned int interval = ANNOUNCE_FRIEND;
-
-    if (onion_c->friends_list[friendnum].run_count < RUN_COUNT_FRIEND_ANNOUNCE_BEGINNING) {
-        interval = ANNOUNCE_FRIEND_BEGINNING;
-    } else {
-        if (onion_c->friends_list[friendnum].last_seen == 0) {
-            onion_c->friends_list[friendnum].last_seen = mono_time_get(onion_c->mono_time);
-        }
-
-        uint64_t backoff_interval = (mono_time_get(onion_c->mono_time) -
-                                     onion_c->friends_list[friendnum].last_seen)
-                                    / ONION_FRIEND_BACKOFF_FACTOR;
-
-        if (backoff_interval > ONION_FRIEND_MAX_PING_INTERVAL) {
-            backoff_interval = ONION_FRIEND_MAX_PING_INTERVAL;
-        }
-
-        if (interval < backoff_interval) {
-            interval = backoff_interval;
-        }
+    if (onion_c->friends_list[friendnum].run_count >= RUN_COUNT_FRIEND_ANNOUNCE_BEGINNING
+            && onion_c->friends_list[friendnum].last_seen == 0) {
+        onion_c->friends_list[friendnum].last_seen = mono_time_get(onion_c->mono_time);
     }
 
+    const unsigned int interval = friend_announce_interval(onion_c, &onion_c->friends_list[friendnum]);
+
     if (!onion_c->friends_list[friendnum].is_online) {
         unsigned int count = 0;
         Onion_Node *list_nodes = onion_c->friends_list[friendnum].clients_list;
@@ -1814,6 +2072,70 @@ static void do_friend(Onion_Client *onion_c, uint16_t friendnum)
     }
 }
 
+/* The earliest time at which do_friend may have something to do for an offline
+ * friend. Changes it cannot foresee, such as nodes added to the list of the
+ * friend, wake the friend up through wake_friend.
+ */
+static uint64_t friend_next_run(const Onion_Client *onion_c, uint16_t friendnum)
+{
+    const Onion_Friend *onion_friend = &onion_c->friends_list[friendnum];
+    const uint64_t now = mono_time_get(onion_c->mono_time);
+
+    if (onion_friend->run_count < RUN_COUNT_FRIEND_ANNOUNCE_BEGINNING) {
+        return now + 1 + friend_search_delay(onion_c);
+    }
+
+    const unsigned int interval = friend_announce_interval(onion_c, onion_friend);
+    uint64_t next = UINT64_MAX;
+    uint64_t ping_random = 0;
+
+    for (unsigned int i = 0; i < MAX_ONION_CLIENTS; ++i) {
+        const Onion_Node *node = &onion_friend->clients_list[i];
+
+        // While the list is not full, do_friend looks for more nodes as often as it may.
+        if (onion_node_timed_out(node, onion_c->mono_time) || node->last_pinged == 0) {
+            return now + 1 + friend_search_delay(onion_c);
+        }
+
+        if (node->unsuccessful_pings >= ONION_NODE_MAX_PINGS) {
+            next = min_u64(next, node->last_pinged + ONION_NODE_TIMEOUT);
+        } else {
+            next = min_u64(next, node->last_pinged + interval);
+        }
+
+        ping_random = max_u64(ping_random, max_u64(node->timestamp + interval / MAX_ONION_CLIENTS,
+                              node->last_pinged + ONION_NODE_PING_INTERVAL));
+    }
+
+    next = min_u64(next, ping_random);
+
+    unsigned int good_nodes[MAX_ONION_CLIENTS];
+
+    if (data_nodes(onion_c, friendnum, good_nodes) != 0) {
+        next = min_u64(next, onion_friend->last_dht_pk_onion_sent + ONION_DHTPK_SEND_INTERVAL);
+    }
+
+    if (onion_friend->know_dht_public_key) {
+        next = min_u64(next, onion_friend->last_dht_pk_dht_sent + DHT_DHTPK_SEND_INTERVAL);
+    }
+
+    return max_u64(next, now + 1);
+}
+
+static void run_friend(void *object, uint32_t id, uint64_t now)
+{
+    Onion_Client *onion_c = (Onion_Client *)object;
+    const uint16_t friendnum = id;
+
+    do_friend(onion_c, friendnum);
+
+    // Friends that are online or deleted wait for onion_set_friend_online or onion_addfriend.
+    if (friendnum < onion_c->num_friends && onion_c->friends_list[friendnum].status != 0
+            && !onion_c->friends_list[friendnum].is_online) {
+        timer_wheel_set(onion_c->friend_timers, friendnum, friend_next_run(onion_c, friendnum));
+    }
+}
+
 
 /* Function to call when onion data packet with contents beginning with byte is received. */
 void oniondata_registerhandler(Onion_Client *onion_c, uint8_t byte, oniondata_handler_cb *cb, void *object)
@@ -1985,6 +2307,7 @@ void do_onion_client(Onion_Client *onion_c)
 
     if (mono_time_is_timeout(onion_c->mono_time, onion_c->first_run, ONION_CONNECTION_SECONDS)) {
         populate_path_nodes(onion_c);
+        fill_path_pool(onion_c, ONION_PATH_POOL_BATCH);
         do_announce(onion_c);
     }
 
@@ -2010,9 +2333,7 @@ void do_onion_client(Onion_Client *onion_c)
                              || get_random_tcp_onion_conn_number(nc_get_tcp_c(onion_c->c)) == -1; /* Check if connected to any TCP relays. */
 
     if (onion_connection_status(onion_c)) {
-        for (unsigned i = 0; i < onion_c->num_friends; ++i) {
-            do_friend(onion_c, i);
-        }
+        timer_wheel_expire(onion_c->friend_timers, mono_time_get(onion_c->mono_time), &run_friend, onion_c);
     }
 
     if (onion_c->last_run == 0) {
@@ -2049,6 +2370,14 @@ Onion_Client *new_onion_client(const Logger *logger, Mono_Time *mono_time, Net_C
         return nullptr;
     }
 
+    onion_c->friend_timers = timer_wheel_new(mono_time_get(mono_time));
+
+    if (onion_c->friend_timers == nullptr) {
+        ping_array_kill(onion_c->announce_ping_array);
+        free(onion_c);
+        return nullptr;
+    }
+
     onion_c->gc_session = gc_session;
     onion_c->mono_time = mono_time;
     onion_c->logger = logger;
@@ -2075,6 +2404,7 @@ void kill_onion_client(Onion_Client *onion_c)
 
     ping_array_kill(onion_c->announce_ping_array);
     realloc_onion_friends(onion_c, 0);
+    timer_wheel_kill(onion_c->friend_timers);
     networking_registerhandler(onion_c->net, NET_PACKET_ANNOUNCE_RESPONSE, nullptr, nullptr);
     networking_registerhandler(onion_c->net, NET_PACKET_ANNOUNCE_RSPONSE_OLD, nullptr, nullptr);
     networking_registerhandler(onion_c->net, NET_PACKET_ONION_DATA_RESPONSE, nullptr, nullptr);
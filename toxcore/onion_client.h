@@ -171,6 +171,17 @@ void oniondata_registerhandler(Onion_Client *onion_c, uint8_t byte, oniondata_ha
 
 void do_onion_client(Onion_Client *onion_c);
 
+typedef struct Onion_Path_Stats {
+    uint64_t built_ahead;  /* paths built ahead of time in do_onion_client */
+    uint64_t built_inline; /* paths built when one was needed and none was ready */
+    uint64_t taken;        /* paths built ahead of time that were put to use */
+    uint64_t reused;       /* times a live path was used instead of a new one */
+    uint64_t expired;      /* paths built ahead of time thrown away unused */
+} Onion_Path_Stats;
+
+/* Copy the counters of the onion paths of onion_c into stats. */
+void onion_get_path_stats(const Onion_Client *onion_c, Onion_Path_Stats *stats);
+
 Onion_Client *new_onion_client(const Logger *logger, Mono_Time *mono_time, Net_Crypto *c, GC_Session *gc_session);
 
 void kill_onion_client(Onion_Client *onion_c);
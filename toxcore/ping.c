@@ -272,7 +272,9 @@ int32_t ping_add(Ping *ping, const uint8_t *public_key, IP_Port ip_port)
         return -1;
     }
 
-    if (in_list(dht_get_close_clientlist(ping->dht), LCLIENT_LIST, ping->mono_time, public_key, ip_port)) {
+    const Client_data *const close_client = dht_find_close_client(ping->dht, public_key);
+
+    if (close_client != nullptr && in_list(close_client, 1, ping->mono_time, public_key, ip_port)) {
         return -1;
     }
 
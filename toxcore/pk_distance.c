@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * XOR distance between public keys.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pk_distance.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "ccompat.h"
+
+static uint64_t load_u64_be(const uint8_t *bytes)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, bytes, sizeof(v));
+    return __builtin_bswap64(v);
+#else
+    uint64_t v = 0;
+
+    for (size_t i = 0; i < sizeof(v); ++i) {
+        v = (v << 8) | bytes[i];
+    }
+
+    return v;
+#endif
+}
+
+/* return the number of leading zero bits of v, which is not 0. */
+static uint32_t leading_zeros(uint64_t v)
+{
+#ifdef __GNUC__
+    return __builtin_clzll(v);
+#else
+    uint32_t n = 0;
+
+    while ((v & (UINT64_C(1) << 63)) == 0) {
+        v <<= 1;
+        ++n;
+    }
+
+    return n;
+#endif
+}
+
+static uint64_t distance_word(const uint8_t *pk1, const uint8_t *pk2, size_t i)
+{
+    return load_u64_be(pk1 + i * sizeof(uint64_t)) ^ load_u64_be(pk2 + i * sizeof(uint64_t));
+}
+
+void pk_distance(Pk_Distance *distance, const uint8_t *pk1, const uint8_t *pk2)
+{
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        distance->words[i] = distance_word(pk1, pk2, i);
+    }
+}
+
+int pk_distance_cmp(const Pk_Distance *distance1, const Pk_Distance *distance2)
+{
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        if (distance1->words[i] != distance2->words[i]) {
+            return distance1->words[i] < distance2->words[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+int pk_closest(const uint8_t *pk, const uint8_t *pk1, const uint8_t *pk2)
+{
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        const uint64_t distance1 = distance_word(pk, pk1, i);
+        const uint64_t distance2 = distance_word(pk, pk2, i);
+
+        if (distance1 < distance2) {
+            return 1;
+        }
+
+        if (distance1 > distance2) {
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t pk_common_prefix(const uint8_t *pk1, const uint8_t *pk2)
+{
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        const uint64_t distance = distance_word(pk1, pk2, i);
+
+        if (distance != 0) {
+            return i * 64 + leading_zeros(distance);
+        }
+    }
+
+    return CRYPTO_PUBLIC_KEY_SIZE * 8;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+static void store_u64_be(uint8_t *bytes, uint64_t v)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+    memcpy(bytes, &v, sizeof(v));
+#else
+
+    for (size_t i = 0; i < sizeof(v); ++i) {
+        bytes[i] = (uint8_t)(v >> (56 - i * 8));
+    }
+
+#endif
+}
+
+/* Of the bytes of a distance and a bound, the first that differ decides which
+ * is smaller. Bit i of the masks is about byte i, the first bytes being the
+ * most significant, so the lowest bit set in differ is that byte.
+ */
+static bool closer_by_masks(uint32_t differ, uint32_t at_most)
+{
+    return (at_most & differ & (~differ + 1)) != 0;
+}
+#endif
+
+uint32_t pk_closer_than(const uint8_t *pk, const Pk_Distance *bound, const uint8_t *keys, size_t stride,
+                        uint32_t num_keys)
+{
+    assert(num_keys <= 32);
+
+    uint32_t closer = 0;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    uint8_t bound_bytes[CRYPTO_PUBLIC_KEY_SIZE];
+
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        store_u64_be(&bound_bytes[i * sizeof(uint64_t)], bound->words[i]);
+    }
+
+#endif
+
+#if defined(__AVX2__)
+    const __m256i target = _mm256_loadu_si256((const __m256i *)pk);
+    const __m256i limit = _mm256_loadu_si256((const __m256i *)bound_bytes);
+
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        const __m256i distance = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + i * stride)), target);
+        const uint32_t equal = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(distance, limit));
+        const uint32_t at_most = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(distance, limit),
+                                 limit));
+
+        closer |= (uint32_t)closer_by_masks(~equal, at_most) << i;
+    }
+
+#elif defined(__SSE2__)
+    const __m128i target_hi = _mm_loadu_si128((const __m128i *)pk);
+    const __m128i target_lo = _mm_loadu_si128((const __m128i *)(pk + 16));
+    const __m128i limit_hi = _mm_loadu_si128((const __m128i *)bound_bytes);
+    const __m128i limit_lo = _mm_loadu_si128((const __m128i *)(bound_bytes + 16));
+
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        const uint8_t *key = keys + i * stride;
+        const __m128i distance_hi = _mm_xor_si128(_mm_loadu_si128((const __m128i *)key), target_hi);
+        const __m128i distance_lo = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(key + 16)), target_lo);
+        const uint32_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(distance_hi, limit_hi))
+                               | ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(distance_lo, limit_lo)) << 16);
+        const uint32_t at_most = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(distance_hi, limit_hi),
+                                 limit_hi))
+                                 | ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(distance_lo, limit_lo),
+                                         limit_lo)) << 16);
+
+        closer |= (uint32_t)closer_by_masks(~equal, at_most) << i;
+    }
+
+#else
+
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        Pk_Distance distance;
+        pk_distance(&distance, pk, keys + i * stride);
+
+        if (pk_distance_cmp(&distance, bound) < 0) {
+            closer |= UINT32_C(1) << i;
+        }
+    }
+
+#endif
+
+    return closer;
+}
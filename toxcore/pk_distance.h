@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * XOR distance between public keys, the metric of the DHT. Keys are compared
+ * as 256 bit big endian integers a 64 bit word at a time rather than a byte at
+ * a time. When the compiler targets SSE2 or AVX2, pk_closer_than compares a
+ * whole key with a couple of vector instructions.
+ */
+#ifndef C_TOXCORE_TOXCORE_PK_DISTANCE_H
+#define C_TOXCORE_TOXCORE_PK_DISTANCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crypto_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PK_DISTANCE_WORDS (CRYPTO_PUBLIC_KEY_SIZE / sizeof(uint64_t))
+
+/* Most significant word first. */
+typedef struct Pk_Distance {
+    uint64_t words[PK_DISTANCE_WORDS];
+} Pk_Distance;
+
+/* Put the XOR distance between pk1 and pk2 in distance. */
+void pk_distance(Pk_Distance *distance, const uint8_t *pk1, const uint8_t *pk2);
+
+/* return -1 if distance1 is smaller, 1 if it is larger, 0 if they are equal. */
+int pk_distance_cmp(const Pk_Distance *distance1, const Pk_Distance *distance2);
+
+/* Compares pk1 and pk2 with pk.
+ *
+ *  return 0 if both are same distance.
+ *  return 1 if pk1 is closer.
+ *  return 2 if pk2 is closer.
+ */
+int pk_closest(const uint8_t *pk, const uint8_t *pk1, const uint8_t *pk2);
+
+/* return the number of leading bits pk1 and pk2 have in common, which is
+ * CRYPTO_PUBLIC_KEY_SIZE * 8 if they are equal.
+ */
+uint32_t pk_common_prefix(const uint8_t *pk1, const uint8_t *pk2);
+
+/* Compare num_keys keys, at most 32, with pk. The keys are stride bytes apart,
+ * so that they may be the public keys in an array of structs.
+ *
+ * return a mask with bit i set if key i is closer to pk than bound.
+ */
+uint32_t pk_closer_than(const uint8_t *pk, const Pk_Distance *bound, const uint8_t *keys, size_t stride,
+                        uint32_t num_keys);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif
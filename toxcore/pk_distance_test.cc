@@ -0,0 +1,135 @@
+#include "pk_distance.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <vector>
+
+namespace {
+
+using Key = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+Key random_key() {
+  Key key;
+  random_bytes(key.data(), key.size());
+  return key;
+}
+
+// A random key that has the first prefix_bits bits of base.
+Key key_with_prefix(const Key &base, uint32_t prefix_bits) {
+  Key key = random_key();
+
+  for (uint32_t i = 0; i < prefix_bits; ++i) {
+    const uint8_t mask = 0x80 >> (i % 8);
+    key[i / 8] = (key[i / 8] & ~mask) | (base[i / 8] & mask);
+  }
+
+  return key;
+}
+
+// The byte at a time comparison the DHT used before.
+int bytewise_closest(const Key &pk, const Key &pk1, const Key &pk2) {
+  for (size_t i = 0; i < pk.size(); ++i) {
+    const uint8_t distance1 = pk[i] ^ pk1[i];
+    const uint8_t distance2 = pk[i] ^ pk2[i];
+
+    if (distance1 < distance2) {
+      return 1;
+    }
+
+    if (distance1 > distance2) {
+      return 2;
+    }
+  }
+
+  return 0;
+}
+
+uint32_t bitwise_common_prefix(const Key &pk1, const Key &pk2) {
+  uint32_t i = 0;
+
+  while (i < pk1.size() * 8 && ((pk1[i / 8] ^ pk2[i / 8]) & (0x80 >> (i % 8))) == 0) {
+    ++i;
+  }
+
+  return i;
+}
+
+TEST(PkDistance, ClosestMatchesBytewiseComparison) {
+  for (uint32_t i = 0; i < 10000; ++i) {
+    const Key pk = random_key();
+    const Key pk1 = key_with_prefix(pk, i % 257);
+    const Key pk2 = key_with_prefix(pk, (i * 7) % 257);
+    EXPECT_EQ(pk_closest(pk.data(), pk1.data(), pk2.data()), bytewise_closest(pk, pk1, pk2));
+  }
+}
+
+TEST(PkDistance, EqualKeysAreAtTheSameDistance) {
+  const Key pk = random_key();
+  const Key pk1 = random_key();
+  EXPECT_EQ(pk_closest(pk.data(), pk1.data(), pk1.data()), 0);
+  EXPECT_EQ(pk_closest(pk.data(), pk.data(), pk1.data()), 1);
+  EXPECT_EQ(pk_closest(pk.data(), pk1.data(), pk.data()), 2);
+}
+
+TEST(PkDistance, DistanceComparesLikeClosest) {
+  for (uint32_t i = 0; i < 10000; ++i) {
+    const Key pk = random_key();
+    const Key pk1 = key_with_prefix(pk, i % 257);
+    const Key pk2 = key_with_prefix(pk, (i * 3) % 257);
+
+    Pk_Distance distance1;
+    Pk_Distance distance2;
+    pk_distance(&distance1, pk.data(), pk1.data());
+    pk_distance(&distance2, pk.data(), pk2.data());
+
+    const int expected[] = {0, -1, 1};
+    EXPECT_EQ(pk_distance_cmp(&distance1, &distance2), expected[bytewise_closest(pk, pk1, pk2)]);
+  }
+}
+
+TEST(PkDistance, CommonPrefixMatchesBitwiseComparison) {
+  for (uint32_t i = 0; i <= CRYPTO_PUBLIC_KEY_SIZE * 8; ++i) {
+    const Key pk1 = random_key();
+    const Key pk2 = key_with_prefix(pk1, i);
+    EXPECT_EQ(pk_common_prefix(pk1.data(), pk2.data()), bitwise_common_prefix(pk1, pk2));
+  }
+
+  const Key pk = random_key();
+  EXPECT_EQ(pk_common_prefix(pk.data(), pk.data()), CRYPTO_PUBLIC_KEY_SIZE * 8);
+}
+
+struct Node {
+  uint16_t port;
+  Key public_key;
+  uint64_t timestamp;
+};
+
+TEST(PkDistance, CloserThanMatchesDistanceComparison) {
+  for (uint32_t round = 0; round < 1000; ++round) {
+    const Key pk = random_key();
+    const Key bound_key = key_with_prefix(pk, round % 64);
+    Pk_Distance bound;
+    pk_distance(&bound, pk.data(), bound_key.data());
+
+    std::vector<Node> nodes(1 + round % 32);
+    uint32_t expected = 0;
+
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+      // Some keys at the same distance as the bound, which is not closer.
+      nodes[i].public_key = i % 5 == 0 ? bound_key : key_with_prefix(pk, (round + i) % 64);
+
+      Pk_Distance distance;
+      pk_distance(&distance, pk.data(), nodes[i].public_key.data());
+
+      if (pk_distance_cmp(&distance, &bound) < 0) {
+        expected |= UINT32_C(1) << i;
+      }
+    }
+
+    EXPECT_EQ(pk_closer_than(pk.data(), &bound, nodes[0].public_key.data(), sizeof(Node), nodes.size()),
+              expected);
+  }
+}
+
+}  // namespace
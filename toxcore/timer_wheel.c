@@ -0,0 +1,340 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * Hierarchical timer wheel.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccompat.h"
+
+/* The wheel has TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots. A slot of
+ * level 0 holds the timers of a single tick, a slot of level l those of
+ * TIMER_WHEEL_SLOTS^l ticks. Timers are put into the lowest level whose range
+ * from the current tick covers their deadline. Whenever the current tick
+ * reaches the start of a slot of a higher level, the timers in it move down to
+ * the levels below, so each timer moves at most once per level before it
+ * expires from level 0.
+ *
+ * Timers further away than the whole wheel covers wait in the top level and
+ * are put back until their deadline is in range.
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 6
+
+/* Slot number of timers that are not set and of the list of those whose
+ * deadline passed, which timer_wheel_expire empties first. */
+#define TIMER_WHEEL_UNSET (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+#define TIMER_WHEEL_EXPIRING (TIMER_WHEEL_UNSET + 1)
+
+#define TIMER_WHEEL_NONE UINT32_MAX
+
+typedef struct Timer_Wheel_Node {
+    uint64_t deadline;
+    uint32_t next;
+    uint32_t prev;
+    uint16_t slot;
+} Timer_Wheel_Node;
+
+struct Timer_Wheel {
+    /* Ticks before current have all been expired. */
+    uint64_t current;
+    bool expiring;
+
+    Timer_Wheel_Node *nodes;
+    uint32_t num_nodes;
+
+    /* First timer in each slot, then in the list of expiring ones. */
+    uint32_t heads[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS + 2];
+    uint32_t level_count[TIMER_WHEEL_LEVELS];
+    uint32_t count;
+};
+
+static uint32_t level_of(uint16_t slot)
+{
+    return slot / TIMER_WHEEL_SLOTS;
+}
+
+static void unlink_node(Timer_Wheel *wheel, uint32_t id)
+{
+    Timer_Wheel_Node *node = &wheel->nodes[id];
+
+    if (node->prev == TIMER_WHEEL_NONE) {
+        wheel->heads[node->slot] = node->next;
+    } else {
+        wheel->nodes[node->prev].next = node->next;
+    }
+
+    if (node->next != TIMER_WHEEL_NONE) {
+        wheel->nodes[node->next].prev = node->prev;
+    }
+
+    if (node->slot < TIMER_WHEEL_UNSET) {
+        --wheel->level_count[level_of(node->slot)];
+    }
+
+    node->slot = TIMER_WHEEL_UNSET;
+    --wheel->count;
+}
+
+static void link_node(Timer_Wheel *wheel, uint32_t id, uint16_t slot)
+{
+    Timer_Wheel_Node *node = &wheel->nodes[id];
+    node->slot = slot;
+    node->prev = TIMER_WHEEL_NONE;
+    node->next = wheel->heads[slot];
+
+    if (node->next != TIMER_WHEEL_NONE) {
+        wheel->nodes[node->next].prev = id;
+    }
+
+    wheel->heads[slot] = id;
+
+    if (slot < TIMER_WHEEL_UNSET) {
+        ++wheel->level_count[level_of(slot)];
+    }
+
+    ++wheel->count;
+}
+
+/* return the slot that a timer expiring at deadline goes into. */
+static uint16_t slot_for(const Timer_Wheel *wheel, uint64_t deadline)
+{
+    if (deadline < wheel->current) {
+        // Timers set again while expiring wait for the next tick.
+        if (!wheel->expiring) {
+            return TIMER_WHEEL_EXPIRING;
+        }
+
+        deadline = wheel->current;
+    }
+
+    const uint64_t delta = deadline - wheel->current;
+
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS - 1; ++level) {
+        if (delta < (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+            return level * TIMER_WHEEL_SLOTS + ((deadline >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+        }
+    }
+
+    const uint32_t top = TIMER_WHEEL_LEVELS - 1;
+    const uint64_t range = 1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+
+    if (delta >= range) {
+        deadline = wheel->current + range - 1;
+    }
+
+    return top * TIMER_WHEEL_SLOTS + ((deadline >> (TIMER_WHEEL_BITS * top)) & TIMER_WHEEL_MASK);
+}
+
+static void schedule(Timer_Wheel *wheel, uint32_t id)
+{
+    link_node(wheel, id, slot_for(wheel, wheel->nodes[id].deadline));
+}
+
+/* Move the timers of one slot into the levels below it.
+ *
+ * return the index of the slot within its level.
+ */
+static uint32_t cascade(Timer_Wheel *wheel, uint32_t level)
+{
+    const uint32_t index = (wheel->current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    const uint16_t slot = level * TIMER_WHEEL_SLOTS + index;
+
+    while (wheel->heads[slot] != TIMER_WHEEL_NONE) {
+        const uint32_t id = wheel->heads[slot];
+        unlink_node(wheel, id);
+        schedule(wheel, id);
+    }
+
+    return index;
+}
+
+Timer_Wheel *timer_wheel_new(uint64_t now)
+{
+    Timer_Wheel *wheel = (Timer_Wheel *)calloc(1, sizeof(Timer_Wheel));
+
+    if (wheel == nullptr) {
+        return nullptr;
+    }
+
+    wheel->current = now;
+
+    for (uint32_t i = 0; i < TIMER_WHEEL_EXPIRING + 1; ++i) {
+        wheel->heads[i] = TIMER_WHEEL_NONE;
+    }
+
+    return wheel;
+}
+
+void timer_wheel_kill(Timer_Wheel *wheel)
+{
+    if (wheel == nullptr) {
+        return;
+    }
+
+    free(wheel->nodes);
+    free(wheel);
+}
+
+bool timer_wheel_set(Timer_Wheel *wheel, uint32_t id, uint64_t deadline)
+{
+    if (id == TIMER_WHEEL_NONE) {
+        return false;
+    }
+
+    if (id >= wheel->num_nodes) {
+        uint32_t num_nodes = wheel->num_nodes == 0 ? 16 : wheel->num_nodes;
+
+        while (num_nodes <= id) {
+            num_nodes = num_nodes > UINT32_MAX / 2 ? UINT32_MAX : num_nodes * 2;
+        }
+
+        Timer_Wheel_Node *nodes = (Timer_Wheel_Node *)realloc(wheel->nodes, num_nodes * sizeof(Timer_Wheel_Node));
+
+        if (nodes == nullptr) {
+            return false;
+        }
+
+        for (uint32_t i = wheel->num_nodes; i < num_nodes; ++i) {
+            nodes[i].slot = TIMER_WHEEL_UNSET;
+        }
+
+        wheel->nodes = nodes;
+        wheel->num_nodes = num_nodes;
+    }
+
+    if (wheel->nodes[id].slot != TIMER_WHEEL_UNSET) {
+        unlink_node(wheel, id);
+    }
+
+    wheel->nodes[id].deadline = deadline;
+    schedule(wheel, id);
+    return true;
+}
+
+void timer_wheel_cancel(Timer_Wheel *wheel, uint32_t id)
+{
+    if (timer_wheel_is_set(wheel, id)) {
+        unlink_node(wheel, id);
+    }
+}
+
+bool timer_wheel_is_set(const Timer_Wheel *wheel, uint32_t id)
+{
+    return id < wheel->num_nodes && wheel->nodes[id].slot != TIMER_WHEEL_UNSET;
+}
+
+uint32_t timer_wheel_count(const Timer_Wheel *wheel)
+{
+    return wheel->count;
+}
+
+/* Skip ticks in which no timer can expire: if the lowest levels are empty,
+ * nothing happens before the start of the next slot of the lowest level that
+ * is not.
+ */
+static void skip_empty(Timer_Wheel *wheel, uint64_t now)
+{
+    uint32_t level = 0;
+
+    while (level < TIMER_WHEEL_LEVELS - 1 && wheel->level_count[level] == 0) {
+        ++level;
+    }
+
+    if (level == 0) {
+        return;
+    }
+
+    const uint64_t step = 1ULL << (TIMER_WHEEL_BITS * level);
+    const uint64_t next = (wheel->current + step - 1) & ~(step - 1);
+
+    wheel->current = next < now + 1 ? next : now + 1;
+}
+
+/* Turn the timers of a level 0 slot into the list of expiring ones, which is
+ * empty.
+ */
+static void take_slot(Timer_Wheel *wheel, uint16_t slot)
+{
+    for (uint32_t id = wheel->heads[slot]; id != TIMER_WHEEL_NONE; id = wheel->nodes[id].next) {
+        wheel->nodes[id].slot = TIMER_WHEEL_EXPIRING;
+        --wheel->level_count[0];
+    }
+
+    wheel->heads[TIMER_WHEEL_EXPIRING] = wheel->heads[slot];
+    wheel->heads[slot] = TIMER_WHEEL_NONE;
+}
+
+/* Call function for all timers in the expiring list, putting back those with
+ * a deadline after tick.
+ *
+ * return the number of expired timers.
+ */
+static uint32_t run_expiring(Timer_Wheel *wheel, uint64_t tick, uint64_t now, timer_wheel_cb *function, void *object)
+{
+    uint32_t expired = 0;
+    wheel->expiring = true;
+
+    while (wheel->heads[TIMER_WHEEL_EXPIRING] != TIMER_WHEEL_NONE) {
+        const uint32_t id = wheel->heads[TIMER_WHEEL_EXPIRING];
+        unlink_node(wheel, id);
+
+        if (wheel->nodes[id].deadline > tick) {
+            // beyond the range of the wheel when it was set
+            schedule(wheel, id);
+            continue;
+        }
+
+        ++expired;
+        function(object, id, now);
+    }
+
+    wheel->expiring = false;
+    return expired;
+}
+
+uint32_t timer_wheel_expire(Timer_Wheel *wheel, uint64_t now, timer_wheel_cb *function, void *object)
+{
+    uint32_t expired = run_expiring(wheel, UINT64_MAX, now, function, object);
+
+    while (wheel->current <= now) {
+        if (wheel->count == 0) {
+            wheel->current = now + 1;
+            break;
+        }
+
+        skip_empty(wheel, now);
+
+        if (wheel->current > now) {
+            break;
+        }
+
+        const uint64_t tick = wheel->current;
+        const uint32_t index = tick & TIMER_WHEEL_MASK;
+
+        for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+            if ((tick & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) != 0 || cascade(wheel, level) != 0) {
+                break;
+            }
+        }
+
+        // Timers set by the callbacks for this tick go into the next one.
+        ++wheel->current;
+
+        take_slot(wheel, index);
+        expired += run_expiring(wheel, tick, now, function, object);
+    }
+
+    return expired;
+}
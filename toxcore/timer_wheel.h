@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2021 The TokTok team.
+ */
+
+/*
+ * Hierarchical timer wheel: one timer for each of a set of numbered objects,
+ * such as connections, so that periodic work only visits the objects whose
+ * deadlines have passed instead of all of them. Deadlines are in ticks, which
+ * may be seconds or milliseconds, as long as the same unit is used throughout.
+ */
+#ifndef C_TOXCORE_TOXCORE_TIMER_WHEEL_H
+#define C_TOXCORE_TOXCORE_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Timer_Wheel Timer_Wheel;
+
+/* Called for a timer whose deadline passed. The timer is no longer set, the
+ * function may set it again or set and cancel any other timer.
+ */
+typedef void timer_wheel_cb(void *object, uint32_t id, uint64_t now);
+
+/* Create a timer wheel whose first deadlines are at or after now.
+ *
+ * return nullptr on failure.
+ */
+Timer_Wheel *timer_wheel_new(uint64_t now);
+
+void timer_wheel_kill(Timer_Wheel *wheel);
+
+/* Set the timer of id to expire at deadline, replacing its previous deadline.
+ * Deadlines that already passed expire on the next call to timer_wheel_expire.
+ *
+ * return false if memory allocation fails.
+ */
+bool timer_wheel_set(Timer_Wheel *wheel, uint32_t id, uint64_t deadline);
+
+/* Cancel the timer of id if it is set. */
+void timer_wheel_cancel(Timer_Wheel *wheel, uint32_t id);
+
+bool timer_wheel_is_set(const Timer_Wheel *wheel, uint32_t id);
+
+/* return the number of timers that are set. */
+uint32_t timer_wheel_count(const Timer_Wheel *wheel);
+
+/* Call function for every timer whose deadline is at or before now, those of
+ * earlier ticks first.
+ *
+ * return the number of expired timers.
+ */
+uint32_t timer_wheel_expire(Timer_Wheel *wheel, uint64_t now, timer_wheel_cb *function, void *object);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#include "timer_wheel.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Timer_Wheel_Deleter {
+  void operator()(Timer_Wheel *wheel) { timer_wheel_kill(wheel); }
+};
+
+using Timer_Wheel_Ptr = std::unique_ptr<Timer_Wheel, Timer_Wheel_Deleter>;
+
+struct Expired {
+  uint32_t id;
+  uint64_t now;
+};
+
+void record(void *object, uint32_t id, uint64_t now) {
+  static_cast<std::vector<Expired> *>(object)->push_back({id, now});
+}
+
+TEST(TimerWheel, ExpiresAtDeadline) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(1000));
+  ASSERT_NE(wheel, nullptr);
+  std::vector<Expired> expired;
+
+  ASSERT_TRUE(timer_wheel_set(wheel.get(), 3, 1010));
+  EXPECT_TRUE(timer_wheel_is_set(wheel.get(), 3));
+  EXPECT_EQ(timer_wheel_expire(wheel.get(), 1009, &record, &expired), 0u);
+  EXPECT_EQ(timer_wheel_expire(wheel.get(), 1010, &record, &expired), 1u);
+  ASSERT_EQ(expired.size(), 1u);
+  EXPECT_EQ(expired[0].id, 3u);
+  EXPECT_FALSE(timer_wheel_is_set(wheel.get(), 3));
+  EXPECT_EQ(timer_wheel_count(wheel.get()), 0u);
+}
+
+TEST(TimerWheel, PastDeadlinesExpireOnNextCall) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(1000));
+  std::vector<Expired> expired;
+
+  timer_wheel_expire(wheel.get(), 2000, &record, &expired);
+  ASSERT_TRUE(timer_wheel_set(wheel.get(), 1, 5));
+  EXPECT_EQ(timer_wheel_expire(wheel.get(), 2000, &record, &expired), 1u);
+}
+
+TEST(TimerWheel, CancelAndResetReplaceDeadline) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(0));
+  std::vector<Expired> expired;
+
+  ASSERT_TRUE(timer_wheel_set(wheel.get(), 1, 10));
+  ASSERT_TRUE(timer_wheel_set(wheel.get(), 2, 10));
+  timer_wheel_cancel(wheel.get(), 1);
+  ASSERT_TRUE(timer_wheel_set(wheel.get(), 2, 500));
+  EXPECT_EQ(timer_wheel_count(wheel.get()), 1u);
+
+  EXPECT_EQ(timer_wheel_expire(wheel.get(), 499, &record, &expired), 0u);
+  EXPECT_EQ(timer_wheel_expire(wheel.get(), 500, &record, &expired), 1u);
+  ASSERT_EQ(expired.size(), 1u);
+  EXPECT_EQ(expired[0].id, 2u);
+}
+
+struct Periodic {
+  Timer_Wheel *wheel;
+  uint32_t fired;
+};
+
+void set_again(void *object, uint32_t id, uint64_t now) {
+  Periodic *periodic = static_cast<Periodic *>(object);
+  ++periodic->fired;
+  // A deadline that already passed must not make the wheel loop within one call.
+  timer_wheel_set(periodic->wheel, id, now);
+}
+
+TEST(TimerWheel, CallbackCanSetTimerAgain) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(0));
+  Periodic periodic = {wheel.get(), 0};
+
+  ASSERT_TRUE(timer_wheel_set(wheel.get(), 0, 0));
+
+  for (uint64_t now = 0; now < 100; ++now) {
+    EXPECT_EQ(timer_wheel_expire(wheel.get(), now, &set_again, &periodic), 1u);
+  }
+
+  EXPECT_EQ(periodic.fired, 100u);
+}
+
+TEST(TimerWheel, RandomDeadlinesExpireOnTime) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(12345));
+  std::mt19937_64 rng(42);
+  std::vector<uint64_t> deadlines(5000);
+
+  for (uint32_t i = 0; i < deadlines.size(); ++i) {
+    // Spread over all levels of the wheel, some beyond its range.
+    const uint64_t range = i % 10 == 0 ? 1ULL << 40 : 300000;
+    deadlines[i] = 12345 + (rng() >> (rng() % 64)) % range;
+    ASSERT_TRUE(timer_wheel_set(wheel.get(), i, deadlines[i]));
+  }
+
+  std::vector<Expired> expired;
+  uint64_t previous = 12344;
+  uint64_t now = 12345;
+  uint32_t total = 0;
+
+  while (timer_wheel_count(wheel.get()) > 0 && now < (1ULL << 41)) {
+    expired.clear();
+    total += timer_wheel_expire(wheel.get(), now, &record, &expired);
+
+    for (const Expired &e : expired) {
+      EXPECT_LE(deadlines[e.id], now) << "timer " << e.id << " expired early";
+      EXPECT_GT(deadlines[e.id], previous) << "timer " << e.id << " expired late";
+    }
+
+    previous = now;
+    now += 1 + rng() % (1 + (now - 12345) / 8);
+  }
+
+  EXPECT_EQ(timer_wheel_count(wheel.get()), 0u);
+  EXPECT_EQ(total, deadlines.size());
+}
+
+}  // namespace
@@ -624,6 +624,16 @@ static class options {
        * Default: false.
        */
       bool thread_safety;
+
+      /**
+       * Queue outgoing UDP packets and send them in batches at the end of each
+       * tox_iterate call, using as few system calls as possible. Packets sent by
+       * API calls outside tox_iterate wait for the next tox_iterate. Ignored on
+       * platforms without batched sends (currently anything but Linux).
+       *
+       * Default: false.
+       */
+      bool udp_batching;
     }
   }
 
@@ -903,6 +913,32 @@ const uint32_t iteration_interval();
 void iterate(any user_data);
 
 
+/**
+ * Copy the file descriptors $iterate() reads from into fds, at most max_fds
+ * of them: the UDP socket, the TCP server (or its epoll descriptor) and the
+ * connections to TCP relays.
+ *
+ * Instead of sleeping for $iteration_interval(), a client can wait until one
+ * of these becomes readable or $iteration_deadline() milliseconds have
+ * passed, whichever comes first, and then call $iterate(). The set changes
+ * as connections come and go, so it must be fetched again after each
+ * $iterate().
+ *
+ * @return the number of file descriptors, which may be larger than max_fds.
+ */
+const uint32_t get_fds(int[max_fds] fds, uint32_t max_fds);
+
+
+/**
+ * Return the time in milliseconds before $iterate() must be called again
+ * if none of the file descriptors from $get_fds() becomes readable.
+ *
+ * This is never shorter than $iteration_interval() and may be much longer
+ * while no data is waiting to be sent.
+ */
+const uint32_t iteration_deadline();
+
+
 /*******************************************************************************
  *
  * :: Internal client information (Tox address/id)
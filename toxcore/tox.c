@@ -779,6 +779,10 @@ Tox *tox_new(const struct Tox_Options *options, Tox_Err_New *error)
     custom_lossy_packet_registerhandler(tox->m, tox_friend_lossy_packet_handler);
     custom_lossless_packet_registerhandler(tox->m, tox_friend_lossless_packet_handler);
 
+    if (tox_options_get_experimental_udp_batching(opts)) {
+        networking_set_batch_send(tox->m->net, true);
+    }
+
 #ifndef VANILLA_NACL
     m_callback_group_invite(tox->m, tox_group_invite_handler, tox);
     gc_callback_message(tox->m, tox_group_message_handler, tox);
@@ -1003,6 +1007,49 @@ uint32_t tox_iteration_interval(const Tox *tox)
     return ret;
 }
 
+/* Most descriptors tox_get_fds copies without allocating. */
+#define TOX_GET_FDS_STACK_SIZE 64
+
+uint32_t tox_get_fds(const Tox *tox, int *fds, uint32_t max_fds)
+{
+    assert(tox != nullptr);
+
+    Socket stack_socks[TOX_GET_FDS_STACK_SIZE];
+    Socket *socks = stack_socks;
+
+    if (max_fds > TOX_GET_FDS_STACK_SIZE) {
+        socks = (Socket *)calloc(max_fds, sizeof(Socket));
+
+        if (socks == nullptr) {
+            socks = stack_socks;
+            max_fds = TOX_GET_FDS_STACK_SIZE;
+        }
+    }
+
+    lock(tox);
+    const uint32_t count = messenger_sockets(tox->m, socks, max_fds);
+    unlock(tox);
+
+    for (uint32_t i = 0; i < count && i < max_fds; ++i) {
+        fds[i] = socks[i].socket;
+    }
+
+    if (socks != stack_socks) {
+        free(socks);
+    }
+
+    return count;
+}
+
+uint32_t tox_iteration_deadline(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    uint32_t ret = messenger_idle_interval(tox->m);
+    unlock(tox);
+    return ret;
+}
+
 void tox_iterate(Tox *tox, void *user_data)
 {
     assert(tox != nullptr);
@@ -1014,6 +1061,7 @@ void tox_iterate(Tox *tox, void *user_data)
     tox->non_const_user_data = user_data;
     do_messenger(tox->m, &tox_data);
     do_groupchats(tox->m->conferences_object, &tox_data);
+    networking_flush(tox->m->net);
 
     unlock(tox);
 }
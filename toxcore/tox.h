@@ -691,6 +691,16 @@ struct Tox_Options {
      */
     bool experimental_thread_safety;
 
+    /**
+     * Queue outgoing UDP packets and send them in batches at the end of each
+     * tox_iterate call, using as few system calls as possible. Packets sent by
+     * API calls outside tox_iterate wait for the next tox_iterate. Ignored on
+     * platforms without batched sends (currently anything but Linux).
+     *
+     * Default: false.
+     */
+    bool experimental_udp_batching;
+
 };
 
 
@@ -758,6 +768,10 @@ bool tox_options_get_experimental_thread_safety(const struct Tox_Options *option
 
 void tox_options_set_experimental_thread_safety(struct Tox_Options *options, bool thread_safety);
 
+bool tox_options_get_experimental_udp_batching(const struct Tox_Options *options);
+
+void tox_options_set_experimental_udp_batching(struct Tox_Options *options, bool udp_batching);
+
 /**
  * Initialises a Tox_Options object with the default options.
  *
@@ -1062,6 +1076,30 @@ uint32_t tox_iteration_interval(const Tox *tox);
  */
 void tox_iterate(Tox *tox, void *user_data);
 
+/**
+ * Copy the file descriptors tox_iterate() reads from into fds, at most max_fds
+ * of them: the UDP socket, the TCP server (or its epoll descriptor) and the
+ * connections to TCP relays.
+ *
+ * Instead of sleeping for tox_iteration_interval(), a client can wait until one
+ * of these becomes readable or tox_iteration_deadline() milliseconds have
+ * passed, whichever comes first, and then call tox_iterate(). The set changes
+ * as connections come and go, so it must be fetched again after each
+ * tox_iterate().
+ *
+ * @return the number of file descriptors, which may be larger than max_fds.
+ */
+uint32_t tox_get_fds(const Tox *tox, int *fds, uint32_t max_fds);
+
+/**
+ * Return the time in milliseconds before tox_iterate() must be called again
+ * if none of the file descriptors from tox_get_fds() becomes readable.
+ *
+ * This is never shorter than tox_iteration_interval() and may be much longer
+ * while no data is waiting to be sent.
+ */
+uint32_t tox_iteration_deadline(const Tox *tox);
+
 
 /*******************************************************************************
  *
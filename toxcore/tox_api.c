@@ -60,6 +60,7 @@ ACCESSORS(tox_log_cb *, log_, callback)
 ACCESSORS(void *, log_, user_data)
 ACCESSORS(bool,, local_discovery_enabled)
 ACCESSORS(bool,, experimental_thread_safety)
+ACCESSORS(bool,, experimental_udp_batching)
 
 //!TOKSTYLE+
 
@@ -85,6 +86,7 @@ void tox_options_default(struct Tox_Options *options)
         tox_options_set_hole_punching_enabled(options, true);
         tox_options_set_local_discovery_enabled(options, true);
         tox_options_set_experimental_thread_safety(options, false);
+        tox_options_set_experimental_udp_batching(options, false);
     }
 }
 